@@ -0,0 +1,175 @@
+/*
+   Tagsistant (tagfs) -- alias_table.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   In-memory copy of the aliases table.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** The alias table holds every row of the aliases table, loaded at mount. The   ***/
+/*** tagsistant_sql_alias_*() functions write through it, so the path expansion   ***/
+/*** and the alias/ operations never query the DB to read an alias.               ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** alias -> query */
+static GHashTable *tagsistant_alias_table = NULL;
+
+/** guards tagsistant_alias_table */
+static GRWLock tagsistant_alias_table_lock;
+
+/** set when the table has been loaded */
+static gint tagsistant_alias_table_loaded = 0;
+
+/**
+ * Callback for tagsistant_alias_table_reload(), loads one alias
+ */
+static int
+tagsistant_alias_table_load_alias(GHashTable *table, dbi_result result)
+{
+	const gchar *alias = tagsistant_result_get_string(result, 1);
+	const gchar *query = tagsistant_result_get_string(result, 2);
+
+	if (alias) g_hash_table_insert(table, g_strdup(alias), g_strdup(_safe_string(query)));
+
+	return (0);
+}
+
+/**
+ * Load (or reload) the whole alias table
+ *
+ * @param dbi a DBI connection
+ */
+void tagsistant_alias_table_reload(dbi_conn dbi)
+{
+#if TAGSISTANT_ENABLE_ALIAS_CACHE
+	GHashTable *table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	tagsistant_query(
+		"select alias, query from aliases",
+		dbi, (tagsistant_query_callback) tagsistant_alias_table_load_alias, table);
+
+	g_rw_lock_writer_lock(&tagsistant_alias_table_lock);
+	GHashTable *old = tagsistant_alias_table;
+	tagsistant_alias_table = table;
+	g_atomic_int_set(&tagsistant_alias_table_loaded, 1);
+	g_rw_lock_writer_unlock(&tagsistant_alias_table_lock);
+
+	if (old) g_hash_table_destroy(old);
+
+	dbg('b', LOG_INFO, "Alias table loaded: %d aliases", g_hash_table_size(table));
+#else
+	(void) dbi;
+#endif
+}
+
+/**
+ * Return TRUE if the table has been loaded
+ */
+gboolean tagsistant_alias_table_is_loaded()
+{
+	return (g_atomic_int_get(&tagsistant_alias_table_loaded));
+}
+
+/**
+ * Load the alias table at mount
+ */
+void tagsistant_alias_table_init()
+{
+#if TAGSISTANT_ENABLE_ALIAS_CACHE
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	tagsistant_alias_table_reload(dbi);
+	tagsistant_db_connection_release(dbi, 0);
+#endif
+}
+
+/**
+ * Lookup an alias
+ *
+ * @param alias the alias
+ * @return a copy of the query bookmarked by the alias (must be freed
+ *   by the caller) or NULL if the alias does not exist
+ */
+gchar *tagsistant_alias_table_lookup(const gchar *alias)
+{
+	if (!alias) return (NULL);
+
+	g_rw_lock_reader_lock(&tagsistant_alias_table_lock);
+	gchar *query = tagsistant_alias_table ? g_strdup(g_hash_table_lookup(tagsistant_alias_table, alias)) : NULL;
+	g_rw_lock_reader_unlock(&tagsistant_alias_table_lock);
+
+	return (query);
+}
+
+/**
+ * Create an alias or change its query
+ *
+ * @param alias the alias
+ * @param query the query bookmarked by the alias
+ */
+void tagsistant_alias_table_set(const gchar *alias, const gchar *query)
+{
+	unless (tagsistant_alias_table_is_loaded() && alias) return;
+
+	g_rw_lock_writer_lock(&tagsistant_alias_table_lock);
+	g_hash_table_insert(tagsistant_alias_table, g_strdup(alias), g_strdup(_safe_string(query)));
+	g_rw_lock_writer_unlock(&tagsistant_alias_table_lock);
+}
+
+/**
+ * Reload an alias from the DB, removing it from the table
+ * if the DB does not hold it
+ *
+ * @param dbi a DBI connection
+ * @param alias the alias
+ */
+void tagsistant_alias_table_load(dbi_conn dbi, const gchar *alias)
+{
+	unless (tagsistant_alias_table_is_loaded() && alias) return;
+
+	GHashTable *row = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	tagsistant_query(
+		"select alias, query from aliases where alias = '%s'",
+		dbi, (tagsistant_query_callback) tagsistant_alias_table_load_alias, row, alias);
+
+	gchar *query = g_hash_table_lookup(row, alias);
+	if (query) {
+		tagsistant_alias_table_set(alias, query);
+	} else {
+		tagsistant_alias_table_remove(alias);
+	}
+
+	g_hash_table_destroy(row);
+}
+
+/**
+ * Remove an alias
+ *
+ * @param alias the alias
+ */
+void tagsistant_alias_table_remove(const gchar *alias)
+{
+	unless (tagsistant_alias_table_is_loaded() && alias) return;
+
+	g_rw_lock_writer_lock(&tagsistant_alias_table_lock);
+	g_hash_table_remove(tagsistant_alias_table, alias);
+	g_rw_lock_writer_unlock(&tagsistant_alias_table_lock);
+}
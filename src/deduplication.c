@@ -90,31 +90,36 @@ int tagsistant_querytree_find_duplicates(tagsistant_querytree *qtree, gchar *hex
 
 	dbg('2', LOG_INFO, "Deduplicating %s: %d -> %d", qtree->full_archive_path, qtree->inode, main_inode);
 
+	/*
+	 * save the tags of the removable inode to update the RDS cache
+	 */
+	GList *tag_ids = tagsistant_sql_get_object_tags(qtree->dbi, qtree->inode);
+
 	/*
 	 * first move all the tags of qtree->inode to main_inode
 	 */
 	if (tagsistant.sql_database_driver is TAGSISTANT_DBI_SQLITE_BACKEND) {
-		tagsistant_query(
-			"update or ignore tagging set inode = %d where inode = %d",
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_TAG, "update or ignore tagging set inode = %d where inode = %d",
 			qtree->dbi,	NULL, NULL,	main_inode,	qtree->inode);
 	} else if (tagsistant.sql_database_driver is TAGSISTANT_DBI_MYSQL_BACKEND) {
-		tagsistant_query(
-			"update ignore tagging set inode = %d where inode = %d",
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_TAG, "update ignore tagging set inode = %d where inode = %d",
 			qtree->dbi,	NULL, NULL,	main_inode,	qtree->inode);
 	}
 
 	/*
 	 * then delete records left because of duplicates in key(inode, tag_id) in the tagging table
 	 */
-	tagsistant_query(
-		"delete from tagging where inode = %d",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_UNTAG, "delete from tagging where inode = %d",
 		qtree->dbi,	NULL, NULL,	qtree->inode);
 
 	/*
 	 * unlink the removable inode
 	 */
-	tagsistant_query(
-		"delete from objects where inode = %d",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_DELETE_OBJECT, "delete from objects where inode = %d",
 		qtree->dbi, NULL, NULL,	qtree->inode);
 
 	/*
@@ -123,9 +128,24 @@ int tagsistant_querytree_find_duplicates(tagsistant_querytree *qtree, gchar *hex
 	qtree->schedule_for_unlink = 1;
 
 	/*
-	 * invalidate the RDS cache
+	 * update the RDS cache: the removable inode leaves them
+	 * while the main inode could join them
 	 */
-	tagsistant_delete_rds_involved(qtree);
+	tagsistant_rds_update_object(qtree->dbi, qtree->inode, tag_ids, qtree->object_path);
+	tagsistant_rds_update_object(qtree->dbi, main_inode, tag_ids, NULL);
+	g_list_free(tag_ids);
+
+	/*
+	 * the main inode now shows up in the directories of the merged tags
+	 */
+	tagsistant_negative_cache_invalidate_inode(qtree->dbi, main_inode);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	/*
+	 * forget the querytrees pointing to the removable inode
+	 */
+	tagsistant_invalidate_querytree_cache_inode(qtree->inode);
+#endif
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
 	/*
@@ -164,6 +184,41 @@ void tagsistant_schedule_for_autotagging(tagsistant_querytree *qtree)
 }
 #endif
 
+/**
+ * Compute the SHA1 checksum of a file
+ *
+ * @param full_archive_path the file path
+ * @return the hexadecimal checksum (must be freed) or NULL on error
+ */
+static gchar *tagsistant_deduplication_checksum(const gchar *full_archive_path)
+{
+	int fd = open(full_archive_path, O_RDONLY|O_NOATIME);
+	if (fd is -1) return (NULL);
+
+	gchar *hex = NULL;
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	guchar buffer[65535];
+
+	if (checksum) {
+		/* feed the checksum object */
+		int length = 0;
+		do {
+			length = read(fd, buffer, 65535);
+			if (length > 0) g_checksum_update(checksum, buffer, length);
+		} while (length > 0);
+
+		/* get the hexadecimal checksum string */
+		hex = g_strdup(g_checksum_get_string(checksum));
+
+		/* destroy the checksum object */
+		g_checksum_free(checksum);
+	}
+
+	close(fd);
+
+	return (hex);
+}
+
 /**
  * kernel of the deduplication thread
  *
@@ -176,61 +231,47 @@ gpointer tagsistant_deduplication_kernel(gpointer data)
 	// dbg('2', LOG_INFO, "Deduplication request for %s", path);
 
 	/*
-	 * create a qtree object just to extract the full_archive_path
+	 * create a qtree object just to extract the full_archive_path; the
+	 * file is read without holding the writer connection
 	 */
 	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 1);
+	if (!qtree) return (NULL);
+
+	dbg('2', LOG_INFO, "Running deduplication on %s", path);
+	gchar *hex = tagsistant_deduplication_checksum(qtree->full_archive_path);
+	tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+
+	if (!hex) return (NULL);
 
+	/*
+	 * save the checksum and merge the duplicates on the writer connection
+	 */
+	qtree = tagsistant_querytree_new(path, 0, TAGSISTANT_START_TRANSACTION, 1, 1);
 	if (qtree) {
-		int fd = open(qtree->full_archive_path, O_RDONLY|O_NOATIME);
-		// tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
-
-		if (fd isNot -1) {
-			dbg('2', LOG_INFO, "Running deduplication on %s", path);
-
-			GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
-			guchar buffer[65535];
-
-			if (checksum) {
-				/* feed the checksum object */
-				int length = 0;
-				do {
-					length = read(fd, buffer, 65535);
-					g_checksum_update(checksum, buffer, length);
-				} while (length > 0);
-
-				/* get the hexadecimal checksum string */
-				gchar *hex = g_strdup(g_checksum_get_string(checksum));
-
-				/* destroy the checksum object */
-				g_checksum_free(checksum);
-
-				/*
-				 * save the string into the objects table
-				 */
-				tagsistant_query(
-					"update objects set checksum = '%s' where inode = %d",
-					qtree->dbi, NULL, NULL, hex, qtree->inode);
-
-				/*
-				 * look for duplicated objects
-				 */
-				if (tagsistant_querytree_find_duplicates(qtree, hex)) {
-					/*
-					 * before destroying the qtree, we build the string
-					 * to schedule the object for autotagging
-					 */
-					tagsistant_schedule_for_autotagging(qtree);
-				}
-
-				/* free the hex checksum string */
-				g_free_null(hex);
-			}
+		/*
+		 * save the string into the objects table
+		 */
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_UPDATE_OBJECT, "update objects set checksum = '%s' where inode = %d",
+			qtree->dbi, NULL, NULL, hex, qtree->inode);
+
+		/*
+		 * look for duplicated objects
+		 */
+		if (tagsistant_querytree_find_duplicates(qtree, hex)) {
+			/*
+			 * before destroying the qtree, we build the string
+			 * to schedule the object for autotagging
+			 */
+			tagsistant_schedule_for_autotagging(qtree);
 		}
 
-		close(fd);
 		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
 	}
 
+	/* free the hex checksum string */
+	g_free_null(hex);
+
 	return (NULL);
 }
 
@@ -323,8 +364,8 @@ int tagsistant_fix_checksums_callback(void *null_pointer, dbi_result result)
 	(void) null_pointer;
 
 	/* fetch the inode and the objectname from the query */
-	const gchar *inode = dbi_result_get_string_idx(result, 1);
-	const gchar *objectname = dbi_result_get_string_idx(result, 2);
+	const gchar *inode = tagsistant_result_get_string(result, 1);
+	const gchar *objectname = tagsistant_result_get_string(result, 2);
 
 	/* build the path using the ALL/ tag */
 	gchar *path = g_strdup_printf("/store/ALL/@@/%s%s%s", inode, TAGSISTANT_INODE_DELIMITER, objectname);
@@ -354,7 +395,7 @@ void tagsistant_fix_checksums()
 		"select cast(inode as char(12)), objectname from objects where checksum = '' and (symlink = '' or symlink is null)",
 		dbi, tagsistant_fix_checksums_callback, NULL);
 
-	tagsistant_db_connection_release(dbi, 1);
+	tagsistant_db_connection_release(dbi, 0);
 }
 
 /**
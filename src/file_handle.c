@@ -0,0 +1,114 @@
+/*
+   Tagsistant (tagfs) -- file_handle.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   Open file handles shared by open(), read(), write(), flush() and release().
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** open() resolves the path once and stores a tagsistant_handle in fi->fh.      ***/
+/*** read(), write(), flush() and release() work on the handle only, without      ***/
+/*** building a querytree, checking out a DB connection or taking the query lock. ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** number of handles currently allocated */
+gint tagsistant_open_handles = 0;
+
+/**
+ * Build a new handle on an open archive file
+ *
+ * @param fd the file descriptor returned by open()
+ * @param qtree the querytree the file has been opened from
+ * @param flags the open() flags
+ * @return the new handle, with one reference held by the caller
+ */
+tagsistant_handle *tagsistant_handle_new(int fd, tagsistant_querytree *qtree, int flags)
+{
+	tagsistant_handle *handle = g_new0(tagsistant_handle, 1);
+
+	handle->fd = fd;
+	handle->inode = qtree->inode;
+	handle->full_archive_path = g_strdup(qtree->full_archive_path);
+	handle->refcount = 1;
+
+	/*
+	 * opening for writing invalidates the object checksum, so the
+	 * object must be deduplicated (and autotagged) on flush()
+	 */
+	handle->dirty = ((flags & O_WRONLY) || (flags & O_RDWR)) ? 1 : 0;
+
+	g_atomic_int_inc(&tagsistant_open_handles);
+
+	return (handle);
+}
+
+/**
+ * Acquire a reference on a handle
+ *
+ * @param handle the handle
+ * @return the same handle
+ */
+tagsistant_handle *tagsistant_handle_ref(tagsistant_handle *handle)
+{
+	if (handle) g_atomic_int_inc(&handle->refcount);
+	return (handle);
+}
+
+/**
+ * Release a reference on a handle, closing the file and
+ * freeing the handle when the last reference goes away
+ *
+ * @param handle the handle
+ */
+void tagsistant_handle_unref(tagsistant_handle *handle)
+{
+	if (!handle) return;
+	unless (g_atomic_int_dec_and_test(&handle->refcount)) return;
+
+	dbg('F', LOG_INFO, "Closing %d = open(%s)", handle->fd, handle->full_archive_path);
+
+	close(handle->fd);
+	g_free(handle->full_archive_path);
+	g_free(handle);
+
+	g_atomic_int_add(&tagsistant_open_handles, -1);
+}
+
+/**
+ * Mark a handle as written
+ *
+ * @param handle the handle
+ */
+void tagsistant_handle_set_dirty(tagsistant_handle *handle)
+{
+	if (!g_atomic_int_get(&handle->dirty)) g_atomic_int_set(&handle->dirty, 1);
+}
+
+/**
+ * Clear the dirty flag of a handle
+ *
+ * @param handle the handle
+ * @return TRUE if the handle was dirty and the caller should deduplicate the object
+ */
+gboolean tagsistant_handle_clear_dirty(tagsistant_handle *handle)
+{
+	return (g_atomic_int_compare_and_exchange(&handle->dirty, 1, 0));
+}
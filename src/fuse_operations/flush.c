@@ -28,52 +28,34 @@
  */
 int tagsistant_flush(const char *path, struct fuse_file_info *fi)
 {
-	(void) fi;
-
-	int res = 0, tagsistant_errno = 0, do_deduplicate = 0;
-	const gchar *deduplicate = NULL;
-
 	TAGSISTANT_START(OPS_IN "FLUSH on %s", path);
 
-	// build querytree
-	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 1);
-
-	// -- malformed --
-	if (QTREE_IS_MALFORMED(qtree))
-		TAGSISTANT_ABORT_OPERATION(ENOENT);
-
-	if (qtree->full_archive_path) {
-		tagsistant_query(
-			"select 1 from objects where objectname = '%s' and checksum = ''",
-			qtree->dbi,
-			tagsistant_return_integer,
-			&do_deduplicate,
-			qtree->object_path);
-
-		if (do_deduplicate) {
-			dbg('2', LOG_INFO, "Deduplicating %s", path);
-			deduplicate = path; // was g_strdup(path);
-		} else {
-			dbg('2', LOG_INFO, "Skipping deduplication for %s", path);
-		}
+	/*
+	 * only objects opened on the archive get a handle: anything
+	 * else has nothing to flush. flush() is called once per close()
+	 * of each duplicated descriptor, so the file itself is closed in
+	 * tagsistant_release().
+	 */
+	tagsistant_handle *handle = tagsistant_get_file_handle(fi);
+	if (!handle) {
+		TAGSISTANT_STOP_OK(OPS_OUT "FLUSH on %s: OK", path);
+		return (0);
 	}
 
-	if (fi->fh) {
-		dbg('F', LOG_INFO, "Uncaching %" PRIu64 " = open(%s)", fi->fh, path);
-		close(fi->fh);
-		fi->fh = 0;
-	}
+	/*
+	 * deduplicate (and then autotag) the object if it has
+	 * been opened for writing since the last flush
+	 */
+	if (tagsistant_handle_clear_dirty(handle)) {
+		dbg('2', LOG_INFO, "Deduplicating %s", path);
+		tagsistant_deduplicate(path);
 
-TAGSISTANT_EXIT_OPERATION:
-	if ( res is -1 ) {
-		TAGSISTANT_STOP_ERROR(OPS_OUT "FLUSH on %s (%s) (%s): %d %d: %s", path, qtree->full_archive_path, tagsistant_querytree_type(qtree), res, tagsistant_errno, strerror(tagsistant_errno));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_ROLLBACK_TRANSACTION);
-		if (do_deduplicate) tagsistant_deduplicate(deduplicate);
-		return (-tagsistant_errno);
+		/* the size and the times of the object changed under its other paths too */
+		tagsistant_kernel_cache_invalidate();
 	} else {
-		TAGSISTANT_STOP_OK(OPS_OUT "FLUSH on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
-		if (do_deduplicate) tagsistant_deduplicate(deduplicate);
-		return (0);
+		dbg('2', LOG_INFO, "Skipping deduplication for %s", path);
 	}
+
+	TAGSISTANT_STOP_OK(OPS_OUT "FLUSH on %s (handle): OK", path);
+	return (0);
 }
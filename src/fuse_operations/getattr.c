@@ -82,6 +82,16 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 
 	TAGSISTANT_START(OPS_IN "GETATTR on %s", path);
 
+	// probed before and not found
+	if (tagsistant_negative_cache_lookup(path)) {
+		TAGSISTANT_STOP_ERROR(OPS_OUT "GETATTR on %s: cached ENOENT", path);
+		return (-ENOENT);
+	}
+
+	// taken before resolving the path, so a concurrent creation is not missed
+	gint negative_ticket = tagsistant_negative_cache_ticket();
+	gint snapshot = tagsistant_db_snapshot();
+
 	// build querytree
 	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 0);
 
@@ -90,13 +100,13 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 	
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		lstat_path = tagsistant.tags;
 	}
 
 	// -- archive --
 	else if (QTREE_IS_ARCHIVE(qtree)) {
-		if (!g_regex_match_simple(TAGSISTANT_INODE_DELIMITER, qtree->object_path, 0, 0)) {
+		if (!strstr(qtree->object_path, TAGSISTANT_INODE_DELIMITER)) {
 			lstat_path = tagsistant.archive;
 		} else if (qtree->full_archive_path) {
 			lstat_path = qtree->full_archive_path;
@@ -182,10 +192,11 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
-		if (g_regex_match_simple("^/stats/(connections|cached_queries|configuration|objects|relations|tags)$", path, 0, 0))
-			lstat_path = tagsistant.tags;
-		else if (g_regex_match_simple("^/stats$", path, 0, 0))
+		tagsistant_stats_entry entry = tagsistant_path_stats_entry(path);
+		if (entry is TAGSISTANT_STATS_ROOT)
 			lstat_path = tagsistant.archive;
+		else if (entry isNot TAGSISTANT_STATS_NONE)
+			lstat_path = tagsistant.tags;
 		else
 			TAGSISTANT_ABORT_OPERATION(ENOENT);
 	}
@@ -210,7 +221,7 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 	tagsistant_errno = errno;
 
 	// post-processing output
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		stbuf->st_size = strlen(qtree->error_message);
 		stbuf->st_mode = S_IFREG|S_IRUSR|S_IRGRP|S_IROTH;
 		stbuf->st_nlink = 1;
@@ -257,7 +268,7 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 			stbuf->st_mode = S_IFDIR|_PERMISSIONS;
 			stbuf->st_nlink = 3;
 
-		} else if (g_regex_match_simple("^" TAGSISTANT_ALIAS_IDENTIFIER, qtree->last_tag, 0, 0)) {
+		} else if (g_str_has_prefix(qtree->last_tag, TAGSISTANT_ALIAS_IDENTIFIER)) {
 			gchar *alias_name = qtree->last_tag + 1;
 			int exists = tagsistant_sql_alias_exists(qtree->dbi, alias_name);
 			if (!exists) {
@@ -309,7 +320,8 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 	} else if (QTREE_IS_STATS(qtree)) {
 
 		stbuf->st_size = TAGSISTANT_STATS_BUFFER;
-		if (g_regex_match_simple("^/stats/(connections|cached_queries|configuration|objects|relations|tags)$", path, 0, 0)) {
+		tagsistant_stats_entry entry = tagsistant_path_stats_entry(path);
+		if (entry isNot TAGSISTANT_STATS_ROOT && entry isNot TAGSISTANT_STATS_NONE) {
 			stbuf->st_mode = tagsistant.open_permission ? S_IFREG|S_IRUSR|S_IRGRP|S_IROTH : S_IFREG|S_IRUSR;
 		} else {
 			stbuf->st_mode = S_IFDIR|_PERMISSIONS;
@@ -352,6 +364,8 @@ TAGSISTANT_EXIT_OPERATION:
 	if ( res is -1 ) {
 		TAGSISTANT_STOP_ERROR(OPS_OUT "GETATTR on %s (%s) {%s}: %d %d: %s", path, lstat_path, tagsistant_querytree_type(qtree), res, tagsistant_errno, strerror(tagsistant_errno));
 		tagsistant_querytree_destroy(qtree, TAGSISTANT_ROLLBACK_TRANSACTION);
+		if ((tagsistant_errno is ENOENT) && tagsistant_db_snapshot_is_current(snapshot))
+			tagsistant_negative_cache_add(path, negative_ticket);
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "GETATTR on %s (%s): OK", qtree->full_path, tagsistant_querytree_type(qtree));
@@ -42,7 +42,7 @@ int tagsistant_link(const char *from, const char *to)
 	}
 
 	tagsistant_querytree *from_qtree = tagsistant_querytree_new(_from, 0, 1, 0, 0);
-	tagsistant_querytree *to_qtree = tagsistant_querytree_new(to, 0, 0, 1, 0);
+	tagsistant_querytree *to_qtree = tagsistant_querytree_new(to, 0, 1, 1, 0);
 
 	from_qtree->is_external = (from is _from) ? 1 : 0;
 
@@ -95,7 +95,8 @@ TAGSISTANT_EXIT_OPERATION:
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "LINK from %s to %s (%s): OK", from, to, tagsistant_querytree_type(to_qtree));
 		tagsistant_querytree_destroy(from_qtree, TAGSISTANT_COMMIT_TRANSACTION);
-		tagsistant_querytree_destroy(to_qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(to_qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_negative_cache_invalidate_path(to);
 		return (0);
 	}
 }
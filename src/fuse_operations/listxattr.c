@@ -40,13 +40,13 @@ int tagsistant_listxattr(const char *path, char *list, size_t size)
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 	
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		TAGSISTANT_ABORT_OPERATION(EFAULT);
 	}
 
 	// -- archive --
 	else if (QTREE_IS_ARCHIVE(qtree)) {
-		if (!g_regex_match_simple(TAGSISTANT_INODE_DELIMITER, qtree->object_path, 0, 0)) {
+		if (!strstr(qtree->object_path, TAGSISTANT_INODE_DELIMITER)) {
 			res = llistxattr(qtree->object_path, list, size);
 			tagsistant_errno = errno;
 		} else if (qtree->full_archive_path) {
@@ -122,8 +122,8 @@ int tagsistant_mkdir(const char *path, mode_t mode)
 			}
 
 			if (qtree->second_tag || (qtree->related_namespace && qtree->related_key && qtree->related_value)) {
-				tagsistant_query(
-					"insert into relations (tag1_id, tag2_id, relation) values (%d, %d, '%s')",
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_RELATE, "insert into relations (tag1_id, tag2_id, relation) values (%d, %d, '%s')",
 					qtree->dbi, NULL, NULL, tag1_id, tag2_id, qtree->relation);
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
@@ -133,6 +133,7 @@ int tagsistant_mkdir(const char *path, mode_t mode)
 
 				tagsistant_invalidate_reasoning_cache(qtree->first_tag ? qtree->first_tag : qtree->namespace);
 				tagsistant_invalidate_reasoning_cache(qtree->second_tag ? qtree->second_tag : qtree->related_namespace);
+				tagsistant_negative_cache_invalidate();
 
 				// clean the RDS library
 				tagsistant_delete_rds_involved(qtree);
@@ -153,7 +154,8 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "MKDIR on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_negative_cache_invalidate_path(path);
 		return (0);
 	}
 }
@@ -85,7 +85,8 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "MKNOD on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_negative_cache_invalidate_path(path);
 		return (0);
 	}
 }
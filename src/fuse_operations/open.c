@@ -32,15 +32,18 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 
 	TAGSISTANT_START(OPS_IN "OPEN on %s", path);
 
+	// opening for writing invalidates the checksum, so it needs the writer connection
+	int writing = ((fi->flags & O_WRONLY) || (fi->flags & O_RDWR)) ? 1 : 0;
+
 	// build querytree
-	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 0);
+	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, writing, 1, 0);
 
 	// -- malformed --
 	if (QTREE_IS_MALFORMED(qtree))
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		res = 1;
 		tagsistant_errno = 0;
 		goto TAGSISTANT_EXIT_OPERATION;
@@ -51,6 +54,8 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 		if (tagsistant_is_tags_list_file(qtree)) {
 			res = open(tagsistant.tags, fi->flags);
 			tagsistant_errno = errno;
+			if (res isNot -1) close(res);
+			tagsistant_set_file_handle(fi, NULL);
 			goto TAGSISTANT_EXIT_OPERATION;
 		}
 
@@ -63,19 +68,10 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 		tagsistant_errno = errno;
 
 		if (res isNot -1) {
-#if TAGSISTANT_ENABLE_FILE_HANDLE_CACHING
-			tagsistant_set_file_handle(fi, res);
-			dbg('F', LOG_INFO, "Caching %" PRIu64 " = open(%s)", fi->fh, path);
-//			fprintf(stderr, "Opened FD %lu\n", fi->fh);
-
-#else
-			close(res);
-#endif
-
 			tagsistant_querytree_check_tagging_consistency(qtree);
 
 			if (QTREE_IS_TAGGABLE(qtree)) {
-				if ((fi->flags & O_WRONLY) || (fi->flags & O_RDWR)) {
+				if (writing) {
 					// invalidate the checksum
 					dbg('2', LOG_INFO, "Invalidating checksum on %s", path);
 					tagsistant_invalidate_object_checksum(qtree->inode, qtree->dbi);
@@ -83,16 +79,24 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 					fi->keep_cache = 1;
 				}
 			}
+
+#if TAGSISTANT_ENABLE_FILE_HANDLE_CACHE
+			tagsistant_set_file_handle(fi, tagsistant_handle_new(res, qtree, fi->flags));
+			dbg('F', LOG_INFO, "Caching %d = open(%s)", res, path);
+#else
+			close(res);
+#endif
 		} else {
-			tagsistant_set_file_handle(fi, 0);
+			tagsistant_set_file_handle(fi, NULL);
 		}
 	}
 
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
 		res = open(tagsistant.tags, fi->flags|O_RDONLY);
-		tagsistant_set_file_handle(fi, res);
 		tagsistant_errno = errno;
+		if (res isNot -1) close(res);
+		tagsistant_set_file_handle(fi, NULL);
 		fi->keep_cache = 0;
 	}
 
@@ -117,7 +121,12 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "OPEN on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) {
+			// the checksum is still valid: don't keep the file open for writing
+			tagsistant_handle_unref(tagsistant_get_file_handle(fi));
+			tagsistant_set_file_handle(fi, NULL);
+			return (-EIO);
+		}
 		return (0);
 	}
 }
@@ -38,6 +38,20 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 
 	TAGSISTANT_START(OPS_IN "READ on %s [size: %lu offset: %lu]", path, (long unsigned int) size, (long unsigned int) offset);
 
+	// -- open object: use the handle, no path resolution --
+	tagsistant_handle *handle = tagsistant_get_file_handle(fi);
+	if (handle) {
+		res = pread(handle->fd, buf, size, offset);
+		if (res is -1) {
+			tagsistant_errno = errno;
+			TAGSISTANT_STOP_ERROR(OPS_OUT "READ %s (%s): %d %d: %s", path, handle->full_archive_path, res, tagsistant_errno, strerror(tagsistant_errno));
+			return (-tagsistant_errno);
+		}
+
+		TAGSISTANT_STOP_OK(OPS_OUT "READ %s (handle): OK", path);
+		return (res);
+	}
+
 	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 1);
 
 	// -- malformed --
@@ -45,7 +59,7 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		memcpy(buf, qtree->error_message, strlen(qtree->error_message));
 		res = strlen(qtree->error_message);
 	}
@@ -71,42 +85,21 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 			TAGSISTANT_ABORT_OPERATION(EFAULT);
 		}
 
-#if TAGSISTANT_ENABLE_FILE_HANDLE_CACHING
-		if (fi->fh) {
-			tagsistant_get_file_handle(fi, fh);
-			res = pread(fh, buf, size, offset);
-			tagsistant_errno = errno;
-//			fprintf(stderr, "Trying a read on FD %lu\n", fi->fh);
-		}
-
-		if ((res is -1) || (fh is 0)) {
-			if (fh) close(fh);
-			fh = open(qtree->full_archive_path, fi->flags|O_RDONLY);
-//			fprintf(stderr, "Re-trying a read on FD %lu\n", fi->fh);
-
-			if (fh)	res = pread(fh, buf, size, offset);
-			else res = -1;
-			tagsistant_errno = errno;
-		}
-
-		tagsistant_set_file_handle(fi, fh);
-#else
 		fh = open(qtree->full_archive_path, fi->flags|O_RDONLY);
-		if (fh) {
+		if (fh isNot -1) {
 			res = pread(fh, buf, size, offset);
 			tagsistant_errno = errno;
 			close(fh);
 		} else {
 			TAGSISTANT_ABORT_OPERATION(errno);
 		}
-#endif
 	}
 
 	// -- alias --
 	else if (QTREE_IS_ALIAS(qtree)) {
 		gchar *value = NULL;
-		tagsistant_query(
-			"select query from aliases where alias = '%s'",
+		tagsistant_statement(
+			TAGSISTANT_STATEMENT_ALIAS_GET,
 			qtree->dbi,
 			tagsistant_return_string,
 			&value,
@@ -121,41 +114,59 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
 		memset(stats_buffer, 0, TAGSISTANT_STATS_BUFFER);
+		tagsistant_stats_entry entry = tagsistant_path_stats_entry(path);
 
 		// -- connections --
-		if (g_regex_match_simple("/connections$", path, 0, 0)) {
-			sprintf(stats_buffer, "# of MySQL open connections: %d\n", tagsistant_active_connections);
+		if (entry is TAGSISTANT_STATS_CONNECTIONS) {
+			tagsistant_db_connection_stats(stats_buffer, TAGSISTANT_STATS_BUFFER);
+
+			size_t used = strlen(stats_buffer);
+			g_snprintf(stats_buffer + used, TAGSISTANT_STATS_BUFFER - used,
+				"# of open file handles: %d\n", g_atomic_int_get(&tagsistant_open_handles));
+
+			used = strlen(stats_buffer);
+			tagsistant_wal_stats(stats_buffer + used, TAGSISTANT_STATS_BUFFER - used);
 		}
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 		// -- cached_queries --
-		else if (g_regex_match_simple("/cached_queries$", path, 0, 0)) {
-			int entries = tagsistant_querytree_cache_total();
-			sprintf(stats_buffer, "# of cached queries: %d\n", entries);
+		else if (entry is TAGSISTANT_STATS_CACHED_QUERIES) {
+			tagsistant_querytree_cache_stats(stats_buffer, TAGSISTANT_STATS_BUFFER);
+
+			size_t used = strlen(stats_buffer);
+			tagsistant_negative_cache_stats(stats_buffer + used, TAGSISTANT_STATS_BUFFER - used);
+
+			used = strlen(stats_buffer);
+			tagsistant_kernel_cache_stats(stats_buffer + used, TAGSISTANT_STATS_BUFFER - used);
 		}
 #endif /* TAGSISTANT_ENABLE_QUERYTREE_CACHE */
 
 		// -- configuration --
-		else if (g_regex_match_simple("/configuration$", path, 0, 0)) {
+		else if (entry is TAGSISTANT_STATS_CONFIGURATION) {
 			tagsistant_read_stats_configuration(stats_buffer);
 		}
 
 		// -- objects --
-		else if (g_regex_match_simple("/objects$", path, 0, 0)) {
+		else if (entry is TAGSISTANT_STATS_OBJECTS) {
 			int entries = 0;
 			tagsistant_query("select count(1) from objects", qtree->dbi, tagsistant_return_integer, &entries);
 			sprintf(stats_buffer, "# of objects: %d\n", entries);
 		}
 
+		// -- rds --
+		else if (entry is TAGSISTANT_STATS_RDS) {
+			tagsistant_rds_stats(stats_buffer, TAGSISTANT_STATS_BUFFER);
+		}
+
 		// -- tags --
-		else if (g_regex_match_simple("/tags$", path, 0, 0)) {
+		else if (entry is TAGSISTANT_STATS_TAGS) {
 			int entries = 2;
 			tagsistant_query("select count(1) from tags", qtree->dbi, tagsistant_return_integer, &entries);
 			sprintf(stats_buffer, "# of tags: %d\n", entries);
 		}
 
 		// -- relations --
-		else if (g_regex_match_simple("/relations$", path, 0, 0)) {
+		else if (entry is TAGSISTANT_STATS_RELATIONS) {
 			int entries = 0;
 			tagsistant_query("select count(1) from relations", qtree->dbi, tagsistant_return_integer, &entries);
 			sprintf(stats_buffer, "# of relations: %d\n", entries);
@@ -200,6 +211,7 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		"  run in foreground: %d\n"
 		"    single threaded: %d\n"
 		"    mount read-only: %d\n"
+		"       kernel cache: %ds (negative: %ds)\n"
 		"              debug: %s\n"
 		"                     [%c] boot\n"
 		"                     [%c] cache\n"
@@ -236,6 +248,7 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		tagsistant.foreground,
 		tagsistant.singlethread,
 		tagsistant.readonly,
+		tagsistant.kernel_cache, tagsistant.negative_timeout,
 		tagsistant.debug_flags ? tagsistant.debug_flags : "-",
 		tagsistant.dbg['b'] ? 'x' : ' ',
 		tagsistant.dbg['c'] ? 'x' : ' ',
@@ -40,7 +40,7 @@ struct tagsistant_use_filler_struct {
 static int tagsistant_add_entry_to_dir(void *filler_ptr, dbi_result result)
 {
 	struct tagsistant_use_filler_struct *ufs = (struct tagsistant_use_filler_struct *) filler_ptr;
-	const char *dir = dbi_result_get_string_idx(result, 1);
+	const char *dir = tagsistant_result_get_string(result, 1);
 
 	/* this must be the last value, just exit */
 	if (dir is NULL) return(0);
@@ -79,7 +79,7 @@ static int tagsistant_add_entry_to_dir(void *filler_ptr, dbi_result result)
 		 * force the inode in the object name, assuming a second field
 		 * provides the inode
 		 */
-		const char *inode = dbi_result_get_string_idx(result, 2);
+		const char *inode = tagsistant_result_get_string(result, 2);
 		if (inode) {
 			gchar *entry = g_strdup_printf("%s%s%s", inode, TAGSISTANT_INODE_DELIMITER, dir);
 			int filler_result = ufs->filler(ufs->buf, entry, NULL, 0);
@@ -105,7 +105,7 @@ static int tagsistant_add_entry_to_dir(void *filler_ptr, dbi_result result)
 static int tagsistant_add_tag_to_export(void *filler_ptr, dbi_result result)
 {
 	struct tagsistant_use_filler_struct *ufs = (struct tagsistant_use_filler_struct *) filler_ptr;
-	const char *tag_or_namespace = dbi_result_get_string_idx(result, 1);
+	const char *tag_or_namespace = tagsistant_result_get_string(result, 1);
 
 	/* this must be the last value, just exit */
 	if (tag_or_namespace is NULL) return(0);
@@ -117,9 +117,9 @@ static int tagsistant_add_tag_to_export(void *filler_ptr, dbi_result result)
 	 */
 	if (strlen(tag_or_namespace) is 0) return (1);
 
-	if (g_regex_match_simple(":$", tag_or_namespace, G_REGEX_EXTENDED, 0)) {
-		const char *key = dbi_result_get_string_idx(result, 2);
-		const char *value = dbi_result_get_string_idx(result, 3);
+	if (tagsistant_is_triple_tag(tag_or_namespace)) {
+		const char *key = tagsistant_result_get_string(result, 2);
+		const char *value = tagsistant_result_get_string(result, 3);
 
 		if (strlen(value) > 0) {
 			gchar *entry = g_strdup_printf("%s%s=%s", tag_or_namespace, key, value);
@@ -191,13 +191,7 @@ tagsistant_readdir_on_store_filler(
  */
 int tagsistant_do_add_operators(tagsistant_querytree *qtree)
 {
-	gchar tagsistant_check_tags_path_regex[] = "/(\\"
-		TAGSISTANT_ANDSET_DELIMITER "|"
-		TAGSISTANT_QUERY_DELIMITER "|"
-		TAGSISTANT_QUERY_DELIMITER_NO_REASONING "|"
-		TAGSISTANT_NEGATE_NEXT_TAG ")$";
-
-	if (!g_regex_match_simple(tagsistant_check_tags_path_regex, qtree->full_path, G_REGEX_EXTENDED, 0)) {
+	if (!tagsistant_path_ends_with_operator(qtree->full_path)) {
 		if (g_strcmp0(qtree->full_path, "/tags")) {
 			if (!qtree->namespace || (qtree->namespace && qtree->value)) {
 				return (1);
@@ -213,9 +207,7 @@ int tagsistant_do_add_operators(tagsistant_querytree *qtree)
  */
 int is_inside_tag_group(gchar *path)
 {
-	if (g_regex_match_simple("/{/[^{}]+$", path, G_REGEX_EXTENDED, 0)) return (1);
-	if (g_regex_match_simple("/{$", path, G_REGEX_EXTENDED, 0)) return (1);
-	return (0);
+	return (tagsistant_path_is_inside_tag_group(path) ? 1 : 0);
 }
 
 /**
@@ -672,6 +664,7 @@ int tagsistant_readdir_on_stats(
 	filler(buf, "configuration", NULL, 0);
 	filler(buf, "connections", NULL, 0);
 	filler(buf, "objects", NULL, 0);
+	filler(buf, "rds", NULL, 0);
 	filler(buf, "relations", NULL, 0);
 	filler(buf, "tags", NULL, 0);
 
@@ -28,35 +28,15 @@
  */
 int tagsistant_release(const char *path, struct fuse_file_info *fi)
 {
-    int res = 0, tagsistant_errno = 0;
-    (void) fi;
-
 	TAGSISTANT_START(OPS_IN "RELEASE on %s", path);
 
-	// build querytree
-	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 0);
-
-	// -- malformed --
-	if (QTREE_IS_MALFORMED(qtree))
-		TAGSISTANT_ABORT_OPERATION(ENOENT);
-
-	tagsistant_querytree_check_tagging_consistency(qtree);
-
-	// -- object --
-	if (QTREE_IS_TAGGABLE(qtree) && fi->fh) {
-		dbg('F', LOG_INFO, "Uncaching %" PRIu64 " = open(%s)", fi->fh, path);
-		close(fi->fh);
-		fi->fh = 0;
+	tagsistant_handle *handle = tagsistant_get_file_handle(fi);
+	if (handle) {
+		dbg('F', LOG_INFO, "Uncaching %d = open(%s)", handle->fd, path);
+		tagsistant_set_file_handle(fi, NULL);
+		tagsistant_handle_unref(handle);
 	}
 
-TAGSISTANT_EXIT_OPERATION:
-	if ( res is -1 ) {
-		TAGSISTANT_STOP_ERROR(OPS_OUT "RELEASE on %s (%s) (%s): %d %d: %s", path, qtree->full_archive_path, tagsistant_querytree_type(qtree), res, tagsistant_errno, strerror(tagsistant_errno));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_ROLLBACK_TRANSACTION);
-		return (-tagsistant_errno);
-	} else {
-		TAGSISTANT_STOP_OK(OPS_OUT "RELEASE on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
-		return (0);
-	}
+	TAGSISTANT_STOP_OK(OPS_OUT "RELEASE on %s: OK", path);
+	return (0);
 }
@@ -66,8 +66,8 @@ int tagsistant_rename(const char *from, const char *to)
 			tagsistant_querytree_set_inode(to_qtree, from_qtree->inode);
 
 			// 3. rename the object
-			tagsistant_query(
-				"update objects set objectname = '%s' where inode = %d",
+			tagsistant_logged_query(
+				TAGSISTANT_WAL_RENAME_OBJECT, "update objects set objectname = '%s' where inode = %d",
 				from_qtree->dbi,
 				NULL, NULL,
 				to_qtree->object_path,
@@ -89,6 +89,11 @@ int tagsistant_rename(const char *from, const char *to)
 			// clean the RDS library
 			tagsistant_delete_rds_involved(from_qtree);
 			tagsistant_delete_rds_involved(to_qtree);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+			// forget the querytrees pointing to the object
+			tagsistant_invalidate_querytree_cache_inode(from_qtree->inode);
+#endif
 		} else {
 			TAGSISTANT_ABORT_OPERATION(EXDEV);
 		}
@@ -112,8 +117,8 @@ int tagsistant_rename(const char *from, const char *to)
 
 		if (from_qtree->value) {
 			if (to_qtree->value) {
-				tagsistant_query(
-					"update tags set tagname = '%s', `key` = '%s', `value` = '%s' "
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s', `key` = '%s', `value` = '%s' "
 						"where tagname = '%s' and `key` = '%s' and `value` = '%s'",
 					from_qtree->dbi,
 					NULL, NULL,
@@ -128,8 +133,8 @@ int tagsistant_rename(const char *from, const char *to)
 			}
 		} else if (from_qtree->key) {
 			if (to_qtree->key) {
-				tagsistant_query(
-					"update tags set tagname = '%s', `key` = '%s' "
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s', `key` = '%s' "
 						"where tagname = '%s' and `key` = '%s' ",
 					from_qtree->dbi,
 					NULL, NULL,
@@ -144,8 +149,8 @@ int tagsistant_rename(const char *from, const char *to)
 			}
 		} else if (from_qtree->namespace) {
 			if (to_qtree->namespace) {
-				tagsistant_query(
-					"update tags set tagname = '%s'"
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s'"
 						"where tagname = '%s' ",
 					from_qtree->dbi,
 					NULL, NULL,
@@ -158,8 +163,8 @@ int tagsistant_rename(const char *from, const char *to)
 				TAGSISTANT_ABORT_OPERATION(ENOENT);
 			}
 		} else {
-			tagsistant_query(
-				"update tags set tagname = '%s' "
+			tagsistant_logged_query(
+				TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s' "
 					"where tagname = '%s'",
 				from_qtree->dbi,
 				NULL, NULL,
@@ -167,11 +172,14 @@ int tagsistant_rename(const char *from, const char *to)
 				from_qtree->last_tag);
 		}
 
-		if (from_qtree->value) {
-			tagsistant_remove_tag_from_cache(from_qtree->namespace, from_qtree->key, from_qtree->value);
-		} else {
-			tagsistant_remove_tag_from_cache(from_qtree->last_tag, NULL, NULL);
-		}
+		// a namespace rename touches many tags: reload the tag dictionary
+		tagsistant_tag_dictionary_reload(from_qtree->dbi);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+		// forget the querytrees naming the old or the new tag
+		tagsistant_invalidate_querytree_cache(from_qtree);
+		tagsistant_invalidate_querytree_cache(to_qtree);
+#endif
 
 		// clean the RDS library
 		tagsistant_delete_rds_involved(from_qtree);
@@ -180,25 +188,28 @@ int tagsistant_rename(const char *from, const char *to)
 
 	// -- tags --
 	if (QTREE_IS_TAGS(from_qtree) && QTREE_IS_TAGS(to_qtree)) {
-		tagsistant_query(
-			"update tags set tagname = '%s' "
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s' "
 				"where tagname = '%s'",
 			from_qtree->dbi,
 			NULL, NULL,
 			to_qtree->last_tag,
 			from_qtree->last_tag);
 
-		if (from_qtree->value) {
-			tagsistant_remove_tag_from_cache(from_qtree->namespace, from_qtree->key, from_qtree->value);
-		} else {
-			tagsistant_remove_tag_from_cache(from_qtree->last_tag, NULL, NULL);
-		}
+		// a namespace rename touches many tags: reload the tag dictionary
+		tagsistant_tag_dictionary_reload(from_qtree->dbi);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+		// forget the querytrees naming the old or the new tag
+		tagsistant_invalidate_querytree_cache(from_qtree);
+		tagsistant_invalidate_querytree_cache(to_qtree);
+#endif
 	} else
 
 	// -- alias --
 	if (QTREE_IS_ALIAS(from_qtree) && QTREE_IS_ALIAS(to_qtree)) {
-		tagsistant_query(
-			"update aliases set alias = '%s' where alias = '%s'",
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_ALIAS, "update aliases set alias = '%s' where alias = '%s'",
 			from_qtree->dbi,
 			NULL, NULL,
 			to_qtree->alias,
@@ -216,8 +227,9 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "RENAME %s (%s) to %s (%s): OK", from, tagsistant_querytree_type(from_qtree), to, tagsistant_querytree_type(to_qtree));
-		tagsistant_querytree_destroy(from_qtree, TAGSISTANT_COMMIT_TRANSACTION);
 		tagsistant_querytree_destroy(to_qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(from_qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_negative_cache_invalidate_path(to);
 		return (0);
 	}
 }
@@ -85,6 +85,13 @@ int tagsistant_rmdir(const char *path)
 			 * ...otherwise we can delete it from the objects table
 			 */
 			dispose = tagsistant_dispose_object_if_untagged(qtree);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+			/*
+			 * forget the querytrees pointing to the object
+			 */
+			tagsistant_invalidate_querytree_cache_inode(qtree->inode);
+#endif
 		}
 
 		// do a real mkdir
@@ -125,8 +132,8 @@ int tagsistant_rmdir(const char *path)
 			}
 
 			if (qtree->second_tag || (qtree->related_namespace && qtree->related_key && qtree->related_value)) {
-				tagsistant_query(
-					"delete from relations where tag1_id = '%d' and tag2_id = '%d' and relation = '%s'",
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_UNRELATE, "delete from relations where tag1_id = '%d' and tag2_id = '%d' and relation = '%s'",
 					qtree->dbi, NULL, NULL, tag1_id, tag2_id, qtree->relation);
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
@@ -136,6 +143,7 @@ int tagsistant_rmdir(const char *path)
 
 				tagsistant_invalidate_reasoning_cache(qtree->first_tag);
 				tagsistant_invalidate_reasoning_cache(qtree->second_tag);
+				tagsistant_negative_cache_invalidate();
 
 				// clean the RDS library
 				tagsistant_delete_rds_involved(qtree);
@@ -179,7 +187,7 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "RMDIR on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
 		return (0);
 	}
 }
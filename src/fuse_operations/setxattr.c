@@ -40,13 +40,13 @@ int tagsistant_setxattr(const char *path, const char *name, const char *value, s
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 	
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && tagsistant_path_is_error(path)) {
 		TAGSISTANT_ABORT_OPERATION(EFAULT);
 	}
 
 	// -- archive --
 	else if (QTREE_IS_ARCHIVE(qtree)) {
-		if (!g_regex_match_simple(TAGSISTANT_INODE_DELIMITER, qtree->object_path, 0, 0)) {
+		if (!strstr(qtree->object_path, TAGSISTANT_INODE_DELIMITER)) {
 			res = lsetxattr(qtree->object_path, name, value, size, flags);
 			tagsistant_errno = errno;
 		} else if (qtree->full_archive_path) {
@@ -84,6 +84,7 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "SETXATTR on %s {%s}: OK", path, tagsistant_querytree_type(qtree));
+		tagsistant_kernel_cache_invalidate();
 		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
 		return (0);
 	}
@@ -27,8 +27,8 @@ int tagsistant_create_symlink(tagsistant_querytree *to_qtree, const gchar *from,
 
 	if (res isNot -1) {
 		// save the target path for future checks
-		tagsistant_query(
-			"update objects set symlink = '%s' where inode = %d",
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_UPDATE_OBJECT, "update objects set symlink = '%s' where inode = %d",
 			to_qtree->dbi,
 			NULL, NULL,
 			from, to_qtree->inode);
@@ -69,7 +69,7 @@ int tagsistant_symlink(const char *from, const char *to)
 					 * fetch the inodes that map to the "to" path
 					 */
 					tagsistant_rds_read_lock(rds, to_qtree);
-					GList *inodes = g_hash_table_lookup(rds->entries, to_qtree->object_path);
+					GList *inodes = g_list_copy(g_hash_table_lookup(rds->entries, to_qtree->object_path));
 					tagsistant_rds_read_unlock(rds);
 
 					if (inodes) {
@@ -77,10 +77,13 @@ int tagsistant_symlink(const char *from, const char *to)
 						 * form a string of comma separated inodes
 						 */
 						GString *i = g_string_new("");
-						while (inodes) {
-							g_string_append_printf(i, "%d", GPOINTER_TO_UINT(inodes->data));
-							if (inodes->next) g_string_append_printf(i, ", ");
+						GList *ptr = inodes;
+						while (ptr) {
+							g_string_append_printf(i, "%d", GPOINTER_TO_UINT(ptr->data));
+							if (ptr->next) g_string_append_printf(i, ", ");
+							ptr = ptr->next;
 						}
+						g_list_free(inodes);
 
 						/*
 						 * check if one of the inodes it's a symlink
@@ -211,7 +214,8 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "SYMLINK from %s to %s (%s): OK", from, to, tagsistant_querytree_type(to_qtree));
-		tagsistant_querytree_destroy(to_qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(to_qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_negative_cache_invalidate_path(to);
 		return (0);
 	}
 }
@@ -32,7 +32,7 @@ int tagsistant_truncate(const char *path, off_t size)
 
 	TAGSISTANT_START(OPS_IN "TRUNCATE on %s [size: %lu]", path, (long unsigned int) size);
 
-	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 1);
+	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 1, 1, 1);
 
 	// -- malformed --
 	if (QTREE_IS_MALFORMED(qtree)) TAGSISTANT_ABORT_OPERATION(ENOENT);
@@ -40,9 +40,7 @@ int tagsistant_truncate(const char *path, off_t size)
 	// -- object on disk --
 	if (QTREE_POINTS_TO_OBJECT(qtree)) {
 		if (tagsistant_is_tags_list_file(qtree)) {
-			tagsistant_query(
-				"delete from tagging where inode = %d",
-				qtree->dbi, NULL, NULL, qtree->inode);
+			tagsistant_full_untag_object(qtree->dbi, qtree->inode);
 		} else {
 			res = truncate(qtree->full_archive_path, size);
 			tagsistant_errno = errno;
@@ -70,7 +68,8 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "TRUNCATE %s, %llu (%s): OK", path, (unsigned long long) size, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
+		tagsistant_kernel_cache_invalidate();
 		return (0);
 	}
 }
@@ -46,14 +46,22 @@ int tagsistant_unlink(const char *path)
 		if (QTREE_IS_TAGGABLE(qtree)) {
 			if (is_all_path(qtree->full_path)) {
 
-				tagsistant_query(
-					"delete from objects where inode = %d",
+				GList *tag_ids = tagsistant_sql_get_object_tags(qtree->dbi, qtree->inode);
+
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_DELETE_OBJECT, "delete from objects where inode = %d",
 					qtree->dbi, NULL, NULL, qtree->inode);
 
-				tagsistant_query(
-					"delete from tagging where inode = %d",
+				tagsistant_logged_query(
+					TAGSISTANT_WAL_UNTAG, "delete from tagging where inode = %d",
 					qtree->dbi, NULL, NULL, qtree->inode);
 
+				/*
+				 * remove the object from the RDS depending on its former tags
+				 */
+				tagsistant_rds_update_object(qtree->dbi, qtree->inode, tag_ids, qtree->object_path);
+				g_list_free(tag_ids);
+
 			} else {
 
 				/*
@@ -82,6 +90,13 @@ int tagsistant_unlink(const char *path)
 			 * clean the RDS library
 			 */
 			tagsistant_delete_rds_involved(qtree);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+			/*
+			 * forget the querytrees pointing to the object
+			 */
+			tagsistant_invalidate_querytree_cache_inode(qtree->inode);
+#endif
 		}
 
 		// unlink the object on disk
@@ -110,7 +125,7 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "UNLINK on %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
 		return (0);
 	}
 }
@@ -59,6 +59,7 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "UTIME %s (%s): OK", path, tagsistant_querytree_type(qtree));
+		tagsistant_kernel_cache_invalidate();
 		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
 		return (0);
 	}
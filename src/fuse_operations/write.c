@@ -35,7 +35,22 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 
 	TAGSISTANT_START(OPS_IN "WRITE on %s [size: %lu offset: %lu]", path, (unsigned long) size, (long unsigned int) offset);
 
-	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 0, 1, 1);
+	// -- open object: use the handle, no path resolution --
+	tagsistant_handle *handle = tagsistant_get_file_handle(fi);
+	if (handle) {
+		res = pwrite(handle->fd, buf, size, offset);
+		if (res is -1) {
+			tagsistant_errno = errno;
+			TAGSISTANT_STOP_ERROR(OPS_OUT "WRITE %s (%s): %d %d: %s", path, handle->full_archive_path, res, tagsistant_errno, strerror(tagsistant_errno));
+			return (-tagsistant_errno);
+		}
+
+		tagsistant_handle_set_dirty(handle);
+		TAGSISTANT_STOP_OK(OPS_OUT "WRITE %s (handle): OK", path);
+		return (res);
+	}
+
+	tagsistant_querytree *qtree = tagsistant_querytree_new(path, 0, 1, 1, 1);
 
 	// -- malformed --
 	if (QTREE_IS_MALFORMED(qtree))
@@ -55,9 +70,7 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 		if (path_ptr) *path_ptr = '/';
 
 		// remove double slashes
-		GRegex *rx = g_regex_new("//", 0, 0, NULL);
-		gchar *_buf2 = g_regex_replace(rx, _buf, -1, 0, "/", 0, NULL);
-		g_regex_unref(rx);
+		gchar *_buf2 = tagsistant_path_compress_slashes(_buf);
 		g_free(_buf);
 		_buf = _buf2;
 
@@ -79,25 +92,20 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 	// -- object on disk --
 	if (QTREE_POINTS_TO_OBJECT(qtree)) {
 		if (tagsistant_is_tags_list_file(qtree)) {
-			tagsistant_delete_rds_involved(qtree);
-
 			/*
 			 * build a tagsistant_querytree without the .tags suffix
 			 * just to guess object inode
 			 */
 			gchar *object_path = tagsistant_string_tags_list_suffix(qtree);
-			tagsistant_querytree *object_qtree = tagsistant_querytree_new(object_path, 0, 0, 0, 1);
+			tagsistant_querytree *object_qtree = tagsistant_querytree_new_on_connection(object_path, qtree->dbi, 1);
 			tagsistant_inode inode = object_qtree->inode;
-			tagsistant_delete_rds_involved(object_qtree);
 			tagsistant_querytree_destroy(object_qtree, 0);
 			g_free(object_path);
 
 			/*
 			 * delete current tagging
 			 */
-			tagsistant_query(
-				"delete from tagging where inode = %d",
-				qtree->dbi, NULL, NULL, inode);
+			tagsistant_full_untag_object(qtree->dbi, inode);
 
 			/*
 			 * split the buffer into tokens
@@ -128,32 +136,14 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 			TAGSISTANT_ABORT_OPERATION(EFAULT);
 		}
 
-#if TAGSISTANT_ENABLE_FILE_HANDLE_CACHING
-		if (fi->fh) {
-			tagsistant_get_file_handle(fi, fh);
-			res = pwrite(fh, buf, size, offset);
-			tagsistant_errno = errno;
-		}
-
-		if ((res is -1) || (fh is 0)) { // TODO or was it "fs is -1"?
-			if (fh) close(fh);
-			fh = open(qtree->full_archive_path, fi->flags|O_WRONLY);
-			if (fh)	res = pwrite(fh, buf, size, offset);
-			else res = -1;
-			tagsistant_errno = errno;
-		}
-
-		tagsistant_set_file_handle(fi, fh);
-#else
 		fh = open(qtree->full_archive_path, fi->flags|O_WRONLY);
-		if (fh) {
+		if (fh isNot -1) {
 			res = pwrite(fh, buf, size, offset);
 			tagsistant_errno = errno;
 			close(fh);
 		} else {
 			TAGSISTANT_ABORT_OPERATION(errno);
 		}
-#endif
 	}
 
 	// -- tags --
@@ -170,7 +160,7 @@ TAGSISTANT_EXIT_OPERATION:
 		return (-tagsistant_errno);
 	} else {
 		TAGSISTANT_STOP_OK(OPS_OUT "WRITE %s (%s): OK", path, tagsistant_querytree_type(qtree));
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION);
+		if (!tagsistant_querytree_destroy(qtree, TAGSISTANT_COMMIT_TRANSACTION)) return (-EIO);
 		return (res);
 	}
 }
@@ -0,0 +1,157 @@
+/*
+   Tagsistant (tagfs) -- kernel_cache.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   Tell the kernel to forget its cached entries after a change.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+#if FUSE_VERSION >= 28
+#include <fuse_lowlevel.h>
+#endif
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** With --kernel-cache=S the kernel keeps entries and attributes for S seconds  ***/
+/*** instead of asking again on every access. The same object shows up under     ***/
+/*** many paths, and the high level FUSE API doesn't tell which kernel nodes a    ***/
+/*** change touches, so after every change of the metadata the notifier thread    ***/
+/*** invalidates the top level entries of the mountpoint: the kernel drops them   ***/
+/*** with every entry cached below, and looks the paths up again.                 ***/
+/***                                                                              ***/
+/*** Notifications can't be sent from inside a FUSE operation, which could hold   ***/
+/*** the locks the kernel takes to invalidate an entry. The operations only flag  ***/
+/*** the change, and the flags raised while the thread is working are coalesced   ***/
+/*** into one more round.                                                         ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the entries of the mountpoint */
+static const gchar *tagsistant_kernel_cache_entries[] = {
+	"alias", "archive", "export", "relations", "stats", "store", "tags", NULL
+};
+
+#if FUSE_VERSION >= 28
+/** the channel to the kernel, set by tagsistant_kernel_cache_init() */
+static struct fuse_chan *tagsistant_kernel_cache_chan = NULL;
+#endif
+
+/** set when a change must be notified */
+static gboolean tagsistant_kernel_cache_pending = FALSE;
+
+/** guards tagsistant_kernel_cache_pending */
+static GMutex tagsistant_kernel_cache_lock;
+static GCond tagsistant_kernel_cache_cond;
+
+/** statistics */
+static guint64 tagsistant_kernel_cache_rounds = 0;
+
+/**
+ * Return TRUE if the kernel can be told to drop its entries, so
+ * it can cache them longer than TAGSISTANT_KERNEL_CACHE_TIMEOUT
+ */
+gboolean tagsistant_kernel_cache_can_invalidate()
+{
+#if FUSE_VERSION >= 28
+	return (TRUE);
+#else
+	return (FALSE);
+#endif
+}
+
+#if FUSE_VERSION >= 28
+/**
+ * The notifier thread
+ */
+static gpointer tagsistant_kernel_cache_loop(gpointer data)
+{
+	(void) data;
+
+	while (1) {
+		g_mutex_lock(&tagsistant_kernel_cache_lock);
+		while (!tagsistant_kernel_cache_pending)
+			g_cond_wait(&tagsistant_kernel_cache_cond, &tagsistant_kernel_cache_lock);
+		tagsistant_kernel_cache_pending = FALSE;
+		g_mutex_unlock(&tagsistant_kernel_cache_lock);
+
+		const gchar **entry;
+		for (entry = tagsistant_kernel_cache_entries; *entry; entry++) {
+			/* -ENOENT just means the kernel has nothing cached */
+			int res = fuse_lowlevel_notify_inval_entry(tagsistant_kernel_cache_chan, FUSE_ROOT_ID, *entry, strlen(*entry));
+			if (res < 0 && res isNot -ENOENT) {
+				dbg('c', LOG_ERR, "Error invalidating kernel entry /%s: %s", *entry, strerror(-res));
+			}
+		}
+
+		tagsistant_kernel_cache_rounds++;
+	}
+
+	return (NULL);
+}
+#endif
+
+/**
+ * Start the notifier thread. Called by tagsistant_init(), inside
+ * the FUSE context, when the kernel caches entries for more than
+ * TAGSISTANT_KERNEL_CACHE_TIMEOUT seconds.
+ */
+void tagsistant_kernel_cache_init()
+{
+#if FUSE_VERSION >= 28
+	if (tagsistant.kernel_cache <= TAGSISTANT_KERNEL_CACHE_TIMEOUT) return;
+
+	struct fuse_session *session = fuse_get_session(fuse_get_context()->fuse);
+	tagsistant_kernel_cache_chan = fuse_session_next_chan(session, NULL);
+
+	if (!tagsistant_kernel_cache_chan) {
+		dbg('c', LOG_ERR, "No FUSE channel: the kernel can show stale entries for up to %d seconds", tagsistant.kernel_cache);
+		return;
+	}
+
+	g_thread_new("Kernel cache notifier", tagsistant_kernel_cache_loop, NULL);
+#endif
+}
+
+/**
+ * Tell the kernel to drop its cached entries, after a change of the
+ * metadata or of the attributes of an object. Returns immediately:
+ * the notifier thread does the job.
+ */
+void tagsistant_kernel_cache_invalidate()
+{
+#if FUSE_VERSION >= 28
+	if (!tagsistant_kernel_cache_chan) return;
+
+	g_mutex_lock(&tagsistant_kernel_cache_lock);
+	tagsistant_kernel_cache_pending = TRUE;
+	g_cond_signal(&tagsistant_kernel_cache_cond);
+	g_mutex_unlock(&tagsistant_kernel_cache_lock);
+#endif
+}
+
+/**
+ * Print the kernel cache statistics
+ *
+ * @param buffer the buffer
+ * @param size the buffer size
+ */
+void tagsistant_kernel_cache_stats(gchar *buffer, size_t size)
+{
+	g_snprintf(buffer, size, "# of kernel cache invalidations: %" G_GUINT64_FORMAT "\n",
+		tagsistant_kernel_cache_rounds);
+}
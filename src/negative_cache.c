@@ -0,0 +1,308 @@
+/*
+   Tagsistant (tagfs) -- negative_cache.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   Remember the store/ and tags/ paths which don't exist.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** File managers, editors and VCS tools probe names like .git, desktop.ini or   ***/
+/*** *.swp in every directory they enter. getattr() remembers the store/ and      ***/
+/*** tags/ paths it answered with ENOENT, so probing them again costs no query.   ***/
+/***                                                                              ***/
+/*** An entry dies when its last element (the object name, stripped of the inode  ***/
+/*** prefix) is created, renamed into or tagged, or when the tag set changes,     ***/
+/*** which bumps a generation counter and makes every older entry stale.          ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/**
+ * A cached ENOENT
+ */
+typedef struct {
+	/** the path, which is also the key of tagsistant_negative_cache */
+	gchar *path;
+
+	/** the interned last element of the path, key of tagsistant_negative_cache_by_name */
+	const gchar *name;
+
+	/** the generation the entry has been added in */
+	gint generation;
+} tagsistant_negative_entry;
+
+/** path -> tagsistant_negative_entry */
+static GHashTable *tagsistant_negative_cache = NULL;
+
+/** interned name -> GHashTable of tagsistant_negative_entry */
+static GHashTable *tagsistant_negative_cache_by_name = NULL;
+
+/** guards both the tables above */
+static GMutex tagsistant_negative_cache_lock;
+
+/** the current generation */
+static gint tagsistant_negative_cache_generation = 0;
+
+/** bumped by every invalidation, to detect the ones racing with a lookup */
+static gint tagsistant_negative_cache_changes = 0;
+
+/** lookups answered by the cache */
+static guint64 tagsistant_negative_cache_hits = 0;
+
+/**
+ * Return the interned object name a path ends by, without
+ * the inode prefix
+ *
+ * @param path the path
+ * @return the interned name
+ */
+static const gchar *tagsistant_negative_cache_name(const gchar *path)
+{
+	const gchar *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	if (tagsistant_path_scan_inode(name)) {
+		const gchar *delimiter = strstr(name, TAGSISTANT_INODE_DELIMITER);
+		if (delimiter) name = delimiter + strlen(TAGSISTANT_INODE_DELIMITER);
+	}
+
+	return (g_intern_string(name));
+}
+
+/**
+ * Unlink an entry from the name index. Must be called with
+ * tagsistant_negative_cache_lock held.
+ */
+static void tagsistant_negative_cache_unindex(tagsistant_negative_entry *entry)
+{
+	GHashTable *entries = g_hash_table_lookup(tagsistant_negative_cache_by_name, entry->name);
+	if (!entries) return;
+
+	g_hash_table_remove(entries, entry);
+	if (!g_hash_table_size(entries)) g_hash_table_remove(tagsistant_negative_cache_by_name, entry->name);
+}
+
+/**
+ * Free an entry (GDestroyNotify of tagsistant_negative_cache)
+ */
+static void tagsistant_negative_cache_free_entry(tagsistant_negative_entry *entry)
+{
+	g_free(entry->path);
+	g_free(entry);
+}
+
+/**
+ * Check if a path is eligible for the negative cache
+ */
+static gboolean tagsistant_negative_cache_applies(const gchar *path)
+{
+	return (path && (g_str_has_prefix(path, "/store/") || g_str_has_prefix(path, "/tags/")));
+}
+
+/**
+ * Initialize the negative cache
+ */
+void tagsistant_negative_cache_init()
+{
+	tagsistant_negative_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+		(GDestroyNotify) tagsistant_negative_cache_free_entry);
+
+	tagsistant_negative_cache_by_name = g_hash_table_new_full(NULL, NULL, NULL,
+		(GDestroyNotify) g_hash_table_destroy);
+}
+
+/**
+ * Check if a path is known not to exist
+ *
+ * @param path the path
+ * @return TRUE if the path does not exist
+ */
+gboolean tagsistant_negative_cache_lookup(const gchar *path)
+{
+	unless (tagsistant_negative_cache && tagsistant_negative_cache_applies(path)) return (FALSE);
+
+	gboolean found = FALSE;
+
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+
+	tagsistant_negative_entry *entry = g_hash_table_lookup(tagsistant_negative_cache, path);
+	if (entry) {
+		if (entry->generation is g_atomic_int_get(&tagsistant_negative_cache_generation)) {
+			found = TRUE;
+			tagsistant_negative_cache_hits++;
+		} else {
+			tagsistant_negative_cache_unindex(entry);
+			g_hash_table_remove(tagsistant_negative_cache, path);
+		}
+	}
+
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+
+	return (found);
+}
+
+/**
+ * Return a ticket to be passed to tagsistant_negative_cache_add(),
+ * taken before resolving a path
+ */
+gint tagsistant_negative_cache_ticket()
+{
+	return (g_atomic_int_get(&tagsistant_negative_cache_changes));
+}
+
+/**
+ * Remember that a path does not exist
+ *
+ * @param path the path
+ * @param ticket the ticket taken before the path was resolved; if any
+ *   invalidation happened meanwhile, the path is not cached
+ */
+void tagsistant_negative_cache_add(const gchar *path, gint ticket)
+{
+	unless (tagsistant_negative_cache && tagsistant_negative_cache_applies(path)) return;
+
+	tagsistant_negative_entry *entry = g_new0(tagsistant_negative_entry, 1);
+	entry->path = g_strdup(path);
+	entry->name = tagsistant_negative_cache_name(path);
+
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+
+	if (g_atomic_int_get(&tagsistant_negative_cache_changes) isNot ticket) {
+		g_mutex_unlock(&tagsistant_negative_cache_lock);
+		tagsistant_negative_cache_free_entry(entry);
+		return;
+	}
+
+	entry->generation = g_atomic_int_get(&tagsistant_negative_cache_generation);
+
+	/* when full, start over */
+	if (g_hash_table_size(tagsistant_negative_cache) >= TAGSISTANT_NEGATIVE_CACHE_SIZE) {
+		g_hash_table_remove_all(tagsistant_negative_cache_by_name);
+		g_hash_table_remove_all(tagsistant_negative_cache);
+	}
+
+	tagsistant_negative_entry *old = g_hash_table_lookup(tagsistant_negative_cache, path);
+	if (old) {
+		tagsistant_negative_cache_unindex(old);
+		g_hash_table_remove(tagsistant_negative_cache, path);
+	}
+
+	g_hash_table_insert(tagsistant_negative_cache, entry->path, entry);
+
+	GHashTable *entries = g_hash_table_lookup(tagsistant_negative_cache_by_name, entry->name);
+	if (!entries) {
+		entries = g_hash_table_new(NULL, NULL);
+		g_hash_table_insert(tagsistant_negative_cache_by_name, (gpointer) entry->name, entries);
+	}
+	g_hash_table_add(entries, entry);
+
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+}
+
+/**
+ * Forget the paths ending by an object name, after the object
+ * has been created, renamed or tagged
+ *
+ * @param name the object name
+ */
+void tagsistant_negative_cache_invalidate_name(const gchar *name)
+{
+	unless (tagsistant_negative_cache && name) return;
+
+	const gchar *interned = g_intern_string(name);
+
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+	g_atomic_int_inc(&tagsistant_negative_cache_changes);
+
+	GHashTable *entries = g_hash_table_lookup(tagsistant_negative_cache_by_name, interned);
+	if (entries) {
+		GHashTableIter iter;
+		gpointer entry;
+		g_hash_table_iter_init(&iter, entries);
+		while (g_hash_table_iter_next(&iter, &entry, NULL))
+			g_hash_table_remove(tagsistant_negative_cache, ((tagsistant_negative_entry *) entry)->path);
+
+		g_hash_table_remove(tagsistant_negative_cache_by_name, interned);
+	}
+
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+}
+
+/**
+ * Forget the paths ending like a given path
+ *
+ * @param path the path
+ */
+void tagsistant_negative_cache_invalidate_path(const gchar *path)
+{
+	if (path) tagsistant_negative_cache_invalidate_name(tagsistant_negative_cache_name(path));
+}
+
+/**
+ * Forget the name of the object with a given inode, if any
+ * entry is cached at all
+ *
+ * @param dbi a DBI connection
+ * @param inode the object inode
+ */
+void tagsistant_negative_cache_invalidate_inode(dbi_conn dbi, tagsistant_inode inode)
+{
+	unless (tagsistant_negative_cache && inode) return;
+
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+	guint size = g_hash_table_size(tagsistant_negative_cache);
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+
+	if (!size) return;
+
+	gchar *objectname = NULL;
+	tagsistant_query("select objectname from objects where inode = %d", dbi, tagsistant_return_string, &objectname, inode);
+
+	if (objectname) {
+		tagsistant_negative_cache_invalidate_name(objectname);
+		g_free(objectname);
+	}
+}
+
+/**
+ * Forget every path, after a change which can make any path exist,
+ * like a new tag, a new relation or a new alias
+ */
+void tagsistant_negative_cache_invalidate()
+{
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+	g_atomic_int_inc(&tagsistant_negative_cache_changes);
+	g_atomic_int_inc(&tagsistant_negative_cache_generation);
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+}
+
+/**
+ * Print the negative cache statistics
+ *
+ * @param buffer the output buffer
+ * @param size the size of the buffer
+ */
+void tagsistant_negative_cache_stats(gchar *buffer, size_t size)
+{
+	g_mutex_lock(&tagsistant_negative_cache_lock);
+	g_snprintf(buffer, size, "# of negative entries: %u\n# of negative hits: %" G_GUINT64_FORMAT "\n",
+		tagsistant_negative_cache ? g_hash_table_size(tagsistant_negative_cache) : 0,
+		tagsistant_negative_cache_hits);
+	g_mutex_unlock(&tagsistant_negative_cache_lock);
+}
@@ -0,0 +1,243 @@
+/*
+   Tagsistant (tagfs) -- path_classification.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   Classify paths and path tokens on the hot FUSE paths.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** getattr(), readdir(), read() and the xattr operations used to classify their ***/
+/*** path with g_regex_match_simple(), which compiles the pattern on every call.  ***/
+/*** All the patterns are fixed, so they are matched here by hand instead.        ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the relations admitted in a relations/ path */
+static const gchar *tagsistant_relations[] = {
+	"includes",
+	"excludes",
+	"is_equivalent",
+	"requires",
+	NULL
+};
+
+/** the entries of the stats/ directory */
+static const struct {
+	const gchar *name;
+	tagsistant_stats_entry entry;
+} tagsistant_stats_entries[] = {
+	{ "connections",	TAGSISTANT_STATS_CONNECTIONS },
+	{ "cached_queries",	TAGSISTANT_STATS_CACHED_QUERIES },
+	{ "configuration",	TAGSISTANT_STATS_CONFIGURATION },
+	{ "objects",		TAGSISTANT_STATS_OBJECTS },
+	{ "rds",			TAGSISTANT_STATS_RDS },
+	{ "relations",		TAGSISTANT_STATS_RELATIONS },
+	{ "tags",			TAGSISTANT_STATS_TAGS },
+	{ NULL,				TAGSISTANT_STATS_NONE }
+};
+
+/** the operators that can't be followed by another operator in readdir() */
+static const gchar *tagsistant_path_operators[] = {
+	TAGSISTANT_ANDSET_DELIMITER,
+	TAGSISTANT_QUERY_DELIMITER,
+	TAGSISTANT_QUERY_DELIMITER_NO_REASONING,
+	TAGSISTANT_NEGATE_NEXT_TAG,
+	NULL
+};
+
+/**
+ * Check if the last element of a path is exactly a given name,
+ * which means the path ends by "/name"
+ *
+ * @param path the path
+ * @param name the name of the last element
+ * @return TRUE if the path ends by "/name"
+ */
+static gboolean tagsistant_path_ends_with_element(const gchar *path, const gchar *name)
+{
+	size_t path_length = strlen(path), name_length = strlen(name);
+
+	if (path_length < name_length + 1) return (FALSE);
+
+	const gchar *element = path + path_length - name_length;
+	return ((*(element - 1) is '/') && (memcmp(element, name, name_length) is 0));
+}
+
+/**
+ * Check if a path contains the meta-tag ALL/
+ *
+ * @param path the path
+ * @return TRUE if one of the elements of the path is ALL
+ */
+gboolean tagsistant_path_is_all(const gchar *path)
+{
+	if (!path) return (FALSE);
+	if (strstr(path, "/ALL/")) return (TRUE);
+	return (tagsistant_path_ends_with_element(path, "ALL"));
+}
+
+/**
+ * Check if a path points to the error file of a malformed query
+ *
+ * @param path the path
+ * @return TRUE if the path ends by "@/error"
+ */
+gboolean tagsistant_path_is_error(const gchar *path)
+{
+	return (path && g_str_has_suffix(path, "@/error"));
+}
+
+/**
+ * Check if a relation is admitted in a relations/ path
+ *
+ * @param relation the relation
+ * @return TRUE if the relation is admitted
+ */
+gboolean tagsistant_is_valid_relation(const gchar *relation)
+{
+	if (!relation) return (FALSE);
+
+	const gchar **candidate;
+	for (candidate = tagsistant_relations; *candidate; candidate++)
+		if (strcmp(*candidate, relation) is 0) return (TRUE);
+
+	return (FALSE);
+}
+
+/**
+ * Classify a path inside the stats/ directory
+ *
+ * @param path the path
+ * @return TAGSISTANT_STATS_ROOT for /stats, the entry for /stats/<entry>
+ *   or TAGSISTANT_STATS_NONE otherwise
+ */
+tagsistant_stats_entry tagsistant_path_stats_entry(const gchar *path)
+{
+	if (!path) return (TAGSISTANT_STATS_NONE);
+	if (strcmp(path, "/stats") is 0) return (TAGSISTANT_STATS_ROOT);
+	if (!g_str_has_prefix(path, "/stats/")) return (TAGSISTANT_STATS_NONE);
+
+	const gchar *name = path + strlen("/stats/");
+
+	int i;
+	for (i = 0; tagsistant_stats_entries[i].name; i++)
+		if (strcmp(tagsistant_stats_entries[i].name, name) is 0)
+			return (tagsistant_stats_entries[i].entry);
+
+	return (TAGSISTANT_STATS_NONE);
+}
+
+/**
+ * Check if a path ends by a query operator, like +/, @/, @@/ or -/
+ *
+ * @param path the path
+ * @return TRUE if the last element of the path is an operator
+ */
+gboolean tagsistant_path_ends_with_operator(const gchar *path)
+{
+	if (!path) return (FALSE);
+
+	const gchar **operator;
+	for (operator = tagsistant_path_operators; *operator; operator++)
+		if (tagsistant_path_ends_with_element(path, *operator)) return (TRUE);
+
+	return (FALSE);
+}
+
+/**
+ * Check if an _incomplete_ path has an open tag group, which means
+ * the path ends by "/{" or by "/{/" followed by elements without braces
+ *
+ * @param path the path
+ * @return TRUE if a tag group is still open
+ */
+gboolean tagsistant_path_is_inside_tag_group(const gchar *path)
+{
+	if (!path) return (FALSE);
+
+	const gchar *last_brace = NULL, *ptr;
+	for (ptr = path; *ptr; ptr++) {
+		if (*ptr is '{' || *ptr is '}') last_brace = ptr;
+	}
+
+	if (!last_brace || *last_brace is '}') return (FALSE);
+	if (last_brace is path || *(last_brace - 1) isNot '/') return (FALSE);
+
+	/* "/{" at the end of the path */
+	if (*(last_brace + 1) is '\0') return (TRUE);
+
+	/* "/{/" followed by at least one character */
+	return ((*(last_brace + 1) is '/') && (*(last_brace + 2) isNot '\0'));
+}
+
+/**
+ * Extract the inode from an object name in the form <inode>___<name>,
+ * either at the beginning of the path or after a slash
+ *
+ * @param path the path
+ * @return the inode, or 0 if the path does not contain one
+ */
+tagsistant_inode tagsistant_path_scan_inode(const gchar *path)
+{
+	if (!path) return (0);
+
+	size_t delimiter_length = strlen(TAGSISTANT_INODE_DELIMITER);
+	const gchar *ptr = path;
+
+	while (*ptr) {
+		/* inodes start at the beginning of the path or of an element */
+		if ((ptr is path || *(ptr - 1) is '/') && g_ascii_isdigit(*ptr)) {
+			const gchar *digits_end = ptr;
+			while (g_ascii_isdigit(*digits_end)) digits_end++;
+
+			if (strncmp(digits_end, TAGSISTANT_INODE_DELIMITER, delimiter_length) is 0)
+				return (strtoul(ptr, NULL, 10));
+
+			ptr = digits_end;
+			continue;
+		}
+		ptr++;
+	}
+
+	return (0);
+}
+
+/**
+ * Compress every sequence of slashes in a path into a single slash
+ *
+ * @param path the path
+ * @return a newly allocated string, to be freed with g_free()
+ */
+gchar *tagsistant_path_compress_slashes(const gchar *path)
+{
+	if (!path) return (NULL);
+
+	gchar *compressed = g_malloc(strlen(path) + 1);
+	gchar *dst = compressed;
+	const gchar *src;
+
+	for (src = path; *src; src++) {
+		if (*src is '/' && dst > compressed && *(dst - 1) is '/') continue;
+		*dst++ = *src;
+	}
+	*dst = '\0';
+
+	return (compressed);
+}
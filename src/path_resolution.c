@@ -33,49 +33,66 @@ GHashTable *tagsistant_and_set_cache = NULL;
 #endif
 
 GRegex *tagsistant_inode_extract_from_path_regex_1 = NULL;
-GRegex *tagsistant_inode_extract_from_path_regex_2 = NULL;
 
 /**
- * Just a wrapper around tagsistant_querytree_destroy() called when
- * an element is removed from tagsistant_querytree_cache.
+ * Free a querytree string field, unless it's borrowed
+ * from the shared querytree it has been looked up from
  *
- * @param qtree the querytree object to be removed
+ * @param qtree the querytree
+ * @param field the name of the field
  */
-void tagsistant_querytree_cache_destroy_element(tagsistant_querytree *qtree)
-{
-	tagsistant_querytree_destroy(qtree, 0);
+#define tagsistant_querytree_free_field(qtree, field) {\
+	if (!qtree->shared || (qtree->field isNot qtree->shared->field)) g_free(qtree->field);\
+	qtree->field = NULL;\
 }
 
 /**
- * Given a linked list of qtree_and_node objects (called an and-set)
- * return a string with a comma separated list of all the tags.
+ * Append to a GString the tag_ids of an and-set, each followed
+ * by the tag_ids of its related tags
  *
+ * @param str the GString
  * @param and_set the linked and-set list
- * @return a string like "tag1, tag2, tag3"
  */
-gchar *tagsistant_compile_and_set(gchar *objectname, qtree_and_node *and_set)
+static void tagsistant_compile_and_set_tag_ids(GString *str, qtree_and_node *and_set)
 {
-	// TODO valgrind says: check for leaks
-	GString *str = g_string_sized_new(10240);
-	g_string_append_printf(str, "%s>>>", objectname);
-
-	/* compile the string */
 	qtree_and_node *and_pointer = and_set;
 	while (and_pointer) {
-		if (and_pointer->tag) {
-			g_string_append(str, and_pointer->tag);
-
-			/* look for related tags too */
-			qtree_and_node *related = and_pointer->related;
-			while (related) {
-				g_string_append_printf(str, ",%s", related->tag);
-				related = related->related;
-			}
-		} else if (and_pointer->namespace && and_pointer->key && and_pointer->value) {
-			g_string_append_printf(str, "%s%s=%s", and_pointer->namespace, and_pointer->key, and_pointer->value);
+		g_string_append_printf(str, "%u", and_pointer->tag_id);
+
+		/* look for related tags too */
+		qtree_and_node *related = and_pointer->related;
+		while (related) {
+			g_string_append_printf(str, ",%u", related->tag_id);
+			related = related->related;
 		}
+
+		g_string_append_c(str, ';');
 		and_pointer = and_pointer->next;
 	}
+}
+
+/**
+ * Given an object name and the and-sets of an OR node, return
+ * the key of the and-set cache, like "name>>>1,7;3;|!5;|"
+ *
+ * @param objectname the object name
+ * @param and_set the linked and-set list
+ * @param negated_and_set the linked negated and-set list
+ * @param is_all_path TRUE if the OR node is an ALL/ node
+ * @return the key (must be freed by the caller)
+ */
+gchar *tagsistant_compile_and_set(const gchar *objectname, qtree_and_node *and_set, qtree_and_node *negated_and_set, gboolean is_all_path)
+{
+	GString *str = g_string_sized_new(256);
+	g_string_append_printf(str, "%s>>>", objectname);
+
+	if (is_all_path)
+		g_string_append(str, "ALL");
+	else
+		tagsistant_compile_and_set_tag_ids(str, and_set);
+
+	g_string_append(str, "|!");
+	tagsistant_compile_and_set_tag_ids(str, negated_and_set);
 
 	/* destroy the GString but not its content, which is returned */
 	return (g_string_free(str, FALSE));
@@ -83,70 +100,156 @@ gchar *tagsistant_compile_and_set(gchar *objectname, qtree_and_node *and_set)
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
 /**
- * Invalidate a tagsistant_and_set_cache entry
+ * g_hash_table_foreach_remove() callback matching the entries of an inode
+ */
+static gboolean tagsistant_and_set_cache_entry_has_inode(gpointer key, gpointer value, gpointer inode)
+{
+	(void) key;
+	return (value is inode);
+}
+
+/**
+ * Invalidate the tagsistant_and_set_cache entries resolved to an inode
  *
- * @param objectname the key of the object to be invalidated
+ * @param inode the inode
  */
-void tagsistant_invalidate_and_set_cache_entries(tagsistant_querytree *qtree)
+void tagsistant_invalidate_and_set_cache_inode(tagsistant_inode inode)
 {
-	(void) qtree;
+	if (!inode) return;
 
+	g_rw_lock_writer_lock(&tagsistant_and_set_cache_lock);
+	guint removed = g_hash_table_foreach_remove(tagsistant_and_set_cache,
+		tagsistant_and_set_cache_entry_has_inode, GUINT_TO_POINTER(inode));
+	g_rw_lock_writer_unlock(&tagsistant_and_set_cache_lock);
 
-	qtree_or_node *ptr = qtree->tree;
-	while (ptr) {
-		// compute the key
-		gchar *search_key = tagsistant_compile_and_set(qtree->object_path, ptr->and_set);
+	dbg('F', LOG_INFO, "%u and-set cache entries of inode %u invalidated", removed, inode);
+}
 
-		// if lookup succeed, removes the entry
-		g_rw_lock_writer_lock(&tagsistant_and_set_cache_lock);
-		if (g_hash_table_remove(tagsistant_and_set_cache, search_key)) {
-			dbg('F', LOG_INFO, "Cache entry %s invalidated", search_key);
-		} else {
-			dbg('F', LOG_INFO, "Cache entry %s not found!", search_key);
-		}
-		g_rw_lock_writer_unlock(&tagsistant_and_set_cache_lock);
+/**
+ * Invalidate the tagsistant_and_set_cache entries of the object
+ * pointed by a querytree
+ *
+ * @param qtree the querytree
+ */
+void tagsistant_invalidate_and_set_cache_entries(tagsistant_querytree *qtree)
+{
+	tagsistant_invalidate_and_set_cache_inode(qtree->inode);
+}
 
-		// free memory
-		g_free(search_key);
+/**
+ * Empty the tagsistant_and_set_cache, when the tagging of many
+ * objects changes at once (like when a tag is deleted)
+ */
+void tagsistant_invalidate_and_set_cache()
+{
+	g_rw_lock_writer_lock(&tagsistant_and_set_cache_lock);
+	g_hash_table_remove_all(tagsistant_and_set_cache);
+	g_rw_lock_writer_unlock(&tagsistant_and_set_cache_lock);
+}
+#endif
 
-		// next or node
-		ptr = ptr->next;
+/**
+ * Append to a GString the SQL CASE branches mapping the tag_ids of
+ * a node and of its related tags to the position of the node
+ *
+ * @param branches the GString receiving the CASE branches (can be NULL)
+ * @param tag_ids the GString receiving the comma separated tag_ids
+ * @param and the qtree_and_node
+ * @param position the position of the node in its and-set
+ * @return TRUE if at least one tag_id has been added
+ */
+static gboolean tagsistant_and_set_sql_node(GString *branches, GString *tag_ids, qtree_and_node *and, int position)
+{
+	gboolean added = FALSE;
+
+	qtree_and_node *related = and;
+	while (related) {
+		if (related->tag_id) {
+			if (branches) g_string_append_printf(branches, " when %u then %d", related->tag_id, position);
+			g_string_append_printf(tag_ids, "%s%u", tag_ids->len ? ", " : "", related->tag_id);
+			added = TRUE;
+		}
+		related = related->related;
 	}
+
+	return (added);
 }
-#endif
 
 /**
- * check if a tagging is valid
+ * Build the query resolving the objects which satisfy an OR node:
+ * tagged by each tag of the and-set (or by one of its related tags)
+ * and by none of the tags of the negated and-set. The tags are
+ * counted by node, so the whole and-set is checked in one grouped
+ * query, whatever its length.
  *
- * @param and the qtree_and_node holding the tag
- * @param dbi a dbi_conn connection
- * @param objectname the name of the object to be checked for tagging by the qtree_and_node
- * @return the inode of the object if the tagging is valid, 0 otherwise
+ * @param and_set the and-set, NULL for ALL/ nodes
+ * @param negated_and_set the negated and-set
+ * @param constraint the SQL condition selecting the candidate objects
+ * @return the query (must be freed by the caller) or NULL if the
+ *   and-set includes a tag which does not exist, so nothing can match
  */
-int tagsistant_check_single_tagging(qtree_and_node *and, dbi_conn dbi, gchar *objectname)
+static gchar *tagsistant_and_set_sql(qtree_and_node *and_set, qtree_and_node *negated_and_set, const gchar *constraint)
 {
-	tagsistant_inode inode = 0;
+	GString *branches = g_string_sized_new(256);
+	GString *tag_ids = g_string_sized_new(256);
+	GString *negated_tag_ids = g_string_sized_new(64);
+	int nodes = 0;
 
-	/*
-	 * if the tag is a triple tag and its operator is not equality,
-	 * this function should return 1
-	 */
-	if (and->namespace && strlen(and->namespace) && and->operator isNot TAGSISTANT_EQUAL_TO) return (1);
+	qtree_and_node *and = and_set;
+	while (and) {
+		/*
+		 * triple tags compared by value are not checked here,
+		 * as tagsistant_check_single_tagging() used to do
+		 */
+		if (!(and->namespace && strlen(and->namespace) && and->operator isNot TAGSISTANT_EQUAL_TO)) {
+			if (!tagsistant_and_set_sql_node(branches, tag_ids, and, nodes)) {
+				g_string_free(branches, TRUE);
+				g_string_free(tag_ids, TRUE);
+				g_string_free(negated_tag_ids, TRUE);
+				return (NULL);
+			}
+			nodes++;
+		}
+		and = and->next;
+	}
 
-	/*
-	 * otherwise the tagging has to be checked
-	 */
-	tagsistant_query(
-		"select objects.inode from objects "
-			"join tagging on objects.inode = tagging.inode "
-			"where objects.objectname = \"%s\" and tagging.tag_id = %d",
-		dbi,
-		tagsistant_return_integer,
-		&inode,
-		objectname,
-		and->tag_id);
+	and = negated_and_set;
+	while (and) {
+		tagsistant_and_set_sql_node(NULL, negated_tag_ids, and, 0);
+		and = and->next;
+	}
 
-	return (inode);
+	GString *sql = g_string_sized_new(512);
+
+	if (nodes) {
+		g_string_append_printf(sql,
+			"select objects.inode from objects "
+				"join tagging on tagging.inode = objects.inode "
+				"where %s and tagging.tag_id in (%s)",
+			constraint, tag_ids->str);
+	} else {
+		g_string_append_printf(sql, "select objects.inode from objects where %s", constraint);
+	}
+
+	if (negated_tag_ids->len) {
+		g_string_append_printf(sql,
+			" and objects.inode not in (select inode from tagging where tag_id in (%s))",
+			negated_tag_ids->str);
+	}
+
+	if (nodes) {
+		g_string_append_printf(sql,
+			" group by objects.inode having count(distinct case tagging.tag_id%s end) = %d",
+			branches->str, nodes);
+	}
+
+	g_string_append(sql, " order by objects.inode limit 1");
+
+	g_string_free(branches, TRUE);
+	g_string_free(tag_ids, TRUE);
+	g_string_free(negated_tag_ids, TRUE);
+
+	return (g_string_free(sql, FALSE));
 }
 
 /**
@@ -160,22 +263,7 @@ tagsistant_inode tagsistant_inode_extract_from_path(const gchar *path)
 {
 	if (!path && strlen(path) is 0) return (0);
 
-	tagsistant_inode inode = 0;
-
-	GMatchInfo *match_info;
-	if (g_regex_match(tagsistant_inode_extract_from_path_regex_1, path, 0, &match_info)) {
-		/* extract the inode */
-		gchar *inode_text = g_match_info_fetch(match_info, 1);
-		inode = strtoul(inode_text, NULL, 10);
-		g_free_null(inode_text);
-	} else if (g_regex_match(tagsistant_inode_extract_from_path_regex_2, path, 0, &match_info)) {
-		/* extract the inode */
-		gchar *inode_text = g_match_info_fetch(match_info, 1);
-		inode = strtoul(inode_text, NULL, 10);
-		g_free_null(inode_text);
-	}
-
-	g_match_info_free(match_info);
+	tagsistant_inode inode = tagsistant_path_scan_inode(path);
 
 	if (inode) {
 		dbg('l', LOG_INFO, "%s has inode %lu", path, (long unsigned int) inode);
@@ -192,8 +280,10 @@ tagsistant_inode tagsistant_inode_extract_from_path(const gchar *path)
  * exists is set to 1.
  *
  * @param and_set a pointer to a qtree_and_node and-set data structure
+ * @param negated_and_set a pointer to the negated and-set
  * @param dbi a libDBI dbi_conn reference
  * @param objectname the name of the object we are looking up the inode
+ * @param is_all_path TRUE if the and-set belongs to an ALL/ node
  * @return the inode of the object if found, zero otherwise
  */
 tagsistant_inode
@@ -201,10 +291,10 @@ tagsistant_guess_inode_from_and_set(
 	qtree_and_node *and_set,
 	qtree_and_node *negated_and_set,
 	dbi_conn dbi,
-	gchar *objectname,
+	const gchar *objectname,
 	gboolean is_all_path)
 {
-	tagsistant_inode inode = 0, guessed_inode = 0;
+	tagsistant_inode inode = 0;
 
 	/*
 	 * if called without an and_set (which can happen on syntactically
@@ -215,145 +305,162 @@ tagsistant_guess_inode_from_and_set(
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
 	/* check if the query has been already answered and cached */
-	gchar *search_key = tagsistant_compile_and_set(objectname, and_set);
+	gchar *search_key = tagsistant_compile_and_set(objectname, and_set, negated_and_set, is_all_path);
 
 	// if lookup succeed, returns the inode
 	g_rw_lock_reader_lock(&tagsistant_and_set_cache_lock);
-	tagsistant_inode *value = (tagsistant_inode *) g_hash_table_lookup(tagsistant_and_set_cache, search_key);
+	inode = GPOINTER_TO_UINT(g_hash_table_lookup(tagsistant_and_set_cache, search_key));
 	g_rw_lock_reader_unlock(&tagsistant_and_set_cache_lock);
 
-	if (value) {
+	if (inode) {
 		g_free_null(search_key);
-		return (GPOINTER_TO_UINT(value));
+		return (inode);
 	}
+
+	/* taken before reading the DB, to know if the result can be cached */
+	gint snapshot = tagsistant_db_snapshot();
 #endif
 
 	/*
-	 * handle the ALL/ special case by guessing the inode of the first
-	 * object named objectname
+	 * resolve the whole and-set in one query; ALL/ nodes
+	 * only exclude the negated tags
 	 */
-	if (is_all_path) {
-		// get the inode from the object path
-		inode = tagsistant_inode_extract_from_path(objectname);
-
-		// load the inode from the object table
-		if (!inode) {
-			tagsistant_query(
-				"select inode from objects where objectname = \"%s\"",
-				dbi, tagsistant_return_integer, &inode, objectname);
-		}
+	gchar *sql = tagsistant_and_set_sql(is_all_path ? NULL : and_set, negated_and_set, "objects.objectname = '%s'");
+	if (sql) {
+		tagsistant_query(sql, dbi, tagsistant_return_integer, &inode, objectname);
+		g_free(sql);
+	}
 
-		goto BREAK_LOOKUP;
+#if TAGSISTANT_ENABLE_AND_SET_CACHE
+	/* cache a result if one has been found and no writer interfered */
+	if (inode && tagsistant_db_snapshot_is_current(snapshot)) {
+		g_rw_lock_writer_lock(&tagsistant_and_set_cache_lock);
+		if (g_hash_table_size(tagsistant_and_set_cache) >= TAGSISTANT_AND_SET_CACHE_SIZE)
+			g_hash_table_remove_all(tagsistant_and_set_cache);
+		g_hash_table_insert(tagsistant_and_set_cache, search_key, GUINT_TO_POINTER(inode));
+		g_rw_lock_writer_unlock(&tagsistant_and_set_cache_lock);
+	} else {
+		g_free_null(search_key);
 	}
+#endif
 
-	/*
-	 * the first step is to check every tag in the and_set linked by
-	 * the ->next field. if the object is tagged by each tag, the first
-	 * step is fulfilled
-	 */
-	qtree_and_node *and_set_ptr = and_set;
+	return (inode);
+}
 
-	while (and_set_ptr) {
-		/*
-		 * the query is not an ALL/ query, so we process each tag.
-		 * if no match is directly found, we check the ->related tags too.
-		 */
-		tagsistant_inode single_and_inode = tagsistant_check_single_tagging(and_set_ptr, dbi, objectname);
+/**
+ * Check if an object satisfies an OR node of a query
+ *
+ * @param or_node the OR node
+ * @param dbi a libDBI dbi_conn reference
+ * @param inode the object inode
+ * @return TRUE if the object is in the result of the OR node
+ */
+static gboolean tagsistant_or_node_includes_inode(qtree_or_node *or_node, dbi_conn dbi, tagsistant_inode inode)
+{
+	/* OR nodes without tags match nothing, like in the RDS materialization */
+	if (!or_node->and_set && !or_node->is_all_node) return (FALSE);
 
-		/*
-		 * if no match has been found, try with related tags
-		 */
-		if (!single_and_inode) {
-			qtree_and_node *related = and_set_ptr->related;
+	gchar *constraint = g_strdup_printf("objects.inode = %u", inode);
+	gchar *sql = tagsistant_and_set_sql(or_node->is_all_node ? NULL : or_node->and_set, or_node->negated_and_set, constraint);
+	g_free(constraint);
 
-			while (related) {
-				single_and_inode = tagsistant_check_single_tagging(related, dbi, objectname);
+	if (!sql) return (FALSE);
 
-				/* if a related tag match, break the while loop */
-				if (single_and_inode) break;
+	tagsistant_inode found = 0;
+	tagsistant_query(sql, dbi, tagsistant_return_integer, &found);
+	g_free(sql);
 
-				related = related->related;
-			}
+	return (found is inode);
+}
 
-			/* it this tag (nor any of its related) matches, break the lookup */
-			if (!single_and_inode && !and_set_ptr->negate) goto BREAK_LOOKUP;
-		}
+/**
+ * Look up the object named like the first element of the object path
+ * which belongs to the result of the query, with one grouped query
+ * for each OR node of the query. If the path carries an inode, only
+ * that object is checked, otherwise the lowest matching inode wins.
+ *
+ * @param qtree the tagsistant_querytree object
+ * @param objectname the first element of the object path
+ * @return the matching inode, 0 if none
+ */
+static tagsistant_inode tagsistant_querytree_point_lookup(tagsistant_querytree *qtree, const gchar *objectname)
+{
+	tagsistant_inode inode = 0;
 
-		/*
-		 * if this is the first iteration and guessed_inode is still
-		 * empty, save the inode for the further checking
-		 */
-		if (!guessed_inode) guessed_inode = single_and_inode;
+	gchar *constraint = qtree->inode ?
+		g_strdup_printf("objects.inode = %u and objects.objectname = '%%s'", qtree->inode) : NULL;
 
-		/*
-		 * if the inode extracted from this iteration is different from the previous one
-		 * this may suggest a case of file homonymy, so we must return a match failure
-		 */
-		if (guessed_inode isNot single_and_inode) goto BREAK_LOOKUP;
+	qtree_or_node *query = qtree->tree;
+	while (query) {
+		if (query->and_set || query->is_all_node) {
+			tagsistant_inode or_inode = 0;
 
-		/*
-		 * otherwise we continue with the next tag
-		 */
-		and_set_ptr = and_set_ptr->next;
-	}
+			if (constraint) {
+				gchar *sql = tagsistant_and_set_sql(query->is_all_node ? NULL : query->and_set, query->negated_and_set, constraint);
+				if (sql) {
+					tagsistant_query(sql, qtree->dbi, tagsistant_return_integer, &or_inode, objectname);
+					g_free(sql);
+				}
 
-	/*
-	 * save the inode for returning it in the end of the function
-	 */
-	inode = guessed_inode;
+				/* the object is in the result, no need to check the other OR nodes */
+				if (or_inode) {
+					inode = or_inode;
+					break;
+				}
+			} else {
+				or_inode = tagsistant_guess_inode_from_and_set(
+					query->and_set, query->negated_and_set, qtree->dbi, objectname, query->is_all_node);
 
-	/*
-	 * the second step involves negated tags
-	 */
-	and_set_ptr = negated_and_set;
-	while (and_set_ptr) {
-		tagsistant_inode single_and_inode = tagsistant_check_single_tagging(and_set_ptr, dbi, objectname);
+				if (or_inode && (!inode || or_inode < inode)) inode = or_inode;
+			}
+		}
+		query = query->next;
+	}
 
-		/*
-		 * if no match has been found, try with related tags
-		 */
-		if (!single_and_inode) {
-			qtree_and_node *related = and_set_ptr->related;
+	g_free(constraint);
 
-			while (related) {
-				single_and_inode = tagsistant_check_single_tagging(related, dbi, objectname);
+	return (inode);
+}
 
-				/* if a related tag match, break the while loop */
-				if (single_and_inode) break;
+/**
+ * Set the existence and the inode of a querytree from the list
+ * of inodes that match its object name in the query result
+ *
+ * @param qtree the tagsistant_querytree object
+ * @param inodes the matching inodes
+ */
+static void tagsistant_querytree_assign_matching_inode(tagsistant_querytree *qtree, GList *inodes)
+{
+	if (!inodes) return;
 
-				related = related->related;
-			}
-		}
+	qtree->exists = 1;
 
-		/*
-		 * if we have a match, the file must be discarder (returning 0)
-		 * because this is the ->negated branch of the tree
-		 */
-		if (single_and_inode) {
-			inode = 0;
-			goto BREAK_LOOKUP;
+	GList *ptr = inodes;
+	GList *match = NULL;
+	while (ptr) {
+		if (GPOINTER_TO_UINT(ptr->data) is qtree->inode) {
+			match = ptr;
+			break;
+		} else {
+			dbg('f', LOG_INFO, "%d is not %d", GPOINTER_TO_UINT(ptr->data), qtree->inode);
 		}
-
-		/*
-		 * otherwise we continue with the next tag
-		 */
-		and_set_ptr = and_set_ptr->next;
+		ptr = ptr->next;
 	}
 
-BREAK_LOOKUP:
-
-#if TAGSISTANT_ENABLE_AND_SET_CACHE
-	/* cache a result if one has been found */
-	if (inode) {
-		g_rw_lock_writer_lock(&tagsistant_and_set_cache_lock);
-		g_hash_table_insert(tagsistant_and_set_cache, search_key, GUINT_TO_POINTER(inode));
-		g_rw_lock_writer_unlock(&tagsistant_and_set_cache_lock);
-	} else {
-		g_free_null(search_key);
+	if (match is NULL) {
+		if (qtree->inode is 0) {
+			/*
+			 * set the inode to the first available one
+			 */
+			tagsistant_querytree_set_inode(qtree, GPOINTER_TO_UINT(inodes->data));
+		} else {
+			/*
+			 * no match for an object with a provided inode
+			 * means that the object doesn't exist
+			 */
+			qtree->exists = 0;
+		}
 	}
-#endif
-
-	return (inode);
 }
 
 /**
@@ -393,7 +500,22 @@ int tagsistant_querytree_check_tagging_consistency(tagsistant_querytree *qtree)
 	}
 
 	/*
-	 * 2. use the object first token to guess if its tagged in the RDS
+	 * 2. check the tags of the objects with that name, unless the
+	 *    query involves triple tags compared by value, which can be
+	 *    resolved only on the RDS
+	 */
+	if (qtree->dbi && tagsistant_tag_index_can_evaluate(qtree->tree)) {
+		tagsistant_inode inode = tagsistant_querytree_point_lookup(qtree, object_path_first_token);
+		GList *inodes = inode ? g_list_prepend(NULL, GUINT_TO_POINTER(inode)) : NULL;
+		tagsistant_querytree_assign_matching_inode(qtree, inodes);
+		g_list_free(inodes);
+
+		g_free_null(object_path_first_token);
+		return (qtree->exists);
+	}
+
+	/*
+	 * 3. use the object first token to guess if its tagged in the RDS
 	 */
 	tagsistant_rds *rds = tagsistant_rds_new_or_lookup(qtree);
 
@@ -401,44 +523,12 @@ int tagsistant_querytree_check_tagging_consistency(tagsistant_querytree *qtree)
 		tagsistant_rds_read_lock(rds, qtree);
 
 		/*
-		 * lookup all the inodes that match the object name
+		 * lookup all the inodes that match the object name and,
+		 * if a GList is returned, set the querytree object as
+		 * existing and try to assign a proper inode
 		 */
 		GList *inodes = g_hash_table_lookup(rds->entries, object_path_first_token);
-
-		/*
-		 * if a GList is returned, set the querytree object as existing
-		 * and try to assign a proper inode
-		 */
-		if (inodes) {
-			qtree->exists = 1;
-
-			GList *ptr = inodes;
-			GList *match = NULL;
-			while (ptr) {
-				if (GPOINTER_TO_UINT(ptr->data) is qtree->inode) {
-					match = ptr;
-					break;
-				} else {
-					dbg('f', LOG_INFO, "%d is not %d", GPOINTER_TO_UINT(ptr->data), qtree->inode);
-				}
-				ptr = ptr->next;
-			}
-
-			if (match is NULL) {
-				if (qtree->inode is 0) {
-					/*
-					 * set the inode to the first available one
-					 */
-					tagsistant_querytree_set_inode(qtree, GPOINTER_TO_UINT(inodes->data));
-				} else {
-					/*
-					 * no match for an object with a provided inode
-					 * means that the object doesn't exist
-					 */
-					qtree->exists = 0;
-				}
-			}
-		}
+		tagsistant_querytree_assign_matching_inode(qtree, inodes);
 
 		tagsistant_rds_read_unlock(rds);
 	}
@@ -473,6 +563,70 @@ int tagsistant_querytree_check_tagging_consistency(tagsistant_querytree *qtree)
 /** next token is outside any tag group */
 #define TAGSISTANT_TAG_GROUP_DONT_ADD 0
 
+/** the maximum number of tokens a path is split into */
+#define TAGSISTANT_PATH_MAX_TOKENS 512
+
+/** paths shorter than this are scanned on the stack */
+#define TAGSISTANT_PATH_SCANNER_BUFFER 4096
+
+/**
+ * the token array built by tagsistant_path_scan(): each token
+ * is a slice of a single copy of the path, terminated in place
+ */
+typedef struct {
+	/** the NULL terminated token array */
+	gchar *tokens[TAGSISTANT_PATH_MAX_TOKENS + 1];
+
+	/** the copy of the path, unless too long for the stack */
+	gchar buffer[TAGSISTANT_PATH_SCANNER_BUFFER];
+
+	/** the copy of the path, when too long for the stack */
+	gchar *heap;
+} tagsistant_path_scanner;
+
+/**
+ * Split a path on slashes in a single pass, like
+ * g_strsplit(path, "/", TAGSISTANT_PATH_MAX_TOKENS) but without
+ * allocating the tokens: the path is copied once, each slash is
+ * replaced by a terminator and the tokens point inside the copy.
+ * Paths shorter than TAGSISTANT_PATH_SCANNER_BUFFER don't allocate
+ * at all. The result must be released with tagsistant_path_scanner_free().
+ *
+ * @param scanner the scanner (usually on the stack)
+ * @param path the path to split
+ * @return the NULL terminated token array
+ */
+static gchar **tagsistant_path_scan(tagsistant_path_scanner *scanner, const gchar *path)
+{
+	size_t length = strlen(path);
+	gchar *copy = scanner->buffer;
+
+	scanner->heap = NULL;
+	if (length >= TAGSISTANT_PATH_SCANNER_BUFFER) copy = scanner->heap = g_malloc(length + 1);
+	memcpy(copy, path, length + 1);
+
+	guint count = 0;
+	scanner->tokens[count++] = copy;
+
+	gchar *c;
+	for (c = copy; *c && count < TAGSISTANT_PATH_MAX_TOKENS; c++) {
+		if (*c is '/') {
+			*c = '\0';
+			scanner->tokens[count++] = c + 1;
+		}
+	}
+
+	scanner->tokens[count] = NULL;
+	return (scanner->tokens);
+}
+
+/**
+ * Release the memory used by a path scanner
+ *
+ * @param scanner the scanner
+ */
+#define tagsistant_path_scanner_free(scanner) g_free_null((scanner)->heap)
+
 /** abort parsing a store query with an error message */
 #define TAGSISTANT_ABORT_STORE_PARSING(message) { qtree->error_message = g_strdup(message); return (0); }
 
@@ -533,11 +687,11 @@ void tagsistant_querytree_rebuild_paths(tagsistant_querytree *qtree)
 	}
 
 	/* reset the querytree archive path */
-	g_free_null(qtree->archive_path);
+	tagsistant_querytree_free_field(qtree, archive_path);
 	qtree->archive_path = g_strdup_printf("%s/%d" TAGSISTANT_INODE_DELIMITER "%s", relative_path, qtree->inode, qtree->object_path);
 
 	/* reset the querytree full archive path */
-	g_free_null(qtree->full_archive_path);
+	tagsistant_querytree_free_field(qtree, full_archive_path);
 	qtree->full_archive_path = g_strdup_printf("%s/%s", tagsistant.archive, qtree->archive_path);
 
 	dbg('q', LOG_ERR, "Full archive/ path is  %s", qtree->full_archive_path);
@@ -677,7 +831,7 @@ int tagsistant_querytree_parse_store (
 			 * if so, this tag is a triple tag and requires special
 			 * parsing ":$"
 			 */
-			if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+			if (tagsistant_is_triple_tag(__TOKEN)) {
 				and->namespace = g_strdup(__TOKEN);
 				qtree->namespace = g_strdup(__TOKEN);
 
@@ -713,7 +867,6 @@ int tagsistant_querytree_parse_store (
 				}
 				and->tag_id = tagsistant_sql_get_tag_id(qtree->dbi, and->namespace, and->key, and->value);
 			} else {
-				qtree->last_tag = g_strdup(__TOKEN);
 				and->tag = g_strdup(__TOKEN);
 				and->tag_id = tagsistant_sql_get_tag_id(qtree->dbi, and->tag, NULL, NULL);
 			}
@@ -832,7 +985,7 @@ int tagsistant_querytree_parse_store (
 			/*
 			qtree_or_node *or_tmp = qtree->tree;
 			while (or_tmp && !qtree->inode && strlen(qtree->object_path)) {
-				qtree->inode = tagsistant_guess_inode_from_and_set(or_tmp->and_set, qtree->dbi, **token_ptr, or_tmp->is_all_node);
+				qtree->inode = tagsistant_guess_inode_from_and_set(or_tmp->and_set, or_tmp->negated_and_set, qtree->dbi, **token_ptr, or_tmp->is_all_node);
 				or_tmp = or_tmp->next;
 			}
 			*/
@@ -861,39 +1014,10 @@ int tagsistant_querytree_parse_store (
 
 			while (or_iterator) {
 				/*
-				 * check if the object is tagged in this andset
+				 * if the object is tagged in at least one and-set, the whole
+				 * query is valid and we don't need further checking
 				 */
-				int valid_and_set = 1;
-				qtree_and_node *and_tmp = or_iterator->and_set;
-
-				while (and_tmp) {
-					tagsistant_inode tmp_inode;
-					tagsistant_query(
-						"select tagging.inode from tagging "
-							"join tags on tagging.tag_id = tags.tag_id "
-							"where tagging.inode = %d and tags.tagname = \"%s\"",
-						qtree->dbi,
-						tagsistant_return_integer,
-						&tmp_inode,
-						qtree->inode,
-						and_tmp->tag);
-
-					/*
-					 * if just one tag is not valid, the whole andset is not valid
-					 */
-					if (tmp_inode isNot qtree->inode) {
-						valid_and_set = 0;
-						break;
-					}
-
-					and_tmp = and_tmp->next;
-				}
-
-				/*
-				 * if at least one andset is valid, the whole query is valid
-				 * and we don't need further checking
-				 */
-				if (valid_and_set) {
+				if (tagsistant_or_node_includes_inode(or_iterator, qtree->dbi, qtree->inode)) {
 					valid_query = 1;
 					break;
 				}
@@ -951,7 +1075,7 @@ int tagsistant_querytree_parse_tags (
 	gchar ***token_ptr)
 {
 	if (__TOKEN) {
-		if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+		if (tagsistant_is_triple_tag(__TOKEN)) {
 			qtree->first_tag = qtree->second_tag = qtree->last_tag = NULL;
 
 			qtree->namespace = g_strdup(__TOKEN);
@@ -1040,7 +1164,7 @@ int tagsistant_querytree_parse_relations (
 {
 	/* parse a relations query */
 	if (__TOKEN) {
-		if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+		if (tagsistant_is_triple_tag(__TOKEN)) {
 			/*
 			 *  the left tag is a triple tag
 			 */
@@ -1050,14 +1174,14 @@ int tagsistant_querytree_parse_relations (
 				__SLIDE_TOKEN;
 
 				/* check if relation is allowed */
-				if (!g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, __TOKEN, G_REGEX_EXTENDED, 0)) return (0);
+				if (!tagsistant_is_valid_relation(__TOKEN)) return (0);
 
 				qtree->relation = g_strdup(__TOKEN);
 
 				if (__NEXT_TOKEN) {
 					__SLIDE_TOKEN;
 
-					if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+					if (tagsistant_is_triple_tag(__TOKEN)) {
 						/*
 						 *  the right (related) tag is a triple tag
 						 */
@@ -1087,14 +1211,14 @@ int tagsistant_querytree_parse_relations (
 				__SLIDE_TOKEN;
 
 				/* check if relation is allowed */
-				if (!g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, __TOKEN, G_REGEX_EXTENDED, 0)) return (0);
+				if (!tagsistant_is_valid_relation(__TOKEN)) return (0);
 
 				qtree->relation = g_strdup(__TOKEN);
 
 				if (__NEXT_TOKEN) {
 					__SLIDE_TOKEN;
 
-					if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+					if (tagsistant_is_triple_tag(__TOKEN)) {
 						/*
 						 *  the right (related) tag is a triple tag
 						 */
@@ -1275,11 +1399,18 @@ int tagsistant_querytree_parse_export(
  */
 gchar *tagsistant_get_reversed_inode_tree(tagsistant_inode inode)
 {
-	gchar *reversed_inode = g_strreverse(g_strdup_printf("%u", inode % TAGSISTANT_ARCHIVE_DEPTH));
-	GRegex *rx = g_regex_new("(.)", 0, G_REGEX_MATCH_NOTEMPTY, NULL);
-	gchar *relative_path = g_regex_replace(rx, reversed_inode, -1, 0, "/\\1", 0, NULL);
-	g_regex_unref(rx);
-	g_free(reversed_inode);
+	gchar digits[16];
+	int length = g_snprintf(digits, sizeof(digits), "%u", inode % TAGSISTANT_ARCHIVE_DEPTH);
+
+	/* prepend a slash to each digit, walking them backward */
+	gchar *relative_path = g_malloc(length * 2 + 1);
+	gchar *ptr = relative_path;
+	while (length--) {
+		*ptr++ = '/';
+		*ptr++ = digits[length];
+	}
+	*ptr = '\0';
+
 	return (relative_path);
 }
 
@@ -1294,8 +1425,9 @@ void tagsistant_querytree_set_object_path(tagsistant_querytree *qtree, char *new
 {
 	if (!new_object_path) return;
 
-	if (qtree->object_path) g_free_null(qtree->object_path);
-	qtree->object_path = g_strdup(new_object_path);
+	gchar *object_path = g_strdup(new_object_path);
+	tagsistant_querytree_free_field(qtree, object_path);
+	qtree->object_path = object_path;
 
 	tagsistant_querytree_rebuild_paths(qtree);
 }
@@ -1317,171 +1449,470 @@ void tagsistant_querytree_set_inode(tagsistant_querytree *qtree, tagsistant_inod
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 
+/************************************************************************************/
+/***                                                                              ***/
+/*** The querytree cache is a segmented LRU: new entries enter the probation      ***/
+/*** segment and are promoted to the protected one on their second hit, so a      ***/
+/*** single scan (like a find over store/) can't flush the hot working set.       ***/
+/*** Eviction starts from the tail of probation when the cache exceeds            ***/
+/*** --qtree-cache entries or --qtree-cache-memory megabytes.                     ***/
+/***                                                                              ***/
+/************************************************************************************/
+
 /**
- * tagsistant_querytree objects cache
+ * Make a querytree shareable: its parsed fields are moved into a new
+ * querytree which is returned to be cached, while the original one
+ * keeps borrowing them. The shared copy starts with two references,
+ * one for the cache and one for the original querytree.
+ *
+ * @param qtree the querytree just parsed
+ * @return the shared querytree
  */
+static tagsistant_querytree *tagsistant_querytree_share(tagsistant_querytree *qtree)
+{
+	tagsistant_querytree *shared = g_new(tagsistant_querytree, 1);
+
+	*shared = *qtree;
+	shared->dbi = NULL;
+	shared->transaction_started = 0;
+	shared->borrowed_dbi = FALSE;
+	shared->schedule_for_unlink = 0;
+	shared->shared = NULL;
+	shared->refcount = 2;
+
+	qtree->shared = shared;
+
+	return (shared);
+}
+
+/**
+ * Build a querytree borrowing all its fields from a shared one.
+ * No string or tag tree is copied.
+ *
+ * @param shared the shared querytree
+ * @return a new querytree holding a reference on shared
+ */
+static tagsistant_querytree *tagsistant_querytree_borrow(tagsistant_querytree *shared)
+{
+	tagsistant_querytree *qtree = g_new(tagsistant_querytree, 1);
+
+	*qtree = *shared;
+	qtree->shared = shared;
+	qtree->refcount = 0;
+
+	g_atomic_int_inc(&shared->refcount);
+
+	return (qtree);
+}
+
+/**
+ * Release a reference on a shared querytree, destroying
+ * it when the last reference goes away
+ *
+ * @param shared the shared querytree
+ */
+static void tagsistant_querytree_unref(tagsistant_querytree *shared)
+{
+	if (g_atomic_int_dec_and_test(&shared->refcount))
+		tagsistant_querytree_destroy(shared, 0);
+}
+
+/**
+ * a cached querytree, linked in one of the two LRU segments
+ */
+typedef struct {
+	/** the cached querytree */
+	tagsistant_querytree *qtree;
+
+	/** the link of this entry inside its segment */
+	GList *link;
+
+	/** TRUE if the entry lives in the protected segment */
+	gboolean protected;
+
+	/** estimated memory footprint of the querytree */
+	gsize size;
+
+	/** the interned names of the tags the querytree depends on */
+	GPtrArray *tags;
+} tagsistant_querytree_cache_entry;
+
+/** full_path -> tagsistant_querytree_cache_entry */
 GHashTable *tagsistant_querytree_cache = NULL;
-GRWLock tagsistant_querytree_cache_lock;
 
 /**
- * Counts one single element of the querytree hashtable
+ * dependency indexes used by selective invalidation: interned tag
+ * name -> set of entries and inode -> set of entries
+ */
+GHashTable *tagsistant_querytree_cache_by_tag = NULL;
+GHashTable *tagsistant_querytree_cache_by_inode = NULL;
+
+/** guards the cache, both segments and the counters */
+GMutex tagsistant_querytree_cache_lock;
+
+/** the probation and protected segments, most recently used first */
+GQueue tagsistant_querytree_cache_probation = G_QUEUE_INIT;
+GQueue tagsistant_querytree_cache_protected = G_QUEUE_INIT;
+
+/** cache accounting */
+gsize tagsistant_querytree_cache_memory = 0;
+guint64 tagsistant_querytree_cache_hits = 0;
+guint64 tagsistant_querytree_cache_misses = 0;
+guint64 tagsistant_querytree_cache_evictions = 0;
+guint64 tagsistant_querytree_cache_invalidations = 0;
+
+/**
+ * Add the interned name of a tag to a dependency array, skipping duplicates
  *
- * @return
+ * @param tags the dependency array
+ * @param tag the tag name (or the namespace of a triple tag)
  */
-void tagsistant_querytree_cache_counter(gpointer key, gpointer value, gpointer user_data)
+static void tagsistant_querytree_add_dependency(GPtrArray *tags, const gchar *tag)
 {
-	(void) key;
-	(void) value;
+	if (!tag || !strlen(tag)) return;
+
+	const gchar *interned = g_intern_string(tag);
+
+	guint i;
+	for (i = 0; i < tags->len; i++)
+		if (g_ptr_array_index(tags, i) is interned) return;
 
- 	int *elements = (int *) user_data;
-	*elements = *elements + 1;
+	g_ptr_array_add(tags, (gpointer) interned);
 }
 
 /**
- * Count the elements contained in the querytree cache
+ * Add the tags of a qtree_and_node branch, related tags included,
+ * to a dependency array
  *
- * @param qtree
+ * @param tags the dependency array
+ * @param and the branch
  */
-int tagsistant_querytree_cache_total()
+static void tagsistant_querytree_and_node_dependencies(GPtrArray *tags, qtree_and_node *and)
 {
-	int elements = 0;
-	g_hash_table_foreach(tagsistant_querytree_cache, tagsistant_querytree_cache_counter, &elements);
-	return (elements);
+	while (and) {
+		tagsistant_querytree_add_dependency(tags, and->tag ? and->tag : and->namespace);
+		tagsistant_querytree_and_node_dependencies(tags, and->related);
+		and = and->next;
+	}
+}
+
+/**
+ * List the tags a querytree depends on. Tags are indexed by name
+ * rather than by tag_id because a querytree can name a tag which
+ * doesn't exist yet, and must be invalidated when it's created.
+ * Triple tags are indexed by their namespace.
+ *
+ * @param qtree the querytree
+ * @return a GPtrArray of interned tag names
+ */
+static GPtrArray *tagsistant_querytree_dependencies(tagsistant_querytree *qtree)
+{
+	GPtrArray *tags = g_ptr_array_new();
+
+	tagsistant_querytree_add_dependency(tags, qtree->first_tag);
+	tagsistant_querytree_add_dependency(tags, qtree->second_tag);
+	tagsistant_querytree_add_dependency(tags, qtree->last_tag);
+	tagsistant_querytree_add_dependency(tags, qtree->namespace);
+	tagsistant_querytree_add_dependency(tags, qtree->related_namespace);
+
+	/* expanded aliases are tracked all together */
+	if (qtree->full_path && strstr(qtree->full_path, TAGSISTANT_ALIAS_IDENTIFIER))
+		tagsistant_querytree_add_dependency(tags, TAGSISTANT_ALIAS_IDENTIFIER);
+
+	if (QTREE_IS_STORE(qtree)) {
+		qtree_or_node *or = qtree->tree;
+		while (or) {
+			tagsistant_querytree_and_node_dependencies(tags, or->and_set);
+			tagsistant_querytree_and_node_dependencies(tags, or->negated_and_set);
+			or = or->next;
+		}
+	}
+
+	return (tags);
+}
+
+/**
+ * Link or unlink an entry in a dependency index. Must be
+ * called with tagsistant_querytree_cache_lock held.
+ *
+ * @param index the dependency index
+ * @param key the dependency (an interned tag name or an inode)
+ * @param entry the cache entry
+ * @param link TRUE to link the entry, FALSE to unlink it
+ */
+static void tagsistant_querytree_cache_index(GHashTable *index, gpointer key, tagsistant_querytree_cache_entry *entry, gboolean link)
+{
+	GHashTable *entries = g_hash_table_lookup(index, key);
+
+	if (link) {
+		if (!entries) {
+			entries = g_hash_table_new(NULL, NULL);
+			g_hash_table_insert(index, key, entries);
+		}
+		g_hash_table_add(entries, entry);
+	} else if (entries) {
+		g_hash_table_remove(entries, entry);
+		if (!g_hash_table_size(entries)) g_hash_table_remove(index, key);
+	}
 }
 
 /**
- * Duplicate a qtree_and_node branch
+ * Link or unlink an entry in both the dependency indexes. Must be
+ * called with tagsistant_querytree_cache_lock held.
  *
- * @param origin
- * @return
+ * @param entry the cache entry
+ * @param link TRUE to link the entry, FALSE to unlink it
  */
-qtree_and_node *tagsistant_querytree_duplicate_qtree_and_node(qtree_and_node *origin)
+static void tagsistant_querytree_cache_index_entry(tagsistant_querytree_cache_entry *entry, gboolean link)
 {
-	if (!origin) return (NULL);
+	guint i;
+	for (i = 0; i < entry->tags->len; i++)
+		tagsistant_querytree_cache_index(tagsistant_querytree_cache_by_tag, g_ptr_array_index(entry->tags, i), entry, link);
+
+	if (entry->qtree->inode)
+		tagsistant_querytree_cache_index(tagsistant_querytree_cache_by_inode, GUINT_TO_POINTER(entry->qtree->inode), entry, link);
+}
 
-	qtree_and_node *copy = g_new0(qtree_and_node, 1);
-	if (!copy) return (NULL);
+/**
+ * Estimate the memory used by a qtree_and_node branch
+ *
+ * @param and the branch
+ * @return the size in bytes
+ */
+static gsize tagsistant_querytree_and_node_size(qtree_and_node *and)
+{
+	gsize size = 0;
+
+	while (and) {
+		size += sizeof(qtree_and_node);
+		if (and->tag) size += strlen(and->tag) + 1;
+		if (and->namespace) size += strlen(and->namespace) + 1;
+		if (and->key) size += strlen(and->key) + 1;
+		if (and->value) size += strlen(and->value) + 1;
+		size += tagsistant_querytree_and_node_size(and->related);
+		and = and->next;
+	}
 
-	copy->negate 		= origin->negate;
-	copy->tag 			= g_strdup(origin->tag);
-	copy->tag_id 		= origin->tag_id;
-	copy->namespace 	= g_strdup(origin->namespace);
-	copy->key 			= g_strdup(origin->key);
-	copy->operator 		= origin->operator;
-	copy->value 		= g_strdup(origin->value);
+	return (size);
+}
 
-	copy->related 		= tagsistant_querytree_duplicate_qtree_and_node(origin->related);
-	copy->next			= tagsistant_querytree_duplicate_qtree_and_node(origin->next);
+/**
+ * Estimate the memory used by a querytree
+ *
+ * @param qtree the querytree
+ * @return the size in bytes
+ */
+static gsize tagsistant_querytree_size(tagsistant_querytree *qtree)
+{
+	gsize size = sizeof(tagsistant_querytree) + sizeof(tagsistant_querytree_cache_entry);
+
+	gchar *strings[] = {
+		qtree->full_path, qtree->expanded_full_path, qtree->object_path,
+		qtree->archive_path, qtree->full_archive_path, qtree->last_tag,
+		qtree->first_tag, qtree->second_tag, qtree->namespace, qtree->key,
+		qtree->value, qtree->related_namespace, qtree->related_key,
+		qtree->related_value, qtree->relation, qtree->stats_path,
+		qtree->alias, qtree->error_message
+	};
+
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS(strings); i++)
+		if (strings[i]) size += strlen(strings[i]) + 1;
+
+	qtree_or_node *or = qtree->tree;
+	while (or) {
+		size += sizeof(qtree_or_node);
+		size += tagsistant_querytree_and_node_size(or->and_set);
+		size += tagsistant_querytree_and_node_size(or->negated_and_set);
+		or = or->next;
+	}
 
-	return (copy);
+	return (size);
 }
 
 /**
- * Duplicate a qtree_or_node tree from a querytree
+ * Destroy a cache entry, unlinking it from its segment.
+ * Called by the hashtable when an entry is removed, so
+ * tagsistant_querytree_cache_lock is already held.
  *
- * @param origin
- * @return
+ * @param entry the entry to be destroyed
+ */
+static void tagsistant_querytree_cache_destroy_element(tagsistant_querytree_cache_entry *entry)
+{
+	g_queue_delete_link(
+		entry->protected ? &tagsistant_querytree_cache_protected : &tagsistant_querytree_cache_probation,
+		entry->link);
+
+	tagsistant_querytree_cache_index_entry(entry, FALSE);
+	g_ptr_array_free(entry->tags, TRUE);
+
+	tagsistant_querytree_cache_memory -= entry->size;
+	tagsistant_querytree_unref(entry->qtree);
+	g_free(entry);
+}
+
+/**
+ * Evict entries until the cache fits its limits. Must be called
+ * with tagsistant_querytree_cache_lock held.
  */
-qtree_or_node *tagsistant_querytree_duplicate_qtree_or_node(qtree_or_node *origin)
+static void tagsistant_querytree_cache_evict()
 {
-	if (!origin) return (NULL);
+	gsize max_memory = (gsize) tagsistant.qtree_cache_memory * 1024 * 1024;
 
-	qtree_or_node *copy = g_new0(qtree_or_node, 1);
-	if (!copy) return (NULL);
+	while (g_hash_table_size(tagsistant_querytree_cache) > (guint) tagsistant.qtree_cache_size ||
+		tagsistant_querytree_cache_memory > max_memory) {
 
-	copy->is_all_node = origin->is_all_node;
+		GQueue *segment = g_queue_is_empty(&tagsistant_querytree_cache_probation)
+			? &tagsistant_querytree_cache_protected
+			: &tagsistant_querytree_cache_probation;
 
-	copy->next = tagsistant_querytree_duplicate_qtree_or_node(origin->next);
-	copy->and_set = tagsistant_querytree_duplicate_qtree_and_node(origin->and_set);
-	copy->negated_and_set = tagsistant_querytree_duplicate_qtree_and_node(origin->negated_and_set);
+		tagsistant_querytree_cache_entry *victim = g_queue_peek_tail(segment);
+		if (!victim) break;
 
-	return (copy);
+		dbg('c', LOG_INFO, "Evicting querytree %s", victim->qtree->full_path);
+		g_hash_table_remove(tagsistant_querytree_cache, victim->qtree->full_path);
+		tagsistant_querytree_cache_evictions++;
+	}
 }
 
 /**
- * Duplicate a querytree, assigning a new connection
+ * Promote an entry to the head of the protected segment, demoting
+ * the protected tail to probation if the segment has grown beyond
+ * its share (80%) of the cache. Must be called with
+ * tagsistant_querytree_cache_lock held.
  *
- * @param qtree
- * @return
+ * @param entry the entry just hit
  */
-tagsistant_querytree *tagsistant_querytree_duplicate(tagsistant_querytree *qtree)
+static void tagsistant_querytree_cache_promote(tagsistant_querytree_cache_entry *entry)
 {
-	/*
-	 * create the duplicated querytree object
-	 */
-	tagsistant_querytree *duplicated = g_new0(tagsistant_querytree, 1);
-	if (!duplicated) return (NULL);
+	if (entry->protected) {
+		g_queue_unlink(&tagsistant_querytree_cache_protected, entry->link);
+		g_queue_push_head_link(&tagsistant_querytree_cache_protected, entry->link);
+		return;
+	}
 
-	/*
-	 * duplicate all the strings (->operator and ->related_operator
-	 * fields are not strings but we keep them here for completeness
-	 * since operators are part of triple tags with namespaces, keys
-	 * and values)
-	 */
-	duplicated->full_path			= g_strdup(qtree->full_path);
-	duplicated->expanded_full_path	= g_strdup(qtree->expanded_full_path);
-	duplicated->object_path			= g_strdup(qtree->object_path);
-	duplicated->archive_path		= g_strdup(qtree->archive_path);
-	duplicated->full_archive_path	= g_strdup(qtree->full_archive_path);
-	duplicated->last_tag			= g_strdup(qtree->last_tag);
-	duplicated->first_tag			= g_strdup(qtree->first_tag);
-	duplicated->second_tag			= g_strdup(qtree->second_tag);
-	duplicated->namespace			= g_strdup(qtree->namespace);
-	duplicated->key					= g_strdup(qtree->key);
-	duplicated->operator			= qtree->operator;
-	duplicated->value				= g_strdup(qtree->value);
-	duplicated->related_namespace	= g_strdup(qtree->related_namespace);
-	duplicated->related_key			= g_strdup(qtree->related_key);
-	duplicated->related_operator	= qtree->related_operator;
-	duplicated->related_value		= g_strdup(qtree->related_value);
-	duplicated->relation			= g_strdup(qtree->relation);
-	duplicated->stats_path			= g_strdup(qtree->stats_path);
-	duplicated->alias				= g_strdup(qtree->alias);
-	duplicated->error_message		= g_strdup(qtree->error_message);
+	g_queue_unlink(&tagsistant_querytree_cache_probation, entry->link);
+	g_queue_push_head_link(&tagsistant_querytree_cache_protected, entry->link);
+	entry->protected = TRUE;
 
-	/*
-	 * duplicate all the numeric fields
-	 */
-	duplicated->inode 						= qtree->inode;
-	duplicated->type						= qtree->type;
-	duplicated->points_to_object			= qtree->points_to_object;
-	duplicated->is_taggable					= qtree->is_taggable;
-	duplicated->is_external					= qtree->is_external;
-	duplicated->valid						= qtree->valid;
-	duplicated->complete					= qtree->complete;
-	duplicated->exists						= qtree->exists;
-	duplicated->transaction_started			= qtree->transaction_started;
-	duplicated->force_inode_in_filenames	= qtree->force_inode_in_filenames;
-	duplicated->negate_next_tag				= qtree->negate_next_tag;
-	duplicated->do_reasoning				= qtree->do_reasoning;
-	duplicated->schedule_for_unlink			= qtree->schedule_for_unlink;
+	guint protected_max = (guint) tagsistant.qtree_cache_size / 5 * 4;
+	if (g_queue_get_length(&tagsistant_querytree_cache_protected) > protected_max) {
+		GList *demoted = g_queue_pop_tail_link(&tagsistant_querytree_cache_protected);
+		((tagsistant_querytree_cache_entry *) demoted->data)->protected = FALSE;
+		g_queue_push_head_link(&tagsistant_querytree_cache_probation, demoted);
+	}
+}
 
-	/*
-	 * duplicate the tag tree
-	 */
-	duplicated->tree = tagsistant_querytree_duplicate_qtree_or_node(qtree->tree);
+/**
+ * Save a shared querytree in the cache, replacing an older copy if any.
+ * The cache takes ownership of one reference.
+ *
+ * @param qtree the shared querytree to be cached
+ */
+static void tagsistant_querytree_cache_insert(tagsistant_querytree *qtree)
+{
+	tagsistant_querytree_cache_entry *entry = g_new0(tagsistant_querytree_cache_entry, 1);
+	entry->qtree = qtree;
+	entry->size = tagsistant_querytree_size(qtree);
+	entry->link = g_list_alloc();
+	entry->link->data = entry;
+	entry->tags = tagsistant_querytree_dependencies(qtree);
 
-	/*
-	 * return the querytree
-	 */
-	return (duplicated);
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+
+	/* the old copy must leave its segment before the new one joins */
+	g_hash_table_remove(tagsistant_querytree_cache, qtree->full_path);
+
+	g_queue_push_head_link(&tagsistant_querytree_cache_probation, entry->link);
+	g_hash_table_insert(tagsistant_querytree_cache, qtree->full_path, entry);
+	tagsistant_querytree_cache_index_entry(entry, TRUE);
+	tagsistant_querytree_cache_memory += entry->size;
+
+	tagsistant_querytree_cache_evict();
+
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
+}
+
+/**
+ * Remove a path from the cache
+ *
+ * @param path the path of the querytree
+ */
+static void tagsistant_querytree_cache_remove(const gchar *path)
+{
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+	g_hash_table_remove(tagsistant_querytree_cache, path);
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
+}
+
+/**
+ * Count the elements contained in the querytree cache
+ */
+int tagsistant_querytree_cache_total()
+{
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+	int elements = g_hash_table_size(tagsistant_querytree_cache);
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
+
+	return (elements);
+}
+
+/**
+ * Print querytree cache statistics
+ *
+ * @param buffer the buffer to print into
+ * @param size the size of the buffer
+ */
+void tagsistant_querytree_cache_stats(gchar *buffer, size_t size)
+{
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+
+	snprintf(buffer, size,
+		"# of cached queries: %u (%u protected)\n"
+		"# of cache hits: %" G_GUINT64_FORMAT "\n"
+		"# of cache misses: %" G_GUINT64_FORMAT "\n"
+		"# of cache evictions: %" G_GUINT64_FORMAT "\n"
+		"# of cache invalidations: %" G_GUINT64_FORMAT "\n"
+		"cache memory: %lu/%d MB\n",
+		g_hash_table_size(tagsistant_querytree_cache),
+		g_queue_get_length(&tagsistant_querytree_cache_protected),
+		tagsistant_querytree_cache_hits,
+		tagsistant_querytree_cache_misses,
+		tagsistant_querytree_cache_evictions,
+		tagsistant_querytree_cache_invalidations,
+		(unsigned long) (tagsistant_querytree_cache_memory / (1024 * 1024)),
+		tagsistant.qtree_cache_memory);
+
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
 }
 
 /**
  * Lookup a querytree from the cache
  *
  * @param path the query path
- * @return a tagsistant_querytree duplicated object
+ * @return a tagsistant_querytree borrowing the cached one
  */
 tagsistant_querytree *tagsistant_querytree_lookup(const char *path)
 {
 	/*
-	 * lookup the querytree
+	 * lookup the querytree and borrow it while still holding
+	 * the lock, since the entry could be evicted right after
 	 */
 	tagsistant_querytree *qtree = NULL;
-	g_rw_lock_reader_lock(&tagsistant_querytree_cache_lock);
-	qtree = g_hash_table_lookup (tagsistant_querytree_cache, path);
-	g_rw_lock_reader_unlock(&tagsistant_querytree_cache_lock);
+
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+
+	tagsistant_querytree_cache_entry *entry = g_hash_table_lookup(tagsistant_querytree_cache, path);
+	if (entry) {
+		tagsistant_querytree_cache_promote(entry);
+		entry->qtree->last_access_microsecond = g_get_real_time();
+		qtree = tagsistant_querytree_borrow(entry->qtree);
+		tagsistant_querytree_cache_hits++;
+	} else {
+		tagsistant_querytree_cache_misses++;
+	}
+
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
 
 	/*
 	 * not found, return and proceed to normal creation
@@ -1493,104 +1924,155 @@ tagsistant_querytree *tagsistant_querytree_lookup(const char *path)
 	 */
 	struct stat st;
 	if (qtree->full_archive_path && (stat(qtree->full_archive_path, &st) isNot 0)) {
-		g_rw_lock_reader_lock(&tagsistant_querytree_cache_lock);
-		g_hash_table_remove(tagsistant_querytree_cache, path);
-		g_rw_lock_reader_unlock(&tagsistant_querytree_cache_lock);
-
+		tagsistant_querytree_cache_remove(path);
+		tagsistant_querytree_destroy(qtree, 0);
 		return (NULL);
 	}
 
-	/*
-	 * set the last_access_microsecond time
-	 * will be used in future code to decide if a cached entry
-	 * could be removed for memory management
-	 */
-	qtree->last_access_microsecond = g_get_real_time();
-
-	/*
-	 * return a duplicate of the qtree
-	 */
-	return (tagsistant_querytree_duplicate(qtree));
+	return (qtree);
 }
 
 /**
- * Return true if entry->full_path contains qtree->first_tag or qtree->second_tag
- * or both.
+ * Remove from the cache all the entries listed in a dependency
+ * index under a key. Must be called with
+ * tagsistant_querytree_cache_lock held.
  *
- * @param key unused
- * @param entry the querytree object from the cache being evaluated
- * @param qtree the querytree object invalidating the cache
- * @return TRUE if a match is found, FALSE otherwise
+ * @param index the dependency index
+ * @param key the dependency (an interned tag name or an inode)
  */
-gboolean tagsistant_invalidate_querytree_entry(gpointer key_p, gpointer entry_p, gpointer qtree_p)
+static void tagsistant_invalidate_querytree_dependency(GHashTable *index, gpointer key)
 {
-	(void) key_p;
-	(void) entry_p;
-	(void) qtree_p;
+	GHashTable *entries = g_hash_table_lookup(index, key);
+	if (!entries) return;
 
-	return (TRUE);
+	/*
+	 * removing an entry unlinks it from the index, so
+	 * the entries must be collected before the removal
+	 */
+	GList *dependents = g_hash_table_get_keys(entries);
+	GList *ptr = dependents;
+	while (ptr) {
+		tagsistant_querytree_cache_entry *entry = (tagsistant_querytree_cache_entry *) ptr->data;
+		dbg('c', LOG_INFO, "Invalidating querytree %s", entry->qtree->full_path);
+		g_hash_table_remove(tagsistant_querytree_cache, entry->qtree->full_path);
+		tagsistant_querytree_cache_invalidations++;
+		ptr = ptr->next;
+	}
 
-#if 0
-	tagsistant_querytree *entry = (tagsistant_querytree *) entry_p;
-	tagsistant_querytree *qtree = (tagsistant_querytree *) qtree_p;
+	g_list_free(dependents);
+}
 
-	gboolean matches = FALSE;
+/**
+ * Delete the cache entries which depend on a tag
+ *
+ * @param tag the tag name (or the namespace of a triple tag)
+ */
+void tagsistant_invalidate_querytree_cache_tag(const gchar *tag)
+{
+	if (!tag) return;
 
-	gchar *first_tag = g_strdup_printf("/%s/", qtree->first_tag);
-	gchar *second_tag = g_strdup_printf("/%s/", qtree->second_tag);
+	/* a tag never interned can't be a dependency of any entry */
+	const gchar *interned = g_intern_string(tag);
 
-	if (strstr(entry->full_path, first_tag) || strstr(entry->full_path, second_tag))
-		matches = TRUE;
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+	tagsistant_invalidate_querytree_dependency(tagsistant_querytree_cache_by_tag, (gpointer) interned);
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
+}
 
-	g_free_null(first_tag);
-	g_free_null(second_tag);
+/**
+ * Delete the cache entries which point to an object
+ *
+ * @param inode the object inode
+ */
+void tagsistant_invalidate_querytree_cache_inode(tagsistant_inode inode)
+{
+	if (!inode) return;
 
-	return (matches);
-#endif
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+	tagsistant_invalidate_querytree_dependency(tagsistant_querytree_cache_by_inode, GUINT_TO_POINTER(inode));
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
 }
 
 /**
- * Delete the cache entries which involve one of the tags qtree->first_tag
- * and qtree->second_tag
+ * Delete the cache entries which involve one of the tags named
+ * by a querytree or the object it points to
  *
  * @param qtree the querytree object which is invalidating the cache
  */
 void tagsistant_invalidate_querytree_cache(tagsistant_querytree *qtree)
 {
-	g_rw_lock_writer_lock(&tagsistant_querytree_cache_lock);
-	g_hash_table_foreach_remove(tagsistant_querytree_cache, tagsistant_invalidate_querytree_entry, qtree);
-	g_rw_lock_writer_unlock(&tagsistant_querytree_cache_lock);
+	GPtrArray *tags = tagsistant_querytree_dependencies(qtree);
+
+	g_mutex_lock(&tagsistant_querytree_cache_lock);
+
+	guint i;
+	for (i = 0; i < tags->len; i++)
+		tagsistant_invalidate_querytree_dependency(tagsistant_querytree_cache_by_tag, g_ptr_array_index(tags, i));
+
+	if (qtree->inode)
+		tagsistant_invalidate_querytree_dependency(tagsistant_querytree_cache_by_inode, GUINT_TO_POINTER(qtree->inode));
+
+	g_mutex_unlock(&tagsistant_querytree_cache_lock);
+
+	g_ptr_array_free(tags, TRUE);
 }
 
 #endif // TAGSISTANT_ENABLE_QUERYTREE_CACHE
 
 /**
- * Alias replacement callback
+ * Append a path to a GString, replacing each alias with the query
+ * it bookmarks. Aliases found inside the query are expanded too,
+ * unless they are already being expanded, which would be a cycle.
+ *
+ * @param result the GString receiving the expansion
+ * @param path the path to expand
+ * @param dbi the DBI connection used when the alias table is not loaded
+ * @param expanding the aliases being expanded by the outer calls
  */
-gboolean  tagsistant_expand_path_callback(
-	const GMatchInfo *match_info,
-    GString *result,
-    gpointer user_data)
+static void tagsistant_expand_path_append(GString *result, const gchar *path, dbi_conn dbi, GPtrArray *expanding)
 {
-	tagsistant_querytree *qtree = (tagsistant_querytree *) user_data;
-
-	// fetch the pattern
-	gchar *pattern = g_match_info_fetch(match_info, 0);
-
-	// the alias is the patter excluded the identifier (thus the + 1)
-	gchar *alias = pattern + 1;
+	const gchar *ptr = path;
+
+	while (*ptr) {
+		const gchar *alias_start = ptr + strlen(TAGSISTANT_ALIAS_IDENTIFIER);
+		const gchar *alias_end = alias_start;
+		while (*alias_end && *alias_end isNot '/') alias_end++;
+
+		/* not an alias: copy one character */
+		if (!g_str_has_prefix(ptr, TAGSISTANT_ALIAS_IDENTIFIER) || alias_end is alias_start) {
+			g_string_append_c(result, *ptr);
+			ptr++;
+			continue;
+		}
 
-	// load the expansion from the DB
-	gchar *alias_expansion = tagsistant_sql_alias_get(qtree->dbi, alias);
+		gchar *alias = g_strndup(alias_start, alias_end - alias_start);
 
-	// replace the alias
-	g_string_append(result, alias_expansion);
+		guint i;
+		gboolean is_cycle = FALSE;
+		for (i = 0; i < expanding->len; i++) {
+			if (strcmp(g_ptr_array_index(expanding, i), alias) is 0) {
+				is_cycle = TRUE;
+				break;
+			}
+		}
 
-	// free allocated memory
-	g_free(alias_expansion);
-	g_free(pattern);
+		if (is_cycle) {
+			dbg('q', LOG_ERR, "Alias %s%s includes itself, not expanding it again", TAGSISTANT_ALIAS_IDENTIFIER, alias);
+			g_string_append_len(result, ptr, alias_end - ptr);
+			g_free(alias);
+		} else {
+			gchar *alias_expansion = tagsistant_sql_alias_get(dbi, alias);
+			if (alias_expansion) {
+				g_ptr_array_add(expanding, alias);
+				tagsistant_expand_path_append(result, alias_expansion, dbi, expanding);
+				g_ptr_array_remove_index(expanding, expanding->len - 1);
+				g_free(alias_expansion);
+			}
+			g_free(alias);
+		}
 
-	return FALSE;
+		ptr = alias_end;
+	}
 }
 
 /**
@@ -1601,48 +2083,16 @@ gboolean  tagsistant_expand_path_callback(
  */
 gchar *tagsistant_expand_path(tagsistant_querytree *qtree)
 {
-	// duplicate the path to work on it
-	gchar *expanded_path = g_strdup(qtree->full_path);
-
-	// declare a regular expression to detect the aliases
-	GRegex *rx = g_regex_new(TAGSISTANT_ALIAS_IDENTIFIER "([^/]+)", 0, 0, NULL);
-
-	// apply the regular expression
-	GMatchInfo *match_info;
-	while (g_regex_match(rx, expanded_path, 0, &match_info)) {
-		// get the alias found in the path
-		gchar *pattern = g_match_info_fetch(match_info, 0);
-
-		// build the GRegex of the alias
-		GRegex *replace_rx = g_regex_new(pattern, 0, 0, NULL);
-
-		// expand the alias
-		gchar *replaced = g_regex_replace_eval(
-			replace_rx,
-			expanded_path,
-			-1, 0, 0,
-			tagsistant_expand_path_callback,
-			qtree,
-			NULL);
-
-		// update the expanded path
-		g_free(expanded_path);
-		expanded_path = replaced;
-
-		// free allocated memory
-		g_free(pattern);
-		g_regex_unref(replace_rx);
-	}
+	GString *expanded_path = g_string_sized_new(strlen(qtree->full_path) * 2);
+	GPtrArray *expanding = g_ptr_array_new();
 
-	// free allocated memory
-	g_match_info_free(match_info);
-	g_regex_unref(rx);
+	// expand the aliases in a single pass
+	tagsistant_expand_path_append(expanded_path, qtree->full_path, qtree->dbi, expanding);
+	g_ptr_array_free(expanding, TRUE);
 
 	// remove duplicated slashes
-	GRegex *slash_compressor = g_regex_new("/+", 0, 0, NULL);
-	gchar *simplified_path = g_regex_replace_literal(slash_compressor, expanded_path, -1, 0, "/", 0, NULL);
-	g_free(expanded_path);
-	g_regex_unref(slash_compressor);
+	gchar *simplified_path = tagsistant_path_compress_slashes(expanded_path->str);
+	g_string_free(expanded_path, TRUE);
 
 	// return the simplified path
 	return (simplified_path);
@@ -1677,6 +2127,29 @@ qtree_or_node *tagsistant_duplicate_tree(qtree_or_node *orig)
 	return (node);
 }
 
+/**
+ * Tie a querytree to a DBI connection
+ *
+ * @param qtree the querytree
+ * @param start_transaction do a "start transaction" on the DB connection
+ * @param provide_connection if true, create a DBI connection
+ * @param dbi a connection to borrow instead, NULL if none
+ */
+static void tagsistant_querytree_connect(tagsistant_querytree *qtree, int start_transaction, int provide_connection, dbi_conn dbi)
+{
+	if (dbi) {
+		qtree->dbi = dbi;
+		qtree->transaction_started = 0;
+		qtree->borrowed_dbi = TRUE;
+	} else if (provide_connection) {
+		qtree->dbi = tagsistant_db_connection(start_transaction);
+		qtree->transaction_started = start_transaction;
+		qtree->borrowed_dbi = FALSE;
+	} else {
+		qtree->dbi = NULL;
+	}
+}
+
 /**
  * Build query tree from path. A querytree is composed of a linked
  * list of qtree_or_node_t objects. Each or object has a descending
@@ -1691,14 +2164,16 @@ qtree_or_node *tagsistant_duplicate_tree(qtree_or_node *orig)
  * @param start_transaction   do a "start transaction" on the DB connection
  * @param provide_connection  if true, create a DBI connection
  * @param disable_reasoner    some FUSE operations do not get affected by the reasoner and can disable it
+ * @param dbi                 a connection to borrow instead of providing one, NULL if none
  * @return a tagsistant_querytree object
  */
-tagsistant_querytree *tagsistant_querytree_new(
+static tagsistant_querytree *tagsistant_querytree_build(
 	const char *path,
 	int assign_inode,
 	int start_transaction,
 	int provide_connection,
-	int disable_reasoner)
+	int disable_reasoner,
+	dbi_conn dbi)
 {
 	(void) assign_inode;
 
@@ -1710,16 +2185,17 @@ tagsistant_querytree *tagsistant_querytree_new(
 	 */
 	qtree = tagsistant_querytree_lookup(path);
 	if (qtree) {
-		if (provide_connection) {
-			/* assign a new connection */
-			qtree->dbi = tagsistant_db_connection(start_transaction);
-			qtree->transaction_started = start_transaction;
-		}
-
+		/* assign a new connection */
+		tagsistant_querytree_connect(qtree, start_transaction, provide_connection, dbi);
 		return (qtree);
 	}
 #endif
 
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	/* taken before reading the DB, to know if the result can be cached */
+	gint snapshot = tagsistant_db_snapshot();
+#endif
+
 	/*
 	 * the qtree object has not been found so lets allocate the querytree structure
 	 */
@@ -1749,12 +2225,7 @@ tagsistant_querytree *tagsistant_querytree_new(
 	/*
 	 * tie this query to a DBI handle
 	 */
-	if (provide_connection) {
-		qtree->dbi = tagsistant_db_connection(start_transaction);
-		qtree->transaction_started = start_transaction;
-	} else {
-		qtree->dbi = NULL;
-	}
+	tagsistant_querytree_connect(qtree, start_transaction, provide_connection, dbi);
 
 	/*
 	 * duplicate the path inside the struct
@@ -1762,9 +2233,9 @@ tagsistant_querytree *tagsistant_querytree_new(
 	qtree->full_path = g_strdup(path);
 
 	/*
-	 * expand the path, resolving aliases
+	 * expand the path, resolving aliases ("/@" also matches "/@@")
 	 */
-	if (g_regex_match_simple("/(" TAGSISTANT_QUERY_DELIMITER "|" TAGSISTANT_QUERY_DELIMITER_NO_REASONING ")", qtree->full_path, 0, 0)) {
+	if (strstr(qtree->full_path, "/" TAGSISTANT_QUERY_DELIMITER)) {
 		qtree->expanded_full_path = tagsistant_expand_path(qtree);
 	} else {
 		qtree->expanded_full_path = g_strdup(qtree->full_path);
@@ -1775,12 +2246,8 @@ tagsistant_querytree *tagsistant_querytree_new(
 	/*
 	 * split the path for parsing
 	 */
-	gchar **splitted = g_strsplit(qtree->expanded_full_path, "/", 512); /* split up to 512 tokens */
-	if (splitted is NULL) {
-		dbg('q', LOG_ERR, "Error parsing query path on %s", path);
-		tagsistant_querytree_destroy(qtree, TAGSISTANT_ROLLBACK_TRANSACTION);
-		return (NULL);
-	}
+	tagsistant_path_scanner scanner;
+	gchar **splitted = tagsistant_path_scan(&scanner, qtree->expanded_full_path);
 
 	/*
 	 * parse the path, skipping the first token which is
@@ -1856,7 +2323,7 @@ tagsistant_querytree *tagsistant_querytree_new(
 	}
 
 RETURN:
-	g_strfreev(splitted);
+	tagsistant_path_scanner_free(&scanner);
 
 	if (QTREE_IS_MALFORMED(qtree) && !qtree->error_message) {
 		qtree->error_message = g_strdup(TAGSISTANT_ERROR_MALFORMED_QUERY);
@@ -1866,19 +2333,44 @@ RETURN:
 	/*
 	 * cache the querytree object
 	 */
-	if ((!qtree->points_to_object) || qtree->inode) {
-		/* save the querytree in the cache */
-		tagsistant_querytree *duplicated = tagsistant_querytree_duplicate(qtree);
-
-		g_rw_lock_writer_lock(&tagsistant_querytree_cache_lock);
-		g_hash_table_insert(tagsistant_querytree_cache, duplicated->full_path, duplicated);
-		g_rw_lock_writer_unlock(&tagsistant_querytree_cache_lock);
+	if (((!qtree->points_to_object) || qtree->inode) && tagsistant_db_snapshot_is_current(snapshot) &&
+		!(qtree->borrowed_dbi && tagsistant_db_connection_is_writer(qtree->dbi))) {
+		/* save the querytree in the cache, sharing its parsed fields */
+		tagsistant_querytree_cache_insert(tagsistant_querytree_share(qtree));
 	}
 #endif
 
 	return(qtree);
 }
 
+/**
+ * Build query tree from path, see tagsistant_querytree_build()
+ */
+tagsistant_querytree *tagsistant_querytree_new(
+	const char *path,
+	int assign_inode,
+	int start_transaction,
+	int provide_connection,
+	int disable_reasoner)
+{
+	return (tagsistant_querytree_build(path, assign_inode, start_transaction, provide_connection, disable_reasoner, NULL));
+}
+
+/**
+ * Build query tree from path on the connection of another querytree,
+ * without checking out a second one. The connection is not released
+ * by tagsistant_querytree_destroy().
+ *
+ * @param path the path to be converted in a logical query
+ * @param dbi the connection to borrow
+ * @param disable_reasoner some FUSE operations do not get affected by the reasoner and can disable it
+ * @return a tagsistant_querytree object
+ */
+tagsistant_querytree *tagsistant_querytree_new_on_connection(const char *path, dbi_conn dbi, int disable_reasoner)
+{
+	return (tagsistant_querytree_build(path, 0, 0, 0, disable_reasoner, dbi));
+}
+
 /**
  * Quick macro to free a qtree_and_node object
  *
@@ -1896,34 +2388,49 @@ RETURN:
  * destroy a tagsistant_querytree_t structure
  *
  * @param qtree the tagsistant_querytree_t to be destroyed
+ * @param commit_transaction TAGSISTANT_COMMIT_TRANSACTION or TAGSISTANT_ROLLBACK_TRANSACTION
+ * @return FALSE if the transaction had to be committed but has been rolled back
  */
-void tagsistant_querytree_destroy(tagsistant_querytree *qtree, guint commit_transaction)
+gboolean tagsistant_querytree_destroy(tagsistant_querytree *qtree, guint commit_transaction)
 {
-	if (!qtree) return;
+	gboolean committed = TRUE;
+
+	if (!qtree) return (committed);
 
 	/* if scheduled for unlink, unlink it */
 	if (qtree->schedule_for_unlink)
 		unlink(qtree->full_archive_path);
 
 	/* commit the transaction, if any, and mark the connection as available */
-	if (qtree->dbi) {
+	if (qtree->dbi && !qtree->borrowed_dbi) {
 		if (qtree->transaction_started) {
 			if (commit_transaction)
-				tagsistant_commit_transaction(qtree->dbi);
+				committed = tagsistant_commit_transaction(qtree->dbi);
 			else
 				tagsistant_rollback_transaction(qtree->dbi);
 		}
 
-		tagsistant_db_connection_release(qtree->dbi, qtree->transaction_started);
+		/* a grouped operation is committed only with its batch */
+		if (!tagsistant_db_connection_release(qtree->dbi, qtree->transaction_started))
+			committed = FALSE;
 	}
 
 	/* free the paths */
-	g_free_null(qtree->full_path);
-	g_free_null(qtree->expanded_full_path);
-	g_free_null(qtree->object_path);
-	g_free_null(qtree->archive_path);
-	g_free_null(qtree->full_archive_path);
-	g_free_null(qtree->error_message);
+	tagsistant_querytree_free_field(qtree, full_path);
+	tagsistant_querytree_free_field(qtree, expanded_full_path);
+	tagsistant_querytree_free_field(qtree, object_path);
+	tagsistant_querytree_free_field(qtree, archive_path);
+	tagsistant_querytree_free_field(qtree, full_archive_path);
+	tagsistant_querytree_free_field(qtree, error_message);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	/* the tag tree and the other parsed fields belong to the shared querytree */
+	if (qtree->shared) {
+		tagsistant_querytree_unref(qtree->shared);
+		g_free_null(qtree);
+		return (committed);
+	}
+#endif
 
 	if (QTREE_IS_STORE(qtree)) {
 		qtree_or_node *node = qtree->tree;
@@ -1970,6 +2477,7 @@ void tagsistant_querytree_destroy(tagsistant_querytree *qtree, guint commit_tran
 
 	// free the structure
 	g_free_null(qtree);
+	return (committed);
 }
 
 extern void tagsistant_querytree_traverse(
@@ -2074,6 +2582,9 @@ void tagsistant_path_resolution_init()
 		g_str_equal,
 		NULL,
 		(GDestroyNotify) tagsistant_querytree_cache_destroy_element);
+
+	tagsistant_querytree_cache_by_tag = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) g_hash_table_destroy);
+	tagsistant_querytree_cache_by_inode = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) g_hash_table_destroy);
 #endif // TAGSISTANT_ENABLE_QUERYTREE_CACHE
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
@@ -2082,5 +2593,4 @@ void tagsistant_path_resolution_init()
 
 	/* compile regular expressions */
 	tagsistant_inode_extract_from_path_regex_1 = g_regex_new("^([0-9]+)" TAGSISTANT_INODE_DELIMITER, 0, 0, NULL);
-	tagsistant_inode_extract_from_path_regex_2 = g_regex_new("/([0-9]+)" TAGSISTANT_INODE_DELIMITER, 0, 0, NULL);
 }
@@ -41,14 +41,24 @@ enum {
 #define TAGSISTANT_SMALLER_THAN_OPERATOR "lt"
 
 /**
- * the regex used to check relations in the relations/ queries
+ * guess if a relation is admitted or not
  */
-#define TAGSISTANT_RELATION_PATTERN "^includes|excludes|is_equivalent|requires$"
+#define IS_VALID_RELATION(relation) tagsistant_is_valid_relation(relation)
 
 /**
- * guess if a relation is admitted or not
+ * the entries of the stats/ directory
  */
-#define IS_VALID_RELATION(relation) g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, relation, G_REGEX_EXTENDED, 0)
+typedef enum {
+	TAGSISTANT_STATS_NONE,				/**< not a stats/ entry */
+	TAGSISTANT_STATS_ROOT,				/**< the stats/ directory itself */
+	TAGSISTANT_STATS_CONNECTIONS,
+	TAGSISTANT_STATS_CACHED_QUERIES,
+	TAGSISTANT_STATS_CONFIGURATION,
+	TAGSISTANT_STATS_OBJECTS,
+	TAGSISTANT_STATS_RDS,
+	TAGSISTANT_STATS_RELATIONS,
+	TAGSISTANT_STATS_TAGS
+} tagsistant_stats_entry;
 
 /**
  * defines a token in a query path
@@ -285,9 +295,22 @@ typedef struct querytree {
 	/** record if a transaction has been opened on this connection */
 	int transaction_started;
 
+	/** the connection belongs to the caller and is not released */
+	gboolean borrowed_dbi;
+
 	/** last time the cached copy of this querytree has been accessed */
 	GTimeSpan last_access_microsecond;
 
+	/**
+	 * the cached querytree this one borrows its parsed fields from,
+	 * or NULL if it owns them. A borrowed field must never be changed
+	 * in place: it can only be replaced by an owned copy.
+	 */
+	struct querytree *shared;
+
+	/** references held on a cached querytree (the cache and each borrower) */
+	gint refcount;
+
 	/** do reasoning or not? */
 	int do_reasoning;
 
@@ -391,7 +414,8 @@ extern void						tagsistant_path_resolution_init();
 extern void						tagsistant_reasoner_init();
 
 extern tagsistant_querytree *	tagsistant_querytree_new(const char *path, int assign_inode, int start_transaction, int provide_connection, int disable_reasoner);
-extern void 					tagsistant_querytree_destroy(tagsistant_querytree *qtree, guint commit_transaction);
+extern tagsistant_querytree *	tagsistant_querytree_new_on_connection(const char *path, dbi_conn dbi, int disable_reasoner);
+extern gboolean				tagsistant_querytree_destroy(tagsistant_querytree *qtree, guint commit_transaction);
 
 extern void						tagsistant_querytree_set_object_path(tagsistant_querytree *qtree, char *new_object_path);
 extern void						tagsistant_querytree_set_inode(tagsistant_querytree *qtree, tagsistant_inode inode);
@@ -401,6 +425,7 @@ extern int						tagsistant_querytree_check_tagging_consistency(tagsistant_queryt
 
 extern int						tagsistant_querytree_deduplicate(tagsistant_querytree *qtree);
 extern int						tagsistant_querytree_cache_total();
+extern void						tagsistant_querytree_cache_stats(gchar *buffer, size_t size);
 
 extern gboolean 				tagsistant_querytree_includes_tag(tagsistant_querytree *qtree,
 									const gchar *tag,
@@ -415,13 +440,29 @@ extern gboolean 				tagsistant_querytree_negates_tag(tagsistant_querytree *qtree
 
 // caching functions
 extern void						tagsistant_invalidate_querytree_cache(tagsistant_querytree *qtree);
+extern void						tagsistant_invalidate_querytree_cache_tag(const gchar *tag);
+extern void						tagsistant_invalidate_querytree_cache_inode(tagsistant_inode inode);
 extern void						tagsistant_invalidate_and_set_cache_entries(tagsistant_querytree *qtree);
+extern void						tagsistant_invalidate_and_set_cache_inode(tagsistant_inode inode);
+extern void						tagsistant_invalidate_and_set_cache();
 
 // inode functions
+extern tagsistant_inode			tagsistant_guess_inode_from_and_set(qtree_and_node *and_set, qtree_and_node *negated_and_set,
+									dbi_conn dbi, const gchar *objectname, gboolean is_all_path);
 extern tagsistant_inode			tagsistant_inode_extract_from_path(const gchar *path);
 extern tagsistant_inode			tagsistant_inode_extract_from_querytree(tagsistant_querytree *qtree);
 extern gchar *					tagsistant_get_reversed_inode_tree(tagsistant_inode inode);
 
+// path classification functions
+extern gboolean					tagsistant_path_is_all(const gchar *path);
+extern gboolean					tagsistant_path_is_error(const gchar *path);
+extern gboolean					tagsistant_is_valid_relation(const gchar *relation);
+extern tagsistant_stats_entry	tagsistant_path_stats_entry(const gchar *path);
+extern gboolean					tagsistant_path_ends_with_operator(const gchar *path);
+extern gboolean					tagsistant_path_is_inside_tag_group(const gchar *path);
+extern tagsistant_inode			tagsistant_path_scan_inode(const gchar *path);
+extern gchar *					tagsistant_path_compress_slashes(const gchar *path);
+
 // reasoner functions
 #define 						tagsistant_reasoner(reasoning) tagsistant_reasoner_inner(reasoning, 1)
 extern int						tagsistant_reasoner_inner(tagsistant_reasoning *reasoning, int do_caching);
@@ -29,26 +29,90 @@
 /***                                                                              ***/
 /************************************************************************************/
 
-#define TAGSISTANT_RDS_HARD_CLEAN TRUE
+#define TAGSISTANT_RDS_HARD_CLEAN FALSE
 
 GRWLock tagsistant_rds_cache_rwlock;
 GHashTable *tagsistant_rds_cache = NULL;
 
 /**
- * add a file to the RDS (callback function)
+ * The reverse dependency index: each tag_id is mapped to the set of the
+ * checksums of the RDS that reference it in their and-sets, negated
+ * and-sets or reasoned related tags. RDS that can't be bound to a
+ * definite set of tags (ALL/ queries, non-equal triple tags) are kept
+ * in the volatile set and get dematerialized on every write.
  *
- * @param hash_table_pointer a GHashTable to hold results
- * @param result a DBI result
+ * Both tables are guarded by tagsistant_rds_dependencies_lock, which
+ * is never held while waiting on an RDS lock.
  */
-static int
-tagsistant_rds_materialize_entry(tagsistant_rds *rds, dbi_result result)
+GMutex tagsistant_rds_dependencies_lock;
+GHashTable *tagsistant_rds_dependencies = NULL;
+GHashTable *tagsistant_rds_volatile = NULL;
+
+/**
+ * A compact copy of a qtree_or_node, used to check if an object
+ * belongs to a materialized RDS without querying the database.
+ * An object matches if it's tagged by at least one tag_id of
+ * each and_group and by none of the negated tag_ids.
+ */
+typedef struct {
+	/** a GList of GLists of tag_ids: each tag with its related tags */
+	GList *and_groups;
+
+	/** a GList of the negated tag_ids, related tags included */
+	GList *negated;
+} tagsistant_rds_or_node;
+
+/**
+ * RDS garbage collector accounting. The totals are guarded by
+ * tagsistant_rds_stats_lock. The CLOCK ring and its hand are
+ * guarded by tagsistant_rds_cache_rwlock (write locked).
+ */
+GMutex tagsistant_rds_stats_lock;
+gint64 tagsistant_rds_total_tuples = 0;
+gint64 tagsistant_rds_total_bytes = 0;
+gint64 tagsistant_rds_materializations = 0;
+gint64 tagsistant_rds_evictions = 0;
+gint64 tagsistant_rds_destructions = 0;
+gint64 tagsistant_rds_derivations = 0;
+
+GList *tagsistant_rds_clock = NULL;
+GList *tagsistant_rds_clock_hand = NULL;
+
+/** estimated memory footprint of an entry name (the string and the hash table node) */
+#define TAGSISTANT_RDS_NAME_SIZE(name) (strlen(name) + 1 + 4 * sizeof(gpointer))
+
+/** estimated memory footprint of an inode listed under an entry name */
+#define TAGSISTANT_RDS_INODE_SIZE sizeof(GList)
+
+/**
+ * Account tuples and bytes added to (or removed from, if negative) an RDS
+ *
+ * @param rds the RDS
+ * @param tuples the number of tuples
+ * @param bytes the number of bytes
+ */
+static void
+tagsistant_rds_account(tagsistant_rds *rds, gint64 tuples, gint64 bytes)
 {
-	/*
-	 * fetch query results
-	 */
-	tagsistant_inode inode = dbi_result_get_uint_idx(result, 1);
-	gchar *name = dbi_result_get_string_copy_idx(result, 2);
+	rds->tuples += tuples;
+	rds->bytes += bytes;
+
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	tagsistant_rds_total_tuples += tuples;
+	tagsistant_rds_total_bytes += bytes;
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
+}
 
+/**
+ * add a file to the RDS while materializing it
+ *
+ * @param rds the RDS
+ * @param inode the object inode
+ * @param name the object name, which is owned by the RDS afterwards
+ */
+static void
+tagsistant_rds_materialize_object(tagsistant_rds *rds, tagsistant_inode inode, gchar *name)
+{
 	dbg('R', LOG_INFO, "adding (%d,%s) to RDS %s", inode, name, rds->checksum);
 
 	/*
@@ -56,18 +120,59 @@ tagsistant_rds_materialize_entry(tagsistant_rds *rds, dbi_result result)
 	 * than once with different inodes, the value of hash_table keys
 	 * is a GList that holds different inodes
 	 */
-	GList *list = (GList *) (rds->entries ? g_hash_table_lookup(rds->entries, name) : NULL);
-	list = g_list_prepend(list, GUINT_TO_POINTER(inode));
+	gpointer key = NULL, value = NULL;
+	if (g_hash_table_lookup_extended(rds->entries, name, &key, &value)) {
+		g_free(name);
+		name = (gchar *) key;
+	} else {
+		rds->bytes += TAGSISTANT_RDS_NAME_SIZE(name);
+	}
+
+	GList *list = g_list_prepend((GList *) value, GUINT_TO_POINTER(inode));
 	dbg('R', LOG_INFO, "Adding inode %d, list holds %d elements", inode, g_list_length(list));
 
+	rds->tuples++;
+	rds->bytes += TAGSISTANT_RDS_INODE_SIZE;
+
 	/*
 	 * save the new start of the GList inside the hash table
 	 */
-	g_hash_table_insert(rds->entries, g_strdup(name), list);
+	g_hash_table_insert(rds->entries, name, list);
+}
+
+/**
+ * add a file to the RDS (callback function)
+ *
+ * @param hash_table_pointer a GHashTable to hold results
+ * @param result a DBI result
+ */
+static int
+tagsistant_rds_materialize_entry(tagsistant_rds *rds, dbi_result result)
+{
+	/*
+	 * fetch query results
+	 */
+	tagsistant_inode inode = tagsistant_result_get_uint(result, 1);
+	gchar *name = tagsistant_result_get_string_copy(result, 2);
+
+	tagsistant_rds_materialize_object(rds, inode, name);
 
 	return (0);
 }
 
+/**
+ * add a file to the RDS (tag index callback)
+ *
+ * @param rds the RDS
+ * @param inode the object inode
+ * @param name the object name
+ */
+static void
+tagsistant_rds_materialize_indexed_entry(tagsistant_rds *rds, tagsistant_inode inode, const gchar *name)
+{
+	tagsistant_rds_materialize_object(rds, inode, g_strdup(name));
+}
+
 /**
  * To be called once inside a g_hash_table_foreach()
  * after RDS materializing, removes duplicated entries
@@ -129,7 +234,182 @@ gchar *tagsistant_rds_path(tagsistant_querytree *qtree)
 }
 
 /**
- * Compute the checksum identifying a RDS
+ * Insert a string in a sorted GList of strings, unless already there.
+ * The string is freed if it's a duplicate.
+ *
+ * @param list the sorted GList
+ * @param term the string to insert
+ * @return the new start of the GList
+ */
+static GList *
+tagsistant_rds_canonical_insert(GList *list, gchar *term)
+{
+	GList *ptr = list;
+	while (ptr) {
+		int cmp = strcmp(ptr->data, term);
+		if (cmp is 0) {
+			g_free(term);
+			return (list);
+		}
+		if (cmp > 0) break;
+		ptr = ptr->next;
+	}
+
+	if (ptr) return (g_list_insert_before(list, ptr, term));
+	return (g_list_append(list, term));
+}
+
+/**
+ * Join a sorted GList of strings, freeing it
+ *
+ * @param list the GList
+ * @param open the opening delimiter
+ * @param separator the separator
+ * @param close the closing delimiter
+ * @return the joined string
+ */
+static gchar *
+tagsistant_rds_canonical_join(GList *list, const gchar *open, const gchar *separator, const gchar *close)
+{
+	GString *joined = g_string_new(open);
+
+	GList *ptr = list;
+	while (ptr) {
+		g_string_append(joined, (gchar *) ptr->data);
+		if (ptr->next) g_string_append(joined, separator);
+		ptr = ptr->next;
+	}
+	g_string_append(joined, close);
+
+	g_list_free_full(list, g_free);
+	return (g_string_free(joined, FALSE));
+}
+
+/**
+ * Return the canonical form of a single tag. Strings are length
+ * prefixed, so no tag name can be mistaken for a delimiter.
+ * Operators are normalized: a triple tag with no value or with no
+ * recognized operator is matched by equality.
+ *
+ * @param and the qtree_and_node
+ * @return the canonical form
+ */
+static gchar *
+tagsistant_rds_canonical_tag(qtree_and_node *and)
+{
+	unless (and->namespace) {
+		return (g_strdup_printf("%zu:%s", strlen(_safe_string(and->tag)), _safe_string(and->tag)));
+	}
+
+	const gchar *key = _safe_string(and->key);
+	const gchar *value = _safe_string(and->value);
+	const gchar *operator = TAGSISTANT_EQUALS_TO_OPERATOR;
+
+	if (strlen(value)) {
+		switch (and->operator) {
+			case TAGSISTANT_CONTAINS:
+				operator = TAGSISTANT_CONTAINS_OPERATOR;
+				break;
+			case TAGSISTANT_GREATER_THAN:
+				operator = TAGSISTANT_GREATER_THAN_OPERATOR;
+				break;
+			case TAGSISTANT_SMALLER_THAN:
+				operator = TAGSISTANT_SMALLER_THAN_OPERATOR;
+				break;
+		}
+	}
+
+	return (g_strdup_printf("%zu:%s%zu:%s%s%zu:%s",
+		strlen(and->namespace), and->namespace,
+		strlen(key), key,
+		operator,
+		strlen(value), value));
+}
+
+/**
+ * Return the canonical form of a tag and its related tags (a tag
+ * group, or the tags added by the reasoner): the sorted set of their
+ * canonical forms
+ *
+ * @param and the qtree_and_node
+ * @return the canonical form
+ */
+static gchar *
+tagsistant_rds_canonical_and_node(qtree_and_node *and)
+{
+	GList *terms = NULL;
+
+	qtree_and_node *related = and;
+	while (related) {
+		terms = tagsistant_rds_canonical_insert(terms, tagsistant_rds_canonical_tag(related));
+		related = related->related;
+	}
+
+	return (tagsistant_rds_canonical_join(terms, "{", ",", "}"));
+}
+
+/**
+ * Return the canonical form of a query tree. And-sets and negated
+ * sets are sorted and deduplicated, the OR nodes are sorted and
+ * deduplicated too, and OR nodes with no tags (which are skipped
+ * by the materialization) are dropped. The and-set of an OR node
+ * containing ALL/ is ignored as the materialization does.
+ *
+ * Equivalent paths like store/a/b/@, store/b/a/@ and store/a/b/b/@
+ * share the same canonical form.
+ *
+ * @param qtree the tagsistant_querytree object
+ * @return the canonical form, NULL if the querytree has no query tree
+ */
+gchar *tagsistant_rds_canonical_query(tagsistant_querytree *qtree)
+{
+	unless (qtree->tree) return (NULL);
+
+	GList *or_terms = NULL;
+
+	qtree_or_node *query = qtree->tree;
+	while (query) {
+		if (query->is_all_node || query->and_set) {
+			GList *and_terms = NULL, *negated_terms = NULL;
+
+			if (query->is_all_node) {
+				and_terms = g_list_append(and_terms, g_strdup("ALL"));
+			} else {
+				qtree_and_node *and = query->and_set;
+				while (and) {
+					and_terms = tagsistant_rds_canonical_insert(and_terms, tagsistant_rds_canonical_and_node(and));
+					and = and->next;
+				}
+			}
+
+			qtree_and_node *negated = query->negated_and_set;
+			while (negated) {
+				negated_terms = tagsistant_rds_canonical_insert(negated_terms, tagsistant_rds_canonical_and_node(negated));
+				negated = negated->next;
+			}
+
+			gchar *and_term = tagsistant_rds_canonical_join(and_terms, "", "/", "");
+			gchar *negated_term = tagsistant_rds_canonical_join(negated_terms, "", "/", "");
+			or_terms = tagsistant_rds_canonical_insert(or_terms, g_strdup_printf("%s/-/%s", and_term, negated_term));
+			g_free(and_term);
+			g_free(negated_term);
+		}
+
+		query = query->next;
+	}
+
+	/*
+	 * the delimiter tells if the query is reasoned or not
+	 */
+	return (tagsistant_rds_canonical_join(or_terms,
+		qtree->do_reasoning ? TAGSISTANT_QUERY_DELIMITER "/" : TAGSISTANT_QUERY_DELIMITER_NO_REASONING "/",
+		"/" TAGSISTANT_ANDSET_DELIMITER "/", ""));
+}
+
+/**
+ * Compute the checksum identifying a RDS. The checksum is computed
+ * on the canonical form of the query, so equivalent paths share the
+ * same RDS.
  *
  * @param qtree the tagsistant_querytree object
  * @return a string containing the checksum
@@ -137,9 +417,12 @@ gchar *tagsistant_rds_path(tagsistant_querytree *qtree)
 gchar *tagsistant_get_rds_checksum(tagsistant_querytree *qtree)
 {
 	/*
-	 * Extract the path to be looked up
+	 * Extract the query to be looked up
 	 */
-	gchar *path = tagsistant_rds_path(qtree);
+	gchar *path = tagsistant_rds_canonical_query(qtree);
+	unless (path) path = tagsistant_rds_path(qtree);
+
+	dbg('R', LOG_INFO, "RDS canonical query: %s", path);
 
 	/*
 	 * compute the checksum
@@ -210,32 +493,37 @@ void tagsistant_rds_materialize_add_and_set(GString *statement, qtree_and_node *
 	 * now add the main part
 	 */
 	if (and_set->value && strlen(and_set->value)) {
+		/*
+		 * the statement is run as is, so the strings must be escaped here
+		 */
+		gchar *namespace = tagsistant_sql_escape(and_set->namespace);
+		gchar *key = tagsistant_sql_escape(and_set->key);
+		gchar *value = tagsistant_sql_escape(and_set->value);
+
 		switch (and_set->operator) {
 			case TAGSISTANT_EQUAL_TO:
 				tagsistant_rds_materialize_add_equal_and_set(statement, and_set, tname);
 				break;
 			case TAGSISTANT_CONTAINS:
 				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value like '%%%s%%' ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
+					"tagname = '%s' and `key` = '%s' and value like '%%%s%%' ",
+					namespace, key, value);
 				break;
 			case TAGSISTANT_GREATER_THAN:
 				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value > \"%s\" ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
+					"tagname = '%s' and `key` = '%s' and value > '%s' ",
+					namespace, key, value);
 				break;
 			case TAGSISTANT_SMALLER_THAN:
 				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value < \"%s\" ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
+					"tagname = '%s' and `key` = '%s' and value < '%s' ",
+					namespace, key, value);
 				break;
 		}
+
+		g_free(namespace);
+		g_free(key);
+		g_free(value);
 	} else if (and_set->tag || and_set->tag_id) {
 		tagsistant_rds_materialize_add_equal_and_set(statement, and_set, tname);
 	} else {
@@ -343,30 +631,157 @@ void tagsistant_rds_materialize_or_node(
 	/*
 	 * create the table and dispose the statement GString
 	 */
-	tagsistant_query(create_base_table->str, qtree->dbi, NULL, NULL);
+	tagsistant_raw_query(create_base_table->str, qtree->dbi, NULL, NULL);
 	g_string_free(create_base_table, TRUE);
 }
 
 /**
- * Materialize the RDS of a query
+ * Remove an RDS from the reverse dependency index
  *
- * @param qtree the querytree object
- * @return the RDS checksum id
+ * @param rds the RDS to be unregistered
  */
-gboolean
-tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree)
+static void
+tagsistant_rds_unregister_dependencies(tagsistant_rds *rds)
+{
+	g_mutex_lock(&tagsistant_rds_dependencies_lock);
+
+	GList *ptr = rds->dependencies;
+	while (ptr) {
+		GHashTable *dependents = g_hash_table_lookup(tagsistant_rds_dependencies, ptr->data);
+		if (dependents) {
+			g_hash_table_remove(dependents, rds->checksum);
+			if (g_hash_table_size(dependents) is 0)
+				g_hash_table_remove(tagsistant_rds_dependencies, ptr->data);
+		}
+		ptr = ptr->next;
+	}
+
+	g_hash_table_remove(tagsistant_rds_volatile, rds->checksum);
+
+	g_mutex_unlock(&tagsistant_rds_dependencies_lock);
+
+	g_list_free(rds->dependencies);
+	rds->dependencies = NULL;
+	rds->is_volatile = FALSE;
+
+	GList *or_ptr = rds->or_nodes;
+	while (or_ptr) {
+		tagsistant_rds_or_node *or_node = (tagsistant_rds_or_node *) or_ptr->data;
+		g_list_free_full(or_node->and_groups, (GDestroyNotify) g_list_free);
+		g_list_free(or_node->negated);
+		g_free(or_node);
+		or_ptr = or_ptr->next;
+	}
+	g_list_free(rds->or_nodes);
+	rds->or_nodes = NULL;
+}
+
+/**
+ * Record that an RDS depends on a tag and on all its related tags
+ *
+ * @param rds the RDS
+ * @param and the qtree_and_node to be recorded
+ * @param tag_ids if not NULL, the tag_ids are prepended to this GList too
+ */
+static void
+tagsistant_rds_register_and_node(tagsistant_rds *rds, qtree_and_node *and, GList **tag_ids)
 {
 	/*
-	 * Declare the entries hash table
+	 * triple tags matched by an operator other than equal (or not
+	 * matched at all) can't be bound to a single tag_id
 	 */
-	rds->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	if (and->namespace && (!and->value || and->operator isNot TAGSISTANT_EQUAL_TO))
+		rds->is_volatile = TRUE;
 
-	if (!rds->entries) {
-		dbg('R', LOG_ERR, "Error allocating RDS entries");
-		return (FALSE);
+	/*
+	 * tags not yet existing are registered as tag_id 0, so that
+	 * creating or renaming any tag will dematerialize them
+	 */
+	qtree_and_node *related = and;
+	while (related) {
+		gpointer tag_id = GUINT_TO_POINTER(related->tag_id);
+
+		GHashTable *dependents = g_hash_table_lookup(tagsistant_rds_dependencies, tag_id);
+		if (!dependents) {
+			dependents = g_hash_table_new(g_str_hash, g_str_equal);
+			g_hash_table_insert(tagsistant_rds_dependencies, tag_id, dependents);
+		}
+
+		unless (g_hash_table_contains(dependents, rds->checksum)) {
+			g_hash_table_add(dependents, rds->checksum);
+			rds->dependencies = g_list_prepend(rds->dependencies, tag_id);
+		}
+
+		if (tag_ids) *tag_ids = g_list_prepend(*tag_ids, tag_id);
+
+		related = related->related;
+	}
+}
+
+/**
+ * Register an RDS in the reverse dependency index. Called on each
+ * materialization since the reasoner can add or remove related tags
+ * between two materializations of the same query.
+ *
+ * @param rds the RDS to be registered
+ * @param qtree the tagsistant_querytree the RDS is materialized from
+ */
+static void
+tagsistant_rds_register_dependencies(tagsistant_rds *rds, tagsistant_querytree *qtree)
+{
+	tagsistant_rds_unregister_dependencies(rds);
+
+	g_mutex_lock(&tagsistant_rds_dependencies_lock);
+
+	if (rds->is_all_path) rds->is_volatile = TRUE;
+
+	qtree_or_node *query = qtree->tree;
+	while (query) {
+		/*
+		 * OR nodes with no tags are skipped by the materialization
+		 */
+		unless (query->is_all_node || query->and_set) {
+			query = query->next;
+			continue;
+		}
+
+		if (query->is_all_node) rds->is_volatile = TRUE;
+
+		tagsistant_rds_or_node *or_node = g_new0(tagsistant_rds_or_node, 1);
+
+		qtree_and_node *and = query->and_set;
+		while (and) {
+			GList *and_group = NULL;
+			tagsistant_rds_register_and_node(rds, and, &and_group);
+			or_node->and_groups = g_list_prepend(or_node->and_groups, and_group);
+			and = and->next;
+		}
+
+		and = query->negated_and_set;
+		while (and) {
+			tagsistant_rds_register_and_node(rds, and, &or_node->negated);
+			and = and->next;
+		}
+
+		rds->or_nodes = g_list_prepend(rds->or_nodes, or_node);
+		query = query->next;
 	}
-	g_hash_table_ref(rds->entries);
 
+	if (rds->is_volatile) g_hash_table_add(tagsistant_rds_volatile, rds->checksum);
+
+	g_mutex_unlock(&tagsistant_rds_dependencies_lock);
+}
+
+/**
+ * Materialize the RDS of a query building one temporary table per
+ * OR node, then reading them back with a UNION and dropping them.
+ *
+ * @param rds the RDS to be filled
+ * @param qtree the querytree object
+ */
+static void
+tagsistant_rds_materialize_with_tables(tagsistant_rds *rds, tagsistant_querytree *qtree)
+{
 	/*
 	 * PHASE 1.
 	 * Build a set of temporary tables containing all the matched objects
@@ -411,7 +826,7 @@ tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree)
 	/*
 	 * Load all the files in the RDS
 	 */
-	tagsistant_query(view_statement->str, qtree->dbi,
+	tagsistant_raw_query(view_statement->str, qtree->dbi,
 		(tagsistant_query_callback) tagsistant_rds_materialize_entry, rds);
 
 	g_string_free(view_statement, TRUE);
@@ -431,345 +846,1608 @@ tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree)
 		tagsistant_query("drop table tv%.16" PRIxPTR, qtree->dbi, NULL, NULL, (uintptr_t) query);
 		query = query->next;
 	}
-
-	return (TRUE);
 }
 
 /**
- * Returns TRUE if the ->name field of the tagsistant_rds_entry
- * passed as value equals the check name passed as user_data
+ * Add a qtree_and_node struct to a set-oriented statement as a subquery
+ * returning the inodes tagged by the node (or by one of its related tags).
  *
- * @param key unused
- * @param value a gpointer to a tagsistant_rds_entry struct
- * @param user_data a gpointer to a string with the name to match
+ * @param statement the GString object with the under-construction query
+ * @param and_set the qtree_and_node to add
  */
-gboolean
-tagsistant_rds_contains_object(gpointer key, gpointer value, gpointer user_data)
+static void
+tagsistant_rds_setops_add_and_node(GString *statement, qtree_and_node *and_set)
 {
-	(void) key;
+	if (and_set->value && strlen(and_set->value) && and_set->operator isNot TAGSISTANT_EQUAL_TO) {
+		gchar *namespace = tagsistant_sql_escape(and_set->namespace);
+		gchar *key = tagsistant_sql_escape(and_set->key);
+		gchar *value = tagsistant_sql_escape(and_set->value);
 
-	tagsistant_rds_entry *e = (tagsistant_rds_entry *) value;
-	gchar *match_name = (gchar *) user_data;
+		g_string_append_printf(statement,
+			"select inode from full_tagging where tagname = '%s' and `key` = '%s' and ",
+			namespace, key);
 
-	if (e is NULL || e->name is NULL) return (FALSE);
-	return (strcmp(e->name, match_name) is 0 ? TRUE : FALSE);
+		switch (and_set->operator) {
+			case TAGSISTANT_CONTAINS:
+				g_string_append_printf(statement, "value like '%%%s%%'", value);
+				break;
+			case TAGSISTANT_GREATER_THAN:
+				g_string_append_printf(statement, "value > '%s'", value);
+				break;
+			case TAGSISTANT_SMALLER_THAN:
+				g_string_append_printf(statement, "value < '%s'", value);
+				break;
+			default:
+				g_string_append(statement, "true");
+				break;
+		}
+
+		g_free(namespace);
+		g_free(key);
+		g_free(value);
+	} else if (and_set->tag || and_set->tag_id || and_set->value) {
+		g_string_append_printf(statement, "select inode from tagging where tag_id in (%d", and_set->tag_id);
+		qtree_and_node *related = and_set->related;
+		while (related) {
+			g_string_append_printf(statement, ", %d", related->tag_id);
+			related = related->related;
+		}
+		g_string_append(statement, ")");
+	} else {
+		dbg('R', LOG_ERR, "Invalid tag with no value and no tag_id");
+		g_string_append(statement, "select inode from objects");
+	}
 }
 
 /**
- * Add an RDS to the cache
+ * Add the negated tags of an OR node to a set-oriented statement as
+ * a list of tag_ids, related tags included.
  *
- * @param rds the RDS to be cached
+ * @param statement the GString object with the under-construction query
+ * @param negated the first negated qtree_and_node
  */
-void tagsistant_rds_add_to_cache(tagsistant_rds *rds)
+static void
+tagsistant_rds_setops_add_negated_tags(GString *statement, qtree_and_node *negated)
 {
-	g_rw_lock_writer_lock(&tagsistant_rds_cache_rwlock);
-	g_hash_table_insert(tagsistant_rds_cache, g_strdup(rds->checksum), rds);
-	g_rw_lock_writer_unlock(&tagsistant_rds_cache_rwlock);
+	g_string_append_printf(statement, "select inode from tagging where tag_id in (%d", negated->tag_id);
+
+	qtree_and_node *next = negated;
+	while (next) {
+		qtree_and_node *related = next;
+		while (related) {
+			g_string_append_printf(statement, ", %d", related->tag_id);
+			related = related->related;
+		}
+		next = next->next;
+	}
+
+	g_string_append(statement, ")");
 }
 
 /**
- * Lookup and RDS into the cache
+ * Add an OR node to a set-oriented statement. If the backend provides
+ * INTERSECT and EXCEPT (SQLite), the node is translated as:
  *
- * @param checksum the RDS checksum
+ *   select o.inode, o.objectname from objects o where o.inode in (
+ *       select inode from tagging where tag_id in (t1, t11)
+ *       intersect
+ *       select inode from tagging where tag_id in (t2)
+ *       except
+ *       select inode from tagging where tag_id in (t4, t5, t51)
+ *   )
+ *
+ * otherwise (MySQL) the and-set is translated as a chain of joins on
+ * the tagging table, as tagsistant_rds_materialize_or_node() does
+ * but without creating a temporary table.
+ *
+ * @param statement the GString object with the under-construction query
+ * @param query the qtree_or_node to add
  */
-tagsistant_rds *tagsistant_rds_lookup_in_cache(gchar *checksum)
+static void
+tagsistant_rds_setops_add_or_node(GString *statement, qtree_or_node *query)
 {
-	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
-	tagsistant_rds *rds = g_hash_table_lookup(tagsistant_rds_cache, checksum);
-	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+	if (tagsistant.sql_backend_have_intersect) {
+		g_string_append(statement, "select o.inode, o.objectname from objects o");
+
+		if (query->is_all_node) {
+			if (query->negated_and_set) {
+				g_string_append(statement, " where o.inode not in (");
+				tagsistant_rds_setops_add_negated_tags(statement, query->negated_and_set);
+				g_string_append(statement, ")");
+			}
+			return;
+		}
 
-	return (rds);
-}
+		g_string_append(statement, " where o.inode in (");
 
-void
+		qtree_and_node *and = query->and_set;
+		while (and) {
+			tagsistant_rds_setops_add_and_node(statement, and);
+			if (and->next) g_string_append(statement, " intersect ");
+			and = and->next;
+		}
+
+		if (query->negated_and_set) {
+			g_string_append(statement, " except ");
+			tagsistant_rds_setops_add_negated_tags(statement, query->negated_and_set);
+		}
+
+		g_string_append(statement, ")");
+	} else {
+		g_string_append(statement,
+			"select distinct o.inode as inode, o.objectname as objectname from objects o ");
+
+		unless (query->is_all_node) {
+			qtree_and_node *and = query->and_set;
+			while (and) {
+				tagsistant_rds_materialize_add_and_set(statement, and);
+				and = and->next;
+			}
+		}
+
+		tagsistant_rds_materialize_add_negated_and_set(statement, query->negated_and_set);
+	}
+}
+
+/**
+ * Materialize the RDS of a query with a single set-oriented statement,
+ * the UNION of one select per OR node, streaming the rows directly
+ * into the RDS entries. No temporary table is created.
+ *
+ * @param rds the RDS to be filled
+ * @param qtree the querytree object
+ */
+static void
+tagsistant_rds_materialize_with_setops(tagsistant_rds *rds, tagsistant_querytree *qtree)
+{
+	GString *statement = g_string_sized_new(10240);
+
+	qtree_or_node *query = qtree->tree;
+	while (query) {
+		/*
+		 * skip OR nodes with no tags
+		 */
+		if (query->is_all_node || query->and_set) {
+			if (statement->len) g_string_append(statement, " union ");
+			tagsistant_rds_setops_add_or_node(statement, query);
+		}
+		query = query->next;
+	}
+
+	if (statement->len)
+		tagsistant_raw_query(statement->str, qtree->dbi,
+			(tagsistant_query_callback) tagsistant_rds_materialize_entry, rds);
+
+	g_string_free(statement, TRUE);
+}
+
+/**
+ * Compare two inodes (GCompareFunc)
+ */
+static gint
+tagsistant_rds_inode_compare(const tagsistant_inode *a, const tagsistant_inode *b)
+{
+	return ((*a < *b) ? -1 : ((*a > *b) ? 1 : 0));
+}
+
+/**
+ * Append a comma separated GList of tag_ids to a statement
+ *
+ * @param statement the GString object with the under-construction query
+ * @param tag_ids the GList of tag_ids
+ */
+static void
+tagsistant_rds_append_tag_ids(GString *statement, GList *tag_ids)
+{
+	GList *ptr = tag_ids;
+	while (ptr) {
+		g_string_append_printf(statement, ptr is tag_ids ? "%u" : ", %u", GPOINTER_TO_UINT(ptr->data));
+		ptr = ptr->next;
+	}
+}
+
+/**
+ * Check if a GList of tag_ids contains another one
+ *
+ * @param list the GList to search in
+ * @param sublist the GList to be searched
+ * @return TRUE if each tag_id of sublist is in list
+ */
+static gboolean
+tagsistant_rds_tag_ids_contain(GList *list, GList *sublist)
+{
+	GList *ptr = sublist;
+	while (ptr) {
+		unless (g_list_find(list, ptr->data)) return (FALSE);
+		ptr = ptr->next;
+	}
+	return (TRUE);
+}
+
+/**
+ * Look for an and_group in a GList of and_groups. Two groups are
+ * equal if they hold the same set of tag_ids.
+ *
+ * @param groups the GList of and_groups
+ * @param group the and_group to look for
+ * @return TRUE if found
+ */
+static gboolean
+tagsistant_rds_and_group_in(GList *groups, GList *group)
+{
+	GList *ptr = groups;
+	while (ptr) {
+		GList *candidate = (GList *) ptr->data;
+		if (tagsistant_rds_tag_ids_contain(candidate, group) && tagsistant_rds_tag_ids_contain(group, candidate))
+			return (TRUE);
+		ptr = ptr->next;
+	}
+	return (FALSE);
+}
+
+/**
+ * Check if an RDS subsumes another one, that is, if the results of
+ * the second can be obtained by filtering the results of the first.
+ * Both must have a single OR node and must not be volatile; each
+ * and_group of the parent must be an and_group of the child too
+ * and each tag negated by the parent must be negated by the child.
+ *
+ * @param parent the candidate superset
+ * @param rds the RDS to be derived
+ * @return TRUE if parent subsumes rds
+ */
+static gboolean
+tagsistant_rds_subsumes(tagsistant_rds *parent, tagsistant_rds *rds)
+{
+	if (parent->is_volatile || !parent->or_nodes || parent->or_nodes->next) return (FALSE);
+
+	tagsistant_rds_or_node *parent_node = (tagsistant_rds_or_node *) parent->or_nodes->data;
+	tagsistant_rds_or_node *or_node = (tagsistant_rds_or_node *) rds->or_nodes->data;
+
+	GList *group = parent_node->and_groups;
+	while (group) {
+		unless (tagsistant_rds_and_group_in(or_node->and_groups, (GList *) group->data)) return (FALSE);
+		group = group->next;
+	}
+
+	return (tagsistant_rds_tag_ids_contain(or_node->negated, parent_node->negated));
+}
+
+/**
+ * Release an RDS locked by tagsistant_rds_find_superset()
+ *
+ * @param parent the RDS to be released
+ */
+static void
+tagsistant_rds_release_superset(tagsistant_rds *parent)
+{
+	g_mutex_unlock(&parent->materializer_mutex);
+	g_rw_lock_reader_unlock(&parent->rwlock);
+	g_atomic_int_add(&parent->pinned, -1);
+}
+
+/**
+ * Pin the materialized RDS which could be the superset of an RDS.
+ * Must be called before locking the RDS: the RDS cache lock is never
+ * taken while holding an RDS lock, because the RDS are write locked
+ * by threads holding the cache lock.
+ *
+ * @param rds the RDS to be derived
+ * @return a GList of pinned RDS, to be released by tagsistant_rds_unpin_list()
+ */
+static GList *
+tagsistant_rds_pin_supersets(tagsistant_rds *rds)
+{
+	GList *candidates = NULL;
+
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, tagsistant_rds_cache);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		tagsistant_rds *parent = (tagsistant_rds *) value;
+		if (parent is rds || !g_atomic_pointer_get(&parent->entries)) continue;
+
+		g_atomic_int_inc(&parent->pinned);
+		candidates = g_list_prepend(candidates, parent);
+	}
+
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+
+	return (candidates);
+}
+
+/**
+ * Release the RDS pinned by tagsistant_rds_pin_supersets() or
+ * tagsistant_rds_pin_set() and free the list
+ *
+ * @param pinned a GList of pinned RDS
+ */
+static void
+tagsistant_rds_unpin_list(GList *pinned)
+{
+	GList *ptr;
+	for (ptr = pinned; ptr; ptr = ptr->next)
+		g_atomic_int_add(&((tagsistant_rds *) ptr->data)->pinned, -1);
+
+	g_list_free(pinned);
+}
+
+/**
+ * Find the smallest materialized RDS which subsumes an RDS among the
+ * candidates pinned by tagsistant_rds_pin_supersets(). RDS busy being
+ * materialized or updated are skipped, so this never waits on an RDS
+ * lock. The RDS returned is pinned again, read locked and has its
+ * materializer mutex locked, so its entries can't change until it's
+ * released by tagsistant_rds_release_superset().
+ *
+ * @param rds the RDS to be derived
+ * @param candidates the pinned candidate supersets
+ * @return the superset RDS, NULL if none
+ */
+static tagsistant_rds *
+tagsistant_rds_find_superset(tagsistant_rds *rds, GList *candidates)
+{
+	tagsistant_rds *best = NULL;
+
+	GList *ptr;
+	for (ptr = candidates; ptr; ptr = ptr->next) {
+		tagsistant_rds *parent = (tagsistant_rds *) ptr->data;
+
+		unless (g_rw_lock_reader_trylock(&parent->rwlock)) continue;
+		unless (g_mutex_trylock(&parent->materializer_mutex)) {
+			g_rw_lock_reader_unlock(&parent->rwlock);
+			continue;
+		}
+		g_atomic_int_inc(&parent->pinned);
+
+		/*
+		 * without the tag index, the parent inodes are sent to
+		 * the database, so the parent can't be too large
+		 */
+		if (parent->entries && !parent->discard &&
+			(tagsistant.tag_index || parent->tuples <= TAGSISTANT_RDS_DERIVE_MAX) &&
+			(!best || parent->tuples < best->tuples) &&
+			tagsistant_rds_subsumes(parent, rds)) {
+
+			if (best) tagsistant_rds_release_superset(best);
+			best = parent;
+		} else {
+			tagsistant_rds_release_superset(parent);
+		}
+	}
+
+	return (best);
+}
+
+/**
+ * The objects of the RDS an RDS is being derived from
+ */
+typedef struct {
+	/** the RDS being derived */
+	tagsistant_rds *rds;
+
+	/** inode -> object name of the parent RDS */
+	GHashTable *names;
+} tagsistant_rds_derivation;
+
+/**
+ * add a file of the parent RDS to a derived RDS (callback function)
+ *
+ * @param derivation the tagsistant_rds_derivation
+ * @param result a DBI result
+ */
+static int
+tagsistant_rds_derive_entry(tagsistant_rds_derivation *derivation, dbi_result result)
+{
+	tagsistant_inode inode = tagsistant_result_get_uint(result, 1);
+
+	const gchar *name = g_hash_table_lookup(derivation->names, GUINT_TO_POINTER(inode));
+	if (name) tagsistant_rds_materialize_object(derivation->rds, inode, g_strdup(name));
+
+	return (0);
+}
+
+/**
+ * Materialize an RDS filtering the entries of an already materialized
+ * RDS which subsumes it (like store/photos/@ for store/photos/2019/@)
+ * against the tags it doesn't share with it. The filter is evaluated
+ * on the tag index, if enabled, or by a single SQL probe on the
+ * parent inodes.
+ *
+ * @param rds the RDS to be filled
+ * @param qtree the querytree object
+ * @param supersets the candidate supersets, see tagsistant_rds_pin_supersets()
+ * @return TRUE if the RDS has been derived
+ */
+static gboolean
+tagsistant_rds_materialize_by_derivation(tagsistant_rds *rds, tagsistant_querytree *qtree, GList *supersets)
+{
+	if (rds->is_volatile || !rds->or_nodes || rds->or_nodes->next) return (FALSE);
+
+	tagsistant_rds *parent = tagsistant_rds_find_superset(rds, supersets);
+	unless (parent) return (FALSE);
+
+	dbg('R', LOG_INFO, "Deriving RDS %s from RDS %s", rds->path, parent->path);
+
+	/*
+	 * collect the tags not shared with the parent
+	 */
+	tagsistant_rds_or_node *parent_node = (tagsistant_rds_or_node *) parent->or_nodes->data;
+	tagsistant_rds_or_node *or_node = (tagsistant_rds_or_node *) rds->or_nodes->data;
+	GList *extra_groups = NULL, *extra_negated = NULL, *ptr = NULL;
+
+	for (ptr = or_node->and_groups; ptr; ptr = ptr->next)
+		unless (tagsistant_rds_and_group_in(parent_node->and_groups, (GList *) ptr->data))
+			extra_groups = g_list_prepend(extra_groups, ptr->data);
+
+	for (ptr = or_node->negated; ptr; ptr = ptr->next)
+		unless (g_list_find(parent_node->negated, ptr->data))
+			extra_negated = g_list_prepend(extra_negated, ptr->data);
+
+	/*
+	 * copy the parent objects and release it
+	 */
+	tagsistant_rds_derivation derivation;
+	derivation.rds = rds;
+	derivation.names = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	GArray *inodes = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), parent->tuples);
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, parent->entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		for (ptr = (GList *) value; ptr; ptr = ptr->next) {
+			tagsistant_inode inode = GPOINTER_TO_UINT(ptr->data);
+			g_array_append_val(inodes, inode);
+			g_hash_table_insert(derivation.names, ptr->data, g_strdup((gchar *) key));
+		}
+	}
+
+	tagsistant_rds_release_superset(parent);
+
+	/*
+	 * filter the parent objects on the extra tags
+	 */
+	g_array_sort(inodes, (GCompareFunc) tagsistant_rds_inode_compare);
+	GArray *filtered = tagsistant_tag_index_filter(inodes, extra_groups, extra_negated);
+
+	if (filtered) {
+		guint i;
+		for (i = 0; i < filtered->len; i++) {
+			tagsistant_inode inode = g_array_index(filtered, tagsistant_inode, i);
+			tagsistant_rds_materialize_object(rds, inode, g_strdup(g_hash_table_lookup(derivation.names, GUINT_TO_POINTER(inode))));
+		}
+		g_array_free(filtered, TRUE);
+	} else if (inodes->len) {
+		GString *statement = g_string_sized_new(51200);
+		guint i;
+
+		g_string_append(statement, "select inode from objects where inode in (");
+		for (i = 0; i < inodes->len; i++)
+			g_string_append_printf(statement, i ? ", %u" : "%u", g_array_index(inodes, tagsistant_inode, i));
+		g_string_append(statement, ")");
+
+		for (ptr = extra_groups; ptr; ptr = ptr->next) {
+			g_string_append(statement, " and inode in (select inode from tagging where tag_id in (");
+			tagsistant_rds_append_tag_ids(statement, (GList *) ptr->data);
+			g_string_append(statement, "))");
+		}
+
+		if (extra_negated) {
+			g_string_append(statement, " and inode not in (select inode from tagging where tag_id in (");
+			tagsistant_rds_append_tag_ids(statement, extra_negated);
+			g_string_append(statement, "))");
+		}
+
+		tagsistant_raw_query(statement->str, qtree->dbi,
+			(tagsistant_query_callback) tagsistant_rds_derive_entry, &derivation);
+
+		g_string_free(statement, TRUE);
+	}
+
+	g_array_free(inodes, TRUE);
+	g_hash_table_destroy(derivation.names);
+	g_list_free(extra_groups);
+	g_list_free(extra_negated);
+
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	tagsistant_rds_derivations++;
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
+
+	return (TRUE);
+}
+
+/**
+ * Materialize the RDS of a query
+ *
+ * @param rds the RDS to be filled
+ * @param qtree the querytree object
+ * @param supersets the RDS it could be derived from, see tagsistant_rds_pin_supersets()
+ * @return TRUE if the RDS has been materialized
+ */
+gboolean
+tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree, GList *supersets)
+{
+	gint64 start = g_get_monotonic_time();
+
+	/* taken before reading the DB, to know if the entries can be kept */
+	gint snapshot = tagsistant_db_snapshot();
+
+	/*
+	 * Declare the entries hash table
+	 */
+	rds->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	rds->tuples = 0;
+	rds->bytes = 0;
+
+	if (!rds->entries) {
+		dbg('R', LOG_ERR, "Error allocating RDS entries");
+		return (FALSE);
+	}
+	g_hash_table_ref(rds->entries);
+
+	/*
+	 * record which tags this RDS depends on
+	 */
+	tagsistant_rds_register_dependencies(rds, qtree);
+
+	/*
+	 * derive the entries from a materialized RDS which subsumes
+	 * this one, or load them from the tag index, if enabled, or
+	 * with the selected materializer
+	 */
+	if (tagsistant_rds_materialize_by_derivation(rds, qtree, supersets)) {
+		dbg('R', LOG_INFO, "RDS %s derived from a materialized RDS", rds->path);
+	} else if (tagsistant_tag_index_evaluate(qtree->tree, (void (*)(gpointer, tagsistant_inode, const gchar *)) tagsistant_rds_materialize_indexed_entry, rds)) {
+		dbg('R', LOG_INFO, "RDS %s materialized from the tag index", rds->path);
+	} else if (tagsistant.rds_materializer && strcmp(tagsistant.rds_materializer, "setops") is 0) {
+		tagsistant_rds_materialize_with_setops(rds, qtree);
+	} else {
+		tagsistant_rds_materialize_with_tables(rds, qtree);
+	}
+
+	/*
+	 * account the RDS for the garbage collector
+	 */
+	rds->cost = g_get_monotonic_time() - start;
+
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	tagsistant_rds_total_tuples += rds->tuples;
+	tagsistant_rds_total_bytes += rds->bytes;
+	tagsistant_rds_materializations++;
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
+
+	dbg('R', LOG_INFO, "RDS %s materialized in %" G_GINT64_FORMAT " usec: %" G_GINT64_FORMAT " tuples, %" G_GINT64_FORMAT " bytes",
+		rds->path, rds->cost, rds->tuples, rds->bytes);
+
+	/*
+	 * a write open or committed meanwhile could have updated the RDS
+	 * in place before it existed: serve the entries to the readers
+	 * already waiting, but don't keep them
+	 */
+	rds->discard = !tagsistant_db_snapshot_is_current(snapshot);
+	if (rds->discard) {
+		dbg('R', LOG_INFO, "RDS %s read during a write, won't be cached", rds->path);
+	}
+
+	return (TRUE);
+}
+
+/**
+ * Returns TRUE if the ->name field of the tagsistant_rds_entry
+ * passed as value equals the check name passed as user_data
+ *
+ * @param key unused
+ * @param value a gpointer to a tagsistant_rds_entry struct
+ * @param user_data a gpointer to a string with the name to match
+ */
+gboolean
+tagsistant_rds_contains_object(gpointer key, gpointer value, gpointer user_data)
+{
+	(void) key;
+
+	tagsistant_rds_entry *e = (tagsistant_rds_entry *) value;
+	gchar *match_name = (gchar *) user_data;
+
+	if (e is NULL || e->name is NULL) return (FALSE);
+	return (strcmp(e->name, match_name) is 0 ? TRUE : FALSE);
+}
+
+/**
+ * Add an RDS to the cache
+ *
+ * @param rds the RDS to be cached
+ */
+void tagsistant_rds_add_to_cache(tagsistant_rds *rds)
+{
+	g_rw_lock_writer_lock(&tagsistant_rds_cache_rwlock);
+	g_hash_table_insert(tagsistant_rds_cache, g_strdup(rds->checksum), rds);
+	g_rw_lock_writer_unlock(&tagsistant_rds_cache_rwlock);
+}
+
+/**
+ * Lookup and RDS into the cache
+ *
+ * @param checksum the RDS checksum
+ */
+tagsistant_rds *tagsistant_rds_lookup_in_cache(gchar *checksum)
+{
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+	tagsistant_rds *rds = g_hash_table_lookup(tagsistant_rds_cache, checksum);
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+
+	return (rds);
+}
+
+void
 tagsistant_rds_entries_clean(gchar *key, GList *inodes, gpointer unused)
 {
-	(void) unused;
+	(void) unused;
+
+	if (key) g_free(key);
+	if (inodes) g_list_free(inodes);
+}
+
+/**
+ * Destroy an RDS
+ *
+ * @param rds the RDS to be destroyed
+ */
+void tagsistant_rds_destroy(tagsistant_rds *rds)
+{
+	if (!rds) return;
+
+	tagsistant_rds_write_lock(rds);
+	dbg('R', LOG_INFO, "Destroying RDS %s", rds->checksum);
+
+	tagsistant_rds_unregister_dependencies(rds);
+
+	g_free(rds->checksum);
+	g_free(rds->path);
+
+	if (rds->entries) {
+		g_hash_table_foreach(rds->entries, (GHFunc) tagsistant_rds_entries_clean, NULL);
+		g_hash_table_destroy(rds->entries);
+		tagsistant_rds_account(rds, -rds->tuples, -rds->bytes);
+	}
+
+#if TAGSISTANT_RDS_NEEDS_TREE
+	if (rds->tree) (void) 0; // TODO destroy the ->tree
+#endif
+
+	tagsistant_rds_write_unlock(rds);
+	g_free(rds);
+}
+
+/**
+ * Callback to tagsistant_rds_destroy() used when
+ * declaring RDS cache
+ *
+ * @param _rds a gpointer to be casted as tagsistant_rds*
+ */
+void tagsistant_rds_destroy_func(gpointer _rds)
+{
+	tagsistant_rds_destroy((tagsistant_rds *) _rds);
+}
+
+/**
+ * Initialize the RDS module
+ */
+void tagsistant_rds_init()
+{
+	tagsistant_rds_cache = g_hash_table_new_full(
+		g_str_hash, /* hash keys as strings */
+		g_str_equal, /* compare keys as strings */
+		(GDestroyNotify) g_free, /* how to free keys */
+		(GDestroyNotify) tagsistant_rds_destroy_func /* how to free values */
+	);
+
+	tagsistant_rds_dependencies = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_hash_table_destroy);
+
+	tagsistant_rds_volatile = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+/**
+ * build a linked list of filenames that satisfy the querytree
+ * object. This is translated in a two phase flow:
+ *
+ * 1. each qtree_and_node list is translated into one
+ * (temporary) table
+ *
+ * 2. the content of all tables are read in with a UNION
+ * chain inside a super-select to apply the ORDER BY clause.
+ *
+ * 3. all the (temporary) tables are removed
+ *
+ * tagsistant_readdir_on_store
+ *   tagsistant_rds_new
+ *      garbage collection
+ *      if (all) materialize the rds with tagsistant_query
+ *      get the RDS ID
+ *      lookup the RDS as GHashTable from cache, using the RDS ID
+ *          if found, return it
+ *      if (!materialized) materialize the rds with tagsistant_query
+ *          create a GHashTable with RDS contents
+ *          cache it
+ *          return it
+ *
+ * @param query the qtree_or_node query structure to be resolved
+ * @param conn a libDBI dbi_conn handle
+ * @return a pointer to a GHashTable of tagsistant_file_handle objects
+ */
+tagsistant_rds *
+tagsistant_rds_new(tagsistant_querytree *qtree)
+{
+	/*
+	 * a NULL query can't be processed
+	 */
+	if (!qtree) {
+		dbg('R', LOG_ERR, "NULL tagsistant_querytree object provided to %s", __func__);
+		return (NULL);
+	}
+
+#if TAGSISTANT_RDS_NEEDS_TREE
+	if (!qtree->tree) {
+		dbg('R', LOG_ERR, "NULL qtree_or_node object provided to %s", __func__);
+		return (NULL);
+	}
+#endif
+
+	/*
+	 * Allocate the RDS structure
+	 */
+	tagsistant_rds *rds = g_new0(tagsistant_rds, 1);
+	if (!rds) {
+		dbg('R', LOG_ERR, "Error allocating memory for RDS: %s", strerror(errno));
+		return (NULL);
+	}
+
+	rds->checksum = tagsistant_get_rds_checksum(qtree);
+	rds->path = g_strdup(qtree->expanded_full_path);
+#if TAGSISTANT_RDS_NEEDS_TREE
+	rds->tree = tagsistant_duplicate_tree(qtree->tree);
+#endif
+	rds->is_all_path = is_all_path(qtree->full_path);
+	rds->entries = NULL;
+	rds->last_access = g_get_monotonic_time();
+
+	return (rds);
+}
+
+/**
+ * Read lock an RDS. If the RDS has not been yet materialized,
+ * materialize it too.
+ *
+ * @param rds The RDS to be locked
+ * @param dbi a dbi_conn connection
+ */
+gboolean tagsistant_rds_read_lock(tagsistant_rds *rds, tagsistant_querytree *qtree)
+{
+	if (!rds) return (FALSE);
+
+	/* the supersets are looked up in the cache before locking the RDS */
+	GList *supersets = g_atomic_pointer_get(&rds->entries) ? NULL : tagsistant_rds_pin_supersets(rds);
+
+	g_rw_lock_reader_lock(&rds->rwlock);
+
+	g_mutex_lock(&rds->materializer_mutex);
+	if (!rds->entries) tagsistant_rds_materialize(rds, qtree, supersets);
+	g_mutex_unlock(&rds->materializer_mutex);
+
+	tagsistant_rds_unpin_list(supersets);
+
+	rds->last_access = g_get_monotonic_time();
+	rds->referenced = TRUE;
+
+	return (TRUE);
+}
+
+/**
+ * Read unlock an RDS, releasing the pin taken by
+ * tagsistant_rds_new_or_lookup(), and run the garbage
+ * collector if the RDS cache is over budget.
+ *
+ * @param rds The RDS to be unlocked
+ */
+void tagsistant_rds_read_unlock(tagsistant_rds *rds)
+{
+	if (!rds) return;
+
+	gboolean discard = rds->discard;
+	g_rw_lock_reader_unlock(&rds->rwlock);
+
+	/* still pinned, so the GC can't destroy it meanwhile */
+	if (discard) tagsistant_rds_dematerialize(NULL, rds, NULL);
+
+	g_atomic_int_add(&rds->pinned, -1);
+
+	tagsistant_rds_gc();
+}
+
+gboolean tagsistant_rds_write_lock(tagsistant_rds *rds)
+{
+	if (!rds) return (FALSE);
+	g_rw_lock_writer_lock(&rds->rwlock);
+	return (TRUE);
+}
+
+void tagsistant_rds_write_unlock(tagsistant_rds *rds)
+{
+	if (!rds) return;
+	g_rw_lock_writer_unlock(&rds->rwlock);
+}
+
+/**
+ * Lookup an RDS in the RDS cache
+ *
+ * @param checksum the RDS checksum to lookup
+ * @return the RDS, if found, NULL otherwise
+ */
+tagsistant_rds *
+tagsistant_rds_lookup(const gchar *checksum)
+{
+	if (checksum is NULL) return (NULL);
+	return (g_hash_table_lookup(tagsistant_rds_cache, checksum));
+}
+
+/**
+ * Lookup or create an RDS based on a tagsistant_querytree object.
+ * The RDS is returned pinned, so the garbage collector won't destroy
+ * it: the caller must read lock it and then release it with
+ * tagsistant_rds_read_unlock().
+ *
+ * @param qtree the tagsistant_querytree source object
+ */
+tagsistant_rds *
+tagsistant_rds_new_or_lookup(tagsistant_querytree *qtree)
+{
+	tagsistant_rds *rds = NULL;
+
+	gchar *checksum = tagsistant_get_rds_checksum(qtree);
+	if (!checksum) return (NULL);
+
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+	rds = g_hash_table_lookup(tagsistant_rds_cache, checksum);
+	if (rds) g_atomic_int_inc(&rds->pinned);
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+
+	if (rds is NULL) {
+		/*
+		 * another thread could have created the RDS meanwhile
+		 */
+		g_rw_lock_writer_lock(&tagsistant_rds_cache_rwlock);
+		rds = g_hash_table_lookup(tagsistant_rds_cache, checksum);
+		if (rds is NULL) {
+			rds = tagsistant_rds_new(qtree);
+			if (rds) {
+				g_hash_table_insert(tagsistant_rds_cache, g_strdup(rds->checksum), rds);
+				tagsistant_rds_clock = g_list_prepend(tagsistant_rds_clock, rds);
+			}
+		}
+		if (rds) g_atomic_int_inc(&rds->pinned);
+		g_rw_lock_writer_unlock(&tagsistant_rds_cache_rwlock);
+	}
+
+	g_free(checksum);
+	return (rds);
+}
+
+/**
+ * Destroy an RDS entry hash table
+ *
+ * @param key unused
+ * @param rds the RDS to dematerialize
+ * @param unused an unused field
+ */
+void
+tagsistant_rds_dematerialize(gpointer key, tagsistant_rds *rds, gpointer unused)
+{
+	(void) key;
+	(void) unused;
+	if (!rds) return;
+
+	/*
+	 * destroy the hash table and set its field to NULL
+	 * to signal that the RDS has been de-materialized
+	 */
+	tagsistant_rds_write_lock(rds);
+	if (rds->entries) {
+		g_hash_table_foreach(rds->entries, (GHFunc) tagsistant_rds_entries_clean, NULL);
+		g_hash_table_destroy(rds->entries);
+		rds->entries = NULL;
+		tagsistant_rds_account(rds, -rds->tuples, -rds->bytes);
+	}
+	rds->discard = FALSE;
+	tagsistant_rds_write_unlock(rds);
+}
+
+/**
+ * Add the checksums of all the RDS depending on a tag to a set.
+ * Must be called with tagsistant_rds_dependencies_lock held.
+ *
+ * @param involved the set of checksums to be dematerialized
+ * @param tag_id the tag_id
+ */
+static void
+tagsistant_rds_collect_dependents(GHashTable *involved, tagsistant_inode tag_id)
+{
+	GHashTable *dependents = g_hash_table_lookup(tagsistant_rds_dependencies, GUINT_TO_POINTER(tag_id));
+	if (!dependents) return;
+
+	GHashTableIter iter;
+	gpointer checksum;
+	g_hash_table_iter_init(&iter, dependents);
+	while (g_hash_table_iter_next(&iter, &checksum, NULL))
+		g_hash_table_add(involved, g_strdup((gchar *) checksum));
+}
+
+/**
+ * Add the checksums of all the RDS depending on an and-node,
+ * including its related tags, to a set.
+ *
+ * @param involved the set of checksums to be dematerialized
+ * @param and the qtree_and_node
+ */
+static void
+tagsistant_rds_collect_and_node(GHashTable *involved, qtree_and_node *and)
+{
+	while (and) {
+		qtree_and_node *related = and;
+		while (related) {
+			tagsistant_rds_collect_dependents(involved, related->tag_id);
+			related = related->related;
+		}
+		and = and->next;
+	}
+}
+
+/**
+ * Add a volatile RDS checksum to a set (g_hash_table_foreach callback)
+ *
+ * @param checksum the RDS checksum
+ * @param unused unused value
+ * @param involved the set of checksums to be dematerialized
+ */
+static void
+tagsistant_rds_collect_volatile(gchar *checksum, gpointer unused, GHashTable *involved)
+{
+	(void) unused;
+	g_hash_table_add(involved, g_strdup(checksum));
+}
+
+/**
+ * Check if an object belongs to an RDS by its tags
+ *
+ * @param rds the RDS
+ * @param object_tags a set of the tag_ids applied to the object
+ * @return TRUE if the object satisfies at least one OR node
+ */
+static gboolean
+tagsistant_rds_matches_object(tagsistant_rds *rds, GHashTable *object_tags)
+{
+	GList *or_ptr = rds->or_nodes;
+	while (or_ptr) {
+		tagsistant_rds_or_node *or_node = (tagsistant_rds_or_node *) or_ptr->data;
+		gboolean matches = TRUE;
+
+		/*
+		 * each and_group must be matched by at least one tag
+		 */
+		GList *group = or_node->and_groups;
+		while (group && matches) {
+			gboolean group_matches = FALSE;
+			GList *tag_id = (GList *) group->data;
+			while (tag_id && !group_matches) {
+				if (g_hash_table_contains(object_tags, tag_id->data)) group_matches = TRUE;
+				tag_id = tag_id->next;
+			}
+			matches = group_matches;
+			group = group->next;
+		}
+
+		/*
+		 * no negated tag must be matched
+		 */
+		GList *negated = or_node->negated;
+		while (negated && matches) {
+			if (g_hash_table_contains(object_tags, negated->data)) matches = FALSE;
+			negated = negated->next;
+		}
+
+		if (matches) return (TRUE);
+		or_ptr = or_ptr->next;
+	}
+
+	return (FALSE);
+}
+
+/**
+ * Remove an inode from the entries of an RDS listed under a name.
+ * Must be called with the RDS write locked.
+ *
+ * @param rds the RDS
+ * @param name the object name
+ * @param inode the object inode
+ */
+static void
+tagsistant_rds_remove_entry(tagsistant_rds *rds, const gchar *name, tagsistant_inode inode)
+{
+	gpointer key = NULL, value = NULL;
+	if (!name || !g_hash_table_lookup_extended(rds->entries, name, &key, &value)) return;
+
+	guint before = g_list_length((GList *) value);
+	GList *list = g_list_remove_all((GList *) value, GUINT_TO_POINTER(inode));
+	gint64 removed = before - g_list_length(list);
+
+	if (list) {
+		g_hash_table_insert(rds->entries, key, list);
+		tagsistant_rds_account(rds, -removed, -removed * TAGSISTANT_RDS_INODE_SIZE);
+	} else {
+		tagsistant_rds_account(rds, -removed, -removed * TAGSISTANT_RDS_INODE_SIZE - TAGSISTANT_RDS_NAME_SIZE((gchar *) key));
+		g_hash_table_remove(rds->entries, key);
+		g_free(key);
+	}
+}
+
+/**
+ * Add an inode to the entries of an RDS listed under a name.
+ * Must be called with the RDS write locked.
+ *
+ * @param rds the RDS
+ * @param name the object name
+ * @param inode the object inode
+ */
+static void
+tagsistant_rds_add_entry(tagsistant_rds *rds, const gchar *name, tagsistant_inode inode)
+{
+	gpointer key = NULL, value = NULL;
+	if (g_hash_table_lookup_extended(rds->entries, name, &key, &value)) {
+		unless (g_list_find((GList *) value, GUINT_TO_POINTER(inode))) {
+			g_hash_table_insert(rds->entries, key, g_list_prepend((GList *) value, GUINT_TO_POINTER(inode)));
+			tagsistant_rds_account(rds, 1, TAGSISTANT_RDS_INODE_SIZE);
+		}
+	} else {
+		g_hash_table_insert(rds->entries, g_strdup(name), g_list_prepend(NULL, GUINT_TO_POINTER(inode)));
+		tagsistant_rds_account(rds, 1, TAGSISTANT_RDS_INODE_SIZE + TAGSISTANT_RDS_NAME_SIZE(name));
+	}
+}
+
+/**
+ * Pin a set of RDS, so they can be locked after releasing the RDS
+ * cache lock: a thread holding an RDS lock could be waiting for the
+ * cache lock to materialize it.
+ *
+ * @param involved the set of RDS checksums, NULL for every RDS
+ * @return a GList of pinned RDS, to be released by tagsistant_rds_unpin_list()
+ */
+static GList *
+tagsistant_rds_pin_set(GHashTable *involved)
+{
+	GList *pinned = NULL;
+
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+
+	GHashTableIter iter;
+	gpointer checksum, value;
+	g_hash_table_iter_init(&iter, involved ? involved : tagsistant_rds_cache);
+	while (g_hash_table_iter_next(&iter, &checksum, &value)) {
+		tagsistant_rds *rds = involved ? g_hash_table_lookup(tagsistant_rds_cache, checksum) : value;
+		if (rds) {
+			g_atomic_int_inc(&rds->pinned);
+			pinned = g_list_prepend(pinned, rds);
+		}
+	}
+
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+
+	return (pinned);
+}
+
+/**
+ * Dematerialize a set of RDS
+ *
+ * @param involved the set of RDS checksums
+ */
+static void
+tagsistant_rds_dematerialize_set(GHashTable *involved)
+{
+	GList *pinned = tagsistant_rds_pin_set(involved), *ptr;
+
+	for (ptr = pinned; ptr; ptr = ptr->next) {
+		tagsistant_rds *rds = (tagsistant_rds *) ptr->data;
+		dbg('R', LOG_INFO, "Dematerializing RDS %s", rds->path);
+		tagsistant_rds_dematerialize(NULL, rds, NULL);
+	}
+
+	tagsistant_rds_unpin_list(pinned);
+}
+
+/**
+ * Dematerialize every RDS
+ */
+static void
+tagsistant_rds_dematerialize_all()
+{
+	GList *pinned = tagsistant_rds_pin_set(NULL), *ptr;
 
-	if (key) g_free(key);
-	if (inodes) g_list_free(inodes);
+	for (ptr = pinned; ptr; ptr = ptr->next)
+		tagsistant_rds_dematerialize(NULL, (tagsistant_rds *) ptr->data, NULL);
+
+	tagsistant_rds_unpin_list(pinned);
 }
 
 /**
- * Destroy an RDS
+ * Check if the RDS cache exceeds its memory or tuple budget
  *
- * @param rds the RDS to be destroyed
+ * @return TRUE if the GC should dematerialize some RDS
  */
-void tagsistant_rds_destroy(tagsistant_rds *rds)
+static gboolean
+tagsistant_rds_over_budget()
 {
-	if (!rds) return;
+	gint64 budget = (gint64) (tagsistant.rds_memory > 0 ? tagsistant.rds_memory : TAGSISTANT_GC_MEMORY) * 1024 * 1024;
 
-	tagsistant_rds_write_lock(rds);
-	dbg('R', LOG_INFO, "Destroying RDS %s", rds->checksum);
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	gboolean over = (tagsistant_rds_total_bytes > budget) || (tagsistant_rds_total_tuples > TAGSISTANT_GC_TUPLES);
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
 
-	g_free(rds->checksum);
-	g_free(rds->path);
+	return (over);
+}
 
-	if (rds->entries) {
-		g_hash_table_foreach(rds->entries, (GHFunc) tagsistant_rds_entries_clean, NULL);
-		g_hash_table_destroy(rds->entries);
-	}
+/**
+ * Dematerialize an RDS on behalf of the garbage collector
+ *
+ * @param rds the RDS to be evicted
+ */
+static void
+tagsistant_rds_gc_evict(tagsistant_rds *rds)
+{
+	dbg('R', LOG_INFO, "GC: evicting RDS %s (%" G_GINT64_FORMAT " bytes)", rds->path, rds->bytes);
+	tagsistant_rds_dematerialize(NULL, rds, NULL);
 
-#if TAGSISTANT_RDS_NEEDS_TREE
-	if (rds->tree) (void) 0; // TODO destroy the ->tree
-#endif
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	tagsistant_rds_evictions++;
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
+}
 
-	tagsistant_rds_write_unlock(rds);
-	g_free(rds);
+/**
+ * Compare two RDS by their cost-weighted last access: an RDS which was
+ * expensive to materialize is kept as if it was accessed later.
+ */
+static gint
+tagsistant_rds_gc_compare(tagsistant_rds *a, tagsistant_rds *b)
+{
+	gint64 pa = a->last_access + a->cost * TAGSISTANT_GC_COST_WEIGHT;
+	gint64 pb = b->last_access + b->cost * TAGSISTANT_GC_COST_WEIGHT;
+	return ((pa < pb) ? -1 : ((pa > pb) ? 1 : 0));
 }
 
 /**
- * Callback to tagsistant_rds_destroy() used when
- * declaring RDS cache
+ * Return all the unpinned RDS sorted by cost-weighted last access.
+ * Must be called with tagsistant_rds_cache_rwlock write locked.
  *
- * @param _rds a gpointer to be casted as tagsistant_rds*
+ * @return a GList to be freed with g_list_free()
  */
-void tagsistant_rds_destroy_func(gpointer _rds)
+static GList *
+tagsistant_rds_gc_candidates()
 {
-	tagsistant_rds_destroy((tagsistant_rds *) _rds);
+	GList *candidates = NULL;
+
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, tagsistant_rds_cache);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		tagsistant_rds *rds = (tagsistant_rds *) value;
+		unless (g_atomic_int_get(&rds->pinned)) candidates = g_list_prepend(candidates, rds);
+	}
+
+	return (g_list_sort(candidates, (GCompareFunc) tagsistant_rds_gc_compare));
 }
 
 /**
- * Initialize the RDS module
+ * Sweep the CLOCK ring dematerializing the RDS not referenced since
+ * the last sweep, until the cache is within its budget.
+ * Must be called with tagsistant_rds_cache_rwlock write locked.
  */
-void tagsistant_rds_init()
+static void
+tagsistant_rds_gc_clock()
 {
-	tagsistant_rds_cache = g_hash_table_new_full(
-		g_str_hash, /* hash keys as strings */
-		g_str_equal, /* compare keys as strings */
-		(GDestroyNotify) g_free, /* how to free keys */
-		(GDestroyNotify) tagsistant_rds_destroy_func /* how to free values */
-	);
+	guint steps = 2 * g_list_length(tagsistant_rds_clock);
+
+	while (steps-- && tagsistant_rds_over_budget()) {
+		unless (tagsistant_rds_clock_hand) tagsistant_rds_clock_hand = tagsistant_rds_clock;
+		unless (tagsistant_rds_clock_hand) break;
+
+		tagsistant_rds *rds = (tagsistant_rds *) tagsistant_rds_clock_hand->data;
+		tagsistant_rds_clock_hand = tagsistant_rds_clock_hand->next;
+
+		if (!rds->entries || g_atomic_int_get(&rds->pinned)) continue;
+
+		if (rds->referenced) {
+			rds->referenced = FALSE;
+		} else {
+			tagsistant_rds_gc_evict(rds);
+		}
+	}
 }
 
 /**
- * build a linked list of filenames that satisfy the querytree
- * object. This is translated in a two phase flow:
- *
- * 1. each qtree_and_node list is translated into one
- * (temporary) table
- *
- * 2. the content of all tables are read in with a UNION
- * chain inside a super-select to apply the ORDER BY clause.
- *
- * 3. all the (temporary) tables are removed
- *
- * tagsistant_readdir_on_store
- *   tagsistant_rds_new
- *      garbage collection
- *      if (all) materialize the rds with tagsistant_query
- *      get the RDS ID
- *      lookup the RDS as GHashTable from cache, using the RDS ID
- *          if found, return it
- *      if (!materialized) materialize the rds with tagsistant_query
- *          create a GHashTable with RDS contents
- *          cache it
- *          return it
- *
- * @param query the qtree_or_node query structure to be resolved
- * @param conn a libDBI dbi_conn handle
- * @return a pointer to a GHashTable of tagsistant_file_handle objects
+ * Dematerialize the RDS with the oldest cost-weighted last access
+ * until the cache is within its budget.
+ * Must be called with tagsistant_rds_cache_rwlock write locked.
  */
-tagsistant_rds *
-tagsistant_rds_new(tagsistant_querytree *qtree)
+static void
+tagsistant_rds_gc_lru()
 {
-	/*
-	 * a NULL query can't be processed
-	 */
-	if (!qtree) {
-		dbg('R', LOG_ERR, "NULL tagsistant_querytree object provided to %s", __func__);
-		return (NULL);
-	}
+	GList *candidates = tagsistant_rds_gc_candidates();
 
-#if TAGSISTANT_RDS_NEEDS_TREE
-	if (!qtree->tree) {
-		dbg('R', LOG_ERR, "NULL qtree_or_node object provided to %s", __func__);
-		return (NULL);
+	GList *ptr = candidates;
+	while (ptr && tagsistant_rds_over_budget()) {
+		tagsistant_rds *rds = (tagsistant_rds *) ptr->data;
+		if (rds->entries) tagsistant_rds_gc_evict(rds);
+		ptr = ptr->next;
 	}
-#endif
+
+	g_list_free(candidates);
+}
+
+/**
+ * The RDS garbage collector. First dematerializes RDS until the cache
+ * is within the memory budget (--rds-memory) and TAGSISTANT_GC_TUPLES,
+ * using the policy selected by --rds-gc. Then, if the cache holds more
+ * than TAGSISTANT_GC_RDS RDS, destroys the least recently used ones.
+ *
+ * Pinned RDS are never touched: since pinning happens with the cache
+ * lock held, an unpinned RDS can't be locked by anyone while the
+ * garbage collector holds the cache write lock.
+ */
+void tagsistant_rds_gc()
+{
+	unless (tagsistant_rds_cache) return;
+
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+	gboolean too_many = g_hash_table_size(tagsistant_rds_cache) > TAGSISTANT_GC_RDS;
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
+
+	unless (too_many || tagsistant_rds_over_budget()) return;
+
+	g_rw_lock_writer_lock(&tagsistant_rds_cache_rwlock);
 
 	/*
-	 * Allocate the RDS structure
+	 * dematerialize RDS to fit the memory budget
 	 */
-	tagsistant_rds *rds = g_new0(tagsistant_rds, 1);
-	if (!rds) {
-		dbg('R', LOG_ERR, "Error allocating memory for RDS: %s", strerror(errno));
-		return (NULL);
+	if (tagsistant.rds_gc && strcmp(tagsistant.rds_gc, "clock") is 0) {
+		tagsistant_rds_gc_clock();
+	} else {
+		tagsistant_rds_gc_lru();
 	}
 
-	rds->checksum = tagsistant_get_rds_checksum(qtree);
-	rds->path = g_strdup(qtree->expanded_full_path);
-#if TAGSISTANT_RDS_NEEDS_TREE
-	rds->tree = tagsistant_duplicate_tree(qtree->tree);
-#endif
-	rds->is_all_path = is_all_path(qtree->full_path);
-	rds->entries = NULL;
-
 	/*
-	 * cache the new RDS
+	 * destroy RDS to fit TAGSISTANT_GC_RDS
 	 */
-	tagsistant_rds_add_to_cache(rds);
+	if (g_hash_table_size(tagsistant_rds_cache) > TAGSISTANT_GC_RDS) {
+		GList *candidates = tagsistant_rds_gc_candidates();
 
-	return (rds);
+		GList *ptr = candidates;
+		while (ptr && g_hash_table_size(tagsistant_rds_cache) > TAGSISTANT_GC_RDS) {
+			tagsistant_rds *rds = (tagsistant_rds *) ptr->data;
+
+			if (tagsistant_rds_clock_hand && tagsistant_rds_clock_hand->data is rds)
+				tagsistant_rds_clock_hand = tagsistant_rds_clock_hand->next;
+			tagsistant_rds_clock = g_list_remove(tagsistant_rds_clock, rds);
+
+			dbg('R', LOG_INFO, "GC: destroying RDS %s", rds->path);
+			g_hash_table_remove(tagsistant_rds_cache, rds->checksum);
+
+			g_mutex_lock(&tagsistant_rds_stats_lock);
+			tagsistant_rds_destructions++;
+			g_mutex_unlock(&tagsistant_rds_stats_lock);
+
+			ptr = ptr->next;
+		}
+
+		g_list_free(candidates);
+	}
+
+	g_rw_lock_writer_unlock(&tagsistant_rds_cache_rwlock);
 }
 
 /**
- * Read lock an RDS. If the RDS has not been yet materialized,
- * materialize it too.
+ * Print RDS cache statistics into a buffer
  *
- * @param rds The RDS to be locked
- * @param dbi a dbi_conn connection
+ * @param buffer the buffer
+ * @param size the size of the buffer
  */
-gboolean tagsistant_rds_read_lock(tagsistant_rds *rds, tagsistant_querytree *qtree)
+void tagsistant_rds_stats(gchar *buffer, size_t size)
 {
-	if (!rds) return (FALSE);
-	g_rw_lock_reader_lock(&rds->rwlock);
+	int total = 0, materialized = 0;
 
-	g_mutex_lock(&rds->materializer_mutex);
-	if (!rds->entries) tagsistant_rds_materialize(rds, qtree);
-	g_mutex_unlock(&rds->materializer_mutex);
+	g_rw_lock_reader_lock(&tagsistant_rds_cache_rwlock);
+	if (tagsistant_rds_cache) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, tagsistant_rds_cache);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			total++;
+			if (((tagsistant_rds *) value)->entries) materialized++;
+		}
+	}
+	g_rw_lock_reader_unlock(&tagsistant_rds_cache_rwlock);
 
-	return (TRUE);
+	g_mutex_lock(&tagsistant_rds_stats_lock);
+	snprintf(buffer, size,
+		"# of RDS: %d (limit %d)\n"
+		"# of materialized RDS: %d\n"
+		"# of tuples: %" G_GINT64_FORMAT " (limit %d)\n"
+		"memory footprint: %" G_GINT64_FORMAT " bytes (budget %d MB)\n"
+		"eviction policy: %s\n"
+		"materializer: %s\n"
+		"# of materializations: %" G_GINT64_FORMAT "\n"
+		"# of evictions: %" G_GINT64_FORMAT "\n"
+		"# of destroyed RDS: %" G_GINT64_FORMAT "\n"
+		"# of derived RDS: %" G_GINT64_FORMAT "\n",
+		total, TAGSISTANT_GC_RDS,
+		materialized,
+		tagsistant_rds_total_tuples, TAGSISTANT_GC_TUPLES,
+		tagsistant_rds_total_bytes, tagsistant.rds_memory > 0 ? tagsistant.rds_memory : TAGSISTANT_GC_MEMORY,
+		tagsistant.rds_gc ? tagsistant.rds_gc : "lru",
+		tagsistant.rds_materializer ? tagsistant.rds_materializer : "tables",
+		tagsistant_rds_materializations,
+		tagsistant_rds_evictions,
+		tagsistant_rds_destructions,
+		tagsistant_rds_derivations);
+	g_mutex_unlock(&tagsistant_rds_stats_lock);
+
+	size_t used = strlen(buffer);
+	tagsistant_tag_index_stats(buffer + used, size - used);
 }
 
-void tagsistant_rds_read_unlock(tagsistant_rds *rds)
+/**
+ * Bring the materialized RDS and the tag index in line with the
+ * tagging and the name of an object, as read on a connection.
+ *
+ * @param dbi the DBI connection to read the object from
+ * @param inode the object inode
+ * @param tag_ids a GList of the tag_ids that changed (as GUINT_TO_POINTER)
+ * @param old_name if the object has been renamed, its previous name, NULL otherwise
+ * @return the current object name, NULL if deleted, to be freed with g_free()
+ */
+static gchar *tagsistant_rds_apply_update(dbi_conn dbi, tagsistant_inode inode, GList *tag_ids, const gchar *old_name)
 {
-	if (!rds) return;
-	g_rw_lock_reader_unlock(&rds->rwlock);
-}
 
-gboolean tagsistant_rds_write_lock(tagsistant_rds *rds)
-{
-	if (!rds) return (FALSE);
-	g_rw_lock_writer_lock(&rds->rwlock);
-	return (TRUE);
-}
+	/*
+	 * load the tags currently applied to the object. If the object has
+	 * been renamed, the RDS depending on them must be updated too.
+	 * Otherwise only the RDS depending on the changed tags can be affected.
+	 */
+	GList *object_tag_list = tagsistant_sql_get_object_tags(dbi, inode);
 
-void tagsistant_rds_write_unlock(tagsistant_rds *rds)
-{
-	if (!rds) return;
-	g_rw_lock_writer_unlock(&rds->rwlock);
+	/*
+	 * collect the RDS involved
+	 */
+	GHashTable *involved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GHashTable *volatiles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GList *ptr = NULL;
+
+	g_mutex_lock(&tagsistant_rds_dependencies_lock);
+	for (ptr = tag_ids; ptr; ptr = ptr->next)
+		tagsistant_rds_collect_dependents(involved, GPOINTER_TO_UINT(ptr->data));
+	if (old_name)
+		for (ptr = object_tag_list; ptr; ptr = ptr->next)
+			tagsistant_rds_collect_dependents(involved, GPOINTER_TO_UINT(ptr->data));
+	g_hash_table_foreach(tagsistant_rds_volatile, (GHFunc) tagsistant_rds_collect_volatile, volatiles);
+	g_mutex_unlock(&tagsistant_rds_dependencies_lock);
+
+	/*
+	 * load the object name (a NULL name means that the object
+	 * has been deleted) and build the set of its tags
+	 */
+	gchar *name = NULL;
+	GHashTable *object_tags = g_hash_table_new(NULL, NULL);
+
+	if (g_hash_table_size(involved) || tagsistant.tag_index) {
+		tagsistant_query(
+			"select objectname from objects where inode = %d",
+			dbi, tagsistant_return_string, &name, inode);
+
+		for (ptr = object_tag_list; ptr; ptr = ptr->next)
+			g_hash_table_add(object_tags, ptr->data);
+	}
+
+	/*
+	 * update each materialized RDS in place
+	 */
+	GHashTableIter iter;
+	gpointer checksum;
+	g_hash_table_iter_init(&iter, volatiles);
+	while (g_hash_table_iter_next(&iter, &checksum, NULL))
+		g_hash_table_remove(involved, checksum);
+
+	GList *pinned = tagsistant_rds_pin_set(involved);
+	for (ptr = pinned; ptr; ptr = ptr->next) {
+		tagsistant_rds *rds = (tagsistant_rds *) ptr->data;
+
+		tagsistant_rds_write_lock(rds);
+		if (rds->entries && !rds->is_volatile) {
+			tagsistant_rds_remove_entry(rds, old_name, inode);
+			tagsistant_rds_remove_entry(rds, name, inode);
+
+			if (name && tagsistant_rds_matches_object(rds, object_tags)) {
+				dbg('R', LOG_INFO, "Adding inode %d to RDS %s", inode, rds->path);
+				tagsistant_rds_add_entry(rds, name, inode);
+			} else {
+				dbg('R', LOG_INFO, "Removing inode %d from RDS %s", inode, rds->path);
+			}
+		}
+		tagsistant_rds_write_unlock(rds);
+	}
+
+	tagsistant_rds_unpin_list(pinned);
+
+	tagsistant_rds_dematerialize_set(volatiles);
+
+	/*
+	 * keep the tag index in sync
+	 */
+	tagsistant_tag_index_update_object(inode, tag_ids, object_tags, name);
+
+	g_hash_table_destroy(volatiles);
+	g_hash_table_destroy(involved);
+	g_hash_table_destroy(object_tags);
+	g_list_free(object_tag_list);
+
+	return (name);
 }
 
 /**
- * Lookup an RDS in the RDS cache
- *
- * @param checksum the RDS checksum to lookup
- * @return the RDS, if found, NULL otherwise
+ * An object update to be applied again if its transaction is rolled back
  */
-tagsistant_rds *
-tagsistant_rds_lookup(const gchar *checksum)
+typedef struct {
+	tagsistant_inode inode;
+	GList *tag_ids;
+	gchar *name;
+} tagsistant_rds_undo;
+
+static void tagsistant_rds_undo_free(tagsistant_rds_undo *undo)
 {
-	if (checksum is NULL) return (NULL);
-	return (g_hash_table_lookup(tagsistant_rds_cache, checksum));
+	g_list_free(undo->tag_ids);
+	g_free_null(undo->name);
+	g_free(undo);
 }
 
 /**
- * Lookup or create an RDS based on a tagsistant_querytree object
- *
- * @param qtree the tagsistant_querytree source object
- * @param writeable if the RDS must be modified, writable must be
- *        TRUE, so the RDS will be returned write locked. Otherwise
- *        set it to FALSE: the RDS will be read locked.
+ * Undo an object update after a rollback: the object is read again and
+ * the entries listed by the name the update has left are replaced.
  */
-tagsistant_rds *
-tagsistant_rds_new_or_lookup(tagsistant_querytree *qtree)
+static void tagsistant_rds_undo_update(dbi_conn dbi, tagsistant_rds_undo *undo)
 {
-	tagsistant_rds *rds = NULL;
-
-	gchar *checksum = tagsistant_get_rds_checksum(qtree);
-	if (checksum) {
-		rds = tagsistant_rds_lookup(checksum);
-		g_free(checksum);
-	}
-
-	if (rds is NULL) rds = tagsistant_rds_new(qtree);
-
-	return (rds);
+	g_free(tagsistant_rds_apply_update(dbi, undo->inode, undo->tag_ids, undo->name));
 }
 
 /**
- * Destroy an RDS entry hash table
+ * Update the materialized RDS after the tagging (or the name) of an
+ * object has changed. The RDS depending on the changed tags or on the
+ * tags currently applied to the object get the object added or removed
+ * by evaluating their OR nodes on the object tags, without running
+ * the materialization query again. Volatile RDS are dematerialized.
  *
- * @param key unused
- * @param rds the RDS to dematerialize
- * @param unused an unused field
+ * The change is still uncommitted: should it be rolled back, the
+ * update is applied again on the restored object.
+ *
+ * @param dbi the DBI connection the change has been done on
+ * @param inode the object inode
+ * @param tag_ids a GList of the tag_ids that changed (as GUINT_TO_POINTER)
+ * @param old_name if the object has been renamed, its previous name, NULL otherwise
  */
-void
-tagsistant_rds_dematerialize(gpointer key, tagsistant_rds *rds, gpointer unused)
+void tagsistant_rds_update_object(dbi_conn dbi, tagsistant_inode inode, GList *tag_ids, const gchar *old_name)
 {
-	(void) key;
-	(void) unused;
-	if (!rds) return;
+	unless (tagsistant_rds_cache && inode) return;
+
+	gchar *name = tagsistant_rds_apply_update(dbi, inode, tag_ids, old_name);
 
 	/*
-	 * destroy the hash table and set its field to NULL
-	 * to signal that the RDS has been de-materialized
+	 * the RDS now list the object by its new name, or by none if it's
+	 * been deleted, when the RDS listing it by its old one are involved
 	 */
-	tagsistant_rds_write_lock(rds);
-	if (rds->entries) {
-		g_hash_table_foreach(rds->entries, (GHFunc) tagsistant_rds_entries_clean, NULL);
-		g_hash_table_destroy(rds->entries);
-		rds->entries = NULL;
-	}
-	tagsistant_rds_write_unlock(rds);
+	tagsistant_rds_undo *undo = g_new0(tagsistant_rds_undo, 1);
+	undo->inode = inode;
+	undo->tag_ids = g_list_copy(tag_ids);
+	undo->name = name ? name : g_strdup(old_name);
+
+	tagsistant_db_on_rollback(dbi,
+		(tagsistant_undo_callback) tagsistant_rds_undo_update, undo,
+		(GDestroyNotify) tagsistant_rds_undo_free);
 }
 
 /**
- * Deletes every RDS involved with one query
+ * Deletes every RDS involved with one query.
  *
- * TODO: current implementation just deletes EVERY RDS.
- * Code a less coarse alternative, then set
- * TAGSISTANT_RDS_HARD_CLEAN to FALSE
+ * If the query points to an object, the RDS depending on the query tags
+ * (negated and related included) and on the tags of the object are
+ * updated in place by tagsistant_rds_update_object().
  *
- * @param query the query driving the deletion
+ * Otherwise the RDS depending on the query tags (tags not yet existing
+ * are tracked as tag_id 0) and the volatile RDS are dematerialized.
+ * Queries that don't reference any tag nor any object (relations/, tags/)
+ * dematerialize every RDS, since they could change reasoning or tag names.
+ *
+ * @param qtree the query driving the deletion
  */
 void tagsistant_delete_rds_involved(tagsistant_querytree *qtree)
 {
 #if TAGSISTANT_RDS_HARD_CLEAN
 
 	(void) qtree;
-	g_rw_lock_writer_lock(&tagsistant_rds_cache_rwlock);
-	// g_hash_table_remove_all(tagsistant_rds_cache);
-	g_hash_table_foreach(tagsistant_rds_cache, (GHFunc) tagsistant_rds_dematerialize, NULL);
-	g_rw_lock_writer_unlock(&tagsistant_rds_cache_rwlock);
+	tagsistant_rds_dematerialize_all();
 
 #else
 
+	unless (tagsistant_rds_cache) return;
+
+	if (!qtree || (!qtree->tree && !qtree->inode)) {
+		tagsistant_rds_dematerialize_all();
+		return;
+	}
+
 	/*
-	 * For every subquery, save the source tags
+	 * For every subquery, collect its tags, related tags and negated tags
 	 */
+	GList *tag_ids = NULL;
 	qtree_or_node *query = qtree->tree;
 	while (query) {
-		/*
-		 * Delete every tag...
-		 */
 		qtree_and_node *and = query->and_set;
-
 		while (and) {
-			tagsistant_delete_rds_by_source(and, qtree->dbi);
-
-			/*
-			 * ... and every related tag ...
-			 */
-			qtree_and_node *related = and->related;
+			qtree_and_node *related = and;
 			while (related) {
-				tagsistant_delete_rds_by_source(related, qtree->dbi);
+				tag_ids = g_list_prepend(tag_ids, GUINT_TO_POINTER(related->tag_id));
 				related = related->related;
 			}
+			and = and->next;
+		}
 
-			/*
-			 * ... and even negated tags.
-			 */
-			qtree_and_node *negated = and->negated;
-			while (negated) {
-				tagsistant_delete_rds_by_source(negated, qtree->dbi);
-				negated = negated->negated;
+		and = query->negated_and_set;
+		while (and) {
+			qtree_and_node *related = and;
+			while (related) {
+				tag_ids = g_list_prepend(tag_ids, GUINT_TO_POINTER(related->tag_id));
+				related = related->related;
 			}
-
 			and = and->next;
 		}
+
 		query = query->next;
 	}
+
+	if (qtree->inode && qtree->dbi) {
+		/*
+		 * the RDS entries are listed by the first element of the object path
+		 */
+		gchar *old_name = qtree->object_path ? g_strdup(qtree->object_path) : NULL;
+		gchar *slash = old_name ? strchr(old_name, G_DIR_SEPARATOR) : NULL;
+		if (slash) *slash = '\0';
+
+		tagsistant_rds_update_object(qtree->dbi, qtree->inode, tag_ids, old_name);
+
+		g_free_null(old_name);
+	} else {
+		GHashTable *involved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+		g_mutex_lock(&tagsistant_rds_dependencies_lock);
+		GList *ptr = tag_ids;
+		while (ptr) {
+			tagsistant_rds_collect_dependents(involved, GPOINTER_TO_UINT(ptr->data));
+			ptr = ptr->next;
+		}
+		g_hash_table_foreach(tagsistant_rds_volatile, (GHFunc) tagsistant_rds_collect_volatile, involved);
+		g_mutex_unlock(&tagsistant_rds_dependencies_lock);
+
+		tagsistant_rds_dematerialize_set(involved);
+		g_hash_table_destroy(involved);
+	}
+
+	g_list_free(tag_ids);
 #endif
 }
@@ -155,14 +155,27 @@ static int tagsistant_add_reasoned_tag_callback(void *_reasoning, dbi_result res
 	tagsistant_tag *T = g_new0(tagsistant_tag, 1);
 
 	tagsistant_return_integer(&T->tag_id, result);
-	const gchar *tag_or_namespace = dbi_result_get_string_idx(result, 2);
 
-	if (g_regex_match_simple(tagsistant.triple_tag_regex, tag_or_namespace, 0, 0)) {
-		strcpy(T->namespace, tag_or_namespace);
-		strcpy(T->key, dbi_result_get_string_idx(result, 3));
-		strcpy(T->value, dbi_result_get_string_idx(result, 4));
+	/*
+	 * the relation queries return just the tag_id: the rest of the
+	 * tag comes from the tag dictionary, fetching it when missing
+	 */
+	const gchar *tag_or_namespace = NULL, *key = NULL, *value = NULL;
+	if (!tagsistant_tag_dictionary_reverse(T->tag_id, &tag_or_namespace, &key, &value)) {
+		if (!tagsistant_tag_dictionary_fetch(reasoning->conn, T->tag_id) ||
+			!tagsistant_tag_dictionary_reverse(T->tag_id, &tag_or_namespace, &key, &value)) {
+			dbg('r', LOG_ERR, "Reasoned tag %d not found", T->tag_id);
+			g_free(T);
+			return (0);
+		}
+	}
+
+	if (tagsistant_is_triple_tag(tag_or_namespace)) {
+		g_strlcpy(T->namespace, tag_or_namespace, 1024);
+		g_strlcpy(T->key, key, 1024);
+		g_strlcpy(T->value, value, 1024);
 	} else {
-		strcpy(T->tag, tag_or_namespace);
+		g_strlcpy(T->tag, tag_or_namespace, 1024);
 	}
 
 	/* add the tag */
@@ -236,12 +249,10 @@ int tagsistant_reasoner_inner(tagsistant_reasoning *reasoning, int do_caching)
 		 */
 		reasoning->negate = 0;
 		tagsistant_query(
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag2_id "
+			"select tag2_id from relations "
 				"where tag1_id = %d and relation in ('includes', 'is_equivalent') "
 			"union "
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag1_id "
+			"select tag1_id from relations "
 				"where tag2_id = %d and relation = 'is_equivalent' ",
 			reasoning->conn,
 			tagsistant_add_reasoned_tag_callback,
@@ -254,8 +265,7 @@ int tagsistant_reasoner_inner(tagsistant_reasoning *reasoning, int do_caching)
 		 */
 		reasoning->negate = 1;
 		tagsistant_query(
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag2_id "
+			"select tag2_id from relations "
 				"where tag1_id = %d and relation = 'excludes'",
 			reasoning->conn,
 			tagsistant_add_reasoned_tag_callback,
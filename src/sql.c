@@ -79,19 +79,84 @@ struct {
 	gchar *db;
 	gchar *username;
 	gchar *password;
+	gboolean native;	/**< SQLite is accessed through the sqlite3 C API */
 } dboptions;
 
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-/** a map tag_name -> tag_id */
-GHashTable *tagsistant_tag_cache = NULL;
-#endif
-
 /** regular expressions used to escape query parameters */
 GRegex *RX1, *RX2, *RX3, *RX_triple_tags;
 
 /** the query used by tagsistant_is_tagged to check if an object is still tagged */
 gchar *tagsistant_tagging_check_query = NULL;
 
+/**
+ * A statement of the registry. The SQL text is split on its ?
+ * placeholders once, at startup, and each placeholder is bound to
+ * a typed parameter: s for strings (escaped and quoted) and d for
+ * integers.
+ */
+typedef struct {
+	/** the SQL text with ? placeholders */
+	const gchar *sql;
+
+	/** the type of each placeholder */
+	const gchar *types;
+
+	/** the operation written into the WAL, TAGSISTANT_WAL_NOT_LOGGED for queries */
+	tagsistant_wal_operation operation;
+
+	/** the SQL text split on the placeholders */
+	gchar **fragments;
+
+	/** the length of the SQL text without the placeholders */
+	size_t length;
+} tagsistant_prepared_statement;
+
+tagsistant_prepared_statement tagsistant_statements[TAGSISTANT_STATEMENT_TOTAL] = {
+	[TAGSISTANT_STATEMENT_GET_TAG_ID] = {
+		"select tag_id from tags where `tagname` = ? and `key` = ? and `value` = ? limit 1", "sss",
+		TAGSISTANT_WAL_NOT_LOGGED },
+	[TAGSISTANT_STATEMENT_GET_TAG_ID_BY_KEY] = {
+		"select tag_id from tags where `tagname` = ? and `key` = ? limit 1", "ss",
+		TAGSISTANT_WAL_NOT_LOGGED },
+	[TAGSISTANT_STATEMENT_GET_TAG_ID_BY_NAME] = {
+		"select tag_id from tags where `tagname` = ? limit 1", "s",
+		TAGSISTANT_WAL_NOT_LOGGED },
+	[TAGSISTANT_STATEMENT_TAG_OBJECT] = {
+		"insert into tagging(tag_id, inode) values(?, ?)", "dd",
+		TAGSISTANT_WAL_TAG },
+	[TAGSISTANT_STATEMENT_UNTAG_OBJECT] = {
+		"delete from tagging where tag_id = ? and inode = ?", "dd",
+		TAGSISTANT_WAL_UNTAG },
+	[TAGSISTANT_STATEMENT_GET_INODE_BY_NAME] = {
+		"select inode from objects where objectname = ? limit 1", "s",
+		TAGSISTANT_WAL_NOT_LOGGED },
+	[TAGSISTANT_STATEMENT_ALIAS_EXISTS] = {
+		"select 1 from aliases where alias = ?", "s",
+		TAGSISTANT_WAL_NOT_LOGGED },
+	[TAGSISTANT_STATEMENT_ALIAS_GET] = {
+		"select query from aliases where alias = ?", "s",
+		TAGSISTANT_WAL_NOT_LOGGED },
+};
+
+/**
+ * Parse the statements of the registry
+ */
+static void
+tagsistant_statements_init()
+{
+	int id;
+	for (id = 0; id < TAGSISTANT_STATEMENT_TOTAL; id++) {
+		tagsistant_prepared_statement *stmt = &tagsistant_statements[id];
+
+		stmt->fragments = g_strsplit(stmt->sql, "?", -1);
+		stmt->length = strlen(stmt->sql) - strlen(stmt->types);
+
+		if (g_strv_length(stmt->fragments) isNot strlen(stmt->types) + 1)
+			dbg('s', LOG_ERR, "Statement %d has %d placeholders but %zu parameters",
+				id, g_strv_length(stmt->fragments) - 1, strlen(stmt->types));
+	}
+}
+
 /**
  * Initialize libDBI structures
  */
@@ -110,10 +175,6 @@ void tagsistant_db_init()
 	g_mutex_init(&tagsistant_query_mutex);
 #endif
 
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	tagsistant_tag_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-#endif
-
 	/*
 	 * by default, DBI backend provides intersect
 	 */
@@ -195,6 +256,11 @@ void tagsistant_db_init()
 
 	g_strfreev(_dboptions);
 
+#if TAGSISTANT_NATIVE_SQLITE
+	dboptions.native = (dboptions.backend is TAGSISTANT_DBI_SQLITE_BACKEND);
+	if (dboptions.native) dbg('b', LOG_INFO, "Using native SQLite %s", sqlite3_libversion());
+#endif
+
 #if 0
 	dbg('b', LOG_INFO, "Database driver: %s", dboptions.backend_name);
 
@@ -229,6 +295,16 @@ void tagsistant_db_init()
 
 	RX_triple_tags = g_regex_new("^([^:]+:)([^=]+)=(.+)$", 0, 0, NULL);
 
+	/*
+	 * parse the statement registry
+	 */
+	tagsistant_statements_init();
+
+	/*
+	 * setup the connection pool
+	 */
+	tagsistant_db_pool_init();
+
 	/*
 	 * initialize the query used to check if an object
 	 * is still tagged by at least one tag
@@ -241,167 +317,990 @@ void tagsistant_db_init()
 			"tagname <> \"" TAGSISTANT_TRASH_TAG "\" limit 1";
 }
 
+/************************************************************************************/
+/***                                                                              ***/
+/*** Readers and writers check out connections from two different pools. Reader  ***/
+/*** connections run in autocommit mode and never wait for a writer: SQLite runs  ***/
+/*** in WAL journal mode and MySQL in READ COMMITTED isolation, so both serve     ***/
+/*** consistent reads while a transaction is open. Writers share one connection   ***/
+/*** and are serialized by tagsistant_writer_lock, since SQLite admits a single   ***/
+/*** writer anyway. tagsistant_query_rwlock is taken in writer mode only by the   ***/
+/*** schema changes done at mount.                                                ***/
+/***                                                                              ***/
+/*** Checking out a connection costs a queue pop: nothing is pinged. A statement  ***/
+/*** failing because the connection is lost marks it broken, and it's closed on   ***/
+/*** release. Idle connections are pinged by a background thread, which also      ***/
+/*** keeps the reader pool above --db-pool-min. Readers beyond --db-pool-max      ***/
+/*** wait for a connection to be released.                                        ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the idle reader connections */
+GAsyncQueue *tagsistant_connection_pool = NULL;
+
+/** the number of open connections, readers and writer */
+int tagsistant_active_connections = 0;
+
+/** the number of open reader connections, idle or checked out */
+static gint tagsistant_reader_connections = 0;
+
+/** the writer connection, guarded by tagsistant_writer_lock */
+static dbi_conn tagsistant_writer_connection = NULL;
+
+/** serializes the writers */
+static GMutex tagsistant_writer_lock;
+
 /**
- * This single linked list holds the connection pool
+ * bumped when a writer checks out its connection and again when it
+ * releases it, so it's odd while a write transaction is open
  */
-GList *tagsistant_connection_pool = NULL;
-GMutex tagsistant_connection_pool_lock;
-int tagsistant_active_connections = 0;
+static gint tagsistant_write_epoch = 0;
+
+/** checkout statistics */
+static gint tagsistant_connection_checkouts = 0;
+static gint tagsistant_connection_waits = 0;
+static gint tagsistant_connection_broken = 0;
+static gint64 tagsistant_connection_wait_time = 0;
+static GMutex tagsistant_connection_stats_lock;
 
 /**
- * Parse command line options, create connection object,
- * start the connection and finally create database schema
+ * Return the error of the last statement run on a connection
  *
- * @return DBI connection handle
+ * @param dbi the connection
+ * @param errmsg if not NULL, filled with the error message
+ * @return the error code, 0 if no error
  */
-dbi_conn *tagsistant_db_connection(int start_transaction)
+static int tagsistant_db_error(dbi_conn dbi, const char **errmsg)
 {
-	/* DBI connection handler used by subsequent calls to dbi_* functions */
-	dbi_conn dbi = NULL;
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) return (tagsistant_sqlite_error(dbi, errmsg));
+#endif
 
-	if (start_transaction) {
-		dbg('s', LOG_ERR, "Writer-locking query rwlock");
-		g_rw_lock_writer_lock(&(tagsistant_query_rwlock));
-	} else {
-		dbg('s', LOG_ERR, "Read-locking query rwlock");
-		g_rw_lock_reader_lock(&(tagsistant_query_rwlock));
+	return (dbi_conn_error(dbi, errmsg));
+}
+
+/**
+ * Run a statement on a connection of any backend, calling the
+ * callback on each row, without logging it into the WAL
+ *
+ * @param dbi the connection
+ * @param statement the SQL statement
+ * @param callback the callback, may be NULL
+ * @param firstarg the first argument of the callback
+ * @return the number of rows passed to the callback, -1 on error
+ */
+static int tagsistant_db_execute(
+	dbi_conn dbi,
+	const gchar *statement,
+	tagsistant_query_callback callback,
+	void *firstarg)
+{
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) return (tagsistant_sqlite_execute(dbi, statement, callback, firstarg));
+#endif
+
+	dbi_result result = dbi_conn_query(dbi, statement);
+	if (!result) return (-1);
+
+	int rows = 0;
+	if (callback) {
+		while (dbi_result_next_row(result)) {
+			callback(firstarg, result);
+			rows++;
+		}
 	}
+	dbi_result_free(result);
+
+	return (rows);
+}
+
+/**
+ * Check if the last error of a connection means the connection
+ * itself is lost, rather than the statement being wrong
+ *
+ * @param dbi the connection
+ * @return TRUE if the connection must not be used again
+ */
+gboolean tagsistant_db_connection_is_broken(dbi_conn dbi)
+{
+	int error = tagsistant_db_error(dbi, NULL);
 
-	/* lock the pool */
-	g_mutex_lock(&tagsistant_connection_pool_lock);
+	if (error is DBI_ERROR_NOCONN) return (TRUE);
 
-	GList *pool = tagsistant_connection_pool;
-	while (pool) {
-		dbi = (dbi_conn) pool->data;
+	switch (dboptions.backend) {
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			return ((error is TAGSISTANT_MYSQL_SERVER_GONE) || (error is TAGSISTANT_MYSQL_SERVER_LOST));
 
-		/* check if the connection is still alive */
-		if (!dbi_conn_ping(dbi) && dbi_conn_connect(dbi) < 0) {
-			dbi_conn_close(dbi);
-			tagsistant_connection_pool = g_list_delete_link(tagsistant_connection_pool, pool);
-			tagsistant_active_connections--;
-		} else {
-			tagsistant_connection_pool = g_list_remove_link(tagsistant_connection_pool, pool);
-			g_list_free_1(pool);
+		case TAGSISTANT_DBI_SQLITE_BACKEND:
+			return ((error is TAGSISTANT_SQLITE_IOERR) || (error is TAGSISTANT_SQLITE_CANTOPEN));
+	}
+
+	return (FALSE);
+}
+
+/**
+ * Check if a connection is the writer connection
+ *
+ * @param dbi the connection
+ * @return TRUE if dbi is the writer connection
+ */
+gboolean tagsistant_db_connection_is_writer(dbi_conn dbi)
+{
+	return (dbi is tagsistant_writer_connection);
+}
+
+/**
+ * Apply a SQLite pragma to a connection
+ *
+ * @param dbi the connection
+ * @param pragma the pragma, as name=value
+ */
+static void tagsistant_db_connection_pragma(dbi_conn dbi, const gchar *pragma)
+{
+	gchar *statement = g_strdup_printf("pragma %s", pragma);
+	tagsistant_raw_query(statement, dbi, NULL, NULL);
+	g_free(statement);
+}
+
+/**
+ * Configure a connection just (re)connected
+ *
+ * @param dbi the connection
+ * @param writer TRUE for the writer connection
+ */
+void tagsistant_db_connection_setup(dbi_conn dbi, gboolean writer)
+{
+	static const gchar *default_pragmas[] = { TAGSISTANT_SQLITE_DEFAULT_PRAGMAS, NULL };
+	const gchar **pragma;
+
+	switch (dboptions.backend) {
+		case TAGSISTANT_DBI_SQLITE_BACKEND:
+			// WAL lets readers and the writer work concurrently
+			for (pragma = default_pragmas; *pragma; pragma++)
+				tagsistant_db_connection_pragma(dbi, *pragma);
+
+			// commits don't wait for the disk, the relaxed syncer thread does
+			if (tagsistant.relaxed_sync)
+				tagsistant_db_connection_pragma(dbi, "synchronous=NORMAL");
+
+			// the --sqlite-pragma ones come last and can override the defaults
+			if (tagsistant.sqlite_pragmas)
+				for (pragma = (const gchar **) tagsistant.sqlite_pragmas; *pragma; pragma++)
+					tagsistant_db_connection_pragma(dbi, *pragma);
 			break;
-		}
 
-		pool = pool->next;
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			// let readers and the writer work concurrently
+			tagsistant_query("set session transaction isolation level read committed", dbi, NULL, NULL);
+
+			// readers can still create the temporary tables of the RDS
+			if (!writer) tagsistant_query("set session transaction read only", dbi, NULL, NULL);
+			break;
 	}
+}
 
-	/*
-	 * unlock the pool mutex only if the backend is not SQLite
-	 */
-	g_mutex_unlock(&tagsistant_connection_pool_lock);
-
-	if (!dbi) {
-		// initialize DBI drivers
-		if (dboptions.backend is TAGSISTANT_DBI_MYSQL_BACKEND) {
-			if (!tagsistant_driver_is_available("mysql")) {
-				fprintf(stderr, "MySQL driver not installed\n");
-				dbg('s', LOG_ERR, "MySQL driver not installed");
-				exit (1);
-			}
+/**
+ * Create and connect a new DBI connection
+ *
+ * @param writer TRUE for the writer connection, FALSE for a reader
+ * @return DBI connection handle
+ */
+static dbi_conn tagsistant_db_connection_new(gboolean writer)
+{
+	dbi_conn dbi = NULL;
+
+	// initialize DBI drivers
+	if (dboptions.backend is TAGSISTANT_DBI_MYSQL_BACKEND) {
+		if (!tagsistant_driver_is_available("mysql")) {
+			fprintf(stderr, "MySQL driver not installed\n");
+			dbg('s', LOG_ERR, "MySQL driver not installed");
+			exit (1);
+		}
 
-			// unlucky, MySQL does not provide INTERSECT operator
-			tagsistant.sql_backend_have_intersect = 0;
+		// unlucky, MySQL does not provide INTERSECT operator
+		tagsistant.sql_backend_have_intersect = 0;
 
-			// create connection
+		// create connection
 #if TAGSISTANT_REENTRANT_DBI
-			dbi = dbi_conn_new_r("mysql", tagsistant.dbi_instance);
+		dbi = dbi_conn_new_r("mysql", tagsistant.dbi_instance);
 #else
-			dbi = dbi_conn_new("mysql");
+		dbi = dbi_conn_new("mysql");
 #endif
-			if (dbi is NULL) {
-				dbg('s', LOG_ERR, "Error creating MySQL connection");
-				exit (1);
-			}
+		if (dbi is NULL) {
+			dbg('s', LOG_ERR, "Error creating MySQL connection");
+			exit (1);
+		}
 
-			// set connection options
-			dbi_conn_set_option(dbi, "host",     dboptions.host);
-			dbi_conn_set_option(dbi, "dbname",   dboptions.db);
-			dbi_conn_set_option(dbi, "username", dboptions.username);
-			dbi_conn_set_option(dbi, "password", dboptions.password);
-			dbi_conn_set_option(dbi, "encoding", "UTF-8");
-
-		} else if (dboptions.backend is TAGSISTANT_DBI_SQLITE_BACKEND) {
-			if (!tagsistant_driver_is_available("sqlite3")) {
-				fprintf(stderr, "SQLite3 driver not installed\n");
-				dbg('s', LOG_ERR, "SQLite3 driver not installed");
-				exit(1);
-			}
+		// set connection options
+		dbi_conn_set_option(dbi, "host",     dboptions.host);
+		dbi_conn_set_option(dbi, "dbname",   dboptions.db);
+		dbi_conn_set_option(dbi, "username", dboptions.username);
+		dbi_conn_set_option(dbi, "password", dboptions.password);
+		dbi_conn_set_option(dbi, "encoding", "UTF-8");
+
+#if TAGSISTANT_NATIVE_SQLITE
+	} else if (dboptions.native) {
+		dbi = tagsistant_sqlite_open(writer);
+		if (dbi is NULL) exit (1);
+#endif
+
+	} else if (dboptions.backend is TAGSISTANT_DBI_SQLITE_BACKEND) {
+		if (!tagsistant_driver_is_available("sqlite3")) {
+			fprintf(stderr, "SQLite3 driver not installed\n");
+			dbg('s', LOG_ERR, "SQLite3 driver not installed");
+			exit(1);
+		}
 
-			// create connection
+		// create connection
 #if TAGSISTANT_REENTRANT_DBI
-			dbi = dbi_conn_new_r("sqlite3", tagsistant.dbi_instance);
+		dbi = dbi_conn_new_r("sqlite3", tagsistant.dbi_instance);
 #else
-			dbi = dbi_conn_new("sqlite3");
+		dbi = dbi_conn_new("sqlite3");
 #endif
-			if (dbi is NULL) {
-				dbg('s', LOG_ERR, "Error connecting to SQLite3");
-				exit (1);
-			}
+		if (dbi is NULL) {
+			dbg('s', LOG_ERR, "Error connecting to SQLite3");
+			exit (1);
+		}
 
-			// set connection options
-			dbi_conn_set_option(dbi, "dbname", "tags.sql");
-			dbi_conn_set_option(dbi, "sqlite3_dbdir", tagsistant.repository);
+		// set connection options
+		dbi_conn_set_option(dbi, "dbname", "tags.sql");
+		dbi_conn_set_option(dbi, "sqlite3_dbdir", tagsistant.repository);
 
-		} else {
+		// wait for the writer to checkpoint instead of failing with SQLITE_BUSY
+		dbi_conn_set_option_numeric(dbi, "sqlite3_timeout", TAGSISTANT_SQLITE_BUSY_TIMEOUT);
 
-			dbg('s', LOG_ERR, "No or wrong database family specified!");
-			exit (1);
-		}
+	} else {
 
-		// try to connect
-		if (dbi_conn_connect(dbi) < 0) {
-			int error = dbi_conn_error(dbi, NULL);
-			dbg('s', LOG_ERR, "Could not connect to DB (error %d). Please check the --db settings", error);
-			exit(1);
-		}
+		dbg('s', LOG_ERR, "No or wrong database family specified!");
+		exit (1);
+	}
+
+	// try to connect
+	if (!dboptions.native && dbi_conn_connect(dbi) < 0) {
+		int error = dbi_conn_error(dbi, NULL);
+		dbg('s', LOG_ERR, "Could not connect to DB (error %d). Please check the --db settings", error);
+		exit(1);
+	}
+
+	tagsistant_db_connection_setup(dbi, writer);
+
+	g_atomic_int_inc(&tagsistant_active_connections);
 
-		tagsistant_active_connections++;
+	dbg('s', LOG_INFO, "SQL connection established");
 
-		dbg('s', LOG_INFO, "SQL connection established");
+	return (dbi);
+}
+
+/**
+ * Close a connection
+ *
+ * @param dbi the connection
+ */
+static void tagsistant_db_connection_close(dbi_conn dbi)
+{
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native)
+		tagsistant_sqlite_close(dbi);
+	else
+#endif
+	dbi_conn_close(dbi);
+	g_atomic_int_add(&tagsistant_active_connections, -1);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** Group commit. With --group-commit=MS, the writers share one transaction, a   ***/
+/*** batch: each operation runs inside a savepoint, so it can still be rolled     ***/
+/*** back alone, and the batch is committed by the first operation releasing the  ***/
+/*** writer connection while no other writer is queued, or when the batch is      ***/
+/*** MS milliseconds old or holds TAGSISTANT_GROUP_COMMIT_MAX_OPS operations. The  ***/
+/*** other operations of the batch wait for that commit before returning, so one  ***/
+/*** fsync makes all of them durable. A sequential writer never waits: nobody is  ***/
+/*** queued behind it, so each operation commits its own batch as before.         ***/
+/***                                                                              ***/
+/*** With --relaxed-sync=MS the commits don't wait for the disk at all: SQLite    ***/
+/*** connections run with synchronous=NORMAL and the journal is synced every MS   ***/
+/*** milliseconds, so a crash loses at most the last MS milliseconds of writes.   ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/**
+ * A batch of writer operations sharing one transaction
+ */
+typedef struct {
+	/** TRUE once the batch has been committed or rolled back */
+	gboolean done;
+
+	/** TRUE if the batch has been committed */
+	gboolean committed;
+
+	/** the operations holding the batch, plus one while it's open */
+	gint refs;
+} tagsistant_batch;
+
+/** the open batch, NULL if none */
+static tagsistant_batch *tagsistant_open_batch = NULL;
+
+/** the operations done in the open batch */
+static gint tagsistant_batch_operations = 0;
+
+/** when the open batch has started */
+static gint64 tagsistant_batch_started = 0;
+
+/** the WAL records logged by the batch before the current operation */
+static guint tagsistant_batch_wal_mark = 0;
+
+/** the writers queued on tagsistant_writer_lock */
+static gint tagsistant_writers_waiting = 0;
+
+/** signal the end of a batch */
+static GMutex tagsistant_batch_lock;
+static GCond tagsistant_batch_cond;
+
+/** group commit statistics */
+static gint tagsistant_batch_commits = 0;
+static gint tagsistant_batch_operations_committed = 0;
+static gint tagsistant_batch_failures = 0;
+
+/**
+ * An action restoring the in-memory state (RDS, tag index, tag
+ * dictionary) changed by a writer transaction that gets rolled back
+ */
+typedef struct {
+	tagsistant_undo_callback callback;
+	gpointer data;
+	GDestroyNotify free_data;
+} tagsistant_undo;
+
+/** the undo actions of the writer transaction, guarded by tagsistant_writer_lock */
+static GPtrArray *tagsistant_undo_log = NULL;
+
+/** the undo actions registered by the batch before the current operation */
+static guint tagsistant_batch_undo_mark = 0;
+
+/** the undo log is being replayed */
+static gboolean tagsistant_undoing = FALSE;
+
+/**
+ * Register an action restoring the in-memory state changed inside
+ * the transaction of the writer connection, should the transaction
+ * (or the operation, inside a batch) be rolled back. The action runs
+ * on the writer connection after the rollback, so it can reload the
+ * state from the database. Reader connections don't change anything,
+ * so the action is just dropped.
+ *
+ * @param dbi the connection the change has been done on
+ * @param callback the undo action
+ * @param data the data passed to the action
+ * @param free_data frees data when the action is run or dropped (may be NULL)
+ */
+void tagsistant_db_on_rollback(dbi_conn dbi, tagsistant_undo_callback callback, gpointer data, GDestroyNotify free_data)
+{
+	if (tagsistant_undoing || !tagsistant_db_connection_is_writer(dbi)) {
+		if (free_data) free_data(data);
+		return;
 	}
 
-	/* start a transaction */
-	if (start_transaction) {
+	if (!tagsistant_undo_log) tagsistant_undo_log = g_ptr_array_new();
+
+	tagsistant_undo *undo = g_new0(tagsistant_undo, 1);
+	undo->callback = callback;
+	undo->data = data;
+	undo->free_data = free_data;
+
+	g_ptr_array_add(tagsistant_undo_log, undo);
+}
+
+/**
+ * Run, newest first, the undo actions registered after a mark and
+ * drop them. Called on the writer connection, after the rollback.
+ *
+ * @param dbi the writer connection
+ * @param mark the undo actions to keep
+ * @param run FALSE to drop the actions without running them
+ */
+static void tagsistant_db_undo(dbi_conn dbi, guint mark, gboolean run)
+{
+	if (!tagsistant_undo_log) return;
+
+	tagsistant_undoing = TRUE;
+
+	while (tagsistant_undo_log->len > mark) {
+		tagsistant_undo *undo = g_ptr_array_index(tagsistant_undo_log, tagsistant_undo_log->len - 1);
+		g_ptr_array_remove_index(tagsistant_undo_log, tagsistant_undo_log->len - 1);
+
+		if (run) undo->callback(dbi, undo->data);
+		if (undo->free_data) undo->free_data(undo->data);
+		g_free(undo);
+	}
+
+	tagsistant_undoing = FALSE;
+}
+
+/**
+ * Count the undo actions registered so far
+ */
+static guint tagsistant_db_undo_mark()
+{
+	return (tagsistant_undo_log ? tagsistant_undo_log->len : 0);
+}
+
+/**
+ * Check if writer operations are grouped in batches
+ */
+static gboolean tagsistant_db_group_commit()
+{
+	return ((tagsistant.group_commit > 0) && !tagsistant.relaxed_sync);
+}
+
+/**
+ * Begin a transaction on the writer connection
+ *
+ * @param dbi the writer connection
+ */
+static void tagsistant_db_begin(dbi_conn dbi)
+{
 #if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
-		switch (tagsistant.sql_database_driver) {
-			case TAGSISTANT_DBI_SQLITE_BACKEND:
-				tagsistant_query("begin transaction", dbi, NULL, NULL);
-				break;
+	switch (tagsistant.sql_database_driver) {
+		case TAGSISTANT_DBI_SQLITE_BACKEND:
+			tagsistant_query("begin transaction", dbi, NULL, NULL);
+			break;
 
-			case TAGSISTANT_DBI_MYSQL_BACKEND:
-				tagsistant_query("start transaction", dbi, NULL, NULL);
-				break;
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			tagsistant_query("start transaction", dbi, NULL, NULL);
+			break;
+	}
+#else
+	dbi_conn_transaction_begin(dbi);
+#endif
+}
+
+/**
+ * Write the WAL records of the writer transaction and save their
+ * last LSN inside the transaction, right before it's committed
+ *
+ * @param dbi the writer connection
+ * @param lsn filled with the LSN saved, 0 if no record was written
+ * @return FALSE if the LSN can't be saved, so the transaction must
+ *   not be committed
+ */
+static gboolean tagsistant_db_wal_flush(dbi_conn dbi, guint64 *lsn)
+{
+	*lsn = tagsistant_wal_flush();
+	if (!*lsn) return (TRUE);
+
+	gchar *query = g_strdup_printf("update status set value = '%" G_GUINT64_FORMAT "' where state = 'wal_lsn'", *lsn);
+	int res = tagsistant_db_execute(dbi, query, NULL, NULL);
+	g_free(query);
+
+	if (res is -1) {
+		const char *errmsg = NULL;
+		tagsistant_db_error(dbi, &errmsg);
+		if (errmsg) dbg('s', LOG_ERR, "WAL: error saving LSN %" G_GUINT64_FORMAT ": %s", *lsn, errmsg);
+		return (FALSE);
+	}
+
+	return (TRUE);
+}
+
+/**
+ * Commit the writer transaction, saving the LSN of its WAL records.
+ * On error the transaction is rolled back, so the connection can
+ * begin a new one, and its WAL records are dropped.
+ *
+ * @param dbi the writer connection
+ * @return TRUE if committed
+ */
+static gboolean tagsistant_db_writer_commit(dbi_conn dbi)
+{
+	guint64 lsn = 0;
+	gboolean committed = tagsistant_db_wal_flush(dbi, &lsn);
+
+	if (committed) {
+#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
+		tagsistant_query("commit", dbi, NULL, NULL);
+#else
+		dbi_conn_transaction_commit(dbi);
+#endif
+
+		const char *errmsg = NULL;
+		if (tagsistant_db_error(dbi, &errmsg)) {
+			dbg('s', LOG_ERR, "Error committing: %s", errmsg ? errmsg : "unknown error");
+			committed = FALSE;
 		}
+	}
+
+	if (committed) {
+		if (lsn) tagsistant_wal_committed(lsn);
+		tagsistant_db_undo(dbi, 0, FALSE);
+
+		/* the transaction changed the metadata: the kernel must look the paths up again */
+		if (lsn) tagsistant_kernel_cache_invalidate();
+	} else {
+		if (lsn) tagsistant_wal_discard();
+
+#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
+		tagsistant_query("rollback", dbi, NULL, NULL);
+#else
+		dbi_conn_transaction_rollback(dbi);
+#endif
+		tagsistant_db_undo(dbi, 0, TRUE);
+	}
+
+	return (committed);
+}
+
+/**
+ * Release a reference to a batch
+ */
+static void tagsistant_db_batch_unref(tagsistant_batch *batch)
+{
+	if (g_atomic_int_dec_and_test(&batch->refs)) g_free(batch);
+}
+
+/**
+ * Commit the open batch and wake up the operations waiting for it.
+ * Must be called with tagsistant_writer_lock held.
+ *
+ * @param dbi the writer connection
+ */
+static void tagsistant_db_batch_commit(dbi_conn dbi)
+{
+	tagsistant_batch *batch = tagsistant_open_batch;
+	if (!batch) return;
+
+	tagsistant_open_batch = NULL;
+
+	gboolean committed = tagsistant_db_writer_commit(dbi);
+	if (committed) {
+		tagsistant_batch_commits++;
+		tagsistant_batch_operations_committed += tagsistant_batch_operations;
+	} else {
+		dbg('s', LOG_ERR, "%d grouped operations rolled back", tagsistant_batch_operations);
+		tagsistant_batch_failures++;
+	}
+
+	g_atomic_int_inc(&tagsistant_write_epoch);
+
+	g_mutex_lock(&tagsistant_batch_lock);
+	batch->committed = committed;
+	batch->done = TRUE;
+	g_cond_broadcast(&tagsistant_batch_cond);
+	g_mutex_unlock(&tagsistant_batch_lock);
+
+	tagsistant_db_batch_unref(batch);
+}
+
+/**
+ * Check if the open batch must be committed now. Must be
+ * called with tagsistant_writer_lock held.
+ */
+static gboolean tagsistant_db_batch_is_due()
+{
+	if (!g_atomic_int_get(&tagsistant_writers_waiting)) return (TRUE);
+	if (tagsistant_batch_operations >= TAGSISTANT_GROUP_COMMIT_MAX_OPS) return (TRUE);
+
+	return (g_get_monotonic_time() - tagsistant_batch_started >= (gint64) tagsistant.group_commit * 1000);
+}
+
+/**
+ * Wait for the end of a batch and release it
+ *
+ * @param batch the batch
+ * @return TRUE if the batch has been committed
+ */
+static gboolean tagsistant_db_batch_wait(tagsistant_batch *batch)
+{
+	g_mutex_lock(&tagsistant_batch_lock);
+	while (!batch->done)
+		g_cond_wait(&tagsistant_batch_cond, &tagsistant_batch_lock);
+	gboolean committed = batch->committed;
+	g_mutex_unlock(&tagsistant_batch_lock);
+
+	tagsistant_db_batch_unref(batch);
+
+	return (committed);
+}
+
+/**
+ * Commit the transaction of a connection. Inside a batch, only
+ * the savepoint of the operation is released: the outcome of the
+ * batch is returned by tagsistant_db_connection_release().
+ *
+ * @param dbi the connection
+ * @return TRUE on success
+ */
+gboolean tagsistant_db_commit(dbi_conn dbi)
+{
+	if (!tagsistant_db_connection_is_writer(dbi)) {
+		/* a reader has nothing to make durable */
+#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
+		tagsistant_query("commit", dbi, NULL, NULL);
+#else
+		dbi_conn_transaction_commit(dbi);
+#endif
+		return (TRUE);
+	}
+
+	if (tagsistant_open_batch) {
+		tagsistant_query("release savepoint tagsistant_operation", dbi, NULL, NULL);
+		return (!tagsistant_db_error(dbi, NULL));
+	}
+
+	return (tagsistant_db_writer_commit(dbi));
+}
+
+/**
+ * Roll back the transaction of a connection. Inside a batch, only
+ * the operation is rolled back, up to its savepoint.
+ *
+ * @param dbi the connection
+ */
+void tagsistant_db_rollback(dbi_conn dbi)
+{
+	if (tagsistant_open_batch && tagsistant_db_connection_is_writer(dbi)) {
+		tagsistant_query("rollback to savepoint tagsistant_operation", dbi, NULL, NULL);
+		tagsistant_query("release savepoint tagsistant_operation", dbi, NULL, NULL);
+		tagsistant_wal_rewind(tagsistant_batch_wal_mark);
+		tagsistant_db_undo(dbi, tagsistant_batch_undo_mark, TRUE);
+	} else {
+		if (tagsistant_db_connection_is_writer(dbi)) tagsistant_wal_rewind(0);
+
+#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
+		tagsistant_query("rollback", dbi, NULL, NULL);
 #else
-		dbi_conn_transaction_begin(dbi);
+		dbi_conn_transaction_rollback(dbi);
 #endif
+
+		if (tagsistant_db_connection_is_writer(dbi)) tagsistant_db_undo(dbi, 0, TRUE);
+	}
+}
+
+/**
+ * Sync the WAL segment and the SQLite journal every --relaxed-sync milliseconds
+ */
+static gpointer tagsistant_db_relaxed_syncer(gpointer data)
+{
+	(void) data;
+
+	gchar *journal = g_build_filename(tagsistant.repository, "tags.sql-wal", NULL);
+
+	while (1) {
+		g_usleep((gulong) tagsistant.relaxed_sync * 1000);
+		tagsistant_wal_fsync();
+
+		int fd = open(journal, O_RDONLY);
+		if (fd is -1) continue;
+
+		if (fsync(fd) is -1) dbg('s', LOG_ERR, "Error syncing %s: %s", journal, strerror(errno));
+		close(fd);
+	}
+
+	return (NULL);
+}
+
+/**
+ * Check out a reader connection: an idle one if available, a new one if
+ * the pool is below --db-pool-max, otherwise wait for one to be released
+ *
+ * @return DBI connection handle
+ */
+static dbi_conn tagsistant_db_connection_checkout_reader()
+{
+	dbi_conn dbi = g_async_queue_try_pop(tagsistant_connection_pool);
+	if (dbi) return (dbi);
+
+	/* reserve a slot for a new connection */
+	if (g_atomic_int_add(&tagsistant_reader_connections, 1) < tagsistant.db_pool_max)
+		return (tagsistant_db_connection_new(FALSE));
+
+	g_atomic_int_add(&tagsistant_reader_connections, -1);
+
+	/*
+	 * the pool is full, wait for a release. The wait is bounded, so a
+	 * slot freed by closing a broken connection is not missed
+	 */
+	gint64 start = g_get_monotonic_time();
+	while (!dbi) {
+		dbi = g_async_queue_timeout_pop(tagsistant_connection_pool, TAGSISTANT_DB_POOL_WAIT * 1000);
+		if (dbi) break;
+
+		if (g_atomic_int_add(&tagsistant_reader_connections, 1) < tagsistant.db_pool_max) {
+			dbi = tagsistant_db_connection_new(FALSE);
+		} else {
+			g_atomic_int_add(&tagsistant_reader_connections, -1);
+		}
+	}
+
+	g_mutex_lock(&tagsistant_connection_stats_lock);
+	tagsistant_connection_waits++;
+	tagsistant_connection_wait_time += g_get_monotonic_time() - start;
+	g_mutex_unlock(&tagsistant_connection_stats_lock);
+
+	return (dbi);
+}
+
+/**
+ * Get a DBI connection. Readers get a connection from the
+ * reader pool without any lock, writers wait their turn for
+ * the writer connection and the schema changes exclude everyone.
+ *
+ * @param start_transaction TAGSISTANT_DONT_START_TRANSACTION for readers,
+ *   TAGSISTANT_START_TRANSACTION for writers and
+ *   TAGSISTANT_SCHEMA_TRANSACTION for schema changes
+ * @return DBI connection handle
+ */
+dbi_conn *tagsistant_db_connection(int start_transaction)
+{
+	/* DBI connection handler used by subsequent calls to dbi_* functions */
+	dbi_conn dbi = NULL;
+
+	if (start_transaction is TAGSISTANT_SCHEMA_TRANSACTION) {
+		dbg('s', LOG_INFO, "Writer-locking query rwlock");
+		g_rw_lock_writer_lock(&tagsistant_query_rwlock);
+	} else {
+		g_rw_lock_reader_lock(&tagsistant_query_rwlock);
+	}
+
+	g_atomic_int_inc(&tagsistant_connection_checkouts);
+
+	if (!start_transaction) return (tagsistant_db_connection_checkout_reader());
+
+	g_atomic_int_inc(&tagsistant_writers_waiting);
+	g_mutex_lock(&tagsistant_writer_lock);
+	g_atomic_int_add(&tagsistant_writers_waiting, -1);
+
+	if (!tagsistant_writer_connection) tagsistant_writer_connection = tagsistant_db_connection_new(TRUE);
+	dbi = tagsistant_writer_connection;
+
+	if ((start_transaction is TAGSISTANT_START_TRANSACTION) && tagsistant_db_group_commit()) {
+		/* join the open batch or start a new one */
+		if (!tagsistant_open_batch) {
+			g_atomic_int_inc(&tagsistant_write_epoch);
+			tagsistant_db_begin(dbi);
+			tagsistant_open_batch = g_new0(tagsistant_batch, 1);
+			tagsistant_open_batch->refs = 1;
+			tagsistant_batch_operations = 0;
+			tagsistant_batch_started = g_get_monotonic_time();
+		}
+
+		tagsistant_query("savepoint tagsistant_operation", dbi, NULL, NULL);
+		tagsistant_batch_wal_mark = tagsistant_wal_mark();
+		tagsistant_batch_undo_mark = tagsistant_db_undo_mark();
+	} else {
+		/* schema changes don't join a batch */
+		tagsistant_db_batch_commit(dbi);
+
+		g_atomic_int_inc(&tagsistant_write_epoch);
+		tagsistant_db_begin(dbi);
 	}
 
 	return(dbi);
 }
 
 /**
- * Release a DBI connection
+ * Release a DBI connection. A writer inside a batch commits the
+ * batch if it's due, otherwise waits for another writer to commit it.
  *
  * @param dbi the connection to be released
+ * @param start_transaction the same value passed to tagsistant_db_connection()
+ * @return FALSE if the batch of the operation has been rolled back
  */
-void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_locked)
+gboolean tagsistant_db_connection_release(dbi_conn dbi, int start_transaction)
 {
-	/* release the connection back to the pool */
-	g_mutex_lock(&tagsistant_connection_pool_lock);
-	tagsistant_connection_pool = g_list_prepend(tagsistant_connection_pool, dbi);
-	g_mutex_unlock(&tagsistant_connection_pool_lock);
+	tagsistant_batch *batch = NULL;
+
+	if (start_transaction) {
+		if (tagsistant_open_batch) {
+			batch = tagsistant_open_batch;
+			g_atomic_int_inc(&batch->refs);
+			tagsistant_batch_operations++;
+
+			if (tagsistant_db_batch_is_due() || tagsistant_db_connection_is_broken(dbi))
+				tagsistant_db_batch_commit(dbi);
+		} else {
+			g_atomic_int_inc(&tagsistant_write_epoch);
+		}
+	}
+
+	gboolean broken = tagsistant_db_connection_is_broken(dbi);
+
+	if (broken) {
+		dbg('s', LOG_ERR, "Closing a broken SQL connection");
+		g_atomic_int_inc(&tagsistant_connection_broken);
+		tagsistant_db_connection_close(dbi);
+	}
+
+	if (start_transaction) {
+		if (broken) tagsistant_writer_connection = NULL;
+		g_mutex_unlock(&tagsistant_writer_lock);
+	} else if (broken) {
+		/* hand a new connection to the readers waiting for a free slot */
+		if (g_async_queue_length(tagsistant_connection_pool) < 0) {
+			g_async_queue_push(tagsistant_connection_pool, tagsistant_db_connection_new(FALSE));
+		} else {
+			g_atomic_int_add(&tagsistant_reader_connections, -1);
+		}
+	} else {
+		g_async_queue_push(tagsistant_connection_pool, dbi);
+	}
 
-	if (is_writer_locked) {
-		dbg('s', LOG_ERR, "Writer-un-locking query rwlock");
+	if (start_transaction is TAGSISTANT_SCHEMA_TRANSACTION) {
+		dbg('s', LOG_INFO, "Writer-un-locking query rwlock");
 		g_rw_lock_writer_unlock(&tagsistant_query_rwlock);
 	} else {
-		dbg('s', LOG_ERR, "Reader-un-locking query rwlock");
 		g_rw_lock_reader_unlock(&tagsistant_query_rwlock);
 	}
+
+	/* the operation is complete only when its batch is durable */
+	if (batch) return (tagsistant_db_batch_wait(batch));
+
+	return (TRUE);
+}
+
+/**
+ * Check if an idle connection is still alive, reconnecting it if needed
+ *
+ * @param dbi the connection
+ * @return TRUE if the connection can be used
+ */
+static gboolean tagsistant_db_connection_check(dbi_conn dbi)
+{
+	/* a native SQLite connection is a local file, nothing to ping */
+	if (dboptions.native) return (TRUE);
+
+	if (dbi_conn_ping(dbi)) return (TRUE);
+	if (dbi_conn_connect(dbi) < 0) return (FALSE);
+
+	tagsistant_db_connection_setup(dbi, tagsistant_db_connection_is_writer(dbi));
+	return (TRUE);
+}
+
+/**
+ * Ping the idle connections every TAGSISTANT_DB_PING_INTERVAL seconds,
+ * closing the dead ones and keeping at least --db-pool-min readers open
+ */
+static gpointer tagsistant_db_pinger(gpointer data)
+{
+	(void) data;
+
+	while (1) {
+		sleep(TAGSISTANT_DB_PING_INTERVAL);
+
+		/* check the idle readers, without blocking the ones checked out meanwhile */
+		gint idle = g_async_queue_length(tagsistant_connection_pool);
+		GList *alive = NULL;
+
+		while (idle-- > 0) {
+			dbi_conn dbi = g_async_queue_try_pop(tagsistant_connection_pool);
+			if (!dbi) break;
+
+			if (tagsistant_db_connection_check(dbi)) {
+				alive = g_list_prepend(alive, dbi);
+			} else {
+				dbg('s', LOG_ERR, "Closing a dead SQL connection");
+				g_atomic_int_inc(&tagsistant_connection_broken);
+				tagsistant_db_connection_close(dbi);
+				g_atomic_int_add(&tagsistant_reader_connections, -1);
+			}
+		}
+
+		GList *ptr;
+		for (ptr = alive; ptr; ptr = ptr->next) g_async_queue_push(tagsistant_connection_pool, ptr->data);
+		g_list_free(alive);
+
+		/* refill the pool */
+		while (g_atomic_int_get(&tagsistant_reader_connections) < tagsistant.db_pool_min) {
+			g_atomic_int_inc(&tagsistant_reader_connections);
+			g_async_queue_push(tagsistant_connection_pool, tagsistant_db_connection_new(FALSE));
+		}
+
+		/* check the writer connection, if no writer or batch is using it */
+		if (g_mutex_trylock(&tagsistant_writer_lock)) {
+			if (tagsistant_writer_connection && !tagsistant_open_batch && !tagsistant_db_connection_check(tagsistant_writer_connection)) {
+				dbg('s', LOG_ERR, "Closing the dead SQL writer connection");
+				g_atomic_int_inc(&tagsistant_connection_broken);
+				tagsistant_db_connection_close(tagsistant_writer_connection);
+				tagsistant_writer_connection = NULL;
+			}
+			g_mutex_unlock(&tagsistant_writer_lock);
+		}
+	}
+
+	return (NULL);
+}
+
+/**
+ * Setup the connection pool and start the pinger thread
+ */
+void tagsistant_db_pool_init()
+{
+	tagsistant_connection_pool = g_async_queue_new();
+	g_thread_new("DB pinger thread", tagsistant_db_pinger, NULL);
+
+	if (!tagsistant.relaxed_sync) return;
+
+	g_thread_new("DB relaxed syncer thread", tagsistant_db_relaxed_syncer, NULL);
+
+	if (dboptions.backend is TAGSISTANT_DBI_MYSQL_BACKEND)
+		dbg('s', LOG_WARNING, "--relaxed-sync on MySQL requires innodb_flush_log_at_trx_commit=2 on the server");
+}
+
+/**
+ * Print the connection pool statistics
+ *
+ * @param buffer the output buffer
+ * @param size the size of the buffer
+ */
+void tagsistant_db_connection_stats(gchar *buffer, size_t size)
+{
+	g_mutex_lock(&tagsistant_connection_stats_lock);
+	gint waits = tagsistant_connection_waits;
+	gint64 wait_time = tagsistant_connection_wait_time;
+	g_mutex_unlock(&tagsistant_connection_stats_lock);
+
+	g_snprintf(buffer, size,
+		"# of SQL open connections: %d\n"
+		"# of idle reader connections: %d (min: %d, max: %d)\n"
+		"# of connection checkouts: %d\n"
+		"# of checkouts waiting: %d (%" G_GINT64_FORMAT " us total)\n"
+		"# of broken connections closed: %d\n"
+		"# of group commits: %d (%d operations, %d failed, window: %dms)\n"
+		"relaxed sync: %dms\n",
+		g_atomic_int_get(&tagsistant_active_connections),
+		g_async_queue_length(tagsistant_connection_pool),
+		tagsistant.db_pool_min, tagsistant.db_pool_max,
+		g_atomic_int_get(&tagsistant_connection_checkouts),
+		waits, wait_time,
+		g_atomic_int_get(&tagsistant_connection_broken),
+		tagsistant_batch_commits, tagsistant_batch_operations_committed, tagsistant_batch_failures,
+		tagsistant_db_group_commit() ? tagsistant.group_commit : 0,
+		tagsistant.relaxed_sync);
+}
+
+/**
+ * Take a snapshot ticket before reading data to be cached in memory.
+ * Readers no longer wait for writers, so a reader can load rows a
+ * concurrent writer is changing, after the writer invalidated the
+ * in-memory caches.
+ *
+ * @return the ticket, to be passed to tagsistant_db_snapshot_is_current()
+ */
+gint tagsistant_db_snapshot()
+{
+	return (g_atomic_int_get(&tagsistant_write_epoch));
+}
+
+/**
+ * Check if data read after taking a ticket can be cached
+ *
+ * @param ticket the ticket returned by tagsistant_db_snapshot()
+ * @return TRUE if no write transaction was open or has been
+ *   committed since the ticket was taken
+ */
+gboolean tagsistant_db_snapshot_is_current(gint ticket)
+{
+	return (!(ticket & 1) && (g_atomic_int_get(&tagsistant_write_epoch) is ticket));
 }
 
 gchar *tagsistant_get_timestamp()
@@ -417,7 +1316,7 @@ gchar *tagsistant_get_timestamp()
  */
 void tagsistant_create_schema()
 {
-	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_SCHEMA_TRANSACTION);
 	gchar *current_schema_version = NULL;
 
 	// create database schema
@@ -662,188 +1561,9 @@ void tagsistant_create_schema()
 	}
 
 	tagsistant_commit_transaction(dbi);
-	tagsistant_db_connection_release(dbi, 1);
-}
-
-GRegex *wal_pattern = NULL;
-
-gboolean tagsistant_wal_apply_line(dbi_conn dbi, const gchar *line, const gchar *last_tstamp)
-{
-	gboolean retcode = FALSE;
-
-	GMatchInfo *info;
-	if (!g_regex_match(wal_pattern, line, 0, &info)) {
-		dbg('s', LOG_ERR, "WAL: malformed log entry %s", line);
-		return (FALSE);
-	}
-
-	gchar *tstamp = g_match_info_fetch(info, 1);
-	gchar *statement = g_match_info_fetch(info, 2);
-
-	if (strcmp(tstamp, last_tstamp) > 0) {
-		/*
-		 * execute the statement
-		 */
-		dbi_result result = dbi_conn_query(dbi, statement);
-		if (!result) {
-			const char *errmsg = NULL;
-			dbi_conn_error(dbi, &errmsg);
-			if (errmsg) dbg('s', LOG_ERR, "WAL: Error syncing [%s]: %s", statement, errmsg);
-		} else {
-			retcode = TRUE;
-		}
-	} else {
-		retcode = TRUE;
-	}
-
-	g_free(tstamp);
-	g_free(statement);
-	g_match_info_free(info);
-	return (retcode);
-}
-
-gboolean tagsistant_wal_apply_log(dbi_conn dbi, const gchar *log_entry, const gchar *last_tstamp)
-{
-	gboolean parsed = FALSE;
-
-	gchar *wal_entry_path = g_strdup_printf("%s/wal/%s", tagsistant.repository, log_entry);
-	if (!wal_entry_path) {
-		dbg('s', LOG_ERR, "WAL: error opening %s/wal/%s", tagsistant.repository, log_entry);
-		return (FALSE);
-	}
-
-	GFile *f = g_file_new_for_path(wal_entry_path);
-	if (f) {
-		GFileInputStream *s = g_file_read(f, NULL, NULL);
-		if (s) {
-			GDataInputStream *ds = g_data_input_stream_new(G_INPUT_STREAM(s));
-			if (ds) {
-				while (1) {
-					gsize size;
-					GError *error = NULL;
-					gchar *line = g_data_input_stream_read_line(ds, &size, NULL, &error);
-					if (line) {
-						if (!tagsistant_wal_apply_line(dbi, line, last_tstamp)) break;
-					} else {
-						if (!error) {
-							// last line read
-							parsed = TRUE;
-						} else {
-							dbg('s', LOG_ERR, "WAL: error parsing line: %s", error->message);
-							g_error_free(error);
-						}
-						break;
-					}
-				}
-				g_object_unref(ds);
-			}
-			g_object_unref(s);
-		}
-		g_object_unref(f);
-	}
-	g_free(wal_entry_path);
-
-	return (parsed);
-}
-
-void tagsistant_wal_sync()
-{
-	/*
-	 * compile the WAL pattern regex
-	 */
-	if (!wal_pattern) wal_pattern = g_regex_new("([^:]+): (.*)", G_REGEX_EXTENDED|G_REGEX_CASELESS, 0, NULL);
-
-	/*
-	 * compute the wal directory path
-	 */
-	gchar *wal_dir = g_strdup_printf("%s/wal", tagsistant.repository);
-	if (!wal_dir) {
-		dbg('s', LOG_ERR, "WAL: error restoring the WAL");
-		exit (1);
-	}
-
-	/*
-	 * open a DB connection
-	 */
-	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
-	gboolean commit = FALSE;
-
-	/*
-	 * load the last timestamp inserted
-	 */
-	gchar *last_tstamp = NULL;
-	tagsistant_query(
-		"select value from status where state = 'wal_timestamp'",
-		dbi, tagsistant_return_string, &last_tstamp);
-
-	if (!last_tstamp) {
-		/*
-		 * check if this is an empty filesystem
-		 */
-		int entries = 0;
-		tagsistant_query(
-			"select sum(entries) as entries from ("
-				"select count(*) as entries from objects "
-				"union all "
-				"select count(*) as entries from tags "
-			")",
-			dbi, tagsistant_return_integer, &entries);
-
-		if (entries) {
-			dbg('s', LOG_ERR, "WAL: error loading last timestamp, can't proceed");
-			exit (1);
-		} else {
-			dbg('s', LOG_INFO, "WAL: skipping sync on empty repository");
-			tagsistant_rollback_transaction(dbi);
-			tagsistant_db_connection_release(dbi, 1);
-			g_free(wal_dir);
-			return;
-		}
-	}
-
-	/*
-	 * open the WAL directory and scan its files
-	 */
-	GError *error = NULL;
-	GDir *dir = g_dir_open(wal_dir, 0, &error);
-	if (dir) {
-		const gchar *entry;
-		while (1) {
-			entry = g_dir_read_name(dir);
-			if (!entry) {
-				commit = TRUE;
-				break;
-			}
-
-			if (!tagsistant_wal_apply_log(dbi, entry, last_tstamp)) break;
-		}
-		g_dir_close(dir);
-	} else {
-		dbg('s', LOG_ERR, "WAL: error opening directory: %s", error->message);
-		g_error_free(error);
-	}
-
-	/*
-	 * on positive sync, commit the transaction, otherwise roll back
-	 */
-	if (commit)
-		tagsistant_commit_transaction(dbi);
-	else
-		tagsistant_rollback_transaction(dbi);
-
-	tagsistant_db_connection_release(dbi, 1);
-	g_free(wal_dir);
-
-	/*
-	 * if unable to sync the WAL, exit to avoid mounting a compromised database
-	 */
-	if (!commit) {
-		dbg('s', LOG_ERR, "WAL: error merging write-ahead logs into DB, can't mount a compromised repository");
-		exit (1);
-	}
+	tagsistant_db_connection_release(dbi, TAGSISTANT_SCHEMA_TRANSACTION);
 }
 
-
 /**
  * Update a status value
  *
@@ -860,12 +1580,12 @@ void tagsistant_save_status(dbi_conn dbi, gchar *key, gchar *value)
 	query = g_strdup_printf("delete from status where state = '%s'", key);
 	if (!query) return;
 
-	dbi_result result = dbi_conn_query(dbi, query);
+	int res = tagsistant_db_execute(dbi, query, NULL, NULL);
 	g_free(query);
 
-	if (!result) {
+	if (res is -1) {
 		const char *errmsg = NULL;
-		dbi_conn_error(dbi, &errmsg);
+		tagsistant_db_error(dbi, &errmsg);
 		if (errmsg) dbg('s', LOG_ERR, "Error saving status %s => %s: %s", key, value, errmsg);
 		return;
 	}
@@ -873,104 +1593,108 @@ void tagsistant_save_status(dbi_conn dbi, gchar *key, gchar *value)
 	query = g_strdup_printf("insert into status values ('%s', '%s')", key, value);
 	if (!query) return;
 
-	result = dbi_conn_query(dbi, query);
+	res = tagsistant_db_execute(dbi, query, NULL, NULL);
 	g_free(query);
 
-	if (!result) {
+	if (res is -1) {
 		const char *errmsg = NULL;
-		dbi_conn_error(dbi, &errmsg);
+		tagsistant_db_error(dbi, &errmsg);
 		if (errmsg) dbg('s', LOG_ERR, "Error saving status %s => %s: %s", key, value, errmsg);
 	}
 }
 
 /**
- * Record eligible queries into the write ahead log
+ * Run a formatted and escaped SQL statement
  *
- * @param dbi a DBI active connection (no ping is done)
- * @param statement the SQL query to save
+ * @param dbi a dbi_conn connection
+ * @param statement the SQL statement
+ * @param operation the operation to be written into the WAL
+ * @param callback pointer to function to be called on results of SQL query
+ * @param file the file where the query has been issued
+ * @param line the file line where the query has been issued
+ * @param firstarg pointer to buffer for callback returned data
+ * @return the number of selected rows
  */
-void tagsistant_wal(dbi_conn dbi, gchar *statement)
+static int
+tagsistant_execute(
+	dbi_conn dbi,
+	const gchar *statement,
+	tagsistant_wal_operation operation,
+	tagsistant_query_callback callback,
+	char *file,
+	int line,
+	void *firstarg)
 {
-	static int fd = -1;
-
 	/*
-	 * Guess if a statement is eligible for being written into the WAL
+	 * check if connection has been created
 	 */
-	if (!g_regex_match_simple(
-		"^(insert[ ]*into|update|delete[ ]*from)[ ]*(tags|objects|relations|tagging|aliases).*$",
-		statement, G_REGEX_CASELESS|G_REGEX_EXTENDED, 0)) return;
-
-	dbg('s', LOG_ERR, "Saving WAL: %s", statement);
+	if (dbi is NULL) {
+		dbg('s', LOG_ERR, "ERROR! DBI connection was not initialized!");
+		return (0);
+	}
 
 	/*
-	 * Get the current timestamp
+	 * changes to the metadata must go through the writer connection,
+	 * which serializes them, keeps the caches coherent and logs them
 	 */
-	gchar *stamp = tagsistant_get_timestamp();
+	if ((operation isNot TAGSISTANT_WAL_NOT_LOGGED) && !tagsistant_db_connection_is_writer(dbi)) {
+		dbg('s', LOG_ERR, "Refusing to run from %s:%d on a reader connection: [%s]", file, line, statement);
+		return (0);
+	}
 
+#if TAGSISTANT_USE_QUERY_MUTEX
 	/*
-	 * Format the log entry and compute its length
+	 * lock the connection mutex
 	 */
-	gchar *log_line = g_strdup_printf("%s: %s\n", stamp, statement);
-	gchar *ptr = log_line;
-	ssize_t line_length = strlen(log_line);
+	g_mutex_lock(&tagsistant_query_mutex);
+#endif
 
 	/*
-	 * Open the write ahead log
+	 * log and run the query
 	 */
-	if (fd is -1) {
-		/*
-		 * Check if WAL directory has been created
-		 */
-		gchar *wal_dir = g_strdup_printf("%s/wal", tagsistant.repository);
-		if (wal_dir) {
-			int res = mkdir(wal_dir, S_IRWXU);
-			g_free(wal_dir);
-			if ((res is -1) && (errno isNot EEXIST)) {
-				dbg('s', LOG_ERR, "WAL: error creating WAL directory %s/wal: %s", tagsistant.repository, strerror(errno));
-				goto WAL_OUT;
-			}
-		}
+	dbg('s', LOG_INFO, "SQL from %s:%d: [%s]", file, line, statement);
+	int rows = tagsistant_db_execute(dbi, statement, callback, firstarg);
 
-		gchar *wal_path = g_strdup_printf("%s/wal/%s", tagsistant.repository, stamp);
-		if (wal_path) {
-			fd = open(wal_path, O_APPEND|O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR);
-			g_free(wal_path);
-
-			if (fd is -1) {
-				dbg('s', LOG_ERR, "WAL: unable to open log %s/wal/%s: %s", tagsistant.repository, stamp, strerror(errno));
-				return;
-			}
+	/*
+	 * the connection is not pinged before running the query: if it has
+	 * been lost, reconnect and retry, unless a transaction was open on it
+	 */
+	if ((rows is -1) && !dboptions.native && tagsistant_db_connection_is_broken(dbi) && !tagsistant_db_connection_is_writer(dbi)) {
+		dbg('s', LOG_INFO, "Reconnecting to the DB");
+		if (dbi_conn_connect(dbi) >= 0) {
+			tagsistant_db_connection_setup(dbi, FALSE);
+			rows = tagsistant_db_execute(dbi, statement, callback, firstarg);
 		} else {
-			dbg('s', LOG_ERR, "WAL: can't allocate file name %s/wal/%s", tagsistant.repository, stamp);
-			return;
+			dbg('s', LOG_ERR, "ERROR! DBI Connection has gone!");
 		}
 	}
 
+	tagsistant_dirty_logging(statement);
+	if ((operation isNot TAGSISTANT_WAL_NOT_LOGGED) && (rows isNot -1)) tagsistant_wal_log(operation, statement);
+
 	/*
-	 * Write the line in the WAL
+	 * report an error
 	 */
-	while (line_length > 0) {
-		ssize_t written = write(fd, ptr, line_length);
-		if (written is -1) {
-			dbg('s', LOG_ERR, "WAL: error writing line: %s", strerror(errno));
-			break;
-		} else {
-			line_length -= written;
-			ptr += written;
-		}
+	if (rows is -1) {
+		const char *errmsg = NULL;
+		tagsistant_db_error(dbi, &errmsg);
+		if (errmsg) dbg('s', LOG_ERR, "Error: %s.", errmsg);
+		rows = 0;
 	}
 
-	tagsistant_save_status(dbi, "wal_timestamp", stamp);
+#if TAGSISTANT_USE_QUERY_MUTEX
+	g_mutex_unlock(&tagsistant_query_mutex);
+#endif
 
-WAL_OUT:
-	g_free(log_line);
-	g_free(stamp);
+	return (rows);
 }
 
 /**
  * Prepare SQL queries and perform them.
  *
  * @param dbi a dbi_conn connection
+ * @param operation the operation to be written into the WAL, TAGSISTANT_WAL_GUESS
+ *   to guess it from the statement
  * @param format printf-like string with the SQL query
  * @param callback pointer to function to be called on results of SQL query
  * @param file the file where the function is called from (see tagsistant_query() macro)
@@ -980,6 +1704,7 @@ WAL_OUT:
  */
 int tagsistant_real_query(
 	dbi_conn dbi,
+	tagsistant_wal_operation operation,
 	const char *format,
 	tagsistant_query_callback callback,
 	char *file,
@@ -990,36 +1715,6 @@ int tagsistant_real_query(
 	va_list ap;
 	va_start(ap, firstarg);
 
-	/*
-	 * check if connection has been created
-	 */
-	if (dbi is NULL) {
-		dbg('s', LOG_ERR, "ERROR! DBI connection was not initialized!");
-		return (0);
-	}
-
-#if TAGSISTANT_USE_QUERY_MUTEX
-	/*
-	 * lock the connection mutex
-	 */
-	g_mutex_lock(&tagsistant_query_mutex);
-#endif
-
-	/*
-	 * check if the connection is alive
-	 */
-	if (!dbi_conn_ping(dbi)) {
-		dbg('s', LOG_INFO, "Reconnecting to the DB");
-		if (dbi_conn_connect(dbi) < 0) {
-
-#if TAGSISTANT_USE_QUERY_MUTEX
-			g_mutex_unlock(&tagsistant_query_mutex);
-#endif
-			dbg('s', LOG_ERR, "ERROR! DBI Connection has gone!");
-			return (0);
-		}
-	}
-
 	/*
 	 * replace all the single or double quotes with "<><>" in the format
 	 */
@@ -1029,11 +1724,8 @@ int tagsistant_real_query(
 	 * format the statement
 	 */
 	gchar *statement = g_strdup_vprintf(escaped_format, ap);
+	va_end(ap);
 	if (statement is NULL) {
-#if TAGSISTANT_USE_QUERY_MUTEX
-		/* lock the connection mutex */
-		g_mutex_unlock(&tagsistant_query_mutex);
-#endif
 		dbg('s', LOG_ERR, "Null SQL statement");
 		g_free(escaped_format);
 		return (0);
@@ -1050,47 +1742,178 @@ int tagsistant_real_query(
 	gchar *escaped_statement = g_regex_replace_literal(RX3, escaped_statement_tmp, -1, 0, "'", 0, NULL);
 
 	/*
-	 * log and run the query
+	 * statements not naming their operation are classified by their text
 	 */
-	dbg('s', LOG_INFO, "SQL from %s:%d: [%s]", file, line, escaped_statement);
-	dbi_result result = dbi_conn_query(dbi, escaped_statement);
+	if (operation is TAGSISTANT_WAL_GUESS) operation = tagsistant_wal_classify(escaped_statement);
 
-	tagsistant_dirty_logging(escaped_statement);
-	tagsistant_wal(dbi, escaped_statement);
+	int rows = tagsistant_execute(dbi, escaped_statement, operation, callback, file, line, firstarg);
 
 	g_free_null(escaped_format);
+	g_free_null(statement);
 	g_free_null(escaped_statement_tmp);
 	g_free_null(escaped_statement);
 
+	return (rows);
+}
+
+/**
+ * Run an already formatted SQL statement as is. Used for statements
+ * built by the caller (like the RDS materialization queries) which
+ * carry no unescaped arguments and must not be written into the WAL.
+ *
+ * @param dbi a dbi_conn connection
+ * @param statement the SQL statement
+ * @param callback pointer to function to be called on results of SQL query
+ * @param file the file where the function is called from (see tagsistant_raw_query() macro)
+ * @param line the file line where the function is called from (see tagsistant_raw_query() macro)
+ * @param firstarg pointer to buffer for callback returned data
+ * @return the number of selected rows
+ */
+int tagsistant_real_raw_query(
+	dbi_conn dbi,
+	const char *statement,
+	tagsistant_query_callback callback,
+	char *file,
+	int line,
+	void *firstarg)
+{
+	return (tagsistant_execute(dbi, statement, TAGSISTANT_WAL_NOT_LOGGED, callback, file, line, firstarg));
+}
+
+/**
+ * Escape a string to be quoted inside an SQL statement: single
+ * quotes are doubled and, on MySQL, backslashes too.
+ *
+ * @param string the string to escape
+ * @return the escaped string (must be freed)
+ */
+gchar *tagsistant_sql_escape(const gchar *string)
+{
+	if (!string) return (g_strdup(""));
+
+	GString *escaped = g_string_sized_new(strlen(string) + 8);
+	const gchar *ptr = string;
+	while (*ptr) {
+		if (*ptr is '\'' || (*ptr is '\\' && tagsistant.sql_database_driver is TAGSISTANT_DBI_MYSQL_BACKEND))
+			g_string_append_c(escaped, *ptr);
+		g_string_append_c(escaped, *ptr);
+		ptr++;
+	}
+
+	return (g_string_free(escaped, FALSE));
+}
+
+/**
+ * Format a statement of the registry, binding its parameters
+ * into the SQL text
+ *
+ * @param stmt the statement
+ * @param ap the bound parameters
+ * @return the SQL text (must be freed by the caller)
+ */
+static gchar *tagsistant_statement_format(tagsistant_prepared_statement *stmt, va_list ap)
+{
+	GString *statement = g_string_sized_new(stmt->length + 64);
+	const gchar *type = stmt->types;
+	gchar **fragment = stmt->fragments;
+
+	g_string_append(statement, *fragment);
+	while (*type && *(fragment + 1)) {
+		fragment++;
+
+		if (*type is 's') {
+			gchar *escaped = tagsistant_sql_escape(va_arg(ap, const gchar *));
+			g_string_append_c(statement, '\'');
+			g_string_append(statement, escaped);
+			g_string_append_c(statement, '\'');
+			g_free(escaped);
+		} else {
+			g_string_append_printf(statement, "%u", va_arg(ap, guint));
+		}
+
+		g_string_append(statement, *fragment);
+		type++;
+	}
+
+	return (g_string_free(statement, FALSE));
+}
+
+/**
+ * Run a statement of the registry, binding its parameters. No printf
+ * formatting nor regex escaping is done and the WAL eligibility of
+ * the statement is known in advance.
+ *
+ * @param dbi a dbi_conn connection
+ * @param id the statement id
+ * @param callback pointer to function to be called on results of SQL query
+ * @param file the file where the function is called from (see tagsistant_statement() macro)
+ * @param line the file line where the function is called from (see tagsistant_statement() macro)
+ * @param firstarg pointer to buffer for callback returned data
+ * @return the number of selected rows
+ */
+int tagsistant_real_statement(
+	dbi_conn dbi,
+	tagsistant_statement_id id,
+	tagsistant_query_callback callback,
+	char *file,
+	int line,
+	void *firstarg,
+	...)
+{
+	tagsistant_prepared_statement *stmt = &tagsistant_statements[id];
+
+	va_list ap;
+	va_start(ap, firstarg);
+
+#if TAGSISTANT_NATIVE_SQLITE
 	/*
-	 * call the callback function on results or report an error
+	 * bind the parameters to the persistent statement. The WAL
+	 * records the statement as SQL text, formatted apart from
+	 * a copy of the parameters.
 	 */
-	int rows = 0;
-	if (result) {
-
-		if (callback) {
-			while (dbi_result_next_row(result)) {
-				callback(firstarg, result);
-				rows++;
+	if (dboptions.native) {
+		gchar *logged = NULL;
+
+		if (stmt->operation isNot TAGSISTANT_WAL_NOT_LOGGED) {
+			if (!tagsistant_db_connection_is_writer(dbi)) {
+				dbg('s', LOG_ERR, "Refusing to run from %s:%d on a reader connection: [%s]", file, line, stmt->sql);
+				va_end(ap);
+				return (0);
 			}
+
+			va_list copy;
+			va_copy(copy, ap);
+			logged = tagsistant_statement_format(stmt, copy);
+			va_end(copy);
 		}
-		dbi_result_free(result);
 
-	} else {
+		dbg('s', LOG_INFO, "SQL from %s:%d: [%s]", file, line, stmt->sql);
+		int rows = tagsistant_sqlite_statement(dbi, id, stmt->sql, stmt->types, ap, callback, firstarg);
+		va_end(ap);
 
-		/*
-		 * get the error message
-		 */
-		const char *errmsg = NULL;
-		dbi_conn_error(dbi, &errmsg);
-		if (errmsg) dbg('s', LOG_ERR, "Error: %s.", errmsg);
+		if (logged) {
+			tagsistant_dirty_logging(logged);
+			if (rows isNot -1) tagsistant_wal_log(stmt->operation, logged);
+			g_free(logged);
+		}
 
-	}
+		if (rows is -1) {
+			const char *errmsg = NULL;
+			tagsistant_db_error(dbi, &errmsg);
+			if (errmsg) dbg('s', LOG_ERR, "Error: %s.", errmsg);
+			rows = 0;
+		}
 
-#if TAGSISTANT_USE_QUERY_MUTEX
-	g_mutex_unlock(&tagsistant_query_mutex);
+		return (rows);
+	}
 #endif
 
+	gchar *statement = tagsistant_statement_format(stmt, ap);
+	va_end(ap);
+
+	int rows = tagsistant_execute(dbi, statement, stmt->operation, callback, file, line, firstarg);
+
+	g_free(statement);
 	return (rows);
 }
 
@@ -1102,6 +1925,11 @@ tagsistant_inode tagsistant_last_insert_id(dbi_conn conn)
 #if TAGSISTANT_USE_INTERNAL_SEQUENCES
 	tagsistant_inode inode = 0;
 
+#if TAGSISTANT_NATIVE_SQLITE
+	/* the native rowid is per connection, so it's safe */
+	if (dboptions.native) return (tagsistant_sqlite_last_insert_id(conn));
+#endif
+
 	switch (tagsistant.sql_database_driver) {
 		case TAGSISTANT_DBI_SQLITE_BACKEND:
 			tagsistant_query(
@@ -1138,6 +1966,14 @@ int tagsistant_return_integer(void *return_integer, dbi_result result)
 	uint32_t *buffer = (uint32_t *) return_integer;
 	*buffer = 0;
 
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) {
+		*buffer = sqlite3_column_int64((sqlite3_stmt *) result, 0);
+		dbg('s', LOG_INFO, "Returning integer: %d", *buffer);
+		return (0);
+	}
+#endif
+
 	unsigned int type = dbi_result_get_field_type_idx(result, 1);
 	if (type is DBI_TYPE_INTEGER) {
 		unsigned int size = dbi_result_get_field_attribs_idx(result, 1);
@@ -1196,11 +2032,56 @@ int tagsistant_return_integer(void *return_integer, dbi_result result)
  * @param result dbi_result pointer
  * @return 0 (always, due to SQLite policy, may change in the future)
  */
+/**
+ * Return a string column of the current row, owned by the result
+ *
+ * @param result the result passed to the query callback
+ * @param idx the column, starting from 1
+ */
+const gchar *tagsistant_result_get_string(dbi_result result, guint idx)
+{
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) return ((const gchar *) sqlite3_column_text((sqlite3_stmt *) result, idx - 1));
+#endif
+
+	return (dbi_result_get_string_idx(result, idx));
+}
+
+/**
+ * Return a copy of a string column of the current row
+ *
+ * @param result the result passed to the query callback
+ * @param idx the column, starting from 1
+ */
+gchar *tagsistant_result_get_string_copy(dbi_result result, guint idx)
+{
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) return (g_strdup((const gchar *) sqlite3_column_text((sqlite3_stmt *) result, idx - 1)));
+#endif
+
+	return (dbi_result_get_string_copy_idx(result, idx));
+}
+
+/**
+ * Return an integer column of the current row
+ *
+ * @param result the result passed to the query callback
+ * @param idx the column, starting from 1
+ */
+guint tagsistant_result_get_uint(dbi_result result, guint idx)
+{
+#if TAGSISTANT_NATIVE_SQLITE
+	if (dboptions.native) return (sqlite3_column_int64((sqlite3_stmt *) result, idx - 1));
+#endif
+
+	return (dbi_result_get_uint_idx(result, idx));
+}
+
 int tagsistant_return_string(void *return_string, dbi_result result)
 {
 	gchar **result_string = (gchar **) return_string;
 
-	*result_string = dbi_result_get_string_copy_idx(result, 1);
+	*result_string = tagsistant_result_get_string_copy(result, 1);
 
 	dbg('s', LOG_INFO, "Returning string: %s", *result_string);
 
@@ -1219,8 +2100,8 @@ void tagsistant_sql_create_tag(dbi_conn conn, const gchar *namespace, const gcha
 {
 	if (!namespace) return;
 
-	tagsistant_query(
-		"insert into tags(tagname, `key`, value) "
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_CREATE_TAG, "insert into tags(tagname, `key`, value) "
 			"values ('%s', '%s', '%s')",
 		conn,
 		NULL,
@@ -1228,6 +2109,24 @@ void tagsistant_sql_create_tag(dbi_conn conn, const gchar *namespace, const gcha
 		namespace,
 		_safe_string(key),
 		_safe_string(value));
+
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	/*
+	 * add the new tag to the tag dictionary
+	 */
+	tagsistant_tag_id tag_id = 0;
+	tagsistant_statement(TAGSISTANT_STATEMENT_GET_TAG_ID,
+		conn, tagsistant_return_integer, &tag_id, namespace, _safe_string(key), _safe_string(value));
+	tagsistant_tag_dictionary_add(conn, tag_id, namespace, key, value);
+#endif
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	/* querytrees naming the tag cached it as missing */
+	tagsistant_invalidate_querytree_cache_tag(namespace);
+#endif
+
+	/* so did getattr() */
+	tagsistant_negative_cache_invalidate();
 }
 
 /**
@@ -1268,14 +2167,62 @@ int tagsistant_object_is_tagged_as(dbi_conn conn, tagsistant_inode inode, tagsis
 }
 
 /**
- * Remove all the tags applied to an object
+ * Callback for tagsistant_sql_get_object_tags()
+ *
+ * @param tag_ids a pointer to the GList to be filled
+ * @param result the DBI result
+ */
+static int
+tagsistant_sql_add_tag_id(GList **tag_ids, dbi_result result)
+{
+	*tag_ids = g_list_prepend(*tag_ids, GUINT_TO_POINTER(tagsistant_result_get_uint(result, 1)));
+	return (0);
+}
+
+/**
+ * Return the ids of all the tags applied to an object
+ *
+ * @param conn dbi_conn reference
+ * @param inode the object inode
+ * @return a GList of tag_ids (as GUINT_TO_POINTER) to be freed with g_list_free()
+ */
+GList *tagsistant_sql_get_object_tags(dbi_conn conn, tagsistant_inode inode)
+{
+	GList *tag_ids = NULL;
+
+	tagsistant_query(
+		"select tag_id from tagging where inode = %d",
+		conn, (tagsistant_query_callback) tagsistant_sql_add_tag_id, &tag_ids, inode);
+
+	return (tag_ids);
+}
+
+/**
+ * Remove all the tags applied to an object, updating the RDS
+ * and the caches depending on its tagging
  *
  * @param conn dbi_conn reference
  * @param inode the object inode
  */
 void tagsistant_full_untag_object(dbi_conn conn, tagsistant_inode inode)
 {
-	tagsistant_query("delete from tagging where inode = %d", conn, NULL, NULL, inode);
+	GList *tag_ids = tagsistant_sql_get_object_tags(conn, inode);
+
+	tagsistant_logged_query(TAGSISTANT_WAL_UNTAG, "delete from tagging where inode = %d", conn, NULL, NULL, inode);
+
+	tagsistant_rds_update_object(conn, inode, tag_ids, NULL);
+	g_list_free(tag_ids);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_inode(inode);
+#endif
+
+#if TAGSISTANT_ENABLE_AND_SET_CACHE
+	tagsistant_invalidate_and_set_cache_inode(inode);
+#endif
+
+	/* the object now shows up in the directories negating its former tags */
+	tagsistant_negative_cache_invalidate_inode(conn, inode);
 }
 
 /**
@@ -1289,40 +2236,31 @@ void tagsistant_full_untag_object(dbi_conn conn, tagsistant_inode inode)
  */
 tagsistant_inode tagsistant_sql_get_tag_id(dbi_conn conn, const gchar *tagname, const gchar *key, const gchar *value)
 {
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	gchar *tag_key = tagsistant_make_tag_key(_safe_string(tagname), _safe_string(key), _safe_string(value));
+	tagsistant_inode tag_id = 0;
 
-	// lookup in the cache
-	tagsistant_inode *tag_value = (tagsistant_inode *) g_hash_table_lookup(tagsistant_tag_cache, tag_key);
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	// lookup in the tag dictionary
+	tag_id = tagsistant_tag_dictionary_lookup(tagname, key, value);
+	if (tag_id) return (tag_id);
 
-	if (tag_value && *tag_value) {
-		g_free(tag_key);
-		return (*tag_value);
-	}
+	// the dictionary holds every tag, so a fully specified tag missing there does not exist
+	if (value && tagsistant_tag_dictionary_is_loaded()) return (0);
 #endif
 
 	// fetch the tag_id from SQL
-	tagsistant_inode tag_id = 0;
 	if (value)
-		tagsistant_query(
-			"select tag_id from tags where `tagname` = '%s' and `key` = '%s' and `value` = '%s' limit 1",
+		tagsistant_statement(TAGSISTANT_STATEMENT_GET_TAG_ID,
 			conn, tagsistant_return_integer, &tag_id, tagname, _safe_string(key), _safe_string(value));
 	else if (key)
-		tagsistant_query(
-			"select tag_id from tags where `tagname` = '%s' and `key` = '%s' limit 1",
+		tagsistant_statement(TAGSISTANT_STATEMENT_GET_TAG_ID_BY_KEY,
 			conn, tagsistant_return_integer, &tag_id, tagname, _safe_string(key));
 	else
-		tagsistant_query(
-			"select tag_id from tags where `tagname` = '%s' limit 1",
+		tagsistant_statement(TAGSISTANT_STATEMENT_GET_TAG_ID_BY_NAME,
 			conn, tagsistant_return_integer, &tag_id, tagname);
 
 #if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	// save the key and the value in the cache
-	if (tag_id) {
-		tag_value = g_new0(tagsistant_inode, 1);
-		*tag_value = tag_id;
-		g_hash_table_insert(tagsistant_tag_cache, tag_key, tag_value);
-	}
+	// save the tag found in the dictionary
+	if (tag_id) tagsistant_tag_dictionary_fetch(conn, tag_id);
 #endif
 
 	return (tag_id);
@@ -1331,9 +2269,7 @@ tagsistant_inode tagsistant_sql_get_tag_id(dbi_conn conn, const gchar *tagname,
 void tagsistant_remove_tag_from_cache(const gchar *tagname, const gchar *key, const gchar *value)
 {
 #if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	gchar *tag_key = tagsistant_make_tag_key(tagname, _safe_string(key), _safe_string(value));
-	g_hash_table_remove(tagsistant_tag_cache, tag_key);
-	g_free(tag_key);
+	tagsistant_tag_dictionary_remove(tagsistant_tag_dictionary_lookup(tagname, key, value));
 #else
 	(void) tagname;
 	(void) key;
@@ -1341,6 +2277,36 @@ void tagsistant_remove_tag_from_cache(const gchar *tagname, const gchar *key, co
 #endif
 }
 
+/**
+ * A deleted tag, to be restored if its transaction is rolled back
+ */
+typedef struct {
+	tagsistant_inode tag_id;
+	gchar *tagname;
+	gchar *key;
+	gchar *value;
+} tagsistant_deleted_tag;
+
+static void tagsistant_deleted_tag_free(tagsistant_deleted_tag *tag)
+{
+	g_free(tag->tagname);
+	g_free(tag->key);
+	g_free(tag->value);
+	g_free(tag);
+}
+
+/**
+ * Undo the in-memory side of tagsistant_sql_delete_tag()
+ */
+static void tagsistant_sql_undo_delete_tag(dbi_conn conn, tagsistant_deleted_tag *tag)
+{
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	tagsistant_tag_dictionary_add(conn, tag->tag_id, tag->tagname, tag->key, tag->value);
+#endif
+
+	tagsistant_tag_index_load_tag(conn, tag->tag_id);
+}
+
 /**
  * Deletes a tag
  *
@@ -1359,17 +2325,39 @@ void tagsistant_sql_delete_tag(dbi_conn conn, const gchar *tagname, const gchar
 	tagsistant_inode tag_id = tagsistant_sql_get_tag_id(conn, tagname, _safe_string(key), _safe_string(value));
 	tagsistant_remove_tag_from_cache(tagname, _safe_string(key), _safe_string(value));
 
-	tagsistant_query(
-		"delete from tags where tagname = '%s' and `key` = '%s' and value = '%s'",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_DELETE_TAG, "delete from tags where tagname = '%s' and `key` = '%s' and value = '%s'",
 		conn, NULL, NULL, tagname, _safe_string(key), _safe_string(value));
 
-	tagsistant_query(
-		"delete from tagging where tag_id = '%d'",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_UNTAG, "delete from tagging where tag_id = '%d'",
 		conn, NULL, NULL, tag_id);
 
-	tagsistant_query(
-		"delete from relations where tag1_id = '%d' or tag2_id = '%d'",
+	tagsistant_tag_index_drop_tag(tag_id);
+
+	tagsistant_deleted_tag *deleted = g_new0(tagsistant_deleted_tag, 1);
+	deleted->tag_id = tag_id;
+	deleted->tagname = g_strdup(tagname);
+	deleted->key = g_strdup(_safe_string(key));
+	deleted->value = g_strdup(_safe_string(value));
+	tagsistant_db_on_rollback(conn,
+		(tagsistant_undo_callback) tagsistant_sql_undo_delete_tag, deleted,
+		(GDestroyNotify) tagsistant_deleted_tag_free);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_tag(tagname);
+#endif
+
+#if TAGSISTANT_ENABLE_AND_SET_CACHE
+	tagsistant_invalidate_and_set_cache();
+#endif
+
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_UNRELATE, "delete from relations where tag1_id = '%d' or tag2_id = '%d'",
 		conn, NULL, NULL, tag_id, tag_id);
+
+	/* objects negating the tag show up again */
+	tagsistant_negative_cache_invalidate();
 }
 
 /**
@@ -1401,7 +2389,23 @@ void tagsistant_sql_tag_object(
 		dbg('s', LOG_INFO, "Tagging object %d as %s (%d)", inode, tagname, tag_id);
 	}
 
-	tagsistant_query("insert into tagging(tag_id, inode) values('%d', '%d')", conn, NULL, NULL, tag_id, inode);
+	tagsistant_statement(TAGSISTANT_STATEMENT_TAG_OBJECT, conn, NULL, NULL, tag_id, inode);
+
+	GList *changed = g_list_prepend(NULL, GUINT_TO_POINTER(tag_id));
+	tagsistant_rds_update_object(conn, inode, changed, NULL);
+	g_list_free(changed);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_inode(inode);
+#endif
+
+#if TAGSISTANT_ENABLE_AND_SET_CACHE
+	/* a new tag can exclude the object from queries negating it */
+	tagsistant_invalidate_and_set_cache_inode(inode);
+#endif
+
+	/* the object now shows up in the directories of the tag */
+	tagsistant_negative_cache_invalidate_inode(conn, inode);
 }
 
 /**
@@ -1454,9 +2458,22 @@ void tagsistant_sql_untag_object(dbi_conn conn, const gchar *tagname, const gcha
 			inode, tagname, tag_id);
 	}
 
-	tagsistant_query(
-		"delete from tagging where tag_id = %d and inode = %d",
-		conn, NULL, NULL, tag_id, inode);
+	tagsistant_statement(TAGSISTANT_STATEMENT_UNTAG_OBJECT, conn, NULL, NULL, tag_id, inode);
+
+	GList *changed = g_list_prepend(NULL, GUINT_TO_POINTER(tag_id));
+	tagsistant_rds_update_object(conn, inode, changed, NULL);
+	g_list_free(changed);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_inode(inode);
+#endif
+
+#if TAGSISTANT_ENABLE_AND_SET_CACHE
+	tagsistant_invalidate_and_set_cache_inode(inode);
+#endif
+
+	/* the object now shows up in the directories negating the tag */
+	tagsistant_negative_cache_invalidate_inode(conn, inode);
 }
 
 /**
@@ -1468,7 +2485,60 @@ void tagsistant_sql_untag_object(dbi_conn conn, const gchar *tagname, const gcha
  */
 void tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, const gchar *oldtagname)
 {
-	tagsistant_query("update tags set tagname = '%s' where tagname = '%s'", conn, NULL, NULL, tagname, oldtagname);
+	tagsistant_logged_query(TAGSISTANT_WAL_RENAME_TAG, "update tags set tagname = '%s' where tagname = '%s'", conn, NULL, NULL, tagname, oldtagname);
+	tagsistant_tag_dictionary_reload(conn);
+
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_tag(oldtagname);
+	tagsistant_invalidate_querytree_cache_tag(tagname);
+#endif
+
+	tagsistant_negative_cache_invalidate();
+}
+
+/**
+ * Drop the cached querytrees built by expanding an alias, after
+ * an alias has been created, changed or deleted
+ */
+static void tagsistant_sql_alias_changed()
+{
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+	tagsistant_invalidate_querytree_cache_tag(TAGSISTANT_ALIAS_IDENTIFIER);
+#endif
+
+	tagsistant_negative_cache_invalidate();
+}
+
+/**
+ * Undo the in-memory side of an alias change, reloading
+ * the alias from the rolled back DB
+ */
+static void tagsistant_sql_undo_alias(dbi_conn conn, gchar *alias)
+{
+	tagsistant_alias_table_load(conn, alias);
+	tagsistant_sql_alias_changed();
+}
+
+/**
+ * Update an alias in the alias table, restoring it if
+ * the transaction is rolled back
+ *
+ * @param conn dbi_conn reference
+ * @param alias the alias
+ * @param query the query bookmarked by the alias, NULL to remove it
+ */
+static void tagsistant_sql_alias_update_table(dbi_conn conn, const gchar *alias, const gchar *query)
+{
+	if (query) {
+		tagsistant_alias_table_set(alias, query);
+	} else {
+		tagsistant_alias_table_remove(alias);
+	}
+
+	tagsistant_db_on_rollback(conn,
+		(tagsistant_undo_callback) tagsistant_sql_undo_alias, g_strdup(alias), g_free);
+
+	tagsistant_sql_alias_changed();
 }
 
 /**
@@ -1480,9 +2550,15 @@ void tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, const gchar
  */
 int tagsistant_sql_alias_exists(dbi_conn conn, const gchar *alias)
 {
+	if (tagsistant_alias_table_is_loaded()) {
+		gchar *query = tagsistant_alias_table_lookup(alias);
+		int exists = query ? 1 : 0;
+		g_free(query);
+		return (exists);
+	}
+
 	int exists = 0;
-	tagsistant_query(
-		"select 1 from aliases where alias = '%s'",
+	tagsistant_statement(TAGSISTANT_STATEMENT_ALIAS_EXISTS,
 		conn, tagsistant_return_integer, &exists, alias);
 	return (exists);
 }
@@ -1496,9 +2572,11 @@ int tagsistant_sql_alias_exists(dbi_conn conn, const gchar *alias)
 void tagsistant_sql_alias_create(dbi_conn conn, const gchar *alias)
 {
 	if (tagsistant_sql_alias_exists(conn, alias)) return;
-	tagsistant_query(
-		"insert into aliases (alias, query) values ('%s', '')",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_ALIAS, "insert into aliases (alias, query) values ('%s', '')",
 		conn, NULL, NULL, alias);
+
+	tagsistant_sql_alias_update_table(conn, alias, "");
 }
 
 /**
@@ -1509,9 +2587,11 @@ void tagsistant_sql_alias_create(dbi_conn conn, const gchar *alias)
  */
 void tagsistant_sql_alias_delete(dbi_conn conn, const gchar *alias)
 {
-	tagsistant_query(
-		"delete from aliases where alias = '%s'",
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_ALIAS, "delete from aliases where alias = '%s'",
 		conn, NULL, NULL, alias);
+
+	tagsistant_sql_alias_update_table(conn, alias, NULL);
 }
 
 /**
@@ -1523,9 +2603,14 @@ void tagsistant_sql_alias_delete(dbi_conn conn, const gchar *alias)
  */
 void tagsistant_sql_alias_set(dbi_conn conn, const gchar *alias, const gchar *query)
 {
-	tagsistant_query(
-		"update aliases set query = '%s' where alias = '%s'",
+	/* the update would match no row: don't make up the alias in the table */
+	unless (tagsistant_sql_alias_exists(conn, alias)) return;
+
+	tagsistant_logged_query(
+		TAGSISTANT_WAL_ALIAS, "update aliases set query = '%s' where alias = '%s'",
 		conn, NULL, NULL, query, alias);
+
+	tagsistant_sql_alias_update_table(conn, alias, query);
 }
 
 /**
@@ -1537,10 +2622,11 @@ void tagsistant_sql_alias_set(dbi_conn conn, const gchar *alias, const gchar *qu
  */
 gchar *tagsistant_sql_alias_get(dbi_conn conn, const gchar *alias)
 {
+	if (tagsistant_alias_table_is_loaded()) return (tagsistant_alias_table_lookup(alias));
+
 	gchar *value = NULL;
 
-	tagsistant_query(
-		"select query from aliases where alias = '%s'",
+	tagsistant_statement(TAGSISTANT_STATEMENT_ALIAS_GET,
 		conn, tagsistant_return_string, &value, alias);
 
 	return (value);
@@ -1558,7 +2644,7 @@ size_t tagsistant_sql_alias_get_length(dbi_conn conn, const gchar *alias)
 	size_t length = 0;
 
 	gchar *value = tagsistant_sql_alias_get(conn, alias);
-	length = strlen(value);
+	if (value) length = strlen(value);
 	g_free(value);
 
 	return (length);
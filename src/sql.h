@@ -20,6 +20,14 @@
 
 #include <dbi/dbi.h>
 
+/* SQLite repositories are opened through the sqlite3 C API when available */
+#if HAVE_LIBSQLITE3 && HAVE_SQLITE3_H
+#	include <sqlite3.h>
+#	define TAGSISTANT_NATIVE_SQLITE 1
+#else
+#	define TAGSISTANT_NATIVE_SQLITE 0
+#endif
+
 #if  LIBDBI_LIB_CURRENT > 1
 #define TAGSISTANT_REENTRANT_DBI 1
 #else
@@ -39,11 +47,70 @@
 
 #define TAGSISTANT_START_TRANSACTION		1
 #define TAGSISTANT_DONT_START_TRANSACTION	0
+#define TAGSISTANT_SCHEMA_TRANSACTION		2
+
+/** milliseconds a SQLite connection waits for a lock before failing */
+#define TAGSISTANT_SQLITE_BUSY_TIMEOUT 5000
+
+/** milliseconds a reader waits for a pooled connection before checking for a free slot */
+#define TAGSISTANT_DB_POOL_WAIT 100
+
+/** the maximum number of writer operations grouped in one commit */
+#define TAGSISTANT_GROUP_COMMIT_MAX_OPS 1024
+
+/** the pragmas applied to every SQLite connection, before the --sqlite-pragma ones */
+#define TAGSISTANT_SQLITE_DEFAULT_PRAGMAS "journal_mode=WAL", "cache_size=-16384", "mmap_size=268435456"
+
+/** the backend errors which mean the connection is lost */
+#define TAGSISTANT_MYSQL_SERVER_GONE	2006	/* CR_SERVER_GONE_ERROR */
+#define TAGSISTANT_MYSQL_SERVER_LOST	2013	/* CR_SERVER_LOST */
+#define TAGSISTANT_SQLITE_IOERR			10		/* SQLITE_IOERR */
+#define TAGSISTANT_SQLITE_CANTOPEN		14		/* SQLITE_CANTOPEN */
 
 extern void tagsistant_db_init();
 extern dbi_conn *tagsistant_db_connection(int start_transaction);
 extern void tagsistant_create_schema();
+extern void tagsistant_save_status(dbi_conn dbi, gchar *key, gchar *value);
+
+/** the size a WAL segment grows to before a new one is started */
+#define TAGSISTANT_WAL_SEGMENT_SIZE (4 * 1024 * 1024)
+
+/** the operations written into the WAL. The values are saved in the WAL records */
+typedef enum {
+	TAGSISTANT_WAL_CHECKPOINT = 0,
+	TAGSISTANT_WAL_STATEMENT,
+	TAGSISTANT_WAL_CREATE_OBJECT,
+	TAGSISTANT_WAL_RENAME_OBJECT,
+	TAGSISTANT_WAL_DELETE_OBJECT,
+	TAGSISTANT_WAL_CREATE_TAG,
+	TAGSISTANT_WAL_RENAME_TAG,
+	TAGSISTANT_WAL_DELETE_TAG,
+	TAGSISTANT_WAL_TAG,
+	TAGSISTANT_WAL_UNTAG,
+	TAGSISTANT_WAL_RELATE,
+	TAGSISTANT_WAL_UNRELATE,
+	TAGSISTANT_WAL_ALIAS,
+	TAGSISTANT_WAL_UPDATE_OBJECT,
+	TAGSISTANT_WAL_OPERATIONS,
+
+	/** the statement doesn't change the metadata */
+	TAGSISTANT_WAL_NOT_LOGGED,
+
+	/** guess the operation from the statement text */
+	TAGSISTANT_WAL_GUESS
+} tagsistant_wal_operation;
+
+// write-ahead log functions
 extern void tagsistant_wal_sync();
+extern tagsistant_wal_operation tagsistant_wal_classify(const gchar *statement);
+extern void tagsistant_wal_log(tagsistant_wal_operation operation, const gchar *statement);
+extern guint tagsistant_wal_mark();
+extern void tagsistant_wal_rewind(guint mark);
+extern guint64 tagsistant_wal_flush();
+extern void tagsistant_wal_committed(guint64 lsn);
+extern void tagsistant_wal_discard();
+extern void tagsistant_wal_fsync();
+extern void tagsistant_wal_stats(gchar *buffer, size_t size);
 
 #define _safe_string(string) string ? string : ""
 
@@ -59,6 +126,7 @@ typedef int (*tagsistant_query_callback)(void *, dbi_result);
  * Prepare SQL queries and perform them.
  *
  * @param dbi a dbi_conn connection
+ * @param operation the operation to be written into the WAL
  * @param format printf-like string with the SQL query
  * @param callback pointer to function to be called on results of SQL query
  * @param file the file where the function is called from (see tagsistant_query() macro)
@@ -68,6 +136,7 @@ typedef int (*tagsistant_query_callback)(void *, dbi_result);
  */
 extern int tagsistant_real_query(
 	dbi_conn conn,
+	tagsistant_wal_operation operation,
 	const char *format,
 	int (*callback)(void *, dbi_result),
 	char *file,
@@ -80,7 +149,102 @@ extern int tagsistant_real_query(
  * SQL string and adding file:line coords
  */
 #define tagsistant_query(format, conn, callback, firstarg, ...) \
-	tagsistant_real_query(conn, format, callback, __FILE__, __LINE__, firstarg, ## __VA_ARGS__)
+	tagsistant_real_query(conn, TAGSISTANT_WAL_GUESS, format, callback, __FILE__, __LINE__, firstarg, ## __VA_ARGS__)
+
+/**
+ * execute a statement changing the metadata, naming
+ * the operation to be written into the WAL
+ */
+#define tagsistant_logged_query(operation, format, conn, callback, firstarg, ...) \
+	tagsistant_real_query(conn, operation, format, callback, __FILE__, __LINE__, firstarg, ## __VA_ARGS__)
+
+/**
+ * Execute an already formatted SQL statement as is, without escaping
+ * it and without checking if it must be written in the WAL. All the
+ * string values inside the statement must be escaped by the caller
+ * with tagsistant_sql_escape().
+ *
+ * @param dbi a dbi_conn connection
+ * @param statement the SQL statement
+ * @param callback pointer to function to be called on results of SQL query
+ * @param file the file where the function is called from (see tagsistant_raw_query() macro)
+ * @param line the file line where the function is called from (see tagsistant_raw_query() macro)
+ * @param firstarg pointer to buffer for callback returned data
+ * @return the number of selected rows
+ */
+extern int tagsistant_real_raw_query(
+	dbi_conn conn,
+	const char *statement,
+	int (*callback)(void *, dbi_result),
+	char *file,
+	int line,
+	void *firstarg);
+
+#define tagsistant_raw_query(statement, conn, callback, firstarg) \
+	tagsistant_real_raw_query(conn, statement, callback, __FILE__, __LINE__, firstarg)
+
+/** escape a string to be quoted inside a raw SQL statement */
+extern gchar *tagsistant_sql_escape(const gchar *string);
+
+/**
+ * The statement registry. Each statement is parsed once at startup,
+ * binding its ? placeholders to typed parameters, and is run by
+ * tagsistant_statement() without printf formatting and regex escaping.
+ */
+typedef enum {
+	TAGSISTANT_STATEMENT_GET_TAG_ID,
+	TAGSISTANT_STATEMENT_GET_TAG_ID_BY_KEY,
+	TAGSISTANT_STATEMENT_GET_TAG_ID_BY_NAME,
+	TAGSISTANT_STATEMENT_TAG_OBJECT,
+	TAGSISTANT_STATEMENT_UNTAG_OBJECT,
+	TAGSISTANT_STATEMENT_GET_INODE_BY_NAME,
+	TAGSISTANT_STATEMENT_ALIAS_EXISTS,
+	TAGSISTANT_STATEMENT_ALIAS_GET,
+	TAGSISTANT_STATEMENT_TOTAL
+} tagsistant_statement_id;
+
+/**
+ * Run a statement of the registry.
+ *
+ * @param dbi a dbi_conn connection
+ * @param id the statement id
+ * @param callback pointer to function to be called on results of SQL query
+ * @param file the file where the function is called from (see tagsistant_statement() macro)
+ * @param line the file line where the function is called from (see tagsistant_statement() macro)
+ * @param firstarg pointer to buffer for callback returned data
+ * @param ... the bound parameters: a const gchar * for each string and a guint for each integer
+ * @return the number of selected rows
+ */
+extern int tagsistant_real_statement(
+	dbi_conn conn,
+	tagsistant_statement_id id,
+	int (*callback)(void *, dbi_result),
+	char *file,
+	int line,
+	void *firstarg,
+	...);
+
+#define tagsistant_statement(id, conn, callback, firstarg, ...) \
+	tagsistant_real_statement(conn, id, callback, __FILE__, __LINE__, firstarg, ## __VA_ARGS__)
+
+/**
+ * Read a column of the current row inside a query callback. Columns are
+ * numbered from 1. Strings are owned by the result, unless copied.
+ */
+extern const gchar *tagsistant_result_get_string(dbi_result result, guint idx);
+extern gchar *tagsistant_result_get_string_copy(dbi_result result, guint idx);
+extern guint tagsistant_result_get_uint(dbi_result result, guint idx);
+
+#if TAGSISTANT_NATIVE_SQLITE
+/* native SQLite backend (see sqlite_native.c) */
+extern dbi_conn tagsistant_sqlite_open(gboolean writer);
+extern void tagsistant_sqlite_close(dbi_conn dbi);
+extern int tagsistant_sqlite_error(dbi_conn dbi, const char **errmsg);
+extern int tagsistant_sqlite_execute(dbi_conn dbi, const gchar *statement, tagsistant_query_callback callback, void *firstarg);
+extern int tagsistant_sqlite_statement(dbi_conn dbi, tagsistant_statement_id id, const gchar *sql, const gchar *types,
+	va_list ap, tagsistant_query_callback callback, void *firstarg);
+extern tagsistant_inode tagsistant_sqlite_last_insert_id(dbi_conn dbi);
+#endif
 
 /** callback to return a string */
 extern int tagsistant_return_string(void *return_string, dbi_result result);
@@ -88,7 +252,14 @@ extern int tagsistant_return_string(void *return_string, dbi_result result);
 /** callback to return an integer */
 extern int tagsistant_return_integer(void *return_integer, dbi_result result);
 
-extern void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_locked);
+extern gboolean tagsistant_db_connection_release(dbi_conn dbi, int start_transaction);
+extern void tagsistant_db_pool_init();
+extern gboolean tagsistant_db_connection_is_broken(dbi_conn dbi);
+extern gboolean tagsistant_db_connection_is_writer(dbi_conn dbi);
+extern void tagsistant_db_connection_setup(dbi_conn dbi, gboolean writer);
+extern void tagsistant_db_connection_stats(gchar *buffer, size_t size);
+extern gint tagsistant_db_snapshot();
+extern gboolean tagsistant_db_snapshot_is_current(gint ticket);
 
 /**
  * if true, use backend calls to fetch last insert row id,
@@ -102,13 +273,22 @@ extern void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_lo
  */
 #define TAGSISTANT_USE_INTERNAL_TRANSACTIONS TRUE
 
-#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
-#	define tagsistant_commit_transaction(dbi_conn) tagsistant_query("commit", dbi_conn, NULL, NULL)
-#	define tagsistant_rollback_transaction(dbi_conn) tagsistant_query("rollback", dbi_conn, NULL, NULL)
-#else
-#	define tagsistant_commit_transaction(dbi_conn) dbi_conn_transaction_commit(dbi_conn)
-#	define tagsistant_rollback_transaction(dbi_conn) dbi_conn_transaction_rollback(dbi_conn)
-#endif /* TAGSISTANT_USE_INTERNAL_TRANSACTIONS */
+/**
+ * commit or roll back the transaction of a connection; inside a
+ * group commit batch only the savepoint of the operation is affected
+ */
+extern gboolean tagsistant_db_commit(dbi_conn dbi);
+extern void tagsistant_db_rollback(dbi_conn dbi);
+
+/**
+ * restore the in-memory state changed by a writer transaction
+ * that gets rolled back, see tagsistant_db_on_rollback()
+ */
+typedef void (*tagsistant_undo_callback)(dbi_conn dbi, gpointer data);
+extern void tagsistant_db_on_rollback(dbi_conn dbi, tagsistant_undo_callback callback, gpointer data, GDestroyNotify free_data);
+
+#define tagsistant_commit_transaction(dbi_conn) tagsistant_db_commit(dbi_conn)
+#define tagsistant_rollback_transaction(dbi_conn) tagsistant_db_rollback(dbi_conn)
 
 /***************\
  * SQL QUERIES *
@@ -124,6 +304,7 @@ extern void				tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, co
 extern tagsistant_inode	tagsistant_last_insert_id(dbi_conn conn);
 extern int				tagsistant_object_is_tagged(dbi_conn conn, tagsistant_inode inode);
 extern int				tagsistant_object_is_tagged_as(dbi_conn conn, tagsistant_inode inode, tagsistant_inode tag_id);
+extern GList *			tagsistant_sql_get_object_tags(dbi_conn conn, tagsistant_inode inode);
 extern void				tagsistant_full_untag_object(dbi_conn conn, tagsistant_inode inode);
 extern void				tagsistant_remove_tag_from_cache(const gchar *tagname, const gchar *key, const gchar *value);
 extern int				tagsistant_sql_alias_exists(dbi_conn conn, const gchar *alias);
@@ -133,11 +314,3 @@ extern void				tagsistant_sql_alias_set(dbi_conn conn, const gchar *alias, const
 extern gchar *			tagsistant_sql_alias_get(dbi_conn conn, const gchar *alias);
 extern size_t			tagsistant_sql_alias_get_length(dbi_conn conn, const gchar *alias);
 
-/**
- * Prepare a key for saving a tag_id inside the cache
- *
- * @param tagname the name of the tag or the namespace of a triple tag
- * @param key the key of a triple tag
- * @param value the value of a triple tag
- */
-#define tagsistant_make_tag_key(tagname, key, value) g_strdup_printf("%s<separator>%s<separator>%s", tagname, key, value)
@@ -0,0 +1,253 @@
+/*
+   Tagsistant (tagfs) -- sqlite_native.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   SQLite backend talking to the sqlite3 C API, without libdbi.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+#if TAGSISTANT_NATIVE_SQLITE
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** When Tagsistant is built with the sqlite3 library, SQLite repositories are   ***/
+/*** opened with sqlite3_open_v2() and the rest of the tree gets the connection   ***/
+/*** as an opaque dbi_conn, like the libdbi ones. Query callbacks receive the     ***/
+/*** sqlite3_stmt as their dbi_result and read typed columns through the          ***/
+/*** tagsistant_result_get_*() functions, so integers are never converted from    ***/
+/*** strings. The statements of the registry are prepared once per connection    ***/
+/*** as persistent statements and reused with new bindings.                       ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/**
+ * A native SQLite connection
+ */
+typedef struct {
+	/** the SQLite database handle */
+	sqlite3 *db;
+
+	/** the statements of the registry, prepared on first use */
+	sqlite3_stmt *statements[TAGSISTANT_STATEMENT_TOTAL];
+
+	/** the result code of the last statement */
+	int error;
+} tagsistant_sqlite_conn;
+
+/**
+ * Open a native connection on the repository database
+ *
+ * @param writer TRUE for the writer connection, FALSE for a read-only reader
+ * @return the connection, as an opaque dbi_conn, or NULL on error
+ */
+dbi_conn tagsistant_sqlite_open(gboolean writer)
+{
+	tagsistant_sqlite_conn *conn = g_new0(tagsistant_sqlite_conn, 1);
+	gchar *path = g_build_filename(tagsistant.repository, "tags.sql", NULL);
+
+	/* each connection is used by one thread at a time, the pool guarantees it */
+	int res = sqlite3_open_v2(path, &conn->db,
+		(writer ? SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE : SQLITE_OPEN_READONLY)|SQLITE_OPEN_NOMUTEX, NULL);
+
+	if (res isNot SQLITE_OK) {
+		dbg('s', LOG_ERR, "Error opening %s: %s", path, conn->db ? sqlite3_errmsg(conn->db) : sqlite3_errstr(res));
+		sqlite3_close(conn->db);
+		g_free(conn);
+		g_free(path);
+		return (NULL);
+	}
+
+	g_free(path);
+
+	// wait for the writer to checkpoint instead of failing with SQLITE_BUSY
+	sqlite3_busy_timeout(conn->db, TAGSISTANT_SQLITE_BUSY_TIMEOUT);
+
+	return ((dbi_conn) conn);
+}
+
+/**
+ * Close a native connection, finalizing its statements
+ *
+ * @param dbi the connection
+ */
+void tagsistant_sqlite_close(dbi_conn dbi)
+{
+	tagsistant_sqlite_conn *conn = (tagsistant_sqlite_conn *) dbi;
+	if (!conn) return;
+
+	int id;
+	for (id = 0; id < TAGSISTANT_STATEMENT_TOTAL; id++)
+		if (conn->statements[id]) sqlite3_finalize(conn->statements[id]);
+
+	sqlite3_close(conn->db);
+	g_free(conn);
+}
+
+/**
+ * Return the result code of the last statement run on a connection
+ *
+ * @param dbi the connection
+ * @param errmsg if not NULL, filled with the error message or NULL if no error
+ * @return the SQLite result code, 0 if no error
+ */
+int tagsistant_sqlite_error(dbi_conn dbi, const char **errmsg)
+{
+	tagsistant_sqlite_conn *conn = (tagsistant_sqlite_conn *) dbi;
+
+	if (errmsg) *errmsg = conn->error ? sqlite3_errmsg(conn->db) : NULL;
+	return (conn->error);
+}
+
+/**
+ * Step a statement to its end, calling the callback on each row
+ *
+ * @param stmt the statement
+ * @param callback the callback, may be NULL
+ * @param firstarg the first argument of the callback
+ * @param rows incremented for each row passed to the callback
+ * @return SQLITE_DONE on success, the result code otherwise
+ */
+static int tagsistant_sqlite_step(
+	sqlite3_stmt *stmt,
+	tagsistant_query_callback callback,
+	void *firstarg,
+	int *rows)
+{
+	int res;
+
+	while ((res = sqlite3_step(stmt)) is SQLITE_ROW) {
+		if (callback) {
+			callback(firstarg, (dbi_result) stmt);
+			(*rows)++;
+		}
+	}
+
+	return (res);
+}
+
+/**
+ * Run one or more SQL statements
+ *
+ * @param dbi the connection
+ * @param statement the SQL text
+ * @param callback the callback called on each row, may be NULL
+ * @param firstarg the first argument of the callback
+ * @return the number of rows passed to the callback, -1 on error
+ */
+int tagsistant_sqlite_execute(
+	dbi_conn dbi,
+	const gchar *statement,
+	tagsistant_query_callback callback,
+	void *firstarg)
+{
+	tagsistant_sqlite_conn *conn = (tagsistant_sqlite_conn *) dbi;
+	const char *tail = statement;
+	int rows = 0;
+
+	conn->error = SQLITE_OK;
+
+	while (tail && *tail) {
+		sqlite3_stmt *stmt = NULL;
+
+		int res = sqlite3_prepare_v3(conn->db, tail, -1, 0, &stmt, &tail);
+		if (res isNot SQLITE_OK) {
+			conn->error = res;
+			return (-1);
+		}
+
+		/* only blanks or comments were left */
+		if (!stmt) break;
+
+		res = tagsistant_sqlite_step(stmt, callback, firstarg, &rows);
+		sqlite3_finalize(stmt);
+
+		if (res isNot SQLITE_DONE) {
+			conn->error = res;
+			return (-1);
+		}
+	}
+
+	return (rows);
+}
+
+/**
+ * Run a statement of the registry, binding its parameters
+ *
+ * @param dbi the connection
+ * @param id the statement id
+ * @param sql the SQL text with ? placeholders
+ * @param types the type of each placeholder: s for strings, d for integers
+ * @param ap the parameters
+ * @param callback the callback called on each row, may be NULL
+ * @param firstarg the first argument of the callback
+ * @return the number of rows passed to the callback, -1 on error
+ */
+int tagsistant_sqlite_statement(
+	dbi_conn dbi,
+	tagsistant_statement_id id,
+	const gchar *sql,
+	const gchar *types,
+	va_list ap,
+	tagsistant_query_callback callback,
+	void *firstarg)
+{
+	tagsistant_sqlite_conn *conn = (tagsistant_sqlite_conn *) dbi;
+	sqlite3_stmt *stmt = conn->statements[id];
+
+	if (!stmt) {
+		int res = sqlite3_prepare_v3(conn->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+		if (res isNot SQLITE_OK) {
+			conn->error = res;
+			return (-1);
+		}
+		conn->statements[id] = stmt;
+	}
+
+	int index = 1;
+	const gchar *type;
+	for (type = types; *type; type++, index++) {
+		if (*type is 's') {
+			const gchar *value = va_arg(ap, const gchar *);
+			sqlite3_bind_text(stmt, index, value ? value : "", -1, SQLITE_STATIC);
+		} else {
+			sqlite3_bind_int64(stmt, index, va_arg(ap, guint));
+		}
+	}
+
+	int rows = 0;
+	int res = tagsistant_sqlite_step(stmt, callback, firstarg, &rows);
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	conn->error = (res is SQLITE_DONE) ? SQLITE_OK : res;
+	return (conn->error ? -1 : rows);
+}
+
+/**
+ * Return the rowid of the last row inserted on a connection
+ *
+ * @param dbi the connection
+ * @return the rowid
+ */
+tagsistant_inode tagsistant_sqlite_last_insert_id(dbi_conn dbi)
+{
+	return (sqlite3_last_insert_rowid(((tagsistant_sqlite_conn *) dbi)->db));
+}
+
+#endif /* TAGSISTANT_NATIVE_SQLITE */
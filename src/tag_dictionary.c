@@ -0,0 +1,625 @@
+/*
+   Tagsistant (tagfs) -- tag_dictionary.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   The tag dictionary: a preloaded map between tags and their tag_ids.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** The tag dictionary holds every row of the tags table, loaded at mount. It    ***/
+/*** maps (tagname, key, value) tuples to tag_ids and tag_ids back to tuples.     ***/
+/***                                                                              ***/
+/*** Both maps are split in shards. A shard is never modified once published:    ***/
+/*** writers (serialized by a mutex) copy the shard, change the copy and swap     ***/
+/*** the shard pointer atomically, so lookups never take a lock. Each shard slot  ***/
+/*** counts the lookups using it, on its own cache line. Replaced shards and      ***/
+/*** removed tags are freed once the slots they can be reached from have no       ***/
+/*** lookup running: a lookup starting later can only find the new shards. The    ***/
+/*** writers free them when retiring something, the lookups when they leave an    ***/
+/*** idle slot.                                                                   ***/
+/***                                                                              ***/
+/*** Tag names, keys and values are interned, so the pointers returned by         ***/
+/*** tagsistant_tag_dictionary_reverse() never expire.                            ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the number of shards of each map (must be a power of 2, at most 64) */
+#define TAGSISTANT_TAG_DICTIONARY_SHARDS 64
+
+/**
+ * A tag of the dictionary
+ */
+typedef struct {
+	tagsistant_tag_id tag_id;
+
+	/** interned strings */
+	const gchar *tagname;
+	const gchar *key;
+	const gchar *value;
+} tagsistant_dictionary_tag;
+
+/**
+ * A shard and the lookups using it right now. A slot fills a cache
+ * line, so the lookups on different shards don't share one.
+ */
+typedef struct {
+	GHashTable *shard;
+	gint readers;
+	gchar padding[64 - sizeof(GHashTable *) - sizeof(gint)];
+} tagsistant_dictionary_slot;
+
+/** (tagname, key, value) -> tagsistant_dictionary_tag */
+static tagsistant_dictionary_slot tagsistant_tag_dictionary_by_tuple[TAGSISTANT_TAG_DICTIONARY_SHARDS];
+
+/** tag_id -> tagsistant_dictionary_tag */
+static tagsistant_dictionary_slot tagsistant_tag_dictionary_by_id[TAGSISTANT_TAG_DICTIONARY_SHARDS];
+
+/** serializes the writers */
+static GMutex tagsistant_tag_dictionary_lock;
+
+/** set when the dictionary has been loaded */
+static gint tagsistant_tag_dictionary_loaded = 0;
+
+/**
+ * A shard or a tag waiting for the running lookups to end
+ */
+typedef struct {
+	GHashTable *shard;
+	tagsistant_dictionary_tag *tag;
+
+	/** free the tags of the shard too */
+	gboolean free_tags;
+
+	/** the slots it can be reached from, one bit per shard */
+	guint64 tuple_slots;
+	guint64 id_slots;
+} tagsistant_dictionary_retired;
+
+/** the shards and tags retired, guarded by tagsistant_tag_dictionary_lock */
+static GQueue tagsistant_tag_dictionary_retired = G_QUEUE_INIT;
+
+/** the length of tagsistant_tag_dictionary_retired, read by the lookups without locking */
+static gint tagsistant_tag_dictionary_retired_count = 0;
+
+/** the bit of a shard in a slot set */
+#define tagsistant_tag_dictionary_slot_bit(shard) (G_GUINT64_CONSTANT(1) << (shard))
+
+/** all the shards of a map */
+#define TAGSISTANT_TAG_DICTIONARY_ALL_SLOTS \
+	(G_MAXUINT64 >> (64 - TAGSISTANT_TAG_DICTIONARY_SHARDS))
+
+/**
+ * Hash a (tagname, key, value) tuple
+ */
+static guint
+tagsistant_tag_dictionary_hash(const tagsistant_dictionary_tag *tag)
+{
+	return ((g_str_hash(tag->tagname) * 31 + g_str_hash(tag->key)) * 31 + g_str_hash(tag->value));
+}
+
+/**
+ * Compare two (tagname, key, value) tuples
+ */
+static gboolean
+tagsistant_tag_dictionary_equal(const tagsistant_dictionary_tag *a, const tagsistant_dictionary_tag *b)
+{
+	return (
+		strcmp(a->tagname, b->tagname) is 0 &&
+		strcmp(a->key, b->key) is 0 &&
+		strcmp(a->value, b->value) is 0);
+}
+
+#define tagsistant_tag_dictionary_tuple_shard(tag) \
+	(tagsistant_tag_dictionary_hash(tag) & (TAGSISTANT_TAG_DICTIONARY_SHARDS - 1))
+
+#define tagsistant_tag_dictionary_id_shard(tag_id) \
+	((tag_id) & (TAGSISTANT_TAG_DICTIONARY_SHARDS - 1))
+
+/**
+ * Create an empty shard
+ */
+static GHashTable *
+tagsistant_tag_dictionary_new_shard(gboolean by_tuple)
+{
+	if (by_tuple)
+		return (g_hash_table_new((GHashFunc) tagsistant_tag_dictionary_hash, (GEqualFunc) tagsistant_tag_dictionary_equal));
+
+	return (g_hash_table_new(NULL, NULL));
+}
+
+/**
+ * Copy a shard
+ */
+static GHashTable *
+tagsistant_tag_dictionary_copy_shard(GHashTable *shard, gboolean by_tuple)
+{
+	GHashTable *copy = tagsistant_tag_dictionary_new_shard(by_tuple);
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, shard);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_hash_table_insert(copy, key, value);
+
+	return (copy);
+}
+
+/**
+ * Free a retired shard or tag
+ */
+static void
+tagsistant_tag_dictionary_free_retired(tagsistant_dictionary_retired *retired)
+{
+	if (retired->shard) {
+		if (retired->free_tags) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, retired->shard);
+			while (g_hash_table_iter_next(&iter, NULL, &value)) g_free(value);
+		}
+		g_hash_table_destroy(retired->shard);
+	}
+
+	g_free(retired->tag);
+	g_free(retired);
+}
+
+/**
+ * Return TRUE if no lookup is running on a set of slots
+ *
+ * @param slots the slots of a map
+ * @param set the set of slots to check
+ */
+static gboolean
+tagsistant_tag_dictionary_idle(tagsistant_dictionary_slot *slots, guint64 set)
+{
+	int i;
+	for (i = 0; i < TAGSISTANT_TAG_DICTIONARY_SHARDS; i++)
+		if ((set & tagsistant_tag_dictionary_slot_bit(i)) && g_atomic_int_get(&slots[i].readers))
+			return (FALSE);
+
+	return (TRUE);
+}
+
+/**
+ * Free the retired shards and tags no running lookup can reach.
+ * Must be called with tagsistant_tag_dictionary_lock held.
+ */
+static void
+tagsistant_tag_dictionary_reclaim()
+{
+	GList *ptr = tagsistant_tag_dictionary_retired.head;
+	while (ptr) {
+		GList *next = ptr->next;
+		tagsistant_dictionary_retired *retired = ptr->data;
+
+		if (tagsistant_tag_dictionary_idle(tagsistant_tag_dictionary_by_tuple, retired->tuple_slots) &&
+			tagsistant_tag_dictionary_idle(tagsistant_tag_dictionary_by_id, retired->id_slots)) {
+			g_queue_delete_link(&tagsistant_tag_dictionary_retired, ptr);
+			g_atomic_int_add(&tagsistant_tag_dictionary_retired_count, -1);
+			tagsistant_tag_dictionary_free_retired(retired);
+		}
+
+		ptr = next;
+	}
+}
+
+/**
+ * Retire a shard or a tag, already unpublished, and free everything
+ * retired so far which no lookup can reach. Must be called with
+ * tagsistant_tag_dictionary_lock held.
+ *
+ * @param shard the shard to retire, if not NULL
+ * @param tag the tag to retire, if not NULL
+ * @param free_tags free the tags of the shard too
+ * @param tuple_slots the by_tuple slots it can be reached from
+ * @param id_slots the by_id slots it can be reached from
+ */
+static void
+tagsistant_tag_dictionary_retire(GHashTable *shard, tagsistant_dictionary_tag *tag, gboolean free_tags, guint64 tuple_slots, guint64 id_slots)
+{
+	if (shard || tag) {
+		tagsistant_dictionary_retired *retired = g_new0(tagsistant_dictionary_retired, 1);
+		retired->shard = shard;
+		retired->tag = tag;
+		retired->free_tags = free_tags;
+		retired->tuple_slots = tuple_slots;
+		retired->id_slots = id_slots;
+		g_queue_push_tail(&tagsistant_tag_dictionary_retired, retired);
+		g_atomic_int_inc(&tagsistant_tag_dictionary_retired_count);
+	}
+
+	tagsistant_tag_dictionary_reclaim();
+}
+
+/**
+ * Publish a new version of a by_tuple shard, retiring the old one.
+ * Must be called with tagsistant_tag_dictionary_lock held.
+ *
+ * @param shard the shard to replace
+ * @param copy the new version
+ */
+static void
+tagsistant_tag_dictionary_publish_by_tuple(int shard, GHashTable *copy)
+{
+	GHashTable *old = g_atomic_pointer_get(&tagsistant_tag_dictionary_by_tuple[shard].shard);
+	g_atomic_pointer_set(&tagsistant_tag_dictionary_by_tuple[shard].shard, copy);
+	tagsistant_tag_dictionary_retire(old, NULL, FALSE, tagsistant_tag_dictionary_slot_bit(shard), 0);
+}
+
+/**
+ * Publish a new version of a by_id shard, retiring the old one.
+ * Must be called with tagsistant_tag_dictionary_lock held.
+ *
+ * @param shard the shard to replace
+ * @param copy the new version
+ * @param free_tags free the tags of the old version too: they must
+ *   have been unpublished from every by_tuple shard already
+ */
+static void
+tagsistant_tag_dictionary_publish_by_id(int shard, GHashTable *copy, gboolean free_tags)
+{
+	GHashTable *old = g_atomic_pointer_get(&tagsistant_tag_dictionary_by_id[shard].shard);
+	g_atomic_pointer_set(&tagsistant_tag_dictionary_by_id[shard].shard, copy);
+	tagsistant_tag_dictionary_retire(old, NULL, free_tags,
+		free_tags ? TAGSISTANT_TAG_DICTIONARY_ALL_SLOTS : 0, tagsistant_tag_dictionary_slot_bit(shard));
+}
+
+/**
+ * Start a lookup on a slot
+ *
+ * @param slot the slot
+ * @return the shard of the slot
+ */
+static GHashTable *
+tagsistant_tag_dictionary_enter(tagsistant_dictionary_slot *slot)
+{
+	g_atomic_int_inc(&slot->readers);
+	return (g_atomic_pointer_get(&slot->shard));
+}
+
+/**
+ * End a lookup on a slot. The last lookup leaving a slot frees
+ * what has been retired meanwhile, unless a writer is running,
+ * which will do it by itself.
+ *
+ * @param slot the slot
+ */
+static void
+tagsistant_tag_dictionary_leave(tagsistant_dictionary_slot *slot)
+{
+	unless (g_atomic_int_dec_and_test(&slot->readers)) return;
+	unless (g_atomic_int_get(&tagsistant_tag_dictionary_retired_count)) return;
+
+	if (g_mutex_trylock(&tagsistant_tag_dictionary_lock)) {
+		tagsistant_tag_dictionary_reclaim();
+		g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+	}
+}
+
+/**
+ * Add a tag to a set of shards being built (no copy is done)
+ */
+static void
+tagsistant_tag_dictionary_insert(GHashTable **by_tuple, GHashTable **by_id, tagsistant_dictionary_tag *tag)
+{
+	g_hash_table_insert(by_tuple[tagsistant_tag_dictionary_tuple_shard(tag)], tag, tag);
+	g_hash_table_insert(by_id[tagsistant_tag_dictionary_id_shard(tag->tag_id)], GUINT_TO_POINTER(tag->tag_id), tag);
+}
+
+/**
+ * Build a dictionary tag from a (tag_id, tagname, key, value) row
+ */
+static tagsistant_dictionary_tag *
+tagsistant_tag_dictionary_new_tag(tagsistant_tag_id tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	tagsistant_dictionary_tag *tag = g_new0(tagsistant_dictionary_tag, 1);
+	tag->tag_id = tag_id;
+	tag->tagname = g_intern_string(_safe_string(tagname));
+	tag->key = g_intern_string(_safe_string(key));
+	tag->value = g_intern_string(_safe_string(value));
+	return (tag);
+}
+
+/**
+ * The shards being built by tagsistant_tag_dictionary_reload()
+ */
+typedef struct {
+	GHashTable *by_tuple[TAGSISTANT_TAG_DICTIONARY_SHARDS];
+	GHashTable *by_id[TAGSISTANT_TAG_DICTIONARY_SHARDS];
+} tagsistant_dictionary_shards;
+
+/**
+ * Callback for tagsistant_tag_dictionary_reload(), loads one tag
+ */
+static int
+tagsistant_tag_dictionary_load_tag(tagsistant_dictionary_shards *shards, dbi_result result)
+{
+	tagsistant_dictionary_tag *tag = tagsistant_tag_dictionary_new_tag(
+		tagsistant_result_get_uint(result, 1),
+		tagsistant_result_get_string(result, 2),
+		tagsistant_result_get_string(result, 3),
+		tagsistant_result_get_string(result, 4));
+
+	tagsistant_tag_dictionary_insert(shards->by_tuple, shards->by_id, tag);
+
+	return (0);
+}
+
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+/**
+ * Undo tagsistant_tag_dictionary_reload() when its transaction rolls back
+ */
+static void
+tagsistant_tag_dictionary_undo_reload(dbi_conn dbi, gpointer unused)
+{
+	(void) unused;
+	tagsistant_tag_dictionary_reload(dbi);
+}
+#endif
+
+/**
+ * Load (or reload) the whole dictionary from the tags table. Used at
+ * mount and after renames, which can change many tags at once.
+ *
+ * @param dbi a DBI connection
+ */
+void tagsistant_tag_dictionary_reload(dbi_conn dbi)
+{
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	tagsistant_dictionary_shards shards;
+	int i;
+
+	for (i = 0; i < TAGSISTANT_TAG_DICTIONARY_SHARDS; i++) {
+		shards.by_tuple[i] = tagsistant_tag_dictionary_new_shard(TRUE);
+		shards.by_id[i] = tagsistant_tag_dictionary_new_shard(FALSE);
+	}
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_query(
+		"select tag_id, tagname, `key`, value from tags",
+		dbi, (tagsistant_query_callback) tagsistant_tag_dictionary_load_tag, &shards);
+
+	/*
+	 * swap the shards: each old tag is in exactly one by_id shard,
+	 * which is retired with its tags once no by_tuple shard can
+	 * lead to them anymore
+	 */
+	int loaded = 0;
+	for (i = 0; i < TAGSISTANT_TAG_DICTIONARY_SHARDS; i++)
+		tagsistant_tag_dictionary_publish_by_tuple(i, shards.by_tuple[i]);
+
+	for (i = 0; i < TAGSISTANT_TAG_DICTIONARY_SHARDS; i++) {
+		loaded += g_hash_table_size(shards.by_id[i]);
+		tagsistant_tag_dictionary_publish_by_id(i, shards.by_id[i], TRUE);
+	}
+
+	g_atomic_int_set(&tagsistant_tag_dictionary_loaded, 1);
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+
+	dbg('b', LOG_INFO, "Tag dictionary loaded: %d tags", loaded);
+
+	/* a rename rolled back restores the old names */
+	tagsistant_db_on_rollback(dbi, tagsistant_tag_dictionary_undo_reload, NULL, NULL);
+#else
+	(void) dbi;
+#endif
+}
+
+/**
+ * Return TRUE if the dictionary has been loaded
+ */
+gboolean tagsistant_tag_dictionary_is_loaded()
+{
+	return (g_atomic_int_get(&tagsistant_tag_dictionary_loaded));
+}
+
+/**
+ * Load the tag dictionary at mount
+ */
+void tagsistant_tag_dictionary_init()
+{
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	tagsistant_tag_dictionary_reload(dbi);
+	tagsistant_db_connection_release(dbi, 0);
+#endif
+}
+
+/**
+ * Lookup a tag_id, without locking
+ *
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag (NULL is the same as "")
+ * @param value the value of a triple tag (NULL is the same as "")
+ * @return the tag_id, 0 if not found
+ */
+tagsistant_tag_id tagsistant_tag_dictionary_lookup(const gchar *tagname, const gchar *key, const gchar *value)
+{
+	unless (tagsistant_tag_dictionary_is_loaded() && tagname) return (0);
+
+	tagsistant_dictionary_tag probe;
+	probe.tagname = tagname;
+	probe.key = _safe_string(key);
+	probe.value = _safe_string(value);
+
+	tagsistant_dictionary_slot *slot = &tagsistant_tag_dictionary_by_tuple[tagsistant_tag_dictionary_tuple_shard(&probe)];
+	GHashTable *shard = tagsistant_tag_dictionary_enter(slot);
+
+	tagsistant_dictionary_tag *tag = g_hash_table_lookup(shard, &probe);
+	tagsistant_tag_id tag_id = tag ? tag->tag_id : 0;
+
+	tagsistant_tag_dictionary_leave(slot);
+
+	return (tag_id);
+}
+
+/**
+ * Lookup a tag by its tag_id, without locking. The strings returned
+ * are interned and must not be freed.
+ *
+ * @param tag_id the tag_id
+ * @param tagname where the tag name or the namespace is returned
+ * @param key where the key is returned (may be NULL)
+ * @param value where the value is returned (may be NULL)
+ * @return TRUE if found
+ */
+gboolean tagsistant_tag_dictionary_reverse(tagsistant_tag_id tag_id, const gchar **tagname, const gchar **key, const gchar **value)
+{
+	unless (tagsistant_tag_dictionary_is_loaded()) return (FALSE);
+
+	tagsistant_dictionary_slot *slot = &tagsistant_tag_dictionary_by_id[tagsistant_tag_dictionary_id_shard(tag_id)];
+	GHashTable *shard = tagsistant_tag_dictionary_enter(slot);
+
+	tagsistant_dictionary_tag *tag = g_hash_table_lookup(shard, GUINT_TO_POINTER(tag_id));
+
+	if (tag) {
+		if (tagname) *tagname = tag->tagname;
+		if (key) *key = tag->key;
+		if (value) *value = tag->value;
+	}
+
+	tagsistant_tag_dictionary_leave(slot);
+
+	return (tag ? TRUE : FALSE);
+}
+
+/**
+ * Undo tagsistant_tag_dictionary_add() when its transaction rolls back
+ */
+static void
+tagsistant_tag_dictionary_undo_add(dbi_conn dbi, gpointer tag_id)
+{
+	(void) dbi;
+	tagsistant_tag_dictionary_remove(GPOINTER_TO_UINT(tag_id));
+}
+
+/**
+ * Add a tag to the dictionary
+ *
+ * @param dbi the connection the tag has been read on: if the tag has
+ *   been created by its writer transaction, it's removed again should
+ *   the transaction be rolled back
+ * @param tag_id the tag_id
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ */
+void tagsistant_tag_dictionary_add(dbi_conn dbi, tagsistant_tag_id tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	unless (tagsistant_tag_dictionary_is_loaded() && tag_id && tagname) return;
+
+	tagsistant_dictionary_tag *tag = tagsistant_tag_dictionary_new_tag(tag_id, tagname, key, value);
+	int tuple_shard = tagsistant_tag_dictionary_tuple_shard(tag);
+	int id_shard = tagsistant_tag_dictionary_id_shard(tag_id);
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	if (g_hash_table_contains(tagsistant_tag_dictionary_by_id[id_shard].shard, GUINT_TO_POINTER(tag_id))) {
+		g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+		g_free(tag);
+		return;
+	}
+
+	GHashTable *by_tuple = tagsistant_tag_dictionary_copy_shard(tagsistant_tag_dictionary_by_tuple[tuple_shard].shard, TRUE);
+	GHashTable *by_id = tagsistant_tag_dictionary_copy_shard(tagsistant_tag_dictionary_by_id[id_shard].shard, FALSE);
+
+	g_hash_table_insert(by_tuple, tag, tag);
+	g_hash_table_insert(by_id, GUINT_TO_POINTER(tag_id), tag);
+
+	tagsistant_tag_dictionary_publish_by_tuple(tuple_shard, by_tuple);
+	tagsistant_tag_dictionary_publish_by_id(id_shard, by_id, FALSE);
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_db_on_rollback(dbi, tagsistant_tag_dictionary_undo_add, GUINT_TO_POINTER(tag_id), NULL);
+}
+
+/**
+ * Remove a tag from the dictionary
+ *
+ * @param tag_id the tag_id of the removed tag
+ */
+void tagsistant_tag_dictionary_remove(tagsistant_tag_id tag_id)
+{
+	unless (tagsistant_tag_dictionary_is_loaded() && tag_id) return;
+
+	int id_shard = tagsistant_tag_dictionary_id_shard(tag_id);
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_dictionary_tag *tag = g_hash_table_lookup(tagsistant_tag_dictionary_by_id[id_shard].shard, GUINT_TO_POINTER(tag_id));
+	if (tag) {
+		int tuple_shard = tagsistant_tag_dictionary_tuple_shard(tag);
+
+		GHashTable *by_tuple = tagsistant_tag_dictionary_copy_shard(tagsistant_tag_dictionary_by_tuple[tuple_shard].shard, TRUE);
+		GHashTable *by_id = tagsistant_tag_dictionary_copy_shard(tagsistant_tag_dictionary_by_id[id_shard].shard, FALSE);
+
+		g_hash_table_remove(by_tuple, tag);
+		g_hash_table_remove(by_id, GUINT_TO_POINTER(tag_id));
+
+		tagsistant_tag_dictionary_publish_by_tuple(tuple_shard, by_tuple);
+		tagsistant_tag_dictionary_publish_by_id(id_shard, by_id, FALSE);
+		tagsistant_tag_dictionary_retire(NULL, tag, FALSE,
+			tagsistant_tag_dictionary_slot_bit(tuple_shard), tagsistant_tag_dictionary_slot_bit(id_shard));
+	}
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+}
+
+/**
+ * The tag being loaded by tagsistant_tag_dictionary_fetch()
+ */
+typedef struct {
+	dbi_conn dbi;
+	tagsistant_tag_id tag_id;
+} tagsistant_dictionary_fetch;
+
+/**
+ * Callback for tagsistant_tag_dictionary_fetch()
+ */
+static int
+tagsistant_tag_dictionary_fetch_tag(tagsistant_dictionary_fetch *fetch, dbi_result result)
+{
+	tagsistant_tag_dictionary_add(fetch->dbi, fetch->tag_id,
+		tagsistant_result_get_string(result, 1),
+		tagsistant_result_get_string(result, 2),
+		tagsistant_result_get_string(result, 3));
+
+	return (0);
+}
+
+/**
+ * Load a tag missing from the dictionary from the tags table
+ *
+ * @param dbi a DBI connection
+ * @param tag_id the tag_id to load
+ * @return TRUE if the tag exists
+ */
+gboolean tagsistant_tag_dictionary_fetch(dbi_conn dbi, tagsistant_tag_id tag_id)
+{
+	tagsistant_dictionary_fetch fetch = { dbi, tag_id };
+
+	return (tagsistant_query(
+		"select tagname, `key`, value from tags where tag_id = %d",
+		dbi, (tagsistant_query_callback) tagsistant_tag_dictionary_fetch_tag, &fetch, tag_id) > 0);
+}
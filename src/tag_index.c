@@ -0,0 +1,616 @@
+/*
+   Tagsistant (tagfs) -- tag_index.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   In-memory inverted index of the tagging table.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** The tag index maps each tag_id to the sorted array of the inodes tagged by   ***/
+/*** it (its posting list) and each inode to its object name. When enabled with   ***/
+/*** --tag-index, it's loaded at mount, kept in sync with the tagging table by    ***/
+/*** tagsistant_tag_index_update_object() and used to materialize the RDS         ***/
+/*** without querying the database.                                               ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** tag_id -> GArray of sorted tagsistant_inode */
+GHashTable *tagsistant_tag_index_postings = NULL;
+
+/** inode -> object name */
+GHashTable *tagsistant_tag_index_names = NULL;
+
+/** guards both the tables above */
+GRWLock tagsistant_tag_index_lock;
+
+/**
+ * Return the position of the first element of a posting list
+ * greater or equal to an inode, starting from a given position.
+ * The search gallops (doubling the step) and then bisects, so
+ * intersecting a short list with a long one costs O(n log(m/n)).
+ *
+ * @param posting the posting list
+ * @param from the starting position
+ * @param inode the inode to look for
+ * @return the position found (posting->len if none)
+ */
+static guint
+tagsistant_tag_index_gallop(GArray *posting, guint from, tagsistant_inode inode)
+{
+	tagsistant_inode *data = (tagsistant_inode *) posting->data;
+	guint step = 1, low = from, high = from;
+
+	while (high < posting->len && data[high] < inode) {
+		low = high + 1;
+		high += step;
+		step <<= 1;
+	}
+
+	if (high > posting->len) high = posting->len;
+
+	while (low < high) {
+		guint middle = low + (high - low) / 2;
+		if (data[middle] < inode) low = middle + 1; else high = middle;
+	}
+
+	return (low);
+}
+
+/**
+ * Insert an inode in a posting list, keeping it sorted
+ *
+ * @param posting the posting list
+ * @param inode the inode to add
+ */
+static void
+tagsistant_tag_index_posting_add(GArray *posting, tagsistant_inode inode)
+{
+	guint position = tagsistant_tag_index_gallop(posting, 0, inode);
+	if (position < posting->len && g_array_index(posting, tagsistant_inode, position) is inode) return;
+	g_array_insert_val(posting, position, inode);
+}
+
+/**
+ * Remove an inode from a posting list
+ *
+ * @param posting the posting list
+ * @param inode the inode to remove
+ */
+static void
+tagsistant_tag_index_posting_remove(GArray *posting, tagsistant_inode inode)
+{
+	guint position = tagsistant_tag_index_gallop(posting, 0, inode);
+	if (position < posting->len && g_array_index(posting, tagsistant_inode, position) is inode)
+		g_array_remove_index(posting, position);
+}
+
+/**
+ * Return the posting list of a tag, creating it if requested.
+ * Must be called with tagsistant_tag_index_lock held.
+ *
+ * @param tag_id the tag_id
+ * @param create if TRUE, create the posting list if missing
+ * @return the posting list or NULL
+ */
+static GArray *
+tagsistant_tag_index_posting(tagsistant_tag_id tag_id, gboolean create)
+{
+	GArray *posting = g_hash_table_lookup(tagsistant_tag_index_postings, GUINT_TO_POINTER(tag_id));
+	if (!posting && create) {
+		posting = g_array_new(FALSE, FALSE, sizeof(tagsistant_inode));
+		g_hash_table_insert(tagsistant_tag_index_postings, GUINT_TO_POINTER(tag_id), posting);
+	}
+	return (posting);
+}
+
+/**
+ * Free a posting list (GDestroyNotify)
+ */
+static void
+tagsistant_tag_index_posting_free(GArray *posting)
+{
+	g_array_free(posting, TRUE);
+}
+
+/**
+ * Callback for tagsistant_tag_index_init() and
+ * tagsistant_tag_index_load_tag(), loads one tagging row.
+ * Rows come ordered by tag_id and inode, so appending keeps the
+ * posting lists sorted.
+ */
+static int
+tagsistant_tag_index_load_tagging(void *unused, dbi_result result)
+{
+	(void) unused;
+
+	tagsistant_tag_id tag_id = tagsistant_result_get_uint(result, 1);
+	tagsistant_inode inode = tagsistant_result_get_uint(result, 2);
+
+	GArray *posting = tagsistant_tag_index_posting(tag_id, TRUE);
+	g_array_append_val(posting, inode);
+
+	return (0);
+}
+
+/**
+ * Callback for tagsistant_tag_index_init(), loads one object name
+ */
+static int
+tagsistant_tag_index_load_object(void *unused, dbi_result result)
+{
+	(void) unused;
+
+	tagsistant_inode inode = tagsistant_result_get_uint(result, 1);
+	gchar *name = tagsistant_result_get_string_copy(result, 2);
+
+	g_hash_table_insert(tagsistant_tag_index_names, GUINT_TO_POINTER(inode), name);
+
+	return (0);
+}
+
+/**
+ * Load the tag index, if enabled with --tag-index
+ */
+void tagsistant_tag_index_init()
+{
+	unless (tagsistant.tag_index) return;
+
+	tagsistant_tag_index_postings = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) tagsistant_tag_index_posting_free);
+
+	tagsistant_tag_index_names = g_hash_table_new_full(
+		g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_free);
+
+	dbi_conn dbi = tagsistant_db_connection(0);
+
+	g_rw_lock_writer_lock(&tagsistant_tag_index_lock);
+
+	tagsistant_query(
+		"select tag_id, inode from tagging order by tag_id, inode",
+		dbi, tagsistant_tag_index_load_tagging, NULL);
+
+	tagsistant_query(
+		"select inode, objectname from objects",
+		dbi, tagsistant_tag_index_load_object, NULL);
+
+	dbg('b', LOG_INFO, "Tag index loaded: %d tags, %d objects",
+		g_hash_table_size(tagsistant_tag_index_postings),
+		g_hash_table_size(tagsistant_tag_index_names));
+
+	g_rw_lock_writer_unlock(&tagsistant_tag_index_lock);
+
+	tagsistant_db_connection_release(dbi, 0);
+}
+
+/**
+ * Keep the index in sync after the tagging or the name of an object
+ * changed: each tag_id in tag_ids is added to or removed from the
+ * object depending on its presence in the object_tags set.
+ *
+ * @param inode the object inode
+ * @param tag_ids a GList of the tag_ids that changed (as GUINT_TO_POINTER)
+ * @param object_tags a set of the tag_ids currently applied to the object
+ * @param name the current object name, NULL if the object has been deleted
+ */
+void tagsistant_tag_index_update_object(
+	tagsistant_inode inode,
+	GList *tag_ids,
+	GHashTable *object_tags,
+	const gchar *name)
+{
+	unless (tagsistant_tag_index_postings && inode) return;
+
+	g_rw_lock_writer_lock(&tagsistant_tag_index_lock);
+
+	GList *ptr = tag_ids;
+	while (ptr) {
+		if (name && g_hash_table_contains(object_tags, ptr->data)) {
+			tagsistant_tag_index_posting_add(tagsistant_tag_index_posting(GPOINTER_TO_UINT(ptr->data), TRUE), inode);
+		} else {
+			GArray *posting = tagsistant_tag_index_posting(GPOINTER_TO_UINT(ptr->data), FALSE);
+			if (posting) tagsistant_tag_index_posting_remove(posting, inode);
+		}
+		ptr = ptr->next;
+	}
+
+	if (name) {
+		g_hash_table_insert(tagsistant_tag_index_names, GUINT_TO_POINTER(inode), g_strdup(name));
+	} else {
+		g_hash_table_remove(tagsistant_tag_index_names, GUINT_TO_POINTER(inode));
+	}
+
+	g_rw_lock_writer_unlock(&tagsistant_tag_index_lock);
+}
+
+/**
+ * Drop the posting list of a deleted tag
+ *
+ * @param tag_id the deleted tag
+ */
+void tagsistant_tag_index_drop_tag(tagsistant_tag_id tag_id)
+{
+	unless (tagsistant_tag_index_postings) return;
+
+	g_rw_lock_writer_lock(&tagsistant_tag_index_lock);
+	g_hash_table_remove(tagsistant_tag_index_postings, GUINT_TO_POINTER(tag_id));
+	g_rw_lock_writer_unlock(&tagsistant_tag_index_lock);
+}
+
+/**
+ * Load again the posting list of a tag, dropped by a transaction
+ * that has been rolled back
+ *
+ * @param dbi a DBI connection
+ * @param tag_id the tag
+ */
+void tagsistant_tag_index_load_tag(dbi_conn dbi, tagsistant_tag_id tag_id)
+{
+	unless (tagsistant_tag_index_postings) return;
+
+	g_rw_lock_writer_lock(&tagsistant_tag_index_lock);
+
+	g_hash_table_remove(tagsistant_tag_index_postings, GUINT_TO_POINTER(tag_id));
+
+	tagsistant_query(
+		"select tag_id, inode from tagging where tag_id = %d order by inode",
+		dbi, tagsistant_tag_index_load_tagging, NULL, tag_id);
+
+	g_rw_lock_writer_unlock(&tagsistant_tag_index_lock);
+}
+
+/**
+ * Merge two sorted inode arrays
+ *
+ * @param a the first array
+ * @param b the second array
+ * @return a new array holding the union of a and b
+ */
+static GArray *
+tagsistant_tag_index_union(GArray *a, GArray *b)
+{
+	GArray *result = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), a->len + b->len);
+	tagsistant_inode *da = (tagsistant_inode *) a->data, *db = (tagsistant_inode *) b->data;
+	guint i = 0, j = 0;
+
+	while (i < a->len || j < b->len) {
+		tagsistant_inode inode;
+		if (j >= b->len || (i < a->len && da[i] < db[j])) {
+			inode = da[i++];
+		} else if (i >= a->len || db[j] < da[i]) {
+			inode = db[j++];
+		} else {
+			inode = da[i++];
+			j++;
+		}
+		g_array_append_val(result, inode);
+	}
+
+	return (result);
+}
+
+/**
+ * Intersect two sorted inode arrays, galloping on the longer one
+ *
+ * @param a the first array
+ * @param b the second array
+ * @return a new array holding the intersection of a and b
+ */
+static GArray *
+tagsistant_tag_index_intersect(GArray *a, GArray *b)
+{
+	if (a->len > b->len) { GArray *swap = a; a = b; b = swap; }
+
+	GArray *result = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), a->len);
+	tagsistant_inode *da = (tagsistant_inode *) a->data;
+	guint i = 0, j = 0;
+
+	for (i = 0; i < a->len && j < b->len; i++) {
+		j = tagsistant_tag_index_gallop(b, j, da[i]);
+		if (j < b->len && g_array_index(b, tagsistant_inode, j) is da[i])
+			g_array_append_val(result, da[i]);
+	}
+
+	return (result);
+}
+
+/**
+ * Subtract a sorted inode array from another
+ *
+ * @param a the array to subtract from
+ * @param b the array to be subtracted
+ * @return a new array holding a minus b
+ */
+static GArray *
+tagsistant_tag_index_subtract(GArray *a, GArray *b)
+{
+	GArray *result = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), a->len);
+	tagsistant_inode *da = (tagsistant_inode *) a->data;
+	guint i = 0, j = 0;
+
+	for (i = 0; i < a->len; i++) {
+		j = tagsistant_tag_index_gallop(b, j, da[i]);
+		unless (j < b->len && g_array_index(b, tagsistant_inode, j) is da[i])
+			g_array_append_val(result, da[i]);
+	}
+
+	return (result);
+}
+
+/**
+ * Replace an array with the result of a set operation, freeing the old one
+ */
+#define tagsistant_tag_index_replace(array, operation, other) {\
+	GArray *__result = operation(array, other);\
+	g_array_free(array, TRUE);\
+	array = __result;\
+}
+
+/**
+ * Return the union of the posting lists of a tag and of its related
+ * tags. Must be called with tagsistant_tag_index_lock held.
+ *
+ * @param and the qtree_and_node
+ * @return a new array
+ */
+static GArray *
+tagsistant_tag_index_and_node(qtree_and_node *and)
+{
+	GArray *result = g_array_new(FALSE, FALSE, sizeof(tagsistant_inode));
+
+	qtree_and_node *related = and;
+	while (related) {
+		GArray *posting = tagsistant_tag_index_posting(related->tag_id, FALSE);
+		if (posting) tagsistant_tag_index_replace(result, tagsistant_tag_index_union, posting);
+		related = related->related;
+	}
+
+	return (result);
+}
+
+/**
+ * Compare two inodes (GCompareFunc)
+ */
+static gint
+tagsistant_tag_index_compare(const tagsistant_inode *a, const tagsistant_inode *b)
+{
+	return ((*a < *b) ? -1 : ((*a > *b) ? 1 : 0));
+}
+
+/**
+ * Return all the indexed inodes, sorted (used by ALL/).
+ * Must be called with tagsistant_tag_index_lock held.
+ *
+ * @return a new array
+ */
+static GArray *
+tagsistant_tag_index_all_objects()
+{
+	GArray *result = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), g_hash_table_size(tagsistant_tag_index_names));
+
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, tagsistant_tag_index_names);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		tagsistant_inode inode = GPOINTER_TO_UINT(key);
+		g_array_append_val(result, inode);
+	}
+
+	g_array_sort(result, (GCompareFunc) tagsistant_tag_index_compare);
+	return (result);
+}
+
+/**
+ * Check if every tag of an and-set resolves to a single tag_id
+ */
+static gboolean
+tagsistant_tag_index_and_set_by_tag_id(qtree_and_node *and)
+{
+	while (and) {
+		if (and->namespace && (!and->value || and->operator isNot TAGSISTANT_EQUAL_TO)) return (FALSE);
+		and = and->next;
+	}
+	return (TRUE);
+}
+
+/**
+ * Check if a query tree can be evaluated by tag_id, on the index or
+ * on the tags of a single object: triple tags matched with operators
+ * other than equal need the database.
+ *
+ * @param tree the query tree
+ * @return TRUE if the tree can be evaluated
+ */
+gboolean tagsistant_tag_index_can_evaluate(qtree_or_node *tree)
+{
+	qtree_or_node *query = tree;
+	while (query) {
+		unless (tagsistant_tag_index_and_set_by_tag_id(query->and_set)) return (FALSE);
+		unless (tagsistant_tag_index_and_set_by_tag_id(query->negated_and_set)) return (FALSE);
+		query = query->next;
+	}
+	return (TRUE);
+}
+
+/**
+ * Evaluate a query tree on the index and call a function for each
+ * matching object, with the index read locked.
+ *
+ * @param tree the query tree
+ * @param callback called with (user_data, inode, name) for each object
+ * @param user_data passed to the callback
+ * @return FALSE if the index is disabled or the tree can't be evaluated
+ */
+gboolean tagsistant_tag_index_evaluate(
+	qtree_or_node *tree,
+	void (*callback)(gpointer user_data, tagsistant_inode inode, const gchar *name),
+	gpointer user_data)
+{
+	unless (tagsistant_tag_index_postings && tagsistant_tag_index_can_evaluate(tree)) return (FALSE);
+
+	g_rw_lock_reader_lock(&tagsistant_tag_index_lock);
+
+	GArray *result = g_array_new(FALSE, FALSE, sizeof(tagsistant_inode));
+
+	qtree_or_node *query = tree;
+	while (query) {
+		GArray *or_result = NULL;
+
+		/*
+		 * intersect the and-set, starting from the ALL/ tag if
+		 * present; OR nodes with no tags are skipped
+		 */
+		if (query->is_all_node) {
+			or_result = tagsistant_tag_index_all_objects();
+		} else {
+			qtree_and_node *and = query->and_set;
+			while (and) {
+				GArray *and_result = tagsistant_tag_index_and_node(and);
+				if (or_result) {
+					tagsistant_tag_index_replace(or_result, tagsistant_tag_index_intersect, and_result);
+					g_array_free(and_result, TRUE);
+				} else {
+					or_result = and_result;
+				}
+				and = and->next;
+			}
+		}
+
+		if (or_result) {
+			/*
+			 * remove the negated tags
+			 */
+			qtree_and_node *negated = query->negated_and_set;
+			while (negated) {
+				GArray *negated_result = tagsistant_tag_index_and_node(negated);
+				tagsistant_tag_index_replace(or_result, tagsistant_tag_index_subtract, negated_result);
+				g_array_free(negated_result, TRUE);
+				negated = negated->next;
+			}
+
+			tagsistant_tag_index_replace(result, tagsistant_tag_index_union, or_result);
+			g_array_free(or_result, TRUE);
+		}
+
+		query = query->next;
+	}
+
+	/*
+	 * resolve the names
+	 */
+	guint i;
+	for (i = 0; i < result->len; i++) {
+		tagsistant_inode inode = g_array_index(result, tagsistant_inode, i);
+		const gchar *name = g_hash_table_lookup(tagsistant_tag_index_names, GUINT_TO_POINTER(inode));
+		if (name) callback(user_data, inode, name);
+	}
+
+	g_rw_lock_reader_unlock(&tagsistant_tag_index_lock);
+
+	g_array_free(result, TRUE);
+	return (TRUE);
+}
+
+/**
+ * Return the union of the posting lists of a list of tag_ids.
+ * Must be called with tagsistant_tag_index_lock held.
+ *
+ * @param tag_ids a GList of tag_ids (as GUINT_TO_POINTER)
+ * @return a new array
+ */
+static GArray *
+tagsistant_tag_index_tag_ids(GList *tag_ids)
+{
+	GArray *result = g_array_new(FALSE, FALSE, sizeof(tagsistant_inode));
+
+	GList *ptr = tag_ids;
+	while (ptr) {
+		GArray *posting = tagsistant_tag_index_posting(GPOINTER_TO_UINT(ptr->data), FALSE);
+		if (posting) tagsistant_tag_index_replace(result, tagsistant_tag_index_union, posting);
+		ptr = ptr->next;
+	}
+
+	return (result);
+}
+
+/**
+ * Filter a sorted array of inodes, keeping the objects tagged by at
+ * least one tag_id of each group and by none of the negated tag_ids
+ *
+ * @param inodes the sorted array of inodes to be filtered
+ * @param and_groups a GList of GLists of tag_ids
+ * @param negated a GList of tag_ids
+ * @return a new array, NULL if the index is disabled
+ */
+GArray *tagsistant_tag_index_filter(GArray *inodes, GList *and_groups, GList *negated)
+{
+	unless (tagsistant_tag_index_postings) return (NULL);
+
+	GArray *result = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), inodes->len);
+	g_array_append_vals(result, inodes->data, inodes->len);
+
+	g_rw_lock_reader_lock(&tagsistant_tag_index_lock);
+
+	GList *group = and_groups;
+	while (group) {
+		GArray *tagged = tagsistant_tag_index_tag_ids((GList *) group->data);
+		tagsistant_tag_index_replace(result, tagsistant_tag_index_intersect, tagged);
+		g_array_free(tagged, TRUE);
+		group = group->next;
+	}
+
+	if (negated) {
+		GArray *tagged = tagsistant_tag_index_tag_ids(negated);
+		tagsistant_tag_index_replace(result, tagsistant_tag_index_subtract, tagged);
+		g_array_free(tagged, TRUE);
+	}
+
+	g_rw_lock_reader_unlock(&tagsistant_tag_index_lock);
+
+	return (result);
+}
+
+/**
+ * Print tag index statistics into a buffer
+ *
+ * @param buffer the buffer
+ * @param size the size of the buffer
+ */
+void tagsistant_tag_index_stats(gchar *buffer, size_t size)
+{
+	unless (tagsistant_tag_index_postings) {
+		snprintf(buffer, size, "tag index: disabled\n");
+		return;
+	}
+
+	g_rw_lock_reader_lock(&tagsistant_tag_index_lock);
+
+	guint64 postings = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, tagsistant_tag_index_postings);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) postings += ((GArray *) value)->len;
+
+	snprintf(buffer, size, "tag index: %d tags, %d objects, %" G_GUINT64_FORMAT " postings\n",
+		g_hash_table_size(tagsistant_tag_index_postings),
+		g_hash_table_size(tagsistant_tag_index_names),
+		postings);
+
+	g_rw_lock_reader_unlock(&tagsistant_tag_index_lock);
+}
@@ -47,6 +47,7 @@ static int tagsistant_fsync(const char *path, int isdatasync, struct fuse_file_i
 static void *tagsistant_init(struct fuse_conn_info *conn)
 {
 	(void) conn;
+	tagsistant_kernel_cache_init();
 	return(NULL);
 }
 
@@ -82,7 +83,7 @@ static struct fuse_operations tagsistant_oper = {
     .read		= tagsistant_read,
     .write		= tagsistant_write,
     .flush		= tagsistant_flush,
-//    .release	= tagsistant_release,
+    .release	= tagsistant_release,
 #if FUSE_USE_VERSION >= 25
     .statfs		= tagsistant_statvfs,
 #else
@@ -151,6 +152,25 @@ void tagsistant_usage(gchar *progname, int verbose)
 		"                               (defaults to .tags)\n"
 		"    --show-config, -p        print the content of the repository.ini file\n"
 		"    --namespace-suffix, -n   the namespace suffix (defaults to ':')\n"
+		"    --rds-memory=MB          memory budget of the RDS cache (defaults to 128)\n"
+		"    --rds-gc=lru|clock       RDS eviction policy (defaults to lru)\n"
+		"    --materializer=tables|setops\n"
+		"                             build query results with temporary tables or\n"
+		"                               with a single set-oriented statement\n"
+		"                               (defaults to tables)\n"
+		"    --tag-index              keep an in-memory index of the tagging table\n"
+		"    --qtree-cache=N          maximum number of cached querytrees (defaults to 65536)\n"
+		"    --qtree-cache-memory=MB  memory budget of the querytree cache (defaults to 32)\n"
+		"    --negative-timeout=S     seconds the kernel caches a nonexistent path (defaults to 1)\n"
+		"    --kernel-cache=S         seconds the kernel caches entries and attributes (defaults to 1)\n"
+		"    --db-pool-min=N          reader SQL connections kept open (defaults to 2)\n"
+		"    --db-pool-max=N          maximum number of reader SQL connections (defaults to 64)\n"
+		"    --group-commit=MS        group concurrent writers in one commit for up to MS\n"
+		"                             milliseconds (defaults to 5, 0 to disable)\n"
+		"    --relaxed-sync=MS        don't sync each commit, sync the journal every MS\n"
+		"                             milliseconds: a crash can lose the last MS ms of writes\n"
+		"    --sqlite-pragma=P=V      apply a pragma to each SQLite connection (can be repeated),\n"
+		"                             like synchronous=NORMAL or mmap_size=0\n"
 #if HAVE_SYS_XATTR_H
 		"    --enable-xattr, -x       enable extended attributes (needed for POSIX ACL)\n"
 #endif
@@ -234,6 +254,19 @@ static GOptionEntry tagsistant_options[] =
   { "namespace-suffix", 'n', 0, G_OPTION_ARG_STRING,			&tagsistant.namespace_suffix,	"The namespace suffix (defaults to ':')", NULL },
   { "fuse-opt", 'o', 0, 		G_OPTION_ARG_STRING_ARRAY, 		&tagsistant.fuse_opts, 			"Pass options to FUSE", "allow_other, allow_root, ..." },
   { "multi-symlink", 'm', 0,	G_OPTION_ARG_NONE,				&tagsistant.multi_symlink,		"Allow multiple symlink with the same name but different targets", NULL },
+  { "rds-memory", 0, 0,			G_OPTION_ARG_INT,				&tagsistant.rds_memory,			"Memory budget of the RDS cache in megabytes", "128" },
+  { "rds-gc", 0, 0,				G_OPTION_ARG_STRING,			&tagsistant.rds_gc,				"RDS eviction policy (defaults to lru)", "lru|clock" },
+  { "materializer", 0, 0,		G_OPTION_ARG_STRING,			&tagsistant.rds_materializer,	"RDS materializer (defaults to tables)", "tables|setops" },
+  { "qtree-cache", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.qtree_cache_size,	"Maximum number of cached querytrees", "65536" },
+  { "qtree-cache-memory", 0, 0,	G_OPTION_ARG_INT,				&tagsistant.qtree_cache_memory,	"Memory budget of the querytree cache in megabytes", "32" },
+  { "negative-timeout", 0, 0,	G_OPTION_ARG_INT,				&tagsistant.negative_timeout,	"Seconds the kernel caches a nonexistent path", "1" },
+  { "kernel-cache", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.kernel_cache,		"Seconds the kernel caches entries and attributes", "1" },
+  { "db-pool-min", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.db_pool_min,		"Reader SQL connections kept open", "2" },
+  { "db-pool-max", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.db_pool_max,		"Maximum number of reader SQL connections", "64" },
+  { "group-commit", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.group_commit,		"Milliseconds concurrent writers share a commit", "5" },
+  { "relaxed-sync", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.relaxed_sync,		"Milliseconds between journal syncs", "0" },
+  { "sqlite-pragma", 0, 0,		G_OPTION_ARG_STRING_ARRAY,		&tagsistant.sqlite_pragmas,		"Apply a pragma to each SQLite connection", "journal_mode=WAL" },
+  { "tag-index", 0, 0,			G_OPTION_ARG_NONE,				&tagsistant.tag_index,			"Keep an in-memory index of the tagging table", NULL },
 #if HAVE_SYS_XATTR_H
   { "enable-xattr", 'x', 0,		G_OPTION_ARG_NONE,				&tagsistant.enable_xattr,		"Enable extended attribute support (required for POSIX ACL)", NULL },
 #endif
@@ -299,6 +332,9 @@ int main(int argc, char *argv[])
 	 */
 	tagsistant.progname = argv[0];
 	tagsistant.debug = FALSE;
+	tagsistant.negative_timeout = -1;
+	tagsistant.kernel_cache = -1;
+	tagsistant.group_commit = -1;
 
 	/*
 	 * zero all the debug options
@@ -382,6 +418,84 @@ int main(int argc, char *argv[])
 		tagsistant.tags_suffix = g_strdup(TAGSISTANT_DEFAULT_TAGS_SUFFIX);
 	}
 
+	/*
+	 * default RDS cache budget, eviction policy and materializer
+	 */
+	if (tagsistant.rds_memory <= 0) {
+		tagsistant.rds_memory = TAGSISTANT_GC_MEMORY;
+	}
+
+	if (!tagsistant.rds_gc) {
+		tagsistant.rds_gc = g_strdup("lru");
+	} else if (strcmp(tagsistant.rds_gc, "lru") isNot 0 && strcmp(tagsistant.rds_gc, "clock") isNot 0) {
+		fprintf(stderr, " WARNING: unknown RDS eviction policy %s, using lru\n", tagsistant.rds_gc);
+		g_free(tagsistant.rds_gc);
+		tagsistant.rds_gc = g_strdup("lru");
+	}
+
+	if (!tagsistant.rds_materializer) {
+		tagsistant.rds_materializer = g_strdup("tables");
+	} else if (strcmp(tagsistant.rds_materializer, "tables") isNot 0 && strcmp(tagsistant.rds_materializer, "setops") isNot 0) {
+		fprintf(stderr, " WARNING: unknown RDS materializer %s, using tables\n", tagsistant.rds_materializer);
+		g_free(tagsistant.rds_materializer);
+		tagsistant.rds_materializer = g_strdup("tables");
+	}
+
+	/*
+	 * default querytree cache limits
+	 */
+	if (tagsistant.qtree_cache_size <= 0) {
+		tagsistant.qtree_cache_size = TAGSISTANT_QTREE_CACHE_SIZE;
+	}
+
+	if (tagsistant.qtree_cache_memory <= 0) {
+		tagsistant.qtree_cache_memory = TAGSISTANT_QTREE_CACHE_MEMORY;
+	}
+
+	/*
+	 * default kernel negative lookup timeout (0 disables it)
+	 */
+	if (tagsistant.negative_timeout < 0) {
+		tagsistant.negative_timeout = TAGSISTANT_NEGATIVE_TIMEOUT;
+	}
+
+	/*
+	 * default kernel entry and attribute timeout. Longer timeouts
+	 * need the kernel to be told when its entries get stale.
+	 */
+	if (tagsistant.kernel_cache < 0) {
+		tagsistant.kernel_cache = TAGSISTANT_KERNEL_CACHE_TIMEOUT;
+	} else if (tagsistant.kernel_cache > TAGSISTANT_KERNEL_CACHE_TIMEOUT && !tagsistant_kernel_cache_can_invalidate()) {
+		fprintf(stderr, " *** FUSE is older than 2.8 and can't invalidate kernel entries, --kernel-cache=%d ignored ***\n", tagsistant.kernel_cache);
+		tagsistant.kernel_cache = TAGSISTANT_KERNEL_CACHE_TIMEOUT;
+	}
+
+	/*
+	 * default SQL connection pool size
+	 */
+	if (tagsistant.db_pool_max <= 0) {
+		tagsistant.db_pool_max = TAGSISTANT_DB_POOL_MAX;
+	}
+
+	if (tagsistant.db_pool_min <= 0) {
+		tagsistant.db_pool_min = TAGSISTANT_DB_POOL_MIN;
+	}
+
+	if (tagsistant.db_pool_min > tagsistant.db_pool_max) {
+		tagsistant.db_pool_min = tagsistant.db_pool_max;
+	}
+
+	/*
+	 * default group commit window and relaxed sync interval
+	 */
+	if (tagsistant.group_commit < 0) {
+		tagsistant.group_commit = TAGSISTANT_GROUP_COMMIT_WINDOW;
+	}
+
+	if (tagsistant.relaxed_sync < 0) {
+		tagsistant.relaxed_sync = 0;
+	}
+
 	/*
 	 * compute the triple tag detector regexp
 	 */
@@ -398,6 +512,15 @@ int main(int argc, char *argv[])
 	fuse_opt_add_arg(&args, "-omax_write=32768");
 	fuse_opt_add_arg(&args, "-omax_read=32768");
 	fuse_opt_add_arg(&args, "-ofsname=tagsistant");
+
+	gchar *negative_timeout = g_strdup_printf("-onegative_timeout=%d", tagsistant.negative_timeout);
+	fuse_opt_add_arg(&args, negative_timeout);
+	g_free_null(negative_timeout);
+
+	gchar *kernel_cache = g_strdup_printf("-oentry_timeout=%d,attr_timeout=%d",
+		tagsistant.kernel_cache, tagsistant.kernel_cache);
+	fuse_opt_add_arg(&args, kernel_cache);
+	g_free_null(kernel_cache);
 //	fuse_opt_add_arg(&args, "-ofstype=tagsistant");
 //	fuse_opt_add_arg(&args, "-ouse_ino,readdir_ino");
 //	fuse_opt_add_arg(&args, "-oallow_other");
@@ -674,11 +797,18 @@ int main(int argc, char *argv[])
 	tagsistant_db_init();
 	tagsistant_create_schema();
 	tagsistant_wal_sync();
+
+	/* preload the tag dictionary and the aliases */
+	tagsistant_tag_dictionary_init();
+	tagsistant_alias_table_init();
+	tagsistant_negative_cache_init();
+
 	tagsistant_path_resolution_init();
 	tagsistant_reasoner_init();
 	tagsistant_utils_init();
 	tagsistant_deduplication_init();
 	tagsistant_rds_init();
+	tagsistant_tag_index_init();
 
 	/* SQLite requires tagsistant to run in single thread mode */
 	if (tagsistant.sql_database_driver is TAGSISTANT_DBI_SQLITE_BACKEND) {
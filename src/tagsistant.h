@@ -68,8 +68,14 @@
 /** cache tag IDs? */
 #define TAGSISTANT_ENABLE_TAG_ID_CACHE 1
 
+/** keep the aliases table in memory? */
+#define TAGSISTANT_ENABLE_ALIAS_CACHE 1
+
 /** cache inode resolution queries? */
-#define TAGSISTANT_ENABLE_AND_SET_CACHE 0
+#define TAGSISTANT_ENABLE_AND_SET_CACHE 1
+
+/** entries of the and-set cache, which is emptied when full */
+#define TAGSISTANT_AND_SET_CACHE_SIZE 16384
 
 /** cache reasoner queries? */
 #define TAGSISTANT_ENABLE_REASONER_CACHE 0
@@ -83,9 +89,6 @@
 /** inline deduplication in main thread or schedule files for deduplication in a separate thread? */
 #define TAGSISTANT_INLINE_DEDUPLICATION 1
 
-/** enable filehandle caching between open(), read(), write() and release() calls */
-#define TAGSISTANT_ENABLE_FILE_HANDLE_CACHING 1
-
 /** the maximum length of the buffer used to store dynamic /stats files */
 #define TAGSISTANT_STATS_BUFFER 2048
 
@@ -98,6 +101,9 @@
 /** the default regular expression to identify the starting token of a triple tag */
 #define TAGSISTANT_DEFAULT_TRIPLE_TAG_REGEX ":$"
 
+/** the default suffix of the starting token of a triple tag (matched by TAGSISTANT_DEFAULT_TRIPLE_TAG_REGEX) */
+#define TAGSISTANT_DEFAULT_NAMESPACE_SUFFIX ":"
+
 /** the default suffix appended to files to get their tags */
 #define TAGSISTANT_DEFAULT_TAGS_SUFFIX ".tags"
 
@@ -107,6 +113,40 @@
 /** the number of RDS (reusable data sets) allowed in the rds table before the GC kicks in */
 #define TAGSISTANT_GC_RDS 50000
 
+/** the default memory budget of the RDS cache, in megabytes (see --rds-memory) */
+#define TAGSISTANT_GC_MEMORY 128
+
+/** microseconds of residency granted by the RDS GC for each microsecond spent materializing an RDS */
+#define TAGSISTANT_GC_COST_WEIGHT 100
+
+/** the default number of querytrees kept in the querytree cache (see --qtree-cache) */
+#define TAGSISTANT_QTREE_CACHE_SIZE 65536
+
+/** the default memory budget of the querytree cache, in megabytes (see --qtree-cache-memory) */
+#define TAGSISTANT_QTREE_CACHE_MEMORY 32
+
+/** the maximum number of paths remembered by the negative cache */
+#define TAGSISTANT_NEGATIVE_CACHE_SIZE 16384
+
+/** the default seconds the kernel caches a nonexistent path (see --negative-timeout) */
+#define TAGSISTANT_NEGATIVE_TIMEOUT 1
+
+/** the default seconds the kernel caches entries and attributes (see --kernel-cache) */
+#define TAGSISTANT_KERNEL_CACHE_TIMEOUT 1
+
+/** the default minimum and maximum number of reader SQL connections (see --db-pool-min and --db-pool-max) */
+#define TAGSISTANT_DB_POOL_MIN 2
+#define TAGSISTANT_DB_POOL_MAX 64
+
+/** the default milliseconds concurrent writers are grouped in one commit (see --group-commit) */
+#define TAGSISTANT_GROUP_COMMIT_WINDOW 5
+
+/** seconds between two health checks of the idle SQL connections */
+#define TAGSISTANT_DB_PING_INTERVAL 30
+
+/** the largest RDS whose inodes are probed by SQL to derive a narrower RDS from it */
+#define TAGSISTANT_RDS_DERIVE_MAX 10000
+
 /** the name of the trash tag */
 #define TAGSISTANT_TRASH_TAG ".Trash"
 
@@ -240,6 +280,20 @@ struct tagsistant {
 	gchar		*namespace_suffix; /**< the suffix that distinguishes namespaces */
 	gchar		*triple_tag_regex; /**< namespace suffix detector regexp */
 
+	gint		rds_memory;		/**< the memory budget of the RDS cache, in megabytes */
+	gchar		*rds_gc;		/**< the RDS eviction policy: lru or clock */
+	gchar		*rds_materializer; /**< the RDS materializer: tables or setops */
+	gboolean	tag_index;		/**< keep an in-memory inverted index of the tagging table */
+	gint		qtree_cache_size; /**< the maximum number of entries in the querytree cache */
+	gint		qtree_cache_memory; /**< the memory budget of the querytree cache, in megabytes */
+	gint		negative_timeout; /**< seconds the kernel caches a nonexistent path */
+	gint		kernel_cache;	/**< seconds the kernel caches entries and attributes */
+	gint		db_pool_min;	/**< the minimum number of reader SQL connections */
+	gint		db_pool_max;	/**< the maximum number of reader SQL connections */
+	gint		group_commit;	/**< the milliseconds concurrent writers share a commit, 0 to disable */
+	gint		relaxed_sync;	/**< the milliseconds between journal syncs, 0 to sync on each commit */
+	gchar		**sqlite_pragmas; /**< the pragmas applied to each SQLite connection */
+
 	gchar		*progname;		/**< tagsistant */
 	gchar		*mountpoint;	/**< no clue? */
 	gchar		*repository;	/**< it's where files and tags are archived, no? */
@@ -305,9 +359,7 @@ extern void tagsistant_schedule_for_autotagging(tagsistant_querytree *qtree);
 /**
  * Check if a path contains the meta-tag ALL/
  */
-#define is_all_path(path) (\
-	g_regex_match_simple("/ALL/", path, G_REGEX_EXTENDED, 0) ||\
-	g_regex_match_simple("/ALL$", path, G_REGEX_EXTENDED, 0))
+#define is_all_path(path) tagsistant_path_is_all(path)
 
 /**
  * Fuse operations logging macros.
@@ -335,6 +387,7 @@ extern void tagsistant_plugin_loader();
 extern void tagsistant_plugin_unloader();
 extern void tagsistant_deduplication_init();
 extern void tagsistant_rds_init();
+extern void tagsistant_tag_index_init();
 
 // call the plugin stack
 extern int tagsistant_process(gchar *path, gchar *full_archive_path);
@@ -347,6 +400,9 @@ extern void tagsistant_plugin_apply_regex(const tagsistant_querytree *qtree, con
 #define		tagsistant_force_create_and_tag_object(qtree, errno) tagsistant_inner_create_and_tag_object(qtree, errno, 1);
 extern int	tagsistant_inner_create_and_tag_object(tagsistant_querytree *qtree, int *tagsistant_errno, int force_create);
 
+// check if a tag ends by the namespace suffix (default: :)
+extern gboolean		tagsistant_is_triple_tag(const gchar *tag);
+
 // check if a file ends by the tags-listing suffix (default: .tags)
 extern gboolean 	tagsistant_is_tags_list_file(tagsistant_querytree *qtree);
 extern gchar *		tagsistant_string_tags_list_suffix(tagsistant_querytree *qtree);
@@ -360,7 +416,7 @@ extern void tagsistant_fix_archive();
  * @param dbi_conn a valid DBI connection
  */
 #define tagsistant_invalidate_object_checksum(inode, dbi_conn)\
-	tagsistant_query("update objects set checksum = '' where inode = %d", dbi_conn, NULL, NULL, inode)
+	tagsistant_logged_query(TAGSISTANT_WAL_UPDATE_OBJECT, "update objects set checksum = '' where inode = %d", dbi_conn, NULL, NULL, inode)
 
 // read and write repository.ini file
 extern GKeyFile *tagsistant_ini;
@@ -377,14 +433,43 @@ extern int tagsistant_querytree_find_duplicates(tagsistant_querytree *qtree, gch
 #define O_NOATIME	01000000
 #endif
 
+/**
+ * An open object, allocated by open() and stored in fi->fh.
+ * read(), write(), flush() and release() use it instead of
+ * resolving the path again.
+ */
+typedef struct {
+	/** the archive file descriptor */
+	int fd;
+
+	/** the object inode */
+	tagsistant_inode inode;
+
+	/** the path of the object inside the archive/ */
+	gchar *full_archive_path;
+
+	/** the object has been opened for writing or written since last flush() */
+	gint dirty;
+
+	/** references held on this handle */
+	gint refcount;
+} tagsistant_handle;
+
 #if TAGSISTANT_ENABLE_FILE_HANDLE_CACHE
-#	define tagsistant_set_file_handle(fi, fh_value) fi->fh = (unsigned long) fh_value
-#	define tagsistant_get_file_handle(fi, fh_variable) fh_variable = (long) fi->fh
+#	define tagsistant_set_file_handle(fi, handle) fi->fh = (uint64_t) (uintptr_t) (handle)
+#	define tagsistant_get_file_handle(fi) ((tagsistant_handle *) (uintptr_t) fi->fh)
 #else
-#	define tagsistant_set_file_handle(fi, fh_value) ()
-#	define tagsistant_get_file_handle(fi, fh_variable) ()
+#	define tagsistant_set_file_handle(fi, handle) {}
+#	define tagsistant_get_file_handle(fi) ((tagsistant_handle *) NULL)
 #endif
 
+extern gint					tagsistant_open_handles;
+extern tagsistant_handle *	tagsistant_handle_new(int fd, tagsistant_querytree *qtree, int flags);
+extern tagsistant_handle *	tagsistant_handle_ref(tagsistant_handle *handle);
+extern void					tagsistant_handle_unref(tagsistant_handle *handle);
+extern void					tagsistant_handle_set_dirty(tagsistant_handle *handle);
+extern gboolean				tagsistant_handle_clear_dirty(tagsistant_handle *handle);
+
 extern gchar *tagsistant_get_file_tags(tagsistant_querytree *qtree);
 
 extern gboolean tagsistant_dispose_object_if_untagged(tagsistant_querytree *qtree);
@@ -409,12 +494,41 @@ typedef struct {
 	GHashTable *entries;
 	GRWLock rwlock;
 	GMutex materializer_mutex;
+
+	/** the tag_ids this RDS depends on, registered on materialization */
+	GList *dependencies;
+
+	/** if TRUE, any write dematerializes this RDS (ALL/, non-equal triple tags) */
+	gboolean is_volatile;
+
+	/** the query OR nodes, used to update the entries in place on tagging changes */
+	GList *or_nodes;
+
+	/** GC accounting: number of (name, inode) tuples and estimated memory footprint */
+	gint64 tuples;
+	gint64 bytes;
+
+	/** GC accounting: last access and materialization time, in microseconds */
+	gint64 last_access;
+	gint64 cost;
+
+	/** CLOCK reference bit */
+	gboolean referenced;
+
+	/** number of threads holding this RDS between lookup and read unlock */
+	gint pinned;
+
+	/** materialized while a write was open or committed: dematerialize on read unlock */
+	gboolean discard;
 } tagsistant_rds;
 
 extern tagsistant_rds *	tagsistant_rds_new_or_lookup(tagsistant_querytree *qtree);
 extern tagsistant_rds *	tagsistant_rds_new(tagsistant_querytree *qtree);
 extern void				tagsistant_delete_rds_involved(tagsistant_querytree *qtree);
-extern gboolean			tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree);
+extern void				tagsistant_rds_update_object(dbi_conn dbi, tagsistant_inode inode, GList *tag_ids, const gchar *old_name);
+extern void				tagsistant_rds_dematerialize(gpointer key, tagsistant_rds *rds, gpointer unused);
+extern gboolean			tagsistant_rds_materialize(tagsistant_rds *rds, tagsistant_querytree *qtree, GList *supersets);
+extern gchar *			tagsistant_rds_canonical_query(tagsistant_querytree *qtree);
 extern gchar *			tagsistant_get_rds_checksum(tagsistant_querytree *qtree);
 extern tagsistant_rds *	tagsistant_rds_lookup(const gchar *checksum);
 extern gboolean			tagsistant_rds_contains_object(gpointer key, gpointer value, gpointer user_data);
@@ -423,3 +537,50 @@ extern gboolean			tagsistant_rds_read_lock(tagsistant_rds *rds, tagsistant_query
 extern void				tagsistant_rds_read_unlock(tagsistant_rds *rds);
 extern gboolean			tagsistant_rds_write_lock(tagsistant_rds *rds);
 extern void				tagsistant_rds_write_unlock(tagsistant_rds *rds);
+extern void				tagsistant_rds_gc();
+extern void				tagsistant_rds_stats(gchar *buffer, size_t size);
+
+// tag index functions
+extern void				tagsistant_tag_index_update_object(tagsistant_inode inode, GList *tag_ids, GHashTable *object_tags, const gchar *name);
+extern void				tagsistant_tag_index_drop_tag(tagsistant_tag_id tag_id);
+extern void				tagsistant_tag_index_load_tag(dbi_conn dbi, tagsistant_tag_id tag_id);
+extern gboolean			tagsistant_tag_index_evaluate(qtree_or_node *tree, void (*callback)(gpointer user_data, tagsistant_inode inode, const gchar *name), gpointer user_data);
+extern gboolean			tagsistant_tag_index_can_evaluate(qtree_or_node *tree);
+extern GArray *			tagsistant_tag_index_filter(GArray *inodes, GList *and_groups, GList *negated);
+extern void				tagsistant_tag_index_stats(gchar *buffer, size_t size);
+
+// tag dictionary functions
+extern void				tagsistant_tag_dictionary_init();
+extern void				tagsistant_tag_dictionary_reload(dbi_conn dbi);
+extern gboolean			tagsistant_tag_dictionary_is_loaded();
+extern tagsistant_tag_id	tagsistant_tag_dictionary_lookup(const gchar *tagname, const gchar *key, const gchar *value);
+extern gboolean			tagsistant_tag_dictionary_reverse(tagsistant_tag_id tag_id, const gchar **tagname, const gchar **key, const gchar **value);
+extern void				tagsistant_tag_dictionary_add(dbi_conn dbi, tagsistant_tag_id tag_id, const gchar *tagname, const gchar *key, const gchar *value);
+extern void				tagsistant_tag_dictionary_remove(tagsistant_tag_id tag_id);
+extern gboolean			tagsistant_tag_dictionary_fetch(dbi_conn dbi, tagsistant_tag_id tag_id);
+
+// negative cache functions
+extern void				tagsistant_negative_cache_init();
+extern gboolean			tagsistant_negative_cache_lookup(const gchar *path);
+extern gint				tagsistant_negative_cache_ticket();
+extern void				tagsistant_negative_cache_add(const gchar *path, gint ticket);
+extern void				tagsistant_negative_cache_invalidate_name(const gchar *name);
+extern void				tagsistant_negative_cache_invalidate_path(const gchar *path);
+extern void				tagsistant_negative_cache_invalidate_inode(dbi_conn dbi, tagsistant_inode inode);
+extern void				tagsistant_negative_cache_invalidate();
+extern void				tagsistant_negative_cache_stats(gchar *buffer, size_t size);
+
+// kernel cache functions
+extern gboolean			tagsistant_kernel_cache_can_invalidate();
+extern void				tagsistant_kernel_cache_init();
+extern void				tagsistant_kernel_cache_invalidate();
+extern void				tagsistant_kernel_cache_stats(gchar *buffer, size_t size);
+
+// alias table functions
+extern void				tagsistant_alias_table_init();
+extern void				tagsistant_alias_table_reload(dbi_conn dbi);
+extern gboolean			tagsistant_alias_table_is_loaded();
+extern gchar *			tagsistant_alias_table_lookup(const gchar *alias);
+extern void				tagsistant_alias_table_set(const gchar *alias, const gchar *query);
+extern void				tagsistant_alias_table_remove(const gchar *alias);
+extern void				tagsistant_alias_table_load(dbi_conn dbi, const gchar *alias);
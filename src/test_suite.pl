@@ -17,6 +17,7 @@ use threads::shared;
 
 use Errno;
 use POSIX;
+use Time::HiRes;
 
 our ($FUSE_GROUP, $MP, $REPOSITORY, $MCMD, $UMCMD, $TID, $tc, $tc_ok, $tc_error, $error_stack, $output);
 
@@ -221,6 +222,8 @@ test("stat $MP/store/tag4/@@/dirobj/file10");
 test("stat $MP/stats/configuration");
 test("cat $MP/stats/configuration");
 out_test("mountpoint: $MP");
+test("cat $MP/stats/rds");
+out_test('# of RDS: \d+', '# of evictions: \d+');
 
 #
 # the alias/ dir
@@ -238,6 +241,11 @@ test("cat $MP/store/tag1/@@/file9.tags");
 out_test("tag1");
 out_test("tag4");
 
+#
+# end-to-end getattr() benchmark on uncached paths
+#
+bench_getattr(2000);
+
 # ---------[no more test to run]---------------------------------------- <---
 OUT:
 
@@ -395,6 +403,35 @@ sub test {
 	return $exitstatus;
 }
 
+#
+# stat() a set of distinct store/ paths covering the whole query
+# grammar, so that neither the kernel nor the querytree cache can
+# answer, and report how many getattr() calls per second have been
+# served. Each call goes through FUSE, the path parser, the DB
+# lookups of the resolution and the lstat() of the archive, so this
+# measures the whole getattr() path, not the parser alone.
+#
+sub bench_getattr {
+	my $count = shift() || 1000;
+	my @templates = (
+		'store/tag1/tag2/@/bench%d',
+		'store/tag1/+/tag3/@@/bench%d',
+		'store/ALL/-/tag2/@/bench%d',
+		'store/{/tag1/tag2/}/tag3/@/bench%d',
+		'store/bench:/key/eq/%d/@/bench%d',
+		'store/tag1/@/%d___bench%d',
+	);
+
+	my $start = Time::HiRes::time();
+	for my $i (1 .. $count) {
+		my $path = sprintf($templates[$i % scalar(@templates)], $i, $i);
+		stat("$MP/$path");
+	}
+	my $elapsed = Time::HiRes::time() - $start;
+
+	printf "\n____ [ BENCH ] getattr() on %d uncached paths in %.3f s (%.0f calls/s)\n", $count, $elapsed, $count / ($elapsed || 1);
+}
+
 #
 # apply a list of regular expressions on the output
 # of last performed command
@@ -133,8 +133,8 @@ tagsistant_inner_create_and_tag_object(
 	 *    and use its inode, otherwise create a new one
 	 */
 	if (!force_create) {
-		tagsistant_query(
-			"select inode from objects where objectname = '%s' limit 1",
+		tagsistant_statement(
+			TAGSISTANT_STATEMENT_GET_INODE_BY_NAME,
 			qtree->dbi,
 			tagsistant_return_integer,
 			&inode,
@@ -148,8 +148,8 @@ tagsistant_inner_create_and_tag_object(
 		/*
 		 * create the object
 		 */
-		tagsistant_query(
-			"insert into objects (objectname) values ('%s')",
+		tagsistant_logged_query(
+			TAGSISTANT_WAL_CREATE_OBJECT, "insert into objects (objectname) values ('%s')",
 			qtree->dbi, NULL, NULL, qtree->object_path);
 
 		/*
@@ -160,6 +160,8 @@ tagsistant_inner_create_and_tag_object(
 
 		if (tagsistant.sql_database_driver is TAGSISTANT_DBI_SQLITE_BACKEND)
 			g_mutex_unlock(&tagsistant_sqlite_mutex);
+
+		tagsistant_tag_index_update_object(inode, NULL, NULL, qtree->object_path);
 	}
 
 	if (!inode) {
@@ -229,6 +231,26 @@ void tagsistant_utils_init()
 	g_free(escaped);
 }
 
+/**
+ * guess if a tag is the namespace of a triple tag, which means it ends
+ * by the namespace suffix. Equivalent to matching tagsistant.triple_tag_regex
+ * but without compiling a regular expression on each call.
+ *
+ * @param tag the tag to check
+ * @return true if the tag is a namespace, false otherwise
+ */
+gboolean tagsistant_is_triple_tag(const gchar *tag)
+{
+	if (!tag) return (FALSE);
+
+	const gchar *suffix = tagsistant.namespace_suffix ? tagsistant.namespace_suffix : TAGSISTANT_DEFAULT_NAMESPACE_SUFFIX;
+	size_t suffix_length = strlen(suffix), tag_length = strlen(tag);
+
+	if (!suffix_length || tag_length < suffix_length) return (FALSE);
+
+	return (memcmp(tag + tag_length - suffix_length, suffix, suffix_length) is 0);
+}
+
 /**
  * guess if a filename refers to a tag-listing special file or not
  *
@@ -452,13 +474,13 @@ int tagsistant_read_file_tags(void *tagsbuffer, dbi_result result)
 {
 	GString *buffer = (GString *) tagsbuffer;
 
-	const gchar *next_tag = dbi_result_get_string_idx(result, 1);
+	const gchar *next_tag = tagsistant_result_get_string(result, 1);
 
-	if (g_regex_match_simple(tagsistant.triple_tag_regex, next_tag, 0, 0)) {
+	if (tagsistant_is_triple_tag(next_tag)) {
 		g_string_append_printf(buffer, "%s%s=%s\n",
 			next_tag,
-			dbi_result_get_string_idx(result, 2),
-			dbi_result_get_string_idx(result, 3));
+			tagsistant_result_get_string(result, 2),
+			tagsistant_result_get_string(result, 3));
 	} else {
 		g_string_append_printf(buffer, "%s\n", next_tag);
 	}
@@ -471,8 +493,8 @@ gchar *tagsistant_get_file_tags(tagsistant_querytree *qtree)
 	/* strip the suffix from the path */
 	gchar *stripped_path = tagsistant_string_tags_list_suffix(qtree);
 	
-	/* create a new one on the stripped path */
-	tagsistant_querytree *stripped_qtree = tagsistant_querytree_new(stripped_path, 0, 0, 1, 1);
+	/* create a new one on the stripped path, sharing the connection */
+	tagsistant_querytree *stripped_qtree = tagsistant_querytree_new_on_connection(stripped_path, qtree->dbi, 1);
 	
 	/* free the stripped path */
 	g_free(stripped_path);
@@ -524,17 +546,19 @@ gboolean tagsistant_dispose_object_if_untagged(tagsistant_querytree *qtree)
 			 * delete the object once for all
 			 */
 			if (tagsistant_querytree_includes_tag(qtree, TAGSISTANT_TRASH_TAG, NULL, NULL, NULL)) {
-				tagsistant_query("delete from objects where inode = %d", qtree->dbi, NULL, NULL, qtree->inode);
+				tagsistant_logged_query(TAGSISTANT_WAL_DELETE_OBJECT, "delete from objects where inode = %d", qtree->dbi, NULL, NULL, qtree->inode);
 			} else {
 				tagsistant_sql_tag_object(qtree->dbi, TAGSISTANT_TRASH_TAG, "", "", qtree->inode);
 				return (FALSE);
 			}
 		} else {
-			tagsistant_query("delete from objects where inode = %d", qtree->dbi, NULL, NULL, qtree->inode);
+			tagsistant_logged_query(TAGSISTANT_WAL_DELETE_OBJECT, "delete from objects where inode = %d", qtree->dbi, NULL, NULL, qtree->inode);
 		}
 	} else {
 		return (FALSE);
 	}
 
+	tagsistant_tag_index_update_object(qtree->inode, NULL, NULL, NULL);
+
 	return (TRUE);
 }
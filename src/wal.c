@@ -0,0 +1,719 @@
+/*
+   Tagsistant (tagfs) -- wal.c
+   Copyright (C) 2006-2015 Tx0 <tx0@strumentiresistenti.org>
+
+   Binary write-ahead log of the metadata changes.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** The statements changing objects, tags, tagging, relations and aliases are    ***/
+/*** logged in repository/wal/ as binary records:                                 ***/
+/***                                                                              ***/
+/***   length (4 bytes) | crc32 (4) | lsn (8) | operation (1) | statement         ***/
+/***                                                                              ***/
+/*** Integers are little endian and the CRC covers lsn, operation and statement.  ***/
+/*** Each LSN (log sequence number) is one more than the previous one.            ***/
+/***                                                                              ***/
+/*** The records of a writer transaction are kept in memory and written by its    ***/
+/*** commit, with one fsync, so a rolled back operation is never logged. The last ***/
+/*** LSN is saved as wal_lsn in the status table by the same transaction. At      ***/
+/*** mount the records after wal_lsn are applied again.                           ***/
+/***                                                                              ***/
+/*** Segments are named after their first LSN and a new one is started every      ***/
+/*** TAGSISTANT_WAL_SEGMENT_SIZE bytes. Each segment starts with a checkpoint     ***/
+/*** record holding the last LSN committed into the DB: the older segments which  ***/
+/*** hold only committed records are deleted.                                     ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the first bytes of a segment */
+#define TAGSISTANT_WAL_MAGIC "TSWAL\001\r\n"
+#define TAGSISTANT_WAL_MAGIC_LENGTH 8
+
+/** length, crc, lsn and operation */
+#define TAGSISTANT_WAL_HEADER_LENGTH 17
+
+static const gchar *tagsistant_wal_operation_names[TAGSISTANT_WAL_OPERATIONS] = {
+	"checkpoint", "statement", "create object", "rename object", "delete object",
+	"create tag", "rename tag", "delete tag", "tag", "untag", "relate", "unrelate", "alias",
+	"update object"
+};
+
+/** a record waiting for the commit of its transaction */
+typedef struct {
+	tagsistant_wal_operation operation;
+	gchar *statement;
+} tagsistant_wal_record;
+
+/** the records of the open writer transaction */
+static GPtrArray *tagsistant_wal_pending = NULL;
+
+/** the open segment */
+static int tagsistant_wal_fd = -1;
+static off_t tagsistant_wal_segment_length = 0;
+
+/** where the last flush started, to drop it if its transaction fails */
+static off_t tagsistant_wal_flush_offset = 0;
+static guint64 tagsistant_wal_flush_lsn = 0;
+
+/** the next LSN and the last one committed into the DB */
+static guint64 tagsistant_wal_next_lsn = 1;
+static guint64 tagsistant_wal_committed_lsn = 0;
+
+/** guards everything above */
+static GMutex tagsistant_wal_lock;
+
+/** the CRC32 lookup table */
+static guint32 tagsistant_wal_crc_table[256];
+
+/** statistics */
+static guint64 tagsistant_wal_records = 0;
+static guint64 tagsistant_wal_bytes = 0;
+static guint64 tagsistant_wal_fsyncs = 0;
+static guint64 tagsistant_wal_segments_deleted = 0;
+static guint64 tagsistant_wal_replayed = 0;
+static guint64 tagsistant_wal_operation_count[TAGSISTANT_WAL_OPERATIONS];
+
+/**
+ * Compute the CRC32 (IEEE 802.3) of a buffer
+ *
+ * @param crc the CRC of the previous buffers, 0 on the first one
+ * @param buffer the buffer
+ * @param length the buffer length
+ * @return the CRC
+ */
+static guint32 tagsistant_wal_crc32(guint32 crc, const guint8 *buffer, gsize length)
+{
+	crc = ~crc;
+	while (length--) crc = tagsistant_wal_crc_table[(crc ^ *buffer++) & 0xff] ^ (crc >> 8);
+	return (~crc);
+}
+
+/**
+ * Guess the operation done by a statement from its text. Only used for
+ * the statements run by tagsistant_query(): the writer helpers name
+ * their operation with tagsistant_logged_query().
+ *
+ * @param statement the SQL statement
+ * @return the operation, TAGSISTANT_WAL_NOT_LOGGED if the statement
+ *   doesn't change the metadata
+ */
+tagsistant_wal_operation tagsistant_wal_classify(const gchar *statement)
+{
+	tagsistant_wal_operation operation = TAGSISTANT_WAL_NOT_LOGGED;
+
+	/* extracts the verb and the table of a statement */
+	static GRegex *tagsistant_wal_operation_rx = NULL;
+	if (g_once_init_enter(&tagsistant_wal_operation_rx)) {
+		g_once_init_leave(&tagsistant_wal_operation_rx, g_regex_new(
+			"^(insert|update|delete)(?:[ ]+or[ ]+[a-z]+|[ ]+ignore)?[ ]*(?:into|from)?[ ]*`?([a-z_]+)",
+			G_REGEX_CASELESS|G_REGEX_OPTIMIZE, 0, NULL));
+	}
+
+	GMatchInfo *info;
+	if (!g_regex_match(tagsistant_wal_operation_rx, statement, 0, &info)) {
+		g_match_info_free(info);
+		return (operation);
+	}
+
+	gchar *verb = g_match_info_fetch(info, 1);
+	gchar *table = g_match_info_fetch(info, 2);
+	gchar v = g_ascii_tolower(*verb);
+
+	if (g_ascii_strcasecmp(table, "objects") is 0) {
+		operation = (v is 'i') ? TAGSISTANT_WAL_CREATE_OBJECT : (v is 'u') ? TAGSISTANT_WAL_RENAME_OBJECT : TAGSISTANT_WAL_DELETE_OBJECT;
+	} else if (g_ascii_strcasecmp(table, "tags") is 0) {
+		operation = (v is 'i') ? TAGSISTANT_WAL_CREATE_TAG : (v is 'u') ? TAGSISTANT_WAL_RENAME_TAG : TAGSISTANT_WAL_DELETE_TAG;
+	} else if (g_ascii_strcasecmp(table, "tagging") is 0) {
+		operation = (v is 'd') ? TAGSISTANT_WAL_UNTAG : TAGSISTANT_WAL_TAG;
+	} else if (g_ascii_strcasecmp(table, "relations") is 0) {
+		operation = (v is 'd') ? TAGSISTANT_WAL_UNRELATE : TAGSISTANT_WAL_RELATE;
+	} else if (g_ascii_strcasecmp(table, "aliases") is 0) {
+		operation = TAGSISTANT_WAL_ALIAS;
+	}
+
+	g_free(verb);
+	g_free(table);
+	g_match_info_free(info);
+
+	return (operation);
+}
+
+/**
+ * Append a record to a buffer
+ *
+ * @param buffer the buffer
+ * @param lsn the record LSN
+ * @param operation the record operation
+ * @param statement the statement, may be NULL
+ */
+static void tagsistant_wal_encode(GByteArray *buffer, guint64 lsn, tagsistant_wal_operation operation, const gchar *statement)
+{
+	guint32 length = statement ? strlen(statement) : 0;
+
+	guint8 header[TAGSISTANT_WAL_HEADER_LENGTH];
+	guint32 le_length = GUINT32_TO_LE(length);
+	guint64 le_lsn = GUINT64_TO_LE(lsn);
+
+	memcpy(header, &le_length, 4);
+	memcpy(header + 8, &le_lsn, 8);
+	header[16] = (guint8) operation;
+
+	guint32 crc = tagsistant_wal_crc32(0, header + 8, TAGSISTANT_WAL_HEADER_LENGTH - 8);
+	crc = tagsistant_wal_crc32(crc, (const guint8 *) statement, length);
+	guint32 le_crc = GUINT32_TO_LE(crc);
+	memcpy(header + 4, &le_crc, 4);
+
+	g_byte_array_append(buffer, header, TAGSISTANT_WAL_HEADER_LENGTH);
+	if (length) g_byte_array_append(buffer, (const guint8 *) statement, length);
+
+	tagsistant_wal_records++;
+	tagsistant_wal_operation_count[operation]++;
+}
+
+/**
+ * Write a buffer into the open segment
+ *
+ * @param data the buffer
+ * @param length the buffer length
+ * @return TRUE on success
+ */
+static gboolean tagsistant_wal_write(const guint8 *data, gsize length)
+{
+	while (length > 0) {
+		ssize_t written = write(tagsistant_wal_fd, data, length);
+		if (written is -1) {
+			if (errno is EINTR) continue;
+			dbg('s', LOG_ERR, "WAL: error writing a segment: %s", strerror(errno));
+			return (FALSE);
+		}
+
+		length -= written;
+		data += written;
+		tagsistant_wal_segment_length += written;
+		tagsistant_wal_bytes += written;
+	}
+
+	return (TRUE);
+}
+
+/**
+ * Return the path of a segment
+ *
+ * @param first_lsn the first LSN of the segment
+ * @return the path (must be freed)
+ */
+static gchar *tagsistant_wal_segment_path(guint64 first_lsn)
+{
+	return (g_strdup_printf("%s/wal/%016" G_GINT64_MODIFIER "x.log", tagsistant.repository, first_lsn));
+}
+
+/**
+ * Compare two LSNs, to sort the segments
+ */
+static gint tagsistant_wal_compare_lsn(const guint64 *a, const guint64 *b)
+{
+	return ((*a > *b) - (*a < *b));
+}
+
+/**
+ * Return the segments, sorted by their first LSN
+ *
+ * @return a GList of guint64 * first LSNs (must be freed with g_list_free_full())
+ */
+static GList *tagsistant_wal_segments()
+{
+	GList *segments = NULL;
+
+	gchar *wal_dir = g_strdup_printf("%s/wal", tagsistant.repository);
+	GDir *dir = g_dir_open(wal_dir, 0, NULL);
+	g_free(wal_dir);
+	if (!dir) return (NULL);
+
+	const gchar *entry;
+	while ((entry = g_dir_read_name(dir))) {
+		guint64 first_lsn;
+		char dot;
+
+		if ((strlen(entry) isNot 20) || !g_str_has_suffix(entry, ".log")) continue;
+		if (sscanf(entry, "%16" G_GINT64_MODIFIER "x%c", &first_lsn, &dot) isNot 2) continue;
+
+		segments = g_list_prepend(segments, g_memdup(&first_lsn, sizeof(guint64)));
+	}
+	g_dir_close(dir);
+
+	return (g_list_sort(segments, (GCompareFunc) tagsistant_wal_compare_lsn));
+}
+
+/**
+ * Delete the segments holding only records committed into the DB:
+ * a segment can go if the next one starts after the committed LSN.
+ * The open segment is never deleted.
+ */
+static void tagsistant_wal_truncate()
+{
+	GList *segments = tagsistant_wal_segments();
+
+	GList *segment;
+	for (segment = segments; segment && segment->next; segment = segment->next) {
+		guint64 next_first_lsn = *(guint64 *) segment->next->data;
+		if (next_first_lsn > tagsistant_wal_committed_lsn + 1) break;
+
+		gchar *path = tagsistant_wal_segment_path(*(guint64 *) segment->data);
+		if (unlink(path) is 0) {
+			dbg('s', LOG_INFO, "WAL: deleted checkpointed segment %s", path);
+			tagsistant_wal_segments_deleted++;
+		} else {
+			dbg('s', LOG_ERR, "WAL: error deleting segment %s: %s", path, strerror(errno));
+		}
+		g_free(path);
+	}
+
+	g_list_free_full(segments, g_free);
+}
+
+/**
+ * Start a new segment with a checkpoint record, then delete
+ * the checkpointed segments. Called with tagsistant_wal_lock held.
+ *
+ * @return TRUE on success
+ */
+static gboolean tagsistant_wal_rotate()
+{
+	if (tagsistant_wal_fd isNot -1) {
+		if (fsync(tagsistant_wal_fd) is 0) tagsistant_wal_fsyncs++;
+		close(tagsistant_wal_fd);
+		tagsistant_wal_fd = -1;
+	}
+
+	gchar *path = tagsistant_wal_segment_path(tagsistant_wal_next_lsn);
+	tagsistant_wal_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, S_IRUSR|S_IWUSR);
+	if (tagsistant_wal_fd is -1) {
+		dbg('s', LOG_ERR, "WAL: unable to open segment %s: %s", path, strerror(errno));
+		g_free(path);
+		return (FALSE);
+	}
+
+	dbg('s', LOG_INFO, "WAL: opened segment %s", path);
+	g_free(path);
+
+	tagsistant_wal_segment_length = 0;
+
+	GByteArray *buffer = g_byte_array_sized_new(TAGSISTANT_WAL_MAGIC_LENGTH + TAGSISTANT_WAL_HEADER_LENGTH);
+	g_byte_array_append(buffer, (const guint8 *) TAGSISTANT_WAL_MAGIC, TAGSISTANT_WAL_MAGIC_LENGTH);
+	tagsistant_wal_encode(buffer, tagsistant_wal_committed_lsn, TAGSISTANT_WAL_CHECKPOINT, NULL);
+
+	gboolean written = tagsistant_wal_write(buffer->data, buffer->len);
+	g_byte_array_free(buffer, TRUE);
+
+	/* make the new segment name durable */
+	gchar *wal_dir = g_strdup_printf("%s/wal", tagsistant.repository);
+	int dir_fd = open(wal_dir, O_RDONLY);
+	if (dir_fd isNot -1) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+	g_free(wal_dir);
+
+	tagsistant_wal_truncate();
+
+	return (written);
+}
+
+/**
+ * Free a pending record
+ */
+static void tagsistant_wal_record_free(tagsistant_wal_record *record)
+{
+	g_free(record->statement);
+	g_free(record);
+}
+
+/**
+ * Cut the records of the last flush from the open segment and reuse
+ * their LSNs. Called with tagsistant_wal_lock held.
+ */
+static void tagsistant_wal_undo_flush()
+{
+	if (ftruncate(tagsistant_wal_fd, tagsistant_wal_flush_offset) is -1) {
+		dbg('s', LOG_ERR, "WAL: error dropping the records from LSN %" G_GUINT64_FORMAT ": %s",
+			tagsistant_wal_flush_lsn, strerror(errno));
+		return;
+	}
+
+	if (!tagsistant.relaxed_sync && (fsync(tagsistant_wal_fd) is 0)) tagsistant_wal_fsyncs++;
+
+	tagsistant_wal_segment_length = tagsistant_wal_flush_offset;
+	tagsistant_wal_next_lsn = tagsistant_wal_flush_lsn;
+}
+
+/**
+ * Write the pending records, with one fsync. Called with
+ * tagsistant_wal_lock held.
+ *
+ * @return the last LSN written, 0 if nothing was written
+ */
+static guint64 tagsistant_wal_write_pending()
+{
+	if (!tagsistant_wal_pending->len) return (0);
+
+	if ((tagsistant_wal_fd is -1) || (tagsistant_wal_segment_length >= TAGSISTANT_WAL_SEGMENT_SIZE))
+		if (!tagsistant_wal_rotate()) {
+			g_ptr_array_set_size(tagsistant_wal_pending, 0);
+			return (0);
+		}
+
+	tagsistant_wal_flush_offset = tagsistant_wal_segment_length;
+	tagsistant_wal_flush_lsn = tagsistant_wal_next_lsn;
+
+	GByteArray *buffer = g_byte_array_sized_new(4096);
+
+	guint index;
+	for (index = 0; index < tagsistant_wal_pending->len; index++) {
+		tagsistant_wal_record *record = g_ptr_array_index(tagsistant_wal_pending, index);
+		tagsistant_wal_encode(buffer, tagsistant_wal_next_lsn++, record->operation, record->statement);
+	}
+
+	g_ptr_array_set_size(tagsistant_wal_pending, 0);
+
+	gboolean written = tagsistant_wal_write(buffer->data, buffer->len);
+	g_byte_array_free(buffer, TRUE);
+
+	if (!written) {
+		tagsistant_wal_undo_flush();
+		return (0);
+	}
+
+	/* with --relaxed-sync the segment is synced by the relaxed syncer thread */
+	if (written && !tagsistant.relaxed_sync) {
+		if (fsync(tagsistant_wal_fd) is -1) {
+			dbg('s', LOG_ERR, "WAL: error syncing a segment: %s", strerror(errno));
+		} else {
+			tagsistant_wal_fsyncs++;
+		}
+	}
+
+	return (tagsistant_wal_next_lsn - 1);
+}
+
+/**
+ * Log a statement of the writer transaction. The record waits for
+ * the commit in tagsistant_wal_flush(), which saves its LSN: reader
+ * connections can't change the metadata, so there are no records
+ * outside a transaction.
+ *
+ * @param operation the operation done by the statement
+ * @param statement the SQL statement
+ */
+void tagsistant_wal_log(tagsistant_wal_operation operation, const gchar *statement)
+{
+	/* the WAL is opened by tagsistant_wal_sync() at mount */
+	if (!tagsistant_wal_pending) return;
+
+	tagsistant_wal_record *record = g_new0(tagsistant_wal_record, 1);
+	record->operation = operation;
+	record->statement = g_strdup(statement);
+
+	g_mutex_lock(&tagsistant_wal_lock);
+	g_ptr_array_add(tagsistant_wal_pending, record);
+	g_mutex_unlock(&tagsistant_wal_lock);
+}
+
+/**
+ * Return the number of records of the writer transaction, to
+ * roll them back with tagsistant_wal_rewind()
+ */
+guint tagsistant_wal_mark()
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	guint mark = tagsistant_wal_pending->len;
+	g_mutex_unlock(&tagsistant_wal_lock);
+
+	return (mark);
+}
+
+/**
+ * Drop the records logged by the writer transaction after a mark
+ *
+ * @param mark the mark, 0 to drop all of them
+ */
+void tagsistant_wal_rewind(guint mark)
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	if (mark < tagsistant_wal_pending->len) g_ptr_array_set_size(tagsistant_wal_pending, mark);
+	g_mutex_unlock(&tagsistant_wal_lock);
+}
+
+/**
+ * Write the records of the writer transaction, before its commit
+ *
+ * @return the last LSN written, to be saved by the transaction, or 0
+ */
+guint64 tagsistant_wal_flush()
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	guint64 lsn = tagsistant_wal_write_pending();
+	g_mutex_unlock(&tagsistant_wal_lock);
+
+	return (lsn);
+}
+
+/**
+ * Drop the records written by the last tagsistant_wal_flush(),
+ * because their transaction has not been committed
+ */
+void tagsistant_wal_discard()
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	tagsistant_wal_undo_flush();
+	g_mutex_unlock(&tagsistant_wal_lock);
+}
+
+/**
+ * Record that a transaction saving an LSN has been committed
+ *
+ * @param lsn the LSN
+ */
+void tagsistant_wal_committed(guint64 lsn)
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	if (lsn > tagsistant_wal_committed_lsn) tagsistant_wal_committed_lsn = lsn;
+	g_mutex_unlock(&tagsistant_wal_lock);
+}
+
+/**
+ * Sync the open segment (used by --relaxed-sync)
+ */
+void tagsistant_wal_fsync()
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+	if ((tagsistant_wal_fd isNot -1) && (fsync(tagsistant_wal_fd) is 0)) tagsistant_wal_fsyncs++;
+	g_mutex_unlock(&tagsistant_wal_lock);
+}
+
+/**
+ * Apply the records of a segment after an LSN
+ *
+ * @param dbi the writer connection
+ * @param first_lsn the first LSN of the segment
+ * @param applied_lsn the last LSN already in the DB
+ * @param last_lsn set to the last valid LSN found
+ * @return FALSE if the segment ends with an invalid record
+ */
+static gboolean tagsistant_wal_apply_segment(dbi_conn dbi, guint64 first_lsn, guint64 applied_lsn, guint64 *last_lsn)
+{
+	gchar *path = tagsistant_wal_segment_path(first_lsn);
+	gchar *contents = NULL;
+	gsize length = 0;
+	GError *error = NULL;
+
+	if (!g_file_get_contents(path, &contents, &length, &error)) {
+		dbg('s', LOG_ERR, "WAL: error reading %s: %s", path, error->message);
+		g_error_free(error);
+		g_free(path);
+		return (FALSE);
+	}
+
+	gboolean valid = TRUE;
+	gsize offset = TAGSISTANT_WAL_MAGIC_LENGTH;
+
+	if ((length < TAGSISTANT_WAL_MAGIC_LENGTH) || memcmp(contents, TAGSISTANT_WAL_MAGIC, TAGSISTANT_WAL_MAGIC_LENGTH)) {
+		dbg('s', LOG_ERR, "WAL: %s is not a segment", path);
+		valid = FALSE;
+		offset = 0;
+	}
+
+	while (valid && (offset < length)) {
+		const guint8 *header = (const guint8 *) contents + offset;
+		guint32 record_length, crc;
+		guint64 lsn;
+
+		/* a torn record is the tail of a write interrupted by a crash */
+		if (length - offset < TAGSISTANT_WAL_HEADER_LENGTH) { valid = FALSE; break; }
+
+		memcpy(&record_length, header, 4);
+		memcpy(&crc, header + 4, 4);
+		memcpy(&lsn, header + 8, 8);
+		record_length = GUINT32_FROM_LE(record_length);
+		crc = GUINT32_FROM_LE(crc);
+		lsn = GUINT64_FROM_LE(lsn);
+
+		if (length - offset - TAGSISTANT_WAL_HEADER_LENGTH < record_length) { valid = FALSE; break; }
+
+		guint32 computed = tagsistant_wal_crc32(0, header + 8, TAGSISTANT_WAL_HEADER_LENGTH - 8);
+		computed = tagsistant_wal_crc32(computed, header + TAGSISTANT_WAL_HEADER_LENGTH, record_length);
+		if (computed isNot crc) { valid = FALSE; break; }
+
+		tagsistant_wal_operation operation = header[16];
+
+		if (operation is TAGSISTANT_WAL_CHECKPOINT) {
+			if (lsn > tagsistant_wal_committed_lsn) tagsistant_wal_committed_lsn = lsn;
+		} else {
+			if (lsn <= *last_lsn) {
+				dbg('s', LOG_ERR, "WAL: LSN %" G_GUINT64_FORMAT " follows %" G_GUINT64_FORMAT " in %s", lsn, *last_lsn, path);
+				valid = FALSE;
+				break;
+			}
+
+			if (lsn > applied_lsn) {
+				gchar *statement = g_strndup((const gchar *) header + TAGSISTANT_WAL_HEADER_LENGTH, record_length);
+				dbg('s', LOG_INFO, "WAL: replaying %" G_GUINT64_FORMAT " (%s)", lsn,
+					operation < TAGSISTANT_WAL_OPERATIONS ? tagsistant_wal_operation_names[operation] : "unknown");
+				tagsistant_raw_query(statement, dbi, NULL, NULL);
+				g_free(statement);
+				tagsistant_wal_replayed++;
+			}
+
+			*last_lsn = lsn;
+		}
+
+		offset += TAGSISTANT_WAL_HEADER_LENGTH + record_length;
+	}
+
+	/* drop the invalid tail, the records after it never reached the DB */
+	if (!valid && offset) {
+		dbg('s', LOG_ERR, "WAL: truncating %s after %zu valid bytes", path, offset);
+		if (truncate(path, offset) is -1)
+			dbg('s', LOG_ERR, "WAL: error truncating %s: %s", path, strerror(errno));
+	}
+
+	g_free(contents);
+	g_free(path);
+
+	return (valid);
+}
+
+/**
+ * Replay the WAL records not yet in the DB, then open a new segment.
+ * Called once at mount.
+ */
+void tagsistant_wal_sync()
+{
+	int i;
+	for (i = 0; i < 256; i++) {
+		guint32 crc = i;
+		int bit;
+		for (bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+		tagsistant_wal_crc_table[i] = crc;
+	}
+
+	tagsistant_wal_pending = g_ptr_array_new_with_free_func((GDestroyNotify) tagsistant_wal_record_free);
+
+	/*
+	 * check if WAL directory has been created
+	 */
+	gchar *wal_dir = g_strdup_printf("%s/wal", tagsistant.repository);
+	if ((mkdir(wal_dir, S_IRWXU) is -1) && (errno isNot EEXIST)) {
+		dbg('s', LOG_ERR, "WAL: error creating WAL directory %s: %s", wal_dir, strerror(errno));
+		exit (1);
+	}
+	g_free(wal_dir);
+
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
+
+	/*
+	 * load the last LSN committed into the DB
+	 */
+	gchar *applied = NULL;
+	tagsistant_query("select value from status where state = 'wal_lsn'", dbi, tagsistant_return_string, &applied);
+
+	if (!applied) {
+		/*
+		 * a new repository, or one logged by the text WAL, which has
+		 * been replayed by each mount and can be left alone
+		 */
+		dbg('s', LOG_INFO, "WAL: starting the binary WAL");
+		tagsistant_save_status(dbi, "wal_lsn", "0");
+		applied = g_strdup("0");
+	}
+
+	guint64 applied_lsn = g_ascii_strtoull(applied, NULL, 10);
+	guint64 last_lsn = 0;
+	g_free(applied);
+
+	/*
+	 * apply the segments; after an invalid record no later record can be trusted
+	 */
+	GList *segments = tagsistant_wal_segments();
+	GList *segment;
+	for (segment = segments; segment; segment = segment->next) {
+		if (!tagsistant_wal_apply_segment(dbi, *(guint64 *) segment->data, applied_lsn, &last_lsn)) {
+			if (segment->next) dbg('s', LOG_ERR, "WAL: ignoring the segments after the invalid record");
+			break;
+		}
+	}
+	g_list_free_full(segments, g_free);
+
+	if (last_lsn < applied_lsn) last_lsn = applied_lsn;
+
+	if (last_lsn > applied_lsn) {
+		gchar *value = g_strdup_printf("%" G_GUINT64_FORMAT, last_lsn);
+		tagsistant_save_status(dbi, "wal_lsn", value);
+		g_free(value);
+	}
+
+	tagsistant_commit_transaction(dbi);
+	tagsistant_db_connection_release(dbi, TAGSISTANT_START_TRANSACTION);
+
+	if (tagsistant_wal_replayed)
+		dbg('s', LOG_INFO, "WAL: replayed %" G_GUINT64_FORMAT " records up to LSN %" G_GUINT64_FORMAT, tagsistant_wal_replayed, last_lsn);
+
+	/*
+	 * the DB now holds every record, so the older segments can go
+	 */
+	g_mutex_lock(&tagsistant_wal_lock);
+	tagsistant_wal_next_lsn = last_lsn + 1;
+	tagsistant_wal_committed_lsn = last_lsn;
+	gboolean opened = tagsistant_wal_rotate();
+	g_mutex_unlock(&tagsistant_wal_lock);
+
+	if (!opened) {
+		dbg('s', LOG_ERR, "WAL: can't open a segment, can't mount without a write-ahead log");
+		exit (1);
+	}
+}
+
+/**
+ * Print the WAL statistics
+ *
+ * @param buffer the output buffer
+ * @param size the buffer size
+ */
+void tagsistant_wal_stats(gchar *buffer, size_t size)
+{
+	g_mutex_lock(&tagsistant_wal_lock);
+
+	gsize used = g_snprintf(buffer, size,
+		"WAL next LSN: %" G_GUINT64_FORMAT " (checkpoint: %" G_GUINT64_FORMAT ")\n"
+		"# of WAL records: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " fsyncs)\n"
+		"# of WAL segments deleted: %" G_GUINT64_FORMAT "\n"
+		"# of WAL records replayed: %" G_GUINT64_FORMAT "\n",
+		tagsistant_wal_next_lsn, tagsistant_wal_committed_lsn,
+		tagsistant_wal_records, tagsistant_wal_bytes, tagsistant_wal_fsyncs,
+		tagsistant_wal_segments_deleted, tagsistant_wal_replayed);
+
+	int operation;
+	for (operation = TAGSISTANT_WAL_STATEMENT; operation < TAGSISTANT_WAL_OPERATIONS && used < size; operation++)
+		if (tagsistant_wal_operation_count[operation])
+			used += g_snprintf(buffer + used, size - used, "  %s: %" G_GUINT64_FORMAT "\n",
+				tagsistant_wal_operation_names[operation], tagsistant_wal_operation_count[operation]);
+
+	g_mutex_unlock(&tagsistant_wal_lock);
+}